@@ -0,0 +1,180 @@
+/***************************************************************************************/
+/*                                      Accuracy.cpp
+
+    --tolerance: the resolutions of the integrals and the mesh for an error of the flux,
+    from errors measured once per machine and kept in a file. See Accuracy.h.
+*/
+/***************************************************************************************/
+
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <memory>
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include "Accuracy.h"
+#include "Engine.h"
+#include "Chi.h"
+#include "OblDeflectionTOA.h"
+#include "Units.h"
+#include "Log.h"
+#include "Exception.h"
+#include "Struct.h"
+
+static const double scales[ACCURACY_LEVELS] = { 0.125, 0.25, 0.5, 1.0, 2.0 };
+
+// The standard star of Accuracy.h, monochromatic, 8 rings and 64 bins
+static void StandardStar( class LightCurve* curve ) {
+
+    double mass( 1.4 ), req( 12.0 ), spin( 600.0 ), distance( 6.1713552e18 );
+    curve->para.mass_over_r = mass/req * Units::GMC2;
+    curve->para.mass = Units::cgs_to_nounits( mass*Units::MSUN, Units::MASS );
+    curve->para.req = Units::cgs_to_nounits( req*1.0e5, Units::LENGTH );
+    curve->para.radius = curve->para.req;
+    curve->para.omega = Units::cgs_to_nounits( 2.0*Units::PI*spin, Units::INVTIME );
+    curve->para.distance = Units::cgs_to_nounits( distance*100, Units::LENGTH );
+    curve->para.incl = 90.0 * Units::PI/180.0;
+    curve->para.theta = 75.0 * Units::PI/180.0;
+    curve->para.rho = 0.5;
+    curve->para.phi_0 = 0.0;
+    curve->para.cosgamma = 0.0;
+    curve->para.temperature = 0.35;
+    curve->para.ts = 0.0;
+    curve->para.E0 = 1.0;
+    curve->numbins = 64;
+    curve->numbands = 1;
+    curve->numtheta = 8;
+    curve->flags.infile_is_set = false;
+    curve->flags.ignore_time_delays = false;
+    curve->flags.spectral_model = 0;
+    curve->flags.beaming_model = 0;
+    curve->flags.NS_model = 1;
+    curve->flags.two_spots = false;
+    curve->flags.only_second_spot = false;
+    curve->flags.normalize_flux = false;
+    curve->flags.single_precision = false;
+    curve->flags.mesh_tolerance = 0.0;
+    curve->flags.nside = 0;
+    curve->flags.pixel_mask = 0;
+    curve->flags.pixel_map = 0;
+    curve->flags.spots = 0;
+    for ( unsigned int p(0); p < NCURVES; p++ ) curve->background[p] = 0.0;
+}
+
+// The standard star's light curve with the quadrature at scale
+static std::vector< double > StandardCurve( double scale ) {
+    std::unique_ptr< LightCurve > curve( new LightCurve );
+    StandardStar( curve.get() );
+    OblDeflectionTOA::SetQuadrature( scale );
+    DeflTables tables( curve.get() );
+    ComputeFlux( curve.get(), &tables );
+    return std::vector< double >( curve->f[0], curve->f[0] + curve->numbins );
+}
+
+// The band integrals of a grid of temperatures and bands, with the steps at scale
+static std::vector< double > BandIntegrals( double scale ) {
+    static const double temperatures[] = { 0.1, 0.35, 1.0, 2.0 },
+                        bands[][2] = { { 0.3, 1.0 }, { 2.0, 3.0 }, { 5.0, 6.0 }, { 0.69, 0.71 } };
+    std::vector< double > integrals;
+    SetSpectralSteps( scale );
+    for ( const double& T : temperatures )
+        for ( const auto& band : bands ) {
+            integrals.push_back( EnergyBandFlux< double >( T, band[0], band[1] ) );
+            integrals.push_back( LineBandFlux< double >( T, band[0], band[1], 0.7*0.995, 0.7*1.005 ) );
+        }
+    return integrals;
+}
+
+// The largest difference of values from reference, as a fraction of the largest of
+// reference (a light curve), or of each (band integrals)
+static double Error( const std::vector< double >& values, const std::vector< double >& reference,
+                     bool each ) {
+    double peak( fabs( *std::max_element( reference.begin(), reference.end() ) ) ), error(0.0);
+    for ( unsigned int k(0); k < values.size(); k++ ) {
+        double scale( each ? fabs( reference[k] ) : peak );
+        if ( scale > 0.0 )
+            error = std::max( error, fabs( values[k] - reference[k] ) / scale );
+    }
+    return error;
+}
+
+// The first line of the file: what measured the errors in it
+static std::string Stamp() {
+    std::ostringstream stamp;
+    stamp << "# spot --tolerance format " << ACCURACY_FORMAT << ", NN " << NN << ", quadrature "
+          << QUADRATURE_N << " " << QUADRATURE_N_MAX << ", band steps " << LINE_BAND_STEPS << " "
+          << ENERGY_BAND_STEPS << ": scale, error of the quadrature, of the band integrals";
+    return stamp.str();
+}
+
+static std::string CacheFile( const char* cache_file ) {
+    if ( cache_file ) return cache_file;
+    const char* home( getenv( "HOME" ) );
+    return std::string( home ? home : "." ) + "/.spot_accuracy";
+}
+
+/**************************************************************************************/
+/* TuneAccuracy:                                                                      */
+/*           see Accuracy.h. The file is the Stamp line then one line per level:      */
+/*           scale, error of the quadrature, error of the band integrals.             */
+/**************************************************************************************/
+struct Accuracy TuneAccuracy( double tolerance, const char* cache_file ) {
+
+    if ( !( tolerance > 0.0 && tolerance < 1.0 ) )
+        throw( Exception(" --tolerance is a fraction of the peak flux, between 0 and 1. Exiting.\n") );
+
+    std::string file( CacheFile( cache_file ) );
+    double quadrature_errors[ACCURACY_LEVELS], spectra_errors[ACCURACY_LEVELS];
+    unsigned int levels(0);
+    {
+        std::ifstream in( file.c_str() );
+        std::string line;
+        bool current( std::getline( in, line ) && line == Stamp() );
+        if ( in && !current )
+            LOG( LOG_INFO, LOG_CURVE, file << " is from another build or format; measuring again" );
+        while ( current && std::getline( in, line ) && levels < ACCURACY_LEVELS ) {
+            double scale;
+            std::istringstream fields( line );
+            if ( line.empty() || line[0] == '#' ) continue;
+            if ( !( fields >> scale >> quadrature_errors[levels] >> spectra_errors[levels] )
+                 || scale != scales[levels] )
+                break;
+            levels++;
+        }
+    }
+
+    if ( levels < ACCURACY_LEVELS ) { // measure them, once
+        LOG( LOG_INFO, LOG_CURVE, "measuring the errors of the resolutions for --tolerance, into " << file );
+        std::vector< double > curve( StandardCurve( ACCURACY_REFERENCE ) ),
+                              integrals( BandIntegrals( ACCURACY_REFERENCE ) );
+        std::ofstream out( file.c_str(), std::ios_base::trunc );
+        out << Stamp() << "\n";
+        for ( unsigned int l(0); l < ACCURACY_LEVELS; l++ ) {
+            quadrature_errors[l] = Error( StandardCurve( scales[l] ), curve, false );
+            spectra_errors[l] = Error( BandIntegrals( scales[l] ), integrals, true );
+            out << scales[l] << " " << quadrature_errors[l] << " " << spectra_errors[l] << "\n";
+        }
+        if ( !out )
+            LOG( LOG_WARNING, LOG_CURVE, "couldn't write " << file << "; the errors will be measured again next time" );
+    }
+
+    // The smallest scales within a third of the tolerance each, and all the scales above
+    // them too (the band integrals of a line do not get better steadily); the largest if
+    // none are
+    struct Accuracy accuracy;
+    unsigned int q( ACCURACY_LEVELS - 1 ), s( ACCURACY_LEVELS - 1 );
+    while ( q > 0 && quadrature_errors[q] <= tolerance / 3.0 && quadrature_errors[q-1] <= tolerance / 3.0 ) q--;
+    while ( s > 0 && spectra_errors[s] <= tolerance / 3.0 && spectra_errors[s-1] <= tolerance / 3.0 ) s--;
+    if ( quadrature_errors[q] > tolerance / 3.0 || spectra_errors[s] > tolerance / 3.0 )
+        LOG( LOG_WARNING, LOG_CURVE, "--tolerance " << tolerance << " is below what the integrals reach; using their finest" );
+    accuracy.quadrature = scales[q];
+    accuracy.spectra = scales[s];
+    accuracy.quadrature_error = quadrature_errors[q];
+    accuracy.spectra_error = spectra_errors[s];
+    accuracy.mesh_tolerance = tolerance / 3.0;
+
+    OblDeflectionTOA::SetQuadrature( accuracy.quadrature );
+    SetSpectralSteps( accuracy.spectra );
+    return accuracy;
+}
@@ -0,0 +1,43 @@
+/***************************************************************************************/
+/*                                       Accuracy.h
+
+    This is the header file for Accuracy.cpp, which turns --tolerance, the error of the
+    flux allowed as a fraction of the peak flux of each band (as for -E), into the
+    resolutions of the parts of the calculation: the points of the trapezoid rules of
+    OblDeflectionTOA (SetQuadrature), the steps of the band integrals of Chi.cpp
+    (SetSpectralSteps) and the adaptive mesh (-E). A third of the tolerance goes to each.
+
+    The resolutions of the integrals are multiples of the ones built in: ACCURACY_LEVELS
+    scales from 1/8 to 2. What error each scale gives is measured once and kept in a file
+    (~/.spot_accuracy), so later runs only read it, as long as its first line still has
+    the ACCURACY_FORMAT and the built-in resolutions of this build: the light curve of a standard star
+    (1.4 Msun, 12 km, oblate at 600 Hz, a spot of 0.5 rad at 75 degrees, seen at 90
+    degrees) with the quadrature at each scale against the same at ACCURACY_REFERENCE,
+    and the band integrals over a range of temperatures and bands likewise. The smallest
+    scale within its share of the tolerance is taken; the table and the star, not the
+    curve of the run, decide it, so -n and -t stay as given.
+*/
+/***************************************************************************************/
+
+#ifndef ACCURACY_H
+#define ACCURACY_H
+
+#define ACCURACY_LEVELS 5         // scales 1/8, 1/4, 1/2, 1 (built in), 2
+#define ACCURACY_REFERENCE 4.0    // scale the errors are measured against
+#define ACCURACY_FORMAT 2         // of the file; count it up when OblDeflectionTOA's integrals or
+                                  // the band integrals change, so the errors are measured again
+
+struct Accuracy {
+    double quadrature,        // scale of the trapezoid rules
+           spectra,           // scale of the band integrals
+           mesh_tolerance,    // for -E
+           quadrature_error,  // measured errors of the scales taken, as fractions of the peak
+           spectra_error;
+};
+
+// The resolutions for tolerance, from cache_file (0 for ~/.spot_accuracy), measuring
+// them and writing the file first if it is missing or not for these levels; sets the
+// quadrature and the band integrals. Call before any tables are built or threads started.
+struct Accuracy TuneAccuracy( double tolerance, const char* cache_file = 0 );
+
+#endif // ACCURACY_H
@@ -0,0 +1,457 @@
+/***************************************************************************************/
+/*                                       Batch.cpp
+
+    Light curves for a table of parameter sets, grouped by star and spread over the
+    thread pool, into one output file that a later run can carry on. See Batch.h.
+*/
+/***************************************************************************************/
+
+#include <cmath>
+#include <cstring>
+#include <stdint.h>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <algorithm>
+#include "Batch.h"
+#include "Engine.h"
+#include "OblDeflectionTOA.h"
+#include "Healpix.h"
+#include "Profile.h"
+#include "ThreadPool.h"
+#include "Units.h"
+#include "Exception.h"
+#include "Struct.h"
+
+#define SPIN NDIM       // a row of the table is the NDIM fit parameters, then the spin
+#define ROW (NDIM+1)    // values in a row
+
+// Column of the row for a letter of the table
+static unsigned int Column( char letter ) {
+    static const char letters[] = "mriepTlf";
+    const char* c( letter == '\0' ? 0 : strchr( letters, letter ) );
+    if ( !c )
+        throw( Exception(" The columns of the batch table are m r i e p T l f. Exiting.\n") );
+    return c - letters;
+}
+
+/**************************************************************************************/
+/* ReadTable:                                                                         */
+/*           reads the table, text or binary (see Batch.h), into rows of ROW values;  */
+/*           what the table leaves out is taken from base                             */
+/**************************************************************************************/
+static void ReadTable( const char* file, const double base[ROW], std::vector< double >& rows ) {
+
+    std::ifstream in( file, std::ios::binary );
+    if ( !in )
+        throw( Exception(" Couldn't open the batch table. Exiting.\n") );
+
+    std::vector< unsigned int > columns;
+    char magic[8] = { 0 };
+    in.read( magic, sizeof(magic) );
+
+    if ( in && std::memcmp( magic, "SPOTGRD1", sizeof(magic) ) == 0 ) {
+        uint32_t ncols(0);
+        uint64_t nrows(0);
+        in.read( reinterpret_cast<char*>( &ncols ), sizeof(ncols) );
+        std::string letters( ncols, '\0' );
+        if ( ncols > 0 ) in.read( &letters[0], ncols );
+        in.read( reinterpret_cast<char*>( &nrows ), sizeof(nrows) );
+        if ( !in || ncols == 0 )
+            throw( Exception(" The binary batch table has a bad header. Exiting.\n") );
+        for ( unsigned int k(0); k < ncols; k++ ) columns.push_back( Column( letters[k] ) );
+
+        std::vector< double > values( ncols );
+        rows.resize( nrows * ROW );
+        for ( uint64_t n(0); n < nrows; n++ ) {
+            in.read( reinterpret_cast<char*>( &values[0] ), ncols * sizeof(double) );
+            if ( !in )
+                throw( Exception(" The binary batch table is shorter than its header says. Exiting.\n") );
+            std::copy( base, base + ROW, rows.begin() + n*ROW );
+            for ( unsigned int k(0); k < ncols; k++ ) rows[n*ROW + columns[k]] = values[k];
+        }
+        return;
+    }
+
+    in.clear();
+    in.seekg( 0 );
+    std::string line;
+    while ( std::getline( in, line ) ) {
+        line = line.substr( 0, line.find( '#' ) );
+        std::replace( line.begin(), line.end(), ',', ' ' );
+        std::istringstream fields( line );
+
+        if ( columns.empty() ) { // the header
+            std::string letter;
+            while ( fields >> letter ) {
+                if ( letter.size() != 1 ) Column( '\0' );
+                columns.push_back( Column( letter[0] ) );
+            }
+            continue;
+        }
+
+        double value;
+        unsigned int k(0);
+        unsigned long n( rows.size() );
+        rows.insert( rows.end(), base, base + ROW );
+        while ( fields >> value ) {
+            if ( k == columns.size() ) break;
+            rows[n + columns[k++]] = value;
+        }
+        if ( k == 0 && fields.eof() ) { // blank line
+            rows.resize( n );
+            continue;
+        }
+        if ( k != columns.size() || !fields.eof() )
+            throw( Exception(" A row of the batch table does not have one number per column. Exiting.\n") );
+    }
+    if ( columns.empty() )
+        throw( Exception(" The batch table has no header line of column letters. Exiting.\n") );
+}
+
+// 64-bit FNV-1a of some bytes, carrying on from hash
+static uint64_t Hash( uint64_t hash, const void* data, size_t bytes ) {
+    const unsigned char* c( static_cast< const unsigned char* >( data ) );
+    for ( size_t k(0); k < bytes; k++ ) {
+        hash ^= c[k];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+template < class T >
+static uint64_t Hash( uint64_t hash, const T& value ) {
+    return Hash( hash, &value, sizeof(value) );
+}
+
+template < class T >
+static uint64_t Hash( uint64_t hash, const std::vector< T >& values ) {
+    hash = Hash( hash, values.size() );
+    return values.empty() ? hash : Hash( hash, &values[0], values.size() * sizeof(T) );
+}
+
+/**************************************************************************************/
+/* Fingerprint:                                                                       */
+/*           a hash of everything the records depend on: the rows (with what the      */
+/*           command line filled in), the settings of curve that the rows leave as    */
+/*           they are, the resolutions of the integrals and the data of chi^2         */
+/**************************************************************************************/
+static uint64_t Fingerprint( const class LightCurve* curve, const class DataStruct* obsdata,
+                             const std::vector< double >& rows ) {
+
+    uint64_t hash( 14695981039346656037ULL );
+    hash = Hash( hash, rows );
+
+    const double para[] = { curve->para.aniso, curve->para.Gamma1, curve->para.Gamma2, curve->para.Gamma3,
+                            curve->para.bbrat, curve->para.E_band_lower_1, curve->para.E_band_upper_1,
+                            curve->para.E_band_lower_2, curve->para.E_band_upper_2, curve->para.distance,
+                            curve->para.E0, curve->para.E1, curve->para.E2, curve->para.DeltaE,
+                            curve->flags.mesh_tolerance, OblDeflectionTOA::Quadrature(), SpectralSteps() };
+    const unsigned int settings[] = { curve->numbins, curve->numbands, curve->numtheta,
+                                      curve->flags.ignore_time_delays, curve->flags.spectral_model,
+                                      curve->flags.beaming_model, curve->flags.NS_model,
+                                      curve->flags.two_spots, curve->flags.only_second_spot,
+                                      curve->flags.normalize_flux, curve->flags.single_precision,
+                                      curve->flags.nside };
+    hash = Hash( hash, para );
+    hash = Hash( hash, settings );
+    hash = Hash( hash, curve->background, curve->numbands * sizeof(double) );
+
+    if ( curve->flags.pixel_mask ) hash = Hash( hash, *curve->flags.pixel_mask );
+    if ( curve->flags.pixel_map ) {
+        hash = Hash( hash, curve->flags.pixel_map->temperature );
+        hash = Hash( hash, curve->flags.pixel_map->beaming );
+    }
+    if ( curve->flags.spots ) hash = Hash( hash, *curve->flags.spots );
+
+    hash = Hash( hash, obsdata != 0 );
+    if ( obsdata ) {
+        hash = Hash( hash, obsdata->numbins );
+        hash = Hash( hash, obsdata->numbands );
+        for ( unsigned int p(0); p < obsdata->numbands; p++ ) {
+            hash = Hash( hash, obsdata->f[p], obsdata->numbins * sizeof(double) );
+            hash = Hash( hash, obsdata->err[p], obsdata->numbins * sizeof(double) );
+        }
+    }
+    return hash;
+}
+
+/**************************************************************************************/
+/* BatchOutput:                                                                       */
+/*           the output file of fixed-size records, one per row (see Batch.h). A file */
+/*           already there from the same table and settings (the same fingerprint) is */
+/*           carried on; any other file is only replaced if overwrite is set. The     */
+/*           records are written by a thread of their own, so the threads computing   */
+/*           light curves never wait for the disk unless BATCH_QUEUE records are      */
+/*           waiting already.                                                         */
+/**************************************************************************************/
+struct BatchOutput {
+    static const std::streamoff HEADER = 8 + 2*sizeof(uint32_t) + 2*sizeof(uint64_t);
+
+    struct Record {
+        uint64_t n;
+        double state;
+        std::vector< double > values;  // chi^2, then the flux
+    };
+
+    unsigned int numbins, numbands;
+    uint64_t nrows, fingerprint;
+    std::streamoff record;             // bytes per row
+    std::vector< double > status;      // of each row, when the run started
+    std::fstream out;
+    std::deque< Record > queue;        // records not written yet
+    bool closing;
+    std::exception_ptr error;          // from the writer
+    std::mutex lock;
+    std::condition_variable ready, room;
+    std::thread writer;
+
+    BatchOutput( const char* file, unsigned int numbins, unsigned int numbands, uint64_t nrows,
+                 uint64_t fingerprint, bool overwrite )
+      : numbins( numbins ), numbands( numbands ), nrows( nrows ), fingerprint( fingerprint ),
+        record( (2 + numbands*numbins) * sizeof(double) ), status( nrows, 0.0 ), closing( false ) {
+
+        out.open( file, std::ios::in | std::ios::out | std::ios::binary );
+        if ( out && !Matches() ) {
+            out.clear();
+            out.seekg( 0, std::ios::end );
+            if ( out.tellg() > 0 && !overwrite )
+                throw( Exception( ( std::string( " The batch output file " ) + file + " is not from this table"
+                                    " and these settings, so its rows can't be carried on; remove it or give"
+                                    " --overwrite. Exiting.\n" ).c_str() ) );
+            out.close();
+        }
+        if ( out.is_open() ) {
+            for ( uint64_t n(0); n < nrows; n++ ) {
+                out.seekg( HEADER + n * record );
+                if ( !out.read( reinterpret_cast<char*>( &status[n] ), sizeof(double) ) ) {
+                    out.clear();        // shorter than it should be: the rest is not done
+                    status[n] = 0.0;
+                    break;
+                }
+            }
+        }
+        else {
+            out.close();
+            out.clear();
+            out.open( file, std::ios::in | std::ios::out | std::ios::binary | std::ios::trunc );
+            if ( !out )
+                throw( Exception(" Couldn't open the batch output file. Exiting.\n") );
+            uint32_t sizes[2] = { numbins, numbands };
+            out.write( "SPOTOUT2", 8 );
+            out.write( reinterpret_cast<const char*>( sizes ), sizeof(sizes) );
+            out.write( reinterpret_cast<const char*>( &nrows ), sizeof(nrows) );
+            out.write( reinterpret_cast<const char*>( &fingerprint ), sizeof(fingerprint) );
+        }
+
+        // Makes the file as long as all the records, the ones not written yet zeros
+        const std::streamoff size( HEADER + nrows * record );
+        char last(0);
+        out.seekg( size - 1 );
+        if ( !out.read( &last, 1 ) ) out.clear();
+        out.seekp( size - 1 );
+        out.write( &last, 1 );
+        out.flush();
+        if ( !out )
+            throw( Exception(" Couldn't write the batch output file. Exiting.\n") );
+
+        writer = std::thread( &BatchOutput::Writer, this );
+    }
+
+    ~BatchOutput() {
+        try { Close(); } catch ( ... ) { }
+    }
+
+    // True if the file has the header this run would write
+    bool Matches() {
+        char magic[8];
+        uint32_t sizes[2];
+        uint64_t rows, hash;
+        out.read( magic, sizeof(magic) );
+        out.read( reinterpret_cast<char*>( sizes ), sizeof(sizes) );
+        out.read( reinterpret_cast<char*>( &rows ), sizeof(rows) );
+        out.read( reinterpret_cast<char*>( &hash ), sizeof(hash) );
+        return out && std::memcmp( magic, "SPOTOUT2", sizeof(magic) ) == 0
+            && sizes[0] == numbins && sizes[1] == numbands && rows == nrows && hash == fingerprint;
+    }
+
+    bool Done( uint64_t n ) const { return status[n] != 0.0; }
+
+    // Hands the record of row n to the writer; c = 0 leaves the flux 0
+    void Write( uint64_t n, double state, double chi, const class LightCurve* c ) {
+        Record r;
+        r.n = n;
+        r.state = state;
+        r.values.assign( 1 + numbands*numbins, 0.0 );
+        r.values[0] = chi;
+        if ( c )
+            for ( unsigned int p(0); p < numbands; p++ )
+                std::copy( c->f[p], c->f[p] + numbins, r.values.begin() + 1 + p*numbins );
+
+        std::unique_lock< std::mutex > hold( lock );
+        room.wait( hold, [this]{ return queue.size() < BATCH_QUEUE || error; } );
+        if ( error ) std::rethrow_exception( error );
+        queue.push_back( std::move( r ) );
+        ready.notify_one();
+    }
+
+    // Writes what is waiting, then stops the writer; rethrows its error
+    void Close() {
+        {
+            std::lock_guard< std::mutex > hold( lock );
+            closing = true;
+        }
+        ready.notify_one();
+        if ( writer.joinable() ) writer.join();
+        if ( error ) std::rethrow_exception( error );
+    }
+
+    // Takes whatever records are waiting and writes them: all their fluxes, then all
+    // their status, so that a row is only marked done once all of it is there
+    void Writer() {
+        std::deque< Record > batch;
+        std::unique_lock< std::mutex > hold( lock );
+        for (;;) {
+            ready.wait( hold, [this]{ return !queue.empty() || closing; } );
+            if ( queue.empty() ) return;
+            batch.swap( queue );
+            room.notify_all();
+            hold.unlock();
+
+            try {
+                ProfileTimer timer( STAGE_OUTPUT );
+                for ( unsigned long k(0); k < batch.size(); k++ ) {
+                    out.seekp( HEADER + batch[k].n * record + sizeof(double) );
+                    out.write( reinterpret_cast<const char*>( &batch[k].values[0] ),
+                               batch[k].values.size() * sizeof(double) );
+                }
+                out.flush();
+                for ( unsigned long k(0); k < batch.size(); k++ ) {
+                    out.seekp( HEADER + batch[k].n * record );
+                    out.write( reinterpret_cast<const char*>( &batch[k].state ), sizeof(double) );
+                }
+                out.flush();
+                if ( !out )
+                    throw( Exception(" Couldn't write the batch output file. Exiting.\n") );
+            }
+            catch ( ... ) {
+                hold.lock();
+                error = std::current_exception();
+                room.notify_all();
+                return;
+            }
+            batch.clear();
+            hold.lock();
+        }
+    }
+};
+
+/**************************************************************************************/
+/* RunBatch:                                                                          */
+/*           see Batch.h                                                              */
+/**************************************************************************************/
+unsigned long RunBatch( class LightCurve* curve, class DataStruct* obsdata,
+                        const double x[NDIM], double spin, const char* table_file,
+                        const char* out_file, unsigned int numthreads, bool overwrite ) {
+
+    double base[ROW];
+    std::vector< double > rows;
+    for ( unsigned int k(0); k < NDIM; k++ ) base[k] = x[k];
+    base[SPIN] = spin;
+    ReadTable( table_file, base, rows );
+
+    const uint64_t nrows( rows.size() / ROW );
+    const bool oblate( curve->flags.NS_model != 3 );
+    struct BatchOutput output( out_file, curve->numbins, curve->numbands, nrows,
+                               Fingerprint( curve, obsdata, rows ), overwrite );
+    class ThreadPool pool( numthreads );
+
+    // The rows not done yet, sorted so that each star is a run of rows, and within it
+    // rows that share the rings of their spot are next to each other
+    std::vector< uint64_t > todo;
+    for ( uint64_t n(0); n < nrows; n++ )
+        if ( !output.Done( n ) ) todo.push_back( n );
+    static const unsigned int order[ROW] = { 0, 1, SPIN, 3, 2, 4, 5, 6 };
+    auto row_less = [&]( uint64_t a, uint64_t b ) {
+        for ( unsigned int k(0); k < ROW; k++ )
+            if ( rows[a*ROW + order[k]] != rows[b*ROW + order[k]] )
+                return rows[a*ROW + order[k]] < rows[b*ROW + order[k]];
+        return false;
+    };
+    auto same_star = [&]( uint64_t a, uint64_t b ) {
+        return rows[a*ROW] == rows[b*ROW] && rows[a*ROW + 1] == rows[b*ROW + 1]
+            && rows[a*ROW + SPIN] == rows[b*ROW + SPIN]
+            && ( !oblate || rows[a*ROW + 3] == rows[b*ROW + 3] );
+    };
+    std::stable_sort( todo.begin(), todo.end(), row_less );
+
+    // Pieces of the list for the pool: a star each, unless it has so many rows that
+    // the other threads would wait for it; largest first
+    unsigned long most( todo.size() / ( BATCH_SPLIT * pool.size() ) ), stars(0);
+    if ( most < BATCH_PIECE ) most = BATCH_PIECE;
+    std::vector< std::pair< unsigned long, unsigned long > > pieces;
+    for ( unsigned long first(0), end; first < todo.size(); first = end ) {
+        for ( end = first + 1; end < todo.size() && same_star( todo[first], todo[end] ); end++ );
+        stars++;
+        for ( unsigned long start( first ); start < end; start += most )
+            pieces.push_back( std::make_pair( start, std::min( start + most, end ) ) );
+    }
+    std::stable_sort( pieces.begin(), pieces.end(),
+                      []( const std::pair< unsigned long, unsigned long >& a,
+                          const std::pair< unsigned long, unsigned long >& b ) {
+                          return a.second - a.first > b.second - b.first; } );
+
+    std::cout << "Batch: " << nrows << " rows, " << nrows - todo.size() << " already done; "
+              << todo.size() << " rows of " << stars << " stars in " << pieces.size()
+              << " pieces on " << pool.size() << " threads" << std::endl;
+
+    std::vector< std::unique_ptr< class LightCurve > > scratch( pool.size() );
+    std::vector< std::shared_ptr< DeflTables > > tables( pool.size() );
+    std::vector< unsigned long > unphysical( pool.size(), 0 );
+    for ( unsigned int t(0); t < pool.size(); t++ ) scratch[t].reset( new class LightCurve );
+
+    pool.Run( pieces.size(), [&]( unsigned int k, unsigned int thread ) {
+        class LightCurve* c( scratch[thread].get() );
+        for ( unsigned long m( pieces[k].first ); m < pieces[k].second; m++ ) {
+            const uint64_t n( todo[m] );
+            const double* row( &rows[n*ROW] );
+
+            *c = *curve;
+            if ( row[SPIN] < 0.0 || !LoadFitParameters( c, row ) ) {
+                output.Write( n, -1.0, 0.0, 0 );
+                unphysical[thread]++;
+                continue;
+            }
+            c->para.omega = Units::cgs_to_nounits( 2.0*Units::PI*row[SPIN], Units::INVTIME );
+
+            if ( !tables[thread] || !tables[thread]->Matches( c ) )
+                tables[thread] = SessionCache().Get( c );
+            if ( tables[thread]->problem ) {
+                output.Write( n, -1.0, 0.0, 0 );
+                unphysical[thread]++;
+                continue;
+            }
+
+            ComputeFlux( c, tables[thread].get() );
+            NormalizeFlux( c );
+            output.Write( n, 1.0, obsdata ? ChiSquare( obsdata, c ) : 0.0, c );
+        }
+    } );
+
+    output.Close();
+
+    unsigned long bad(0);
+    for ( unsigned int t(0); t < pool.size(); t++ ) bad += unphysical[t];
+    std::cout << "Batch: " << todo.size() - bad << " light curves computed, " << bad
+              << " rows unphysical" << std::endl;
+
+    return todo.size();
+}
@@ -0,0 +1,53 @@
+/***************************************************************************************/
+/*                                       Batch.h
+
+    This is the header file for Batch.cpp, which computes the light curves of a whole
+    table of parameter sets in one run of spot (--batch), in place of running spot once
+    per set from a script as gonice.sh and goline.sh do.
+
+    The table gives some of the parameters for each row, by the letters of their command
+    line flags: m r i e p T l, and f for the spin; the command line gives the rest. It is
+    either text, a header line of letters then one row per line (separated by commas or
+    blanks, '#' starts a comment), or binary: the 8 characters SPOTGRD1, the number of
+    columns as a 32-bit unsigned integer, one letter per column, the number of rows as a
+    64-bit unsigned integer, then the rows as 64-bit floats, in the byte order of the
+    machine.
+
+    Rows with the same star (M, R_eq and spin, and theta if oblate) are computed one
+    after the other by one thread, so the look-up tables are built once per star; big
+    groups are split between threads. The pool hands the groups out as threads become
+    free, so stars that are slow (near the limb, oblate) do not hold up the rest.
+
+    The light curves go into one binary file: the 8 characters SPOTOUT2, numbins and
+    numbands as 32-bit unsigned integers, the number of rows and a fingerprint as 64-bit
+    unsigned integers, then one record of 64-bit floats per row, in the order of the
+    table: status, chi^2 (0 without a data file), then f[p][i] band by band. The status
+    is 0 until the row is done, then 1, or -1 if its parameters are unphysical (its flux
+    is left 0). A thread of its own writes the records, so the others carry on computing
+    meanwhile.
+
+    The fingerprint is a hash of the rows and of everything else the records depend on
+    (the other options, the resolutions, the data file). A run that stops part way
+    carries on from the rows that are not done when started again with the same
+    fingerprint; an output file with any other is not touched unless overwrite is set.
+*/
+/***************************************************************************************/
+
+#ifndef BATCH_H
+#define BATCH_H
+
+#include "Chi.h"
+
+#define BATCH_SPLIT 4   // a star with more than 1/(BATCH_SPLIT threads) of the rows is split between threads
+#define BATCH_PIECE 16  // but not into pieces of fewer rows than this
+#define BATCH_QUEUE 1024 // most rows waiting to be written before the threads wait for the disk
+
+// Computes the light curve of each row of table_file, starting from the parameters in x
+// (M, R_eq, incl, theta, rho, T, ts as in FitCurve) and spin [Hz], and the rest of curve,
+// into out_file. With obsdata, chi^2 against it is kept for each row too. Returns the
+// number of rows computed now.
+unsigned long RunBatch( class LightCurve* curve, class DataStruct* obsdata,
+                        const double x[NDIM], double spin, const char* table_file,
+                        const char* out_file, unsigned int numthreads, bool overwrite );
+
+#endif // BATCH_H
@@ -0,0 +1,332 @@
+/***************************************************************************************/
+/*                                       Bench.cpp
+
+    The benchmarks of spot (make bench), in place of the times calls of gonice.sh:
+
+      scenario/...  whole runs of spot, the tests of gonice.sh and goline.sh: a tiny
+                    spot at 1 Hz, 50-ring spots at 200 and 400 Hz, an oblate star at
+                    600 Hz, the line model with 100 bands, two spots. Seconds per run,
+                    start-up and output included.
+      micro/...     the inner routines on their own, seconds per call: one integral of
+                    the trapezoid rule (psi_outgoing_u), b_from_psi over outgoing and
+                    ingoing psi of an oblate star, LineBandFlux, the rebinning
+                    (ComputeCurve of a ring, monochromatic, so its spectra are a small
+                    part) and ChiSquare.
+
+    Each is run -r times and the fastest kept, as the one least disturbed by the rest
+    of the machine. The results go to the -o file as JSON, one per line:
+
+        { "repeats": 5, "results": {
+          "scenario/tiny_spot_1hz": 0.0123,
+          ...
+        } }
+
+    and, given the -b file of an earlier run (make bench-baseline), each is compared
+    with it: more than -t (a fraction) slower is a regression, and spotbench exits
+    with 1, so make bench fails.
+
+    usage: spotbench [-s spot] [-o results] [-b baseline] [-t threshold] [-r repeats]
+*/
+/***************************************************************************************/
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include "Chi.h"
+#include "Engine.h"
+#include "OblDeflectionTOA.h"
+#include "Units.h"
+#include "Exception.h"
+#include "Struct.h"
+
+static double Seconds() {
+    return std::chrono::duration< double >( std::chrono::steady_clock::now().time_since_epoch() ).count();
+}
+
+// The shortest of repeats runs of work, divided by the calls it makes
+template <class Work>
+static double Fastest( unsigned int repeats, unsigned long calls, Work work ) {
+    double best( HUGE_VAL );
+    for ( unsigned int r(0); r < repeats; r++ ) {
+        double start( Seconds() );
+        work();
+        best = std::min( best, Seconds() - start );
+    }
+    return best / calls;
+}
+
+/**************************************************************************************/
+/* Star:                                                                              */
+/*           fills in curve as Spot.cpp does for -m 1.4 -r 12 -f spin -i incl        */
+/*           -e theta -p rho -T 0.35 -D 200 pc, isotropic, monochromatic at 1 keV    */
+/**************************************************************************************/
+static void Star( class LightCurve* curve, double spin, double incl, double theta, double rho,
+                  unsigned int NS_model, unsigned int numbins ) {
+
+    double mass( 1.4 ), req( 12.0 ), distance( 6.1713552e18 );
+    curve->para.mass_over_r = mass/req * Units::GMC2;
+    curve->para.mass = Units::cgs_to_nounits( mass*Units::MSUN, Units::MASS );
+    curve->para.req = Units::cgs_to_nounits( req*1.0e5, Units::LENGTH );
+    curve->para.radius = curve->para.req;
+    curve->para.rspot = curve->para.req;
+    curve->para.rpole = curve->para.req;
+    curve->para.omega = Units::cgs_to_nounits( 2.0*Units::PI*spin, Units::INVTIME );
+    curve->para.distance = Units::cgs_to_nounits( distance*100, Units::LENGTH );
+    curve->para.incl = incl * Units::PI/180.0;
+    curve->para.theta = theta * Units::PI/180.0;
+    curve->para.rho = rho;
+    curve->para.phi_0 = 0.0;
+    curve->para.cosgamma = 0.0;
+    curve->para.temperature = 0.35;
+    curve->para.ts = 0.0;
+    curve->para.E0 = 1.0;
+    curve->para.dS = pow( curve->para.req, 2 ) * 2.0*Units::PI * (1.0 - cos(rho));
+    curve->numbins = numbins;
+    curve->numbands = 1;
+    curve->numtheta = 1;
+    curve->flags.infile_is_set = false;
+    curve->flags.ignore_time_delays = false;
+    curve->flags.spectral_model = 0;
+    curve->flags.beaming_model = 0;
+    curve->flags.NS_model = NS_model;
+    curve->flags.two_spots = false;
+    curve->flags.only_second_spot = false;
+    curve->flags.normalize_flux = false;
+    curve->flags.single_precision = false;
+    curve->flags.mesh_tolerance = 0.0;
+    curve->flags.nside = 0;
+    curve->flags.pixel_mask = 0;
+    curve->flags.pixel_map = 0;
+    curve->flags.spots = 0;
+    for ( unsigned int p(0); p < NCURVES; p++ ) curve->background[p] = 0.0;
+    for ( unsigned int i(0); i < numbins; i++ ) curve->t[i] = i / (1.0 * numbins);
+}
+
+/**************************************************************************************/
+/* Scenario:                                                                          */
+/*           seconds per run of spot with the common flags and args                   */
+/**************************************************************************************/
+static double Scenario( const std::string& spot, const std::string& args, unsigned int repeats ) {
+    std::string command( spot + " -m 1.4 -r 12 -l 0 -n 128 -T 0.35 -D 6.1713552e18 -g 0 "
+                         + args + " -o /dev/null > /dev/null 2>&1" );
+    return Fastest( repeats, 1, [&]() {
+        if ( std::system( command.c_str() ) != 0 )
+            throw( Exception( (" spotbench: this failed: " + command + "\n").c_str() ) );
+    } );
+}
+
+/**************************************************************************************/
+/* Baseline:                                                                          */
+/*           the results of an earlier run, from its -o file                          */
+/**************************************************************************************/
+static std::map< std::string, double > Baseline( const char* file ) {
+    std::map< std::string, double > results;
+    std::ifstream in( file );
+    std::string line;
+    while ( std::getline( in, line ) ) {
+        char name[256];
+        double seconds;
+        if ( sscanf( line.c_str(), " \"%255[^\"]\": %lf", name, &seconds ) == 2 )
+            results[name] = seconds;
+    }
+    return results;
+}
+
+int main( int argc, char** argv ) try {
+
+    std::string spot( "./spot" );
+    const char* out_file( "bench.json" );
+    const char* baseline_file( 0 );
+    double threshold( 0.2 );
+    unsigned int repeats( 5 );
+
+    for ( int i(1); i < argc; i++ ) {
+        if ( argv[i][0] != '-' || i+1 >= argc ) {
+            std::cout << "usage: spotbench [-s spot] [-o results] [-b baseline] [-t threshold] [-r repeats]" << std::endl;
+            return 2;
+        }
+        switch ( argv[i][1] ) {
+            case 's': spot = argv[++i]; break;
+            case 'o': out_file = argv[++i]; break;
+            case 'b': baseline_file = argv[++i]; break;
+            case 't': threshold = atof( argv[++i] ); break;
+            case 'r': repeats = std::max( 1, atoi( argv[++i] ) ); break;
+            default:
+                std::cout << "usage: spotbench [-s spot] [-o results] [-b baseline] [-t threshold] [-r repeats]" << std::endl;
+                return 2;
+        }
+    }
+
+    std::vector< std::pair< std::string, double > > results;
+
+    /*****************************************/
+    /* WHOLE RUNS: gonice.sh AND goline.sh   */
+    /*****************************************/
+
+    const char* scenarios[][2] = {
+        { "scenario/tiny_spot_1hz",     "-q 3 -f 1 -i 90 -e 90 -p 1e-2 -t 1 -s 0 -S 1" },
+        { "scenario/big_spot_200hz",    "-q 3 -f 200 -i 90 -e 90 -p 1 -t 50 -s 0 -S 1" },
+        { "scenario/big_spot_400hz",    "-q 3 -f 400 -i 30 -e 60 -p 1 -t 50 -s 0 -S 1" },
+        { "scenario/oblate_600hz",      "-q 1 -f 600 -i 90 -e 75 -p 1 -t 16 -s 0 -S 1" },
+        { "scenario/line_100_bands",    "-q 3 -f 400 -i 90 -e 90 -p 1e-2 -t 1 -s 1 -S 100 -u 0.995 -U 1.005 -x 0.7 -X 1e-3" },
+        { "scenario/two_spots_200hz",   "-q 3 -f 200 -i 60 -e 40 -p 0.5 -t 8 -s 0 -S 1 -2" }
+    };
+    for ( unsigned int k(0); k < sizeof(scenarios)/sizeof(scenarios[0]); k++ ) {
+        results.push_back( std::make_pair( scenarios[k][0], Scenario( spot, scenarios[k][1], repeats ) ) );
+        std::cout << std::setw(32) << std::left << scenarios[k][0] << results.back().second << " s" << std::endl;
+    }
+
+    /*****************************************/
+    /* THE INNER ROUTINES                    */
+    /*****************************************/
+
+    std::unique_ptr< LightCurve > curve( new LightCurve );
+    bool problem( false );
+
+    // One trapezoid rule integral of the bending angle
+    Star( curve.get(), 400.0, 90.0, 90.0, 1e-2, 3, 128 );
+    DeflTables spherical( curve.get() );
+    {
+        const unsigned long calls( 200 );
+        double b_max( spherical.defl.b_max ), psi_max( spherical.defl.psi_max ), sum(0.0);
+        results.push_back( std::make_pair( "micro/trapezoid_integral", Fastest( repeats, calls, [&]() {
+            for ( unsigned long n(0); n < calls; n++ )
+                sum += spherical.defltoa->psi_outgoing_u( b_max * (n + 0.5) / calls, spherical.rspot,
+                                                          b_max, psi_max, &problem );
+        } ) ) );
+        if ( !( sum > 0.0 ) ) throw( Exception(" spotbench: the integrals came out wrong.\n") );
+    }
+
+    // b_from_psi over psi up to past psi_max, so over the ingoing branch too; the
+    // guesses from the b vs psi table, as ComputeAngles gives them
+    Star( curve.get(), 600.0, 90.0, 75.0, 1e-2, 1, 128 );
+    DeflTables oblate( curve.get() );
+    {
+        const unsigned long calls( 20000 );
+        const Defl& defl( oblate.defl );
+        double mu( cos( oblate.theta ) );
+        unsigned long found(0);
+        results.push_back( std::make_pair( "micro/b_from_psi", Fastest( repeats, calls, [&]() {
+            for ( unsigned long n(0); n < calls; n++ ) {
+                double psi( 1.2 * defl.psi_max * (n + 0.5) / calls ), b(0.0),
+                       b_guess( defl.b_max ), b2( defl.b_max ), psi2( defl.psi_max );
+                int rdot(0);
+                if ( psi < defl.psi_max ) {
+                    unsigned int j(1);
+                    while ( j < 3*NN && psi > defl.psi_b[j] ) j++;
+                    b_guess = defl.b_psi[j-1] + ( defl.b_psi[j] - defl.b_psi[j-1] )
+                              * ( psi - defl.psi_b[j-1] ) / ( defl.psi_b[j] - defl.psi_b[j-1] );
+                    b2 = defl.b_psi[j];
+                    psi2 = defl.psi_b[j];
+                }
+                found += oblate.defltoa->b_from_psi( psi, oblate.rspot, mu, b, rdot, defl.b_max, defl.psi_max,
+                                                     b_guess, psi, b2, psi - psi2, &problem );
+            }
+        } ) ) );
+        if ( found == 0 ) throw( Exception(" spotbench: b_from_psi found no b.\n") );
+    }
+
+    // The band integral of the line model, over the band of goline.sh
+    {
+        const unsigned long calls( 100000 );
+        double sum(0.0);
+        results.push_back( std::make_pair( "micro/line_band_flux", Fastest( repeats, calls, [&]() {
+            for ( unsigned long n(0); n < calls; n++ ) {
+                double E( 0.69 + 0.02 * n / calls );
+                sum += LineBandFlux< double >( 0.35, E, E + 1e-3, 0.7*0.995, 0.7*1.005 );
+            }
+        } ) ) );
+        if ( std::isnan( sum ) ) throw( Exception(" spotbench: the band integrals came out NaN.\n") );
+    }
+
+    // The rebinning of one ring's light curve, from its angles
+    Star( curve.get(), 400.0, 90.0, 90.0, 1e-2, 3, 128 );
+    curve->defl = spherical.defl;
+    ComputeAngles( *curve, spherical.defltoa );
+    {
+        const unsigned long calls( 2000 );
+        results.push_back( std::make_pair( "micro/rebin", Fastest( repeats, calls, [&]() {
+            for ( unsigned long n(0); n < calls; n++ )
+                ComputeCurve( *curve );
+        } ) ) );
+    }
+
+    // chi^2 of that light curve against itself with 1% error bars
+    {
+        std::vector< double > t( MAX_NUMBINS ), f( MAX_NUMBINS ), err( MAX_NUMBINS );
+        class DataStruct data;
+        data.t = &t[0];
+        data.f[0] = &f[0];
+        data.err[0] = &err[0];
+        data.numbins = curve->numbins;
+        data.numbands = 1;
+        data.shift = 0.0;
+        for ( unsigned int i(0); i < curve->numbins; i++ ) {
+            t[i] = curve->t[i];
+            f[i] = curve->f[0][i];
+            err[i] = 0.01 * fabs( curve->f[0][i] ) + 1e-30;
+        }
+        const unsigned long calls( 100000 );
+        double sum(0.0);
+        results.push_back( std::make_pair( "micro/chi_square", Fastest( repeats, calls, [&]() {
+            for ( unsigned long n(0); n < calls; n++ )
+                sum += ChiSquare( &data, curve.get() );
+        } ) ) );
+        if ( std::isnan( sum ) ) throw( Exception(" spotbench: chi^2 came out NaN.\n") );
+    }
+    for ( unsigned int k(sizeof(scenarios)/sizeof(scenarios[0])); k < results.size(); k++ )
+        std::cout << std::setw(32) << std::left << results[k].first << results[k].second << " s" << std::endl;
+
+    /*****************************************/
+    /* WRITE, AND COMPARE WITH THE BASELINE  */
+    /*****************************************/
+
+    std::ofstream out( out_file, std::ios_base::trunc );
+    if ( !out )
+        throw( Exception(" spotbench: couldn't open the results file.\n") );
+    out << std::setprecision( 6 ) << "{ \"repeats\": " << repeats << ", \"results\": {\n";
+    for ( unsigned int k(0); k < results.size(); k++ )
+        out << "  \"" << results[k].first << "\": " << results[k].second
+            << ( k + 1 < results.size() ? ",\n" : "\n" );
+    out << "} }\n";
+    out.close();
+
+    if ( !baseline_file ) return 0;
+    std::map< std::string, double > baseline( Baseline( baseline_file ) );
+    if ( baseline.empty() ) {
+        std::cout << "\nNo baseline in " << baseline_file << " to compare with; make bench-baseline makes one." << std::endl;
+        return 0;
+    }
+    unsigned int regressions(0);
+    std::cout << "\nAgainst " << baseline_file << " (regression: more than " << threshold*100 << "% slower):" << std::endl;
+    for ( unsigned int k(0); k < results.size(); k++ ) {
+        std::map< std::string, double >::const_iterator b( baseline.find( results[k].first ) );
+        if ( b == baseline.end() || b->second <= 0.0 ) continue;
+        double ratio( results[k].second / b->second );
+        bool slower( ratio > 1.0 + threshold );
+        if ( slower ) regressions++;
+        std::cout << std::setw(32) << std::left << results[k].first << std::fixed << std::setprecision(2)
+                  << ratio << " x" << ( slower ? "   REGRESSION" : "" ) << std::defaultfloat << std::endl;
+    }
+    if ( regressions > 0 ) {
+        std::cout << regressions << " regression(s)." << std::endl;
+        return 1;
+    }
+    return 0;
+}
+
+catch ( std::exception& e ) {
+    std::cerr << "\nERROR: Exception thrown. " << std::endl << e.what() << std::endl;
+    return -1;
+}
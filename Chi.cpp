@@ -18,6 +18,7 @@
 #include <fstream>
 #include <vector>
 #include <string>
+#include <algorithm>
 #include "Chi.h"
 #include "OblDeflectionTOA.h"
 #include "OblModelBase.h"
@@ -25,6 +26,10 @@
 #include "Exception.h"
 #include "Units.h"
 #include "Struct.h"
+#include "Engine.h"
+#include "ThreadPool.h"
+#include "Log.h"
+#include "Profile.h"
 #include "time.h"
 #include <stdio.h>
 using namespace std;
@@ -34,28 +39,38 @@ using namespace std;
 /*           computes the chi^2 fit of data vs a simulation                           */
 /*																					  */
 /* pass: obsdata = light curve fluxes from observational data                         */
-/*       ts = time shift or phase shift (normalized)                                  */
+/*       curve = simulated light curve; para.ts is the time shift (normalized)        */
+/*       obsdata->f[p] is compared to curve->f[p] for p < obsdata->numbands           */
 /**************************************************************************************/
 double ChiSquare ( class DataStruct* obsdata, class LightCurve* curve) {
+    return ChiSquare<double>( obsdata, curve );
+}
+
+template <class T>
+T ChiSquare ( class DataStruct* obsdata, LightCurveT<T>* curve) {
         
+    ProfileTimer timer( STAGE_CHI );
     /***************************************/
    	/* VARIABLE DECLARATIONS FOR ChiSquare */
     /***************************************/
     
-    unsigned int numbins;  // Number of phase (or time) bins the light curve is cut into
+    unsigned int numbins,  // Number of phase (or time) bins the light curve is cut into
+                 numbands; // Number of energy bands in the data
     
     int k,      // Array index variable
     	new_b,  // 
     	n;      // Array index variable
     
-    double ts,                              // time shift, so the phase of the simulation matches the phase of the data
-           new_shift,                       // A time shift (for rebinning?)
-    	   ja_check,                        // 
-    	   chisquare(0.0),                  // Computed chi^2
-    	   tempflux[NCURVES][MAX_NUMBINS],  // Temporary array to store the flux
-    	   min_location;                    // 
+    T ts,                                   // time shift, so the phase of the simulation matches the phase of the data
+      new_shift,                            // A time shift (for rebinning?)
+      chisquare(0.0),                       // Computed chi^2
+      min_location;                         // 
+    double ja_check;                        // 
     
     numbins = obsdata->numbins;
+    numbands = obsdata->numbands;
+    if ( numbands > curve->numbands ) numbands = curve->numbands;
+    std::vector< T > tempflux( numbands*numbins );  // Temporary array to store the flux, tempflux[p*numbins+i]
     ts = curve->para.ts;
     
     for ( unsigned int z(1); z<=1 ; z++ ) { // for different epochs
@@ -79,18 +94,16 @@ double ChiSquare ( class DataStruct* obsdata, class LightCurve* curve) {
         }*/
         
         // Rebinning the data and store shifted data back in Flux
+        // Band p of the data is compared to band p of the simulation, for every band
+        // that was read in from the data file.
         
-        for ( unsigned int i(0); i < numbins; i++ ) {
-            k = i - new_b; //May changed
-            if (k > static_cast<int>(numbins)-1) k -= numbins;
-            if (k < 0) k += numbins;
-            
-            unsigned int p = 1;
-        	unsigned int q = 2;
-            tempflux[p][i] = curve->f[q][k]; // putting things from curve->f's k bin into tempflux's i bin
-            p = 2;
-        	q = 3;
-        	tempflux[p][i] = curve->f[q][k]; // putting things from curve->f's k bin into tempflux's i bin
+        for ( unsigned int p(0); p < numbands; p++ ) {
+            for ( unsigned int i(0); i < numbins; i++ ) {
+                k = i - new_b; //May changed
+                if (k > static_cast<int>(numbins)-1) k -= numbins;
+                if (k < 0) k += numbins;
+                tempflux[p*numbins+i] = curve->f[p][k]; // putting things from curve->f's k bin into tempflux's i bin
+            }
         }
         
         for ( unsigned int i(0); i < numbins; i++ ) {
@@ -99,31 +112,17 @@ double ChiSquare ( class DataStruct* obsdata, class LightCurve* curve) {
             // n = i+1;
             if ( n > static_cast<int>(numbins) - 1 ) n -= numbins;
             
-            unsigned int p = 1;
-        	unsigned int q = 2;
-            curve->f[q][i] = tempflux[p][i] + (tempflux[p][n]-tempflux[p][i]) * new_shift * numbins;
-            p = 2;
-        	q = 3;
-        	curve->f[q][i] = tempflux[p][i] + (tempflux[p][n]-tempflux[p][i]) * new_shift * numbins;
+            for ( unsigned int p(0); p < numbands; p++ )
+                curve->f[p][i] = tempflux[p*numbins+i] + (tempflux[p*numbins+n]-tempflux[p*numbins+i]) * new_shift * numbins;
         }
 
         
         // Compute chisquare for shifted data
         
-        // energy band 1
-        unsigned int p = 1;
-        unsigned int q = 2;
-        for ( unsigned int i(0); i < numbins; i++ ) {
-            chisquare += pow( (obsdata->f[p][i] - curve->f[q][i])/obsdata->err[p][i], 2);
-            // using different 'p' and 'q' because we're not comparing the exact same columns of obsdata.f and Flux
-        }
-
-		// energy band 2
-        p = 2;
-        q = 3;
-        for ( unsigned int i(0); i < numbins; i++ ) {
-            chisquare += pow( (obsdata->f[p][i] - curve->f[q][i])/obsdata->err[p][i], 2);
-            // using different 'p' and 'q' because we're not comparing the exact same columns of obsdata.f and Flux
+        for ( unsigned int p(0); p < numbands; p++ ) {
+            for ( unsigned int i(0); i < numbins; i++ ) {
+                chisquare += pow( (obsdata->f[p][i] - curve->f[p][i])/obsdata->err[p][i], 2);
+            }
         }
     }
     
@@ -138,6 +137,54 @@ double ChiSquare ( class DataStruct* obsdata, class LightCurve* curve) {
     
 }
 
+/**************************************************************************************/
+/* Interpolate4:                                                                      */
+/*              4-point (cubic) Lagrange interpolation of y(x) through (xk, yk)       */
+/**************************************************************************************/
+template <class T>
+static T Interpolate4( const T& x, const T xk[4], const T yk[4] ) {
+    return (x-xk[1])*(x-xk[2])*(x-xk[3])*yk[0]/
+	   ((xk[0]-xk[1])*(xk[0]-xk[2])*(xk[0]-xk[3]))
+	   +(x-xk[0])*(x-xk[2])*(x-xk[3])*yk[1]/
+	   ((xk[1]-xk[0])*(xk[1]-xk[2])*(xk[1]-xk[3]))
+	   +(x-xk[0])*(x-xk[1])*(x-xk[3])*yk[2]/
+	   ((xk[2]-xk[0])*(xk[2]-xk[1])*(xk[2]-xk[3]))
+	   +(x-xk[0])*(x-xk[1])*(x-xk[2])*yk[3]/
+	   ((xk[3]-xk[0])*(xk[3]-xk[1])*(xk[3]-xk[2]));
+}
+
+/**************************************************************************************/
+/* TableNode:                                                                         */
+/*              works out node i of the b vs psi look-up table (see DeflTables in     */
+/*              Engine.h) as a function of the star, if not done already. The values  */
+/*              are those in defl; the derivatives are those of b_max and psi(b).     */
+/*                                                                                    */
+/* pass: b_node, psi_node = the nodes done so far; empty to start with                */
+/**************************************************************************************/
+template <class T>
+static void TableNode( unsigned int i, const class Defl& defl, const OblStar<T>& star,
+                       class OblDeflectionTOA* defltoa, std::vector< T >* b_node,
+                       std::vector< T >* psi_node, bool* prob ) {
+
+    if ( b_node->empty() ) {
+        b_node->assign( 3*NN+1, T(-1.0) );
+        psi_node->assign( 3*NN+1, T(0.0) );
+    }
+    if ( (*b_node)[i] >= 0.0 ) return;
+
+    // the nodes are fixed fractions of b_max
+    T b_max( star.rspot / sqrt( 1.0 - 2.0 * star.mass_over_r ) );
+    (*b_node)[i] = WithValue( defl.b_psi[i], T( b_max * (defl.b_psi[i]/defl.b_max) ) );
+
+    if ( i == 0 )
+        (*psi_node)[i] = 0.0;
+    else if ( i == 3*NN )
+        (*psi_node)[i] = WithValue( defl.psi_b[i], defltoa->psi_max_outgoing_u( (*b_node)[i], star, prob ) );
+    else
+        (*psi_node)[i] = WithValue( defl.psi_b[i], defltoa->psi_outgoing_u( (*b_node)[i], star, defl.b_max,
+                                                                             defl.psi_max, prob ) );
+}
+
 /**************************************************************************************/
 /* ComputeAngles:                                                                     */
 /*              computes all angles necessary to create the x-ray light curve         */
@@ -147,36 +194,45 @@ double ChiSquare ( class DataStruct* obsdata, class LightCurve* curve) {
 /**************************************************************************************/
 class LightCurve ComputeAngles ( class LightCurve* incurve,
 				                 class OblDeflectionTOA* defltoa) {
+    class LightCurve curve;
+    curve = *incurve;
+    curve.para.rpole = defltoa->star( curve.para.radius ).rpole;
+    ComputeAngles( curve, defltoa );
+    return curve;
+}
+
+template <class T>
+void ComputeAngles ( LightCurveT<T>& curve,
+				     class OblDeflectionTOA* defltoa) {
 
 	/*******************************************/
 	/* VARIABLE DECLARATIONS FOR ComputeAngles */
 	/*******************************************/
 	
-    class LightCurve curve;
-    curve = *incurve;
-
-    double theta_0,                   // Emission angle (latitude) of the spot, in radians          
-           incl,                      // inclination angle of the observer, in radians
-           mass,                      // Mass of the star, in M_sun
-           radius,                    // Radius of the star (at whatever little bit we're evaluating at)
+    T theta_0,                        // Emission angle (latitude) of the spot, in radians          
+      incl,                           // inclination angle of the observer, in radians
+      mass,                           // Mass of the star, in M_sun
+      radius,                         // Radius of the star (at whatever little bit we're evaluating at)
       mass_over_r,
-           omega,                     // Spin frequency of the neutron star, in Hz
-           cosgamma,                  // Cos of the angle between the radial vector and the surface normal vector
-           shift_t,                   // Time off-set from data
+      cosgamma,                       // Cos of the angle between the radial vector and the surface normal vector
+      shift_t,                        // Time off-set from data
+      mu(1.0),                        // = cos(theta_0), unitless
+      speed(0.0),                     // Velocity of the spot, defined in MLCB34
+      alpha(0.0),                     // Zenith angle, in radians
+      sinalpha(0.0),                  // Sin of zenith angle, defined in MLCB19
+      cosalpha(1.0),                  // Cos of zenith angle, used in MLCB30
+      b(0.0),                         // Photon's impact parameter
+      toa_val(0.0),                   // Time of arrival, MLCB38
+      dpsi_db_val(0.0),               // Derivative of MLCB20 with respect to b
+      phi_0,                          // Azimuthal location of the spot, in radians
+      dS;                             // Surface area of the spot, defined in MLCB2; computed in Spot.cpp
+    double omega,                     // Spin frequency of the neutron star, in Hz
            b_guess(0.0),              // Impact parameter; starting off with reasonable guess then refining it
-           mu(1.0),                   // = cos(theta_0), unitless
-           speed(0.0),                // Velocity of the spot, defined in MLCB34
-           alpha(0.0),                // Zenith angle, in radians
-           sinalpha(0.0),             // Sin of zenith angle, defined in MLCB19
-           cosalpha(1.0),             // Cos of zenith angle, used in MLCB30
-           b(0.0),                    // Photon's impact parameter
-           toa_val(0.0),              // Time of arrival, MLCB38
-           dpsi_db_val(0.0),          // Derivative of MLCB20 with respect to b
-           phi_0,                     // Azimuthal location of the spot, in radians
-           dS,                        // Surface area of the spot, defined in MLCB2; computed in Spot.cpp
            distance;                  // Distance from Earth to NS, inputted in meters
 
-    double eps, epspsi,dcosa_dcosp;
+    double eps;
+    T epspsi, dcosa_dcosp;
+    OblStar<T> star;                  // the star as seen by the deflection routines
            
     unsigned int numbins(MAX_NUMBINS);// Number of phase bins the light curve is split into; same as number of flux data points
     numbins = curve.numbins;
@@ -185,17 +241,24 @@ class LightCurve ComputeAngles ( class LightCurve* incurve,
     bool ingoing(false);
     bool infile_is_set(false);
 
-    std::vector< double > phi_em(numbins, 0.0);   // Azimuth as measured from the star's emission frame; one for each phase bin
-    std::vector< double > psi(numbins, 0.0);      // Bending angle, as defined in MLCB20
+    std::vector< T > phi_em(numbins, 0.0);   // Azimuth as measured from the star's emission frame; one for each phase bin
+    std::vector< T > psi(numbins, 0.0);      // Bending angle, as defined in MLCB20
 
     // These are calculated in the second loop.
-    std::vector< double > dcosalpha_dcospsi(numbins, 0.0);    // Used in MLCB30
-    std::vector< double > cosdelta(numbins, 0.0);             // 
-    std::vector< double > cosxi(numbins, 0.0);                // Used in Doppler boost factor, defined in MLCB35
+    std::vector< T > dcosalpha_dcospsi(numbins, 0.0);    // Used in MLCB30
+    std::vector< T > cosdelta(numbins, 0.0);             // 
+    std::vector< T > cosxi(numbins, 0.0);                // Used in Doppler boost factor, defined in MLCB35
 
     // vectors for 4-point interpolation
     std::vector< double > psi_k(4, 0.0);       // Bending angle, sub k?
     std::vector< double > b_k(4, 0.0);         // Impact parameter, sub k?
+
+    // With derivatives: the nodes of the look-up table as functions of the star, worked
+    // out as they are needed (see TableNode); b_table is b from them.
+    std::vector< T > b_node, psi_node;
+    T b_table(0.0);
+    ProfileTimer timer( STAGE_ANGLES );
+    unsigned int ingoing_bins(0);
     
     /************************************************************************************/
     /* SETTING THINGS UP - keep in mind that these variables are in dimensionless units */
@@ -216,8 +279,12 @@ class LightCurve ComputeAngles ( class LightCurve* incurve,
     speed = omega*radius*sin(theta_0) / sqrt( 1.0 - 2.0*mass_over_r ); // MLCB34
     //std::cout << "Speed = " << speed << std::endl;
     mu = cos(theta_0);
+    star.mass = mass;
+    star.mass_over_r = mass_over_r;
+    star.rspot = radius;
+    star.rpole = curve.para.rpole;
 
-    std::cout << "ComputeAngles: radius = " << radius << std::endl;
+    LOG( LOG_DEBUG, LOG_ANGLES, "ComputeAngles: radius = " << radius );
 
 
     //initial assumptions
@@ -235,8 +302,8 @@ class LightCurve ComputeAngles ( class LightCurve* incurve,
         // SMM: Added an offset of phi_0
         // SMM: Time is normalized to the spin period so 0 < t_e < 1 
         // curve.t[i] = i/(1.0*numbins) + shift_t; (This is computed in Spot.cpp)
-        phi_em.at(i) = phi_0 + (2.0*Units::PI) * curve.t[i]; // phi_em is the same thing as "phi" in PG; changes with t
-        psi.at(i) = acos(cos(incl)*cos(theta_0) + sin(incl)*sin(theta_0)*cos(phi_em.at(i))); // PG1; this theta_0 is the theta_0 from spot.cpp
+        phi_em[i] = phi_0 + (2.0*Units::PI) * curve.t[i]; // phi_em is the same thing as "phi" in PG; changes with t
+        psi[i] = acos(cos(incl)*cos(theta_0) + sin(incl)*sin(theta_0)*cos(phi_em[i])); // PG1; this theta_0 is the theta_0 from spot.cpp
        
     } // closing For-Loop-1
 
@@ -249,18 +316,19 @@ class LightCurve ComputeAngles ( class LightCurve* incurve,
         double b1(0.0), b2(0.0), psi1(0.0), psi2(0.0);
         double xb(0.0);
         int k(0);
+        ProfileTimer solve( STAGE_SOLVE );
         //j=0;
         /**************************************************************************/
 	/* TEST FOR VISIBILITY FOR EACH VALUE OF b, THE PHOTON'S IMPACT PARAMETER */
 	/**************************************************************************/
 
-        if ( psi.at(i) < curve.defl.psi_max ) {
-            if ( psi.at(i) > curve.defl.psi_b[j] )
-	            while ( psi.at(i) > curve.defl.psi_b[j] ) {
+        if ( psi[i] < curve.defl.psi_max ) {
+            if ( psi[i] > curve.defl.psi_b[j] )
+	            while ( psi[i] > curve.defl.psi_b[j] ) {
 	                j++;      
                 }
             else {
-	            while ( psi.at(i) < curve.defl.psi_b[j] ) {
+	            while ( psi[i] < curve.defl.psi_b[j] ) {
 	              j--;
 	            }
 	           j++;
@@ -276,41 +344,51 @@ class LightCurve ComputeAngles ( class LightCurve* incurve,
             if ( j == 3 * NN ) k = 3 * NN - 3;
 
             for ( j = 0; j < 4; j++ ) {
-	            b_k.at(j) = curve.defl.b_psi[k+j];
-	            psi_k.at(j) = curve.defl.psi_b[k+j];
+	            b_k[j] = curve.defl.b_psi[k+j];
+	            psi_k[j] = curve.defl.psi_b[k+j];
             }
   
             // 4-pt interpolation to find the correct value of b given psi.
-            xb = psi.at(i);
-            b_guess = (xb-psi_k.at(1))*(xb-psi_k.at(2))*(xb-psi_k.at(3))*b_k.at(0)/
-	                  ((psi_k.at(0)-psi_k.at(1))*(psi_k.at(0)-psi_k.at(2))*(psi_k.at(0)-psi_k.at(3)))
-	                  +(xb-psi_k.at(0))*(xb-psi_k.at(2))*(xb-psi_k.at(3))*b_k.at(1)/
-	                  ((psi_k.at(1)-psi_k.at(0))*(psi_k.at(1)-psi_k.at(2))*(psi_k.at(1)-psi_k.at(3)))
-	                  +(xb-psi_k.at(0))*(xb-psi_k.at(1))*(xb-psi_k.at(3))*b_k.at(2)/
-	                  ((psi_k.at(2)-psi_k.at(0))*(psi_k.at(2)-psi_k.at(1))*(psi_k.at(2)-psi_k.at(3)))
-	                  +(xb-psi_k.at(0))*(xb-psi_k.at(1))*(xb-psi_k.at(2))*b_k.at(3)/
-                	  ((psi_k.at(3)-psi_k.at(0))*(psi_k.at(3)-psi_k.at(1))*(psi_k.at(3)-psi_k.at(2)));
-        } // ending psi.at(i) < curve.defl.psi_max
+            xb = Value( psi[i] );
+            b_guess = Interpolate4( xb, &psi_k[0], &b_k[0] );
+
+            // The same, with the derivatives of the table nodes as well as of psi
+            if ( IsDual<T>::value ) {
+                T psi_kT[4], b_kT[4];
+                for ( j = 0; j < 4; j++ ) {
+                    TableNode( k+j, curve.defl, star, defltoa, &b_node, &psi_node, &curve.problem );
+                    b_kT[j] = b_node[k+j];
+                    psi_kT[j] = psi_node[k+j];
+                }
+                b_table = Interpolate4( psi[i], psi_kT, b_kT );
+            }
+        } // ending psi[i] < curve.defl.psi_max
         
         /***********************************************/
 	/* FINDING IF A SOLUTION EXISTS, SETTING FLAGS */
 	/***********************************************/
 		
-        result = defltoa->b_from_psi( fabs(psi.at(i)), radius, mu, bval, sign, curve.defl.b_max, 
-        		 curve.defl.psi_max, b_guess, fabs(psi.at(i)), b2, fabs(psi.at(i))-psi2, 
+        result = defltoa->b_from_psi( fabs(Value(psi[i])), Value(radius), Value(mu), bval, sign, curve.defl.b_max, 
+        		 curve.defl.psi_max, b_guess, fabs(Value(psi[i])), b2, fabs(Value(psi[i]))-psi2, 
         		 &curve.problem );
         if ( result == false ) { 
             curve.visible[i] = false;
-            curve.t_o[i] = curve.t[i] + curve.t_o[i-1] - curve.t[i-1] ;
+            if ( i > 0 )
+                curve.t_o[i] = curve.t[i] + curve.t_o[i-1] - curve.t[i-1] ;
+            else
+                curve.t_o[i] = curve.t[i]; // given the delay of the first visible bin below
             curve.dOmega_s[i] = 0.0;
             curve.eclipse = true;
         }
 		
         else { // there is a solution
-            b = bval;
+            b = defltoa->b_of_psi( bval, sign, b_table, T( fabs(psi[i]) ), Value(mu), star,
+                                   curve.defl.b_max, curve.defl.psi_max, &curve.problem );
+            solve.Stop();
             if ( sign < 0 ) { // if the photon is initially ingoing (only a problem in oblate models)
 	            ingoing = true;
 	            curve.ingoing = true;
+	            ingoing_bins++;
 	            //std::cout << "ingoing!"<< std::endl;
             }
             else if ( sign > 0 ) {
@@ -320,10 +398,11 @@ class LightCurve ComputeAngles ( class LightCurve* incurve,
 	            throw( Exception("Chi.cpp: sign not returned as + or - with success.") ); // used to say "ObFluxApp.cpp"
             }
             
-			double b_maximum = radius/sqrt(1.0 - 2.0*mass_over_r);
+			T b_maximum = radius/sqrt(1.0 - 2.0*mass_over_r);
 			if ( (fabs(b-b_maximum) < 1e-7) && (b > 0.0) && (b > b_maximum) ) { 
 			// this corrects for b being ever so slightly over bmax, which yields all kinds of errors in OblDeflectionTOA
-				std::cout << "Setting b = b_max." << std::endl;
+				LogCount( EVENT_B_MAX );
+				LOG( LOG_DEBUG, LOG_ANGLES, "Setting b = b_max at i = " << i );
 				b = b_maximum - DBL_EPSILON;
 			}
             curve.b[i] = b/radius;
@@ -345,32 +424,25 @@ class LightCurve ComputeAngles ( class LightCurve* incurve,
 	            alpha = Units::PI - alpha;
             }
 
-            cosdelta.at(i) =  (cos(incl) - cos(theta_0)*cos(psi.at(i))) / (sin(theta_0)*sin(psi.at(i))) ;
+            cosdelta[i] =  (cos(incl) - cos(theta_0)*cos(psi[i])) / (sin(theta_0)*sin(psi[i])) ;
             if ( theta_0 == 0.0 )  // cosdelta needs to be redone if theta_0 = 0
-            	cosdelta.at(i) = sqrt( 1 - pow( sin(incl) * sin(phi_em.at(i)) / sin(psi.at(i)) ,2) ); // law of sines from MLCB Fig 1 and in MLCB17 and just above
+            	cosdelta[i] = sqrt( 1 - pow( sin(incl) * sin(phi_em[i]) / sin(psi[i]) ,2) ); // law of sines from MLCB Fig 1 and in MLCB17 and just above
      
             if ( (cos(theta_0) < 0) && (cos(incl) < 0 ) ) {
-	            cosdelta.at(i) *= -1.0;
+	            cosdelta[i] *= -1.0;
             }
-            if ( sin(psi.at(i)) != 0.0 ) {
-	            curve.cosbeta[i] = cosalpha * cosgamma + sinalpha * sqrt( 1.0 - pow( cosgamma, 2.0 )) * cosdelta.at(i);
-	            //if( std::isnan(curve.cosbeta[i]) ) std::cout << "cosdelta.at(i="<<i<<") = " << cosdelta.at(i) << std::endl;
+            if ( sin(psi[i]) != 0.0 ) {
+	            curve.cosbeta[i] = cosalpha * cosgamma + sinalpha * sqrt( 1.0 - pow( cosgamma, 2.0 )) * cosdelta[i];
+	            //if( std::isnan(curve.cosbeta[i]) ) std::cout << "cosdelta.at(i="<<i<<") = " << cosdelta[i] << std::endl;
             }
             else {
 	            curve.cosbeta[i] = cosalpha * cosgamma;
             }
 
             if ( cosalpha < 0.01 ) {
-	            curve.cosbeta[i] = (Units::PI/2.0 - alpha + sqrt(2) * sqrt(1.0-cosgamma) * cosdelta.at(i));
+	            curve.cosbeta[i] = (Units::PI/2.0 - alpha + sqrt(2) * sqrt(1.0-cosgamma) * cosdelta[i]);
   			}
-            if ( curve.cosbeta[i] < 0.0 && curve.cosbeta[i] > 1.0 ) { // cosbeta > 1.0 added by Abbie, Feb 22 2013
-	            std::cerr << "i = " << i
-	        	          << ", Not visible at phi_em = " << 180.0 * phi_em.at(i) / Units::PI 
-	                   	  << ", cos(beta) = " << curve.cosbeta[i] 
-		                  << ", cos(alpha) = " << cosalpha
-		                  << ", cos(gamma) = " << cosgamma
-		                  << ", cos(delta) = " << cosdelta.at(i)
-		                  << " (visibility condition)." << std::endl << std::endl;
+            if ( curve.cosbeta[i] < 0.0 ) { // the photon leaves the surface from below it: the spot faces away
 	            curve.visible[i] = false;
             }
             else {
@@ -390,40 +462,49 @@ class LightCurve ComputeAngles ( class LightCurve* incurve,
 			/********************************************************/
 			
             if ( curve.visible[i] ) { // visible 
-            	if (alpha == 0.0 && psi.at(i) == 0.0 & phi_em.at(i) == 0.0) 
-            		cosxi.at(i) = 0.0; // to avoid NAN errors from dividing by 0; appears when incl = theta at i=0
+            	if (alpha == 0.0 && psi[i] == 0.0 & phi_em[i] == 0.0) 
+            		cosxi[i] = 0.0; // to avoid NAN errors from dividing by 0; appears when incl = theta at i=0
 	            else 
-	            	cosxi.at(i) = - sinalpha * sin(incl) * sin(phi_em.at(i)) / sin(fabs(psi.at(i)));  // PG11
-	            curve.eta[i] = sqrt( 1.0 - speed*speed ) / (1.0 - speed*cosxi.at(i) ); // Doppler boost factor, MLCB33
+	            	cosxi[i] = - sinalpha * sin(incl) * sin(phi_em[i]) / sin(fabs(psi[i]));  // PG11
+	            curve.eta[i] = sqrt( 1.0 - speed*speed ) / (1.0 - speed*cosxi[i] ); // Doppler boost factor, MLCB33
 	            
-	            if ((1.0 - speed*cosxi.at(i)) == 0.0) 
-	            	std::cout << "dividing by zero" << std::endl;
-	            if((std::isnan(speed) || speed == 0.0) && theta_0 != 0.0 )
-	            	std::cout << "speed = " << speed << " at i = " << i << std::endl;
-	            //if(std::isnan(cosxi.at(i)) || cosxi.at(i) == 0.0) 
-	            //	std::cout << "cosxi(i="<<i<<") = " << cosxi.at(i) << std::endl;
+	            if ((1.0 - speed*cosxi[i]) == 0.0) {
+	            	LogCount( EVENT_DIVIDE_BY_ZERO );
+	            	LOG( LOG_DEBUG, LOG_ANGLES, "dividing by zero at i = " << i );
+	            }
+	            if((std::isnan(Value(speed)) || speed == 0.0) && theta_0 != 0.0 )
+	            	LOG( LOG_DEBUG, LOG_ANGLES, "speed = " << speed << " at i = " << i );
+	            //if(std::isnan(cosxi[i]) || cosxi[i] == 0.0) 
+	            //	std::cout << "cosxi(i="<<i<<") = " << cosxi[i] << std::endl;
 	            
 
+	            ProfileTimer integrals( STAGE_INTEGRALS );
 	            if ( ingoing ) {
 	             //  std::cout << "Ingoing b = " << b << std::endl;
-		      dpsi_db_val = defltoa->dpsi_db_ingoing( b, radius, mu, &curve.problem );
-		      toa_val = defltoa->toa_ingoing( b, radius, mu, &curve.problem );
+		      if ( IsDual<T>::value ) {
+		        dpsi_db_val = defltoa->dpsi_db_ingoing( b, Value(mu), star, &curve.problem );
+		        toa_val = defltoa->toa_ingoing( b, Value(mu), star, &curve.problem );
+		      }
+		      else { // from the ring's table of the ingoing branch, see OblRing
+		        dpsi_db_val = defltoa->dpsi_db_ingoing( Value(b), Value(radius), Value(mu), &curve.problem );
+		        toa_val = defltoa->toa_ingoing( Value(b), Value(radius), Value(mu), &curve.problem );
+		      }
 	            }
                 else {
 
 		  if (b != curve.defl.b_max ){
-	                dpsi_db_val = defltoa->dpsi_db_outgoing_u( b, radius, &curve.problem );
+	                dpsi_db_val = defltoa->dpsi_db_outgoing_u( b, star, &curve.problem );
 	                //if (i == 0) std::cout << "b = " << b <<", dpsi_db = " << dpsi_db_val << std::endl;
 
-	                toa_val = defltoa->toa_outgoing_u( b, radius, &curve.problem );
+	                toa_val = defltoa->toa_outgoing_u( b, star, &curve.problem );
 	                //std::cout << "dpsi_db_val = " << dpsi_db_val << ", toa_val = " << toa_val << std::endl;
 		  }
 		  else{
-		    toa_val = defltoa->toa_outgoing_u( b, radius, &curve.problem );
+		    toa_val = defltoa->toa_outgoing_u( b, star, &curve.problem );
 		    	eps = 1e-6;
-			b = curve.defl.b_max * sqrt(1.0 - eps);
-			epspsi = defltoa->psi_outgoing( b, radius, curve.defl.b_max, curve.defl.psi_max, &curve.problem);
-			dpsi_db_val = defltoa->dpsi_db_outgoing( b, radius, &curve.problem );
+			b = b * sqrt(1.0 - eps); // b = b_max here
+			epspsi = defltoa->psi_outgoing( b, star, curve.defl.b_max, curve.defl.psi_max, &curve.problem);
+			dpsi_db_val = defltoa->dpsi_db_outgoing( b, star, &curve.problem );
 			dcosa_dcosp = sqrt(1.0-2*mass_over_r) / (sqrt(eps) * sin(fabs(epspsi)) * radius * dpsi_db_val) * sqrt(1.0-eps);
 
 		  }
@@ -431,17 +512,18 @@ class LightCurve ComputeAngles ( class LightCurve* incurve,
 
 		}
 
+	            integrals.Stop();
 	            //std::cout << "Done computing TOA " << std::endl;
 	            curve.t_o[i] = curve.t[i] + (omega * toa_val) / (2.0 * Units::PI);
-	            curve.psi[i] = psi.at(i);
+	            curve.psi[i] = psi[i];
 	            curve.R_dpsi_db[i] = dpsi_db_val * radius;
 
 		    if (b != curve.defl.b_max){
-		    if ( psi.at(i) == 0 && alpha == 0 ) 
+		    if ( psi[i] == 0 && alpha == 0 ) 
 		      curve.dcosalpha_dcospsi[i] = fabs( (1.0 - 2.0 * mass_over_r) / curve.R_dpsi_db[i]);
-		    //if (psi.at(i) == 0 && alpha == 0 ) curve.dcosalpha_dcospsi[i] = 0.0;
+		    //if (psi[i] == 0 && alpha == 0 ) curve.dcosalpha_dcospsi[i] = 0.0;
 	            else 
-		      curve.dcosalpha_dcospsi[i] = fabs( sinalpha/cosalpha * sqrt(1.0 - 2.0*mass_over_r) / (sin(fabs(psi.at(i))) * curve.R_dpsi_db[i]) );
+		      curve.dcosalpha_dcospsi[i] = fabs( sinalpha/cosalpha * sqrt(1.0 - 2.0*mass_over_r) / (sin(fabs(psi[i])) * curve.R_dpsi_db[i]) );
 		    }
 		    else
 		      curve.dcosalpha_dcospsi[i] = dcosa_dcosp; 
@@ -456,16 +538,17 @@ class LightCurve ComputeAngles ( class LightCurve* incurve,
 	            /***********************************/
 				/* FLAGS IF A VALUE IS NAN OR ZERO */
 				/***********************************/
-	            if (std::isnan(dpsi_db_val) || dpsi_db_val == 0) std::cout << "dpsi_db_val = " << dpsi_db_val << "at i = " << i << std::endl;
-				if (std::isnan(psi.at(i))) std::cout << "psi.at(i="<<i<<") = " << psi.at(i) << std::endl;
-				if (std::isnan(curve.dOmega_s[i])) std::cout << "dOmega is NAN at i = " << i << std::endl;
-				if (std::isnan(curve.cosbeta[i])) std::cout << "cosbeta is NAN at i = " << i << std::endl;
-				if (std::isnan(curve.dcosalpha_dcospsi[i])) std::cout << "dcosalpha_dcospsi is NAN at i = " << i<< std::endl;
-				if (std::isnan(sinalpha)) std::cout << "sinalpha is NAN at i = " << i << std::endl;
-				if (std::isnan(cosalpha)) std::cout << "cosalpha is NAN at i = " << i << std::endl;
-				if (std::isnan(psi.at(i))) std::cout << "psi is NAN at i = " << i << std::endl;
-				if (std::isnan(mass)) std::cout << "mass is NAN at i = " << i << std::endl;
-				if (std::isnan(radius)) std::cout << "radius is NAN at i = " << i << std::endl;
+	            if ( std::isnan(Value(dpsi_db_val)) || std::isnan(Value(curve.dOmega_s[i])) || std::isnan(Value(curve.cosbeta[i]))
+	                 || std::isnan(Value(curve.dcosalpha_dcospsi[i])) || std::isnan(Value(sinalpha)) || std::isnan(Value(cosalpha))
+	                 || std::isnan(Value(psi[i])) ) {
+	            	LogCount( EVENT_NAN_ANGLES );
+	            	LOG( LOG_DEBUG, LOG_ANGLES, "NaN at i = " << i << ": dpsi_db_val = " << dpsi_db_val << " psi = " << psi[i]
+	            	     << " dOmega = " << curve.dOmega_s[i] << " cosbeta = " << curve.cosbeta[i]
+	            	     << " dcosalpha_dcospsi = " << curve.dcosalpha_dcospsi[i] << " sinalpha = " << sinalpha
+	            	     << " cosalpha = " << cosalpha << " mass = " << mass << " radius = " << radius );
+	            }
+	            else if ( dpsi_db_val == 0 )
+	            	LOG( LOG_DEBUG, LOG_ANGLES, "dpsi_db_val = 0 at i = " << i );
 				
 
             } // end visible
@@ -475,18 +558,30 @@ class LightCurve ComputeAngles ( class LightCurve* incurve,
 			/**************************************************************/
       
             else { // not visible; we think that it shouldn't matter if it's not visible at i=0
-	      curve.t_o[i] = curve.t[i] + (curve.t_o[i-1] - curve.t[i-1]) ; // t_o is not defined properly, so we'll set it to emission time
+	      curve.t_o[i] = curve.t[i] + ( i > 0 ? curve.t_o[i-1] - curve.t[i-1] : 0.0 ); // t_o is not defined properly, so we'll set it to emission time
 	      //curve.t_o[i] = curve.t[i] ;
 	      curve.dOmega_s[i] = 0.0;    // don't see the spot, so dOmega = 0
 	      curve.cosbeta[i] = 0.0;     // doesn't matter, doesn't enter into calculation
 	      curve.eta[i] = 1.0;	        // doesn't matter, doesn't enter into calculation
-	      std::cout << "toa = " << (curve.t_o[i-1] - curve.t[i-1]) << std::endl;
 	            //}
             } // end not visible
         } // end "there is a solution"
     }  // closing For-Loop-2
 
-    return curve;
+    // If the spot is hidden at the start of the period, the bins before it comes into
+    // view get the time delay of the first visible bin, as the ones after it sets do
+    unsigned int first_visible(0);
+    while ( first_visible < numbins && !curve.visible[first_visible] ) first_visible++;
+    if ( first_visible < numbins )
+        for ( unsigned int i(0); i < first_visible; i++ )
+            curve.t_o[i] = curve.t[i] + curve.t_o[first_visible] - curve.t[first_visible];
+
+    if ( profile_enabled ) {
+        ProfileCount( COUNT_BINS, numbins );
+        ProfileCount( COUNT_INVISIBLE, std::count( curve.visible, curve.visible + numbins, false ) );
+        ProfileCount( COUNT_INGOING, ingoing_bins );
+        timer.Note( ingoing_bins );
+    }
 
 } // End ComputeAngles
 
@@ -529,7 +624,7 @@ void Bend ( class LightCurve* incurve,
     numbins = 1000;
 
 
-    std::cout << "Entering Bend" << std::endl;
+    LOG( LOG_DEBUG, LOG_ANGLES, "Entering Bend" );
 
     /************************************************************************************/
     /* SETTING THINGS UP - keep in mind that these variables are in dimensionless units */
@@ -543,7 +638,7 @@ void Bend ( class LightCurve* incurve,
     // psi_max = curve.defl.psi_max;
 
     psi_max = defltoa->psi_max_outgoing_u(b_max,radius, &curve.problem);
-    std::cout << "BEND: psi_max = " << psi_max << std::endl;
+    LOG( LOG_DEBUG, LOG_ANGLES, "BEND: psi_max = " << psi_max );
 
     //initial assumptions
     curve.problem = false;
@@ -572,7 +667,7 @@ void Bend ( class LightCurve* incurve,
 	               
       toa_val = defltoa->toa_outgoing_u( b, radius, &curve.problem );
 
-      std::cout << "bend: alpha = " << alpha << " b/r = " << b/radius << " psi = " << psi << " dpsi = " << dpsi_db_val << std::endl; 
+      LOG( LOG_DEBUG, LOG_ANGLES, "bend: alpha = " << alpha << " b/r = " << b/radius << " psi = " << psi << " dpsi = " << dpsi_db_val );
 
       if (psi==0 && alpha == 0)
 	dcosa_dcosp =  fabs( (1.0 - 2.0 * mass_over_r) / (radius * dpsi_db_val));
@@ -612,6 +707,109 @@ void Bend ( class LightCurve* incurve,
 } // End Bend
 
 
+/**************************************************************************************/
+/* BinFlux:                                                                           */
+/*           the flux of each phase bin, before the time delays, for one spectral     */
+/*           model (0, 1 or 7; any other leaves the visible bins as they are) and     */
+/*           beaming model (graybody or isotropic). ComputeCurve picks the version it */
+/*           needs once, so nothing in the loop over the bins tests the models.       */
+/**************************************************************************************/
+template <class T, unsigned int SPECTRAL, bool GRAYBODY>
+static void BinFlux( LightCurveT<T>& curve, const T& temperature, const T& redshift,
+                     const T& bolo, std::vector< bool >& nullcurve ) {
+
+    const unsigned int numbins( curve.numbins ), numbands( curve.numbands );
+    const double E0( curve.para.E0 ), E1( curve.para.E1 ), E2( curve.para.E2 ),
+                 DeltaE( curve.para.DeltaE ),
+                 E_band_lower_1( curve.para.E_band_lower_1 ), E_band_upper_1( curve.para.E_band_upper_1 ),
+                 E_band_lower_2( curve.para.E_band_lower_2 ), E_band_upper_2( curve.para.E_band_upper_2 );
+    const T z3( pow(redshift,-3) );
+    bool odd( std::isnan(Value(redshift)) || redshift == 0 ); // redshift, or gray or eta of a visible bin, zero or NaN
+
+    for ( unsigned int i(0); i < numbins; i++ ) { // Compute flux for each phase bin
+
+      if ( curve.dOmega_s[i] == 0.0 ) {
+	for ( unsigned int p(0); p < numbands; p++) {
+	  curve.f[p][i] = 0.0;
+	}
+	continue;
+      }
+
+      // the graybody factor, or 1 when isotropic, the same at all angles
+      const T gray( GRAYBODY ? Gray(curve.cosbeta[i]*curve.eta[i]) : T(1.0) );
+      odd |= !(Value(gray) != 0.0) || !(Value(curve.eta[i]) != 0.0);
+
+      if (SPECTRAL == 0){ // Monochromatic Observation of Blackbody
+	/*******************************************************************/
+	/* COMPUTING BLACKBODY LIGHT CURVE FOR MONOCHROMATIC ENERGY, p = 0 */
+	/*      First computes in [erg/(s cm^2 Hz), converts to            */
+	/*		photons/(s cm^2 keV)                               */
+	/*******************************************************************/
+
+	// Moonochromatic light curve in energy flux erg/(s cm^2 Hz)
+	curve.f[0][i] = gray * curve.dOmega_s[i] * pow(curve.eta[i],4) * z3 * BlackBody<T>(temperature,E0*redshift/curve.eta[i]);
+	// Units: erg/(s cm^2 Hz)
+	//Convert to photons/(s cm^2 keV)
+	curve.f[0][i] *= (1.0 / ( E0 * Units::H_PLANCK )); // Units: photons/(s cm^2 keV)
+
+	if (curve.f[0][i] != 0.0) nullcurve[0] = false;
+      }
+
+      if (SPECTRAL == 1){ // Funny Line Emission for NICER
+	for (unsigned int p=0; p<numbands; p++){
+	  double E_obs( E0 + p*DeltaE );
+	  curve.f[p][i] = gray * curve.dOmega_s[i] * pow(curve.eta[i],4) * z3 * LineBandFlux<T>(temperature, (E_obs-0.5*DeltaE)*redshift/curve.eta[i], (E_obs+0.5*DeltaE)*redshift/curve.eta[i], E1, E2); // Units: photon/(s cm^2)
+
+	  if (curve.f[p][i] != 0.0) nullcurve[0] = false;
+	}
+      }
+
+      if (SPECTRAL == 7) { // Not Used Right Now.
+
+	/*******************************************/
+	/* COMPUTING BOLOMETRIC LIGHT CURVE, p = 0 */
+	/* Units: photons/(cm^2 s)                 */
+	/*******************************************/
+
+	// Bolometric Light Curve for photon number flux photons/(cm^2 s)
+	curve.f[0][i] = bolo * gray * curve.dOmega_s[i] * pow(curve.eta[i],4) * z3; // Units: photons/(cm^2 s)
+
+	/***************************************************/
+	/* COMPUTING PHOTON NUMBER FLUX FOR AN ENERGY BAND */
+	/*   	1 < p < NCURVES-1                          */
+	/*      Units: photons/(s cm^2)                    */
+	/***************************************************/
+
+	// First energy band
+	curve.f[NCURVES-2][i] = gray * curve.dOmega_s[i] * pow(curve.eta[i],4) * z3 * EnergyBandFlux<T>(temperature, E_band_lower_1*redshift/curve.eta[i], E_band_upper_1*redshift/curve.eta[i]); // Units: photon/(s cm^2)
+	// Second energy band
+	curve.f[NCURVES-1][i] = gray * curve.dOmega_s[i] * pow(curve.eta[i],4) * z3 * EnergyBandFlux<T>(temperature, E_band_lower_2*redshift/curve.eta[i], E_band_upper_2*redshift/curve.eta[i]); // Units: photon/(s cm^2)
+      }
+
+    } // ending the for(i) loop
+
+    if ( odd ) { // only now say which bins
+      LogCount( EVENT_NAN_FLUX );
+      LOG( LOG_DEBUG, LOG_CURVE, "redshift = " << redshift );
+      for ( unsigned int i(0); i < numbins; i++ ) {
+	if ( curve.dOmega_s[i] == 0.0 ) continue;
+	const T gray( GRAYBODY ? Gray(curve.cosbeta[i]*curve.eta[i]) : T(1.0) );
+	if (std::isnan(Value(gray)) || gray == 0) LOG( LOG_DEBUG, LOG_CURVE, "gray[i="<<i<<"] = " << gray );
+	if (std::isnan(Value(curve.eta[i])) || curve.eta[i] == 0) LOG( LOG_DEBUG, LOG_CURVE, "eta[i="<<i<<"] = " << curve.eta[i] );
+      }
+    }
+}
+
+// BinFlux for the beaming model of the curve, given the spectral model
+template <class T, unsigned int SPECTRAL>
+static void BinFlux( LightCurveT<T>& curve, const T& temperature, const T& redshift,
+                     const T& bolo, std::vector< bool >& nullcurve ) {
+    if ( curve.flags.beaming_model == 1 )
+        BinFlux<T, SPECTRAL, true>( curve, temperature, redshift, bolo, nullcurve );
+    else
+        BinFlux<T, SPECTRAL, false>( curve, temperature, redshift, bolo, nullcurve );
+}
+
 /**************************************************************************************/
 /* ComputeCurve:                                                                      */
 /*              computes the flux of each light curve                                 */
@@ -620,39 +818,37 @@ void Bend ( class LightCurve* incurve,
 /*                computed in the routine/method/function above [radians or unitless] */
 /**************************************************************************************/
 class LightCurve ComputeCurve( class LightCurve* angles ) {
+    class LightCurve curve;
+    curve = (*angles);
+    ComputeCurve( curve );
+    return curve;
+}
+
+template <class T>
+void ComputeCurve( LightCurveT<T>& curve ) {
 	
 	/******************************************/
 	/* VARIABLE DECLARATIONS FOR ComputeCurve */
 	/******************************************/
 	
-    class LightCurve curve;
-
     std::ifstream input;
     std::ofstream output;
     std::ofstream ttt;
 
 
     bool infile_is_set;   // If the user has specified an input file
-    double 
+    T 
            mass,               // Mass of the star, in M_sun
            radius,             // Radius of the star at the spot, in km
       mass_over_r,
            temperature,        // Temperature of the spot, in keV
-      //           E_mono,             // Energy observed, in keV, for each monochromatic energy
-           E_band_lower_1,     // Lower bound of energy band for flux integration, in keV
-           E_band_upper_1,     // Upper bound of energy band for flux integration, in keV
-           E_band_lower_2,     // Lower bound of energy band for flux integration, in keV
-           E_band_upper_2,     // Upper bound of energy band for flux integration, in keV
            redshift,           // Gravitational redshift = 1 + z = (1-2M/R)^{-1/2}
-           bolo,               // Bolometric flux; bolo = sigma T^4/pi
-           gray(1.0);          // Graybody factor (when = 1, not effective)
-        
-    double E0, E1, E2, DeltaE, E_obs;
+           bolo;               // Bolometric flux; bolo = sigma T^4/pi
 
     unsigned int numbins(MAX_NUMBINS);  // Time bins of light curve (usually 128)
     unsigned int numbands(NCURVES);  // Number of Energy Bands
         
-    std::vector< double > totflux(MAX_NUMBINS, 0.0); // integrated flux
+    std::vector< T > totflux(MAX_NUMBINS, 0.0); // integrated flux
 
     std::vector< bool > nullcurve(NCURVES,true); // true means that the curve is zero everywhere
 
@@ -668,7 +864,6 @@ class LightCurve ComputeCurve( class LightCurve* angles ) {
     // One monochromatic energy, hardwired value, in keV
     //    E_mono = 1.0;
 
-    curve = (*angles);
     mass = curve.para.mass;                     // unitless
     radius = curve.para.radius;                 // unitless
     mass_over_r = curve.para.mass_over_r;
@@ -676,14 +871,6 @@ class LightCurve ComputeCurve( class LightCurve* angles ) {
     infile_is_set = curve.flags.infile_is_set;
     numbins = curve.numbins;
     numbands = curve.numbands;
-    E_band_lower_1 = curve.para.E_band_lower_1;     // in keV
-    E_band_upper_1 = curve.para.E_band_upper_1;     // in keV
-    E_band_lower_2 = curve.para.E_band_lower_2;     // in keV
-    E_band_upper_2 = curve.para.E_band_upper_2;     // in keV
-    E0 = curve.para.E0;
-    E1 = curve.para.E1;
-    E2 = curve.para.E2;
-    DeltaE = curve.para.DeltaE;
    
     redshift = 1.0 / sqrt( 1 - 2.0 * mass_over_r);
 
@@ -694,89 +881,13 @@ class LightCurve ComputeCurve( class LightCurve* angles ) {
     // the e9 in the beginning is for changing T^3 from keV to eV
     // 2.404 comes from evaluating Bradt equation 6.17 (modified, for photon number count units), using the Riemann zeta function for z=3
 
-    for ( unsigned int i(0); i < numbins; i++ ) { // Compute flux for each phase bin
-
-      if ( curve.dOmega_s[i] != 0.0 ) {
-	if ( curve.flags.beaming_model == 1 ) {
-	  gray = Gray(curve.cosbeta[i]*curve.eta[i]); // gets the graybody factor
-	}
-	else
-	  gray = 1.0; // Isotropic, the same at all angles
-
-	if (std::isnan(gray) || gray == 0) std::cout << "gray = " << gray << std::endl;
-	if (std::isnan(curve.eta[i]) || curve.eta[i] == 0) std::cout << "eta[i="<<i<<"] = " << curve.eta[i] << std::endl;
-	if (std::isnan(redshift) || redshift == 0) std::cout << "redshift = " << redshift << std::endl;
-
-
-	if (curve.flags.spectral_model == 0){ // Monochromatic Observation of Blackbody
-	/*******************************************************************/
-	/* COMPUTING BLACKBODY LIGHT CURVE FOR MONOCHROMATIC ENERGY, p = 0 */
-	/*      First computes in [erg/(s cm^2 Hz), converts to            */
-	/*		photons/(s cm^2 keV)                               */
-	/*******************************************************************/
-	  //std::cout << "E_obs = " << E0 << std::endl;
-
-	  // Moonochromatic light curve in energy flux erg/(s cm^2 Hz)
-	  curve.f[0][i] = gray * curve.dOmega_s[i] * pow(curve.eta[i],4) * pow(redshift,-3) * BlackBody(temperature,E0*redshift/curve.eta[i]); 
-	  // Units: erg/(s cm^2 Hz)
-	  //Convert to photons/(s cm^2 keV)
-	  curve.f[0][i] *= (1.0 / ( E0 * Units::H_PLANCK )); // Units: photons/(s cm^2 keV)
-
-	  if (curve.f[0][i] != 0.0) nullcurve[0] = false;
-	}
-
-	if (curve.flags.spectral_model == 1){ // Funny Line Emission for NICER
-	  for (unsigned int p=0; p<numbands; p++){
-	    
-	    E_obs = E0 + p*DeltaE;
-	    //curve.f[p][i] = gray * curve.dOmega_s[i] * pow(curve.eta[i],4) * pow(redshift,-3) * Line(temperature,E_obs*redshift/curve.eta[i],E1,E2); 
-	    // Units: erg/(s cm^2 Hz)
-	    //Convert to photons/(s cm^2 keV)
-	    //curve.f[p][i] *= (1.0 / ( E_obs * Units::H_PLANCK )); // Units: photons/(s cm^2 keV)
-	    // Multiply by the width of the energy band;
-	    //curve.f[p][i] *= DeltaE; // Units: photons/(s cm^2)
-
-	    //curve.eta[i] = 1.0;
-
-	    curve.f[p][i] = gray * curve.dOmega_s[i] * pow(curve.eta[i],4) * pow(redshift,-3) * LineBandFlux(temperature, (E_obs-0.5*DeltaE)*redshift/curve.eta[i], (E_obs+0.5*DeltaE)*redshift/curve.eta[i], E1, E2); // Units: photon/(s cm^2)
-
-	    if (curve.f[p][i] != 0.0) nullcurve[0] = false;
-
-	  }
-	}
-
-	if (curve.flags.spectral_model == 7) { // Not Used Right Now.
-			
-	  /*******************************************/
-	  /* COMPUTING BOLOMETRIC LIGHT CURVE, p = 0 */
-	  /* Units: photons/(cm^2 s)                 */
-	  /*******************************************/
-    		
-	  // Bolometric Light Curve for energy flux erg/(cm^2 s)
-	  curve.f[0][i] =  bolo * gray * curve.dOmega_s[i] * pow(curve.eta[i],5) * pow(redshift,-4); // Units: erg/(cm^2 s)
-
-	  // Bolometric Light Curve for photon number flux photons/(cm^2 s)
-	  curve.f[0][i] = bolo * gray * curve.dOmega_s[i] * pow(curve.eta[i],4) * pow(redshift,-3); // Units: photons/(cm^2 s)
-                                     
-	  /***************************************************/
-	  /* COMPUTING PHOTON NUMBER FLUX FOR AN ENERGY BAND */
-	  /*   	1 < p < NCURVES-1                          */
-	  /*      Units: photons/(s cm^2)                    */
-	  /***************************************************/
-    		
-	  // First energy band
-	  curve.f[NCURVES-2][i] = gray * curve.dOmega_s[i] * pow(curve.eta[i],4) * pow(redshift,-3) * EnergyBandFlux(temperature, E_band_lower_1*redshift/curve.eta[i], E_band_upper_1*redshift/curve.eta[i]); // Units: photon/(s cm^2)
-	  // Second energy band
-	  curve.f[NCURVES-1][i] = gray * curve.dOmega_s[i] * pow(curve.eta[i],4) * pow(redshift,-3) * EnergyBandFlux(temperature, E_band_lower_2*redshift/curve.eta[i], E_band_upper_2*redshift/curve.eta[i]); // Units: photon/(s cm^2)
-	}		
-      }
-      else { // if curve.dOmega_s[i] == 0.0
-	for ( unsigned int p(0); p < numbands; p++) {
-	  curve.f[p][i] = 0.0;
-	}
-      }
-
-    } // ending the for(i) loop
+    ProfileTimer timer( STAGE_SPECTRA );
+    switch ( curve.flags.spectral_model ) { // the flux of each phase bin
+        case 0:  BinFlux<T, 0>( curve, temperature, redshift, bolo, nullcurve ); break;
+        case 1:  BinFlux<T, 1>( curve, temperature, redshift, bolo, nullcurve ); break;
+        case 7:  BinFlux<T, 7>( curve, temperature, redshift, bolo, nullcurve ); break;
+        default: BinFlux<T, 2>( curve, temperature, redshift, bolo, nullcurve ); break;
+    }
     
 
 	
@@ -785,6 +896,7 @@ class LightCurve ComputeCurve( class LightCurve* angles ) {
     /* This is where the jumpy problems tend to be.            */
     /***********************************************************/
 
+    timer.Next( STAGE_REBIN );
     curve.flags.ignore_time_delays = false;
     		
     if ( !curve.flags.ignore_time_delays ) { // if we are not ignoring the time delays        
@@ -806,18 +918,18 @@ class LightCurve ComputeCurve( class LightCurve* angles ) {
 	/* MORE DECLARATIONS */
 	/*********************/
     		
-	  std::vector< double > newflux(MAX_NUMBINS, 0.0);                  // rebinned flux (to account for photon travel time)
+	  std::vector< T > newflux(MAX_NUMBINS, 0.0);                  // rebinned flux (to account for photon travel time)
 	  unsigned int imax(0), imin(0);                                    // index of element with maximum flux value, minimum flux value
-	  double max_discrete_flux(0.0), min_discrete_flux(curve.f[p][0]);  // maximum flux value and minimum flux value assigned to a grid point (discrete)
-	  double tx(0), ta(0), tb(0), tc(0);                                // a,b,c: three-point interpolation on a parabola for min and max areas (time a, time b, time c)
-	  double fa(0), fb(0), fc(0);                                       // corresponding fluxes for three-point interpolation
+	  T      max_discrete_flux(0.0), min_discrete_flux(curve.f[p][0]);  // maximum flux value and minimum flux value assigned to a grid point (discrete)
+	  T      tx(0), ta(0), tb(0), tc(0);                                // a,b,c: three-point interpolation on a parabola for min and max areas (time a, time b, time c)
+	  T      fa(0), fb(0), fc(0);                                       // corresponding fluxes for three-point interpolation
 	  int ia(0), ic(0);                                                 // indices in array for where flux is fa, fc
-	  double temporary1(0.0), temporary2(0.0);                          // makes math easier
-	  double maximum(0.0), minimum(100000.0);                           // true (continuous) maximum and minimum flux values
-	  double tmin(0.0);                                                 // value of t at the true minimum
+	  T      temporary1(0.0), temporary2(0.0);                          // makes math easier
+	  T      maximum(0.0), minimum(100000.0);                           // true (continuous) maximum and minimum flux values
+	  T      tmin(0.0);                                                 // value of t at the true minimum
 
 	  int ec1(0), ec2(0),j1,j2;
-	  double te1, te2, tt1, tt2, slope1, slope2;
+	  T      te1, te2, tt1, tt2, slope1, slope2;
 
 	  /**********************************************************/
 	  /* START WITH FINDING THE MAXIMUM FLUX OF THE LIGHT CURVE */
@@ -1054,7 +1166,7 @@ class LightCurve ComputeCurve( class LightCurve* angles ) {
 
 	  // Initializing totflux
 	  for ( unsigned int i(0); i < numbins; i++ )
-	    totflux.at(i) = 0.0;
+	    totflux[i] = 0.0;
 			
 		           		
 	  /**************************************************************/
@@ -1092,21 +1204,21 @@ class LightCurve ComputeCurve( class LightCurve* angles ) {
 		 (imax == 0 && (i <= 1 || i == numbins-1)) || 
 		 (imax == numbins-1 && (i==0 || i >= numbins-2))) { // parabolic interpolation near the maximum
 	      if ( imax == numbins-1 && i == 0 ) {
-		newflux.at(i) = maximum - temporary1 * pow(curve.t[i] + 1.0 - tx,2);  // intermediate value of flux
+		newflux[i] = maximum - temporary1 * pow(curve.t[i] + 1.0 - tx,2);  // intermediate value of flux
 	      }
 	      else {
 		if ( imax == 0 && i == numbins-1 )
-		  newflux.at(i) = maximum - temporary1 * pow(curve.t[i] - 1.0 - tx,2);
+		  newflux[i] = maximum - temporary1 * pow(curve.t[i] - 1.0 - tx,2);
 		else
-		  newflux.at(i) = maximum - temporary1 * pow(curve.t[i] - tx,2);
+		  newflux[i] = maximum - temporary1 * pow(curve.t[i] - tx,2);
 	      }
-	      //std::cout << "MAX i = " << i << " time = " << curve.t[i] << " flux  = " << newflux.at(i) << std::endl;
+	      //std::cout << "MAX i = " << i << " time = " << curve.t[i] << " flux  = " << newflux[i] << std::endl;
 	    }
 	            
 	    // Not near the maximum
 	    else {	            
 	      	     
-		double t1, t2;
+		T t1, t2;
 		// Find point to the left of the "ith" point 
 		// Time delays mean that j isn't always i-1
 
@@ -1166,45 +1278,45 @@ class LightCurve ComputeCurve( class LightCurve* angles ) {
 		  std::cout << "k=" << k << " t_o[k}=" << curve.t_o[k] << " t2 = " << t2 << std::endl;
 		  }*/
 
-		newflux.at(i) = curve.f[p][j] + (curve.f[p][k]-curve.f[p][j])/(t2-t1) * (curve.t[i]-t1); // linear interpolation!
+		newflux[i] = curve.f[p][j] + (curve.f[p][k]-curve.f[p][j])/(t2-t1) * (curve.t[i]-t1); // linear interpolation!
 
 		if (curve.eclipse){
 		  if (curve.t[i] < te1 && curve.t[i] > te1 - 1.0/numbins){
 		    //std::cout << "time just before eclipse at te1=" << te1 <<"! i=" << i << " t = " << curve.t[i] << std::endl;
-		    newflux.at(i) = slope1 * (curve.t[i] - te1);
+		    newflux[i] = slope1 * (curve.t[i] - te1);
 		  }
 		  if (curve.t[i] < te1 + 1.0/numbins && curve.t[i] > te1)
-		    newflux.at(i) = 0.0;
+		    newflux[i] = 0.0;
 
 		  if (curve.t[i] > te2 && curve.t[i] < te2 + 1.0/numbins){
 		    // std::cout << "eclipse ends at te2=" << te2 <<"! i=" << i << " t = " << curve.t[i] << std::endl;
-		    newflux.at(i) = slope2 * (curve.t[i] - te2);
+		    newflux[i] = slope2 * (curve.t[i] - te2);
 		  }
 
 		  if (curve.t[i] > te1 && curve.t[i] < te2)
-		    newflux.at(i) = 0.0;
+		    newflux[i] = 0.0;
 		}
 
 		if (minimum != 0.0)
-		  if ( fabs(newflux.at(i) - minimum)/minimum <= 0.000001) {
+		  if ( fabs(newflux[i] - minimum)/minimum <= 0.000001) {
 
 		    //std::cout << "near minimum!!!! " << std::endl;
 		    if ( i == numbins-1 ) 
-		      newflux.at(i) = minimum - temporary2 * pow(curve.t[i] - 1 - tmin,2); 
+		      newflux[i] = minimum - temporary2 * pow(curve.t[i] - 1 - tmin,2); 
 		    else {
-		      newflux.at(i) = minimum - temporary2 * pow(curve.t[i] - tmin,2);
+		      newflux[i] = minimum - temporary2 * pow(curve.t[i] - tmin,2);
 		    }
-		    //std::cout << "MIN i = " << i << " time = " << curve.t[i] << " flux  = " << newflux.at(i) << std::endl;
+		    //std::cout << "MIN i = " << i << " time = " << curve.t[i] << " flux  = " << newflux[i] << std::endl;
 
 
 
 		  }
 
 		//std::cout << "i = " << i << " j = " << j << " k = " << k 
-		//	  << "t=" << curve.t[i] << " f=" << newflux.at(i) 
+		//	  << "t=" << curve.t[i] << " f=" << newflux[i] 
 		//	  <<std::endl;
 		//else
-		//newflux.at(i) = curve.f[p][i];
+		//newflux[i] = curve.f[p][i];
 
 		// }// end else-not-near the minimum
 	    }
@@ -1212,8 +1324,8 @@ class LightCurve ComputeCurve( class LightCurve* angles ) {
 	    /* newflux vs t_e corresponds to the new re-binned light curve.
 	       It corresponds to the same light curve as bolflux vs t_o */
 	    
-	    if ( newflux.at(i) < 0.0 )
-	      newflux.at(i) = 0.0;
+	    if ( newflux[i] < 0.0 )
+	      newflux[i] = 0.0;
 	  
 	  } // closes the for(i) loop, going through the curves.
     	
@@ -1222,26 +1334,24 @@ class LightCurve ComputeCurve( class LightCurve* angles ) {
 	  /****************************************************************/
     	
 	  for ( unsigned int i(0); i < numbins; i++ ) {
-            totflux.at(i) += newflux.at(i);   // setting totflux = newflux
+            totflux[i] += newflux[i];   // setting totflux = newflux
 	  }
 	  //if (p==0)
 	  //ttt.open("time.txt", std::ios_base::trunc);
 
 	  for ( unsigned int i(0); i < numbins; i++ ) {
 	    /*if ( p==0 ) 
-	      ttt << curve.t_o[i] << " " << curve.f[p][i] << " " << curve.t[i] << " " << totflux.at(i) 
+	      ttt << curve.t_o[i] << " " << curve.f[p][i] << " " << curve.t[i] << " " << totflux[i] 
 	    	  << " " << i
 	    	  << std::endl;*/
 	    
-            curve.f[p][i] = totflux.at(i);
+            curve.f[p][i] = totflux[i];
 	  }
 	  // only plotting versus evenly spaced time -- not using t_o
 	}
       }// end for-p-loop
     } // end time delay section
     
-    return curve;
-
 } // end ComputeCurve
 
 
@@ -1253,9 +1363,16 @@ class LightCurve ComputeCurve( class LightCurve* angles ) {
 /*                computed in the routine/method/function above [radians or unitless] */
 /**************************************************************************************/
 class LightCurve ShiftCurve( class LightCurve* angles, double phishift) {
-		
     class LightCurve curve;
+    curve = (*angles);
+    ShiftCurve( curve, phishift );
+    return curve;
+}
 
+template <class T>
+void ShiftCurve( LightCurveT<T>& curve, const T& phishift ) {
+		
+    ProfileTimer timer( STAGE_SHIFT );
     std::ifstream input;
     std::ofstream output;
     std::ofstream ttt;
@@ -1263,16 +1380,15 @@ class LightCurve ShiftCurve( class LightCurve* angles, double phishift) {
     unsigned int numbins(MAX_NUMBINS);  // Time bins of light curve (usually 128)
     unsigned int numbands(NCURVES);  // Number of Energy Bands
         
-    std::vector< double > totflux(MAX_NUMBINS, 0.0); // integrated flux
+    std::vector< T > totflux(MAX_NUMBINS, 0.0); // integrated flux
     std::vector< bool > nullcurve(NCURVES,false); // true means that the curve is zero everywhere
 
-    double timeshift;
+    T timeshift;
 
     /*********************/
     /* SETTING THINGS UP */
     /*********************/
 
-    curve = (*angles);
     numbins = curve.numbins;
     numbands = curve.numbands;
 
@@ -1298,11 +1414,12 @@ class LightCurve ShiftCurve( class LightCurve* angles, double phishift) {
 	/* MORE DECLARATIONS */
 	/*********************/
     		
-	  std::vector< double > newflux(MAX_NUMBINS, 0.0);                  // rebinned flux (to account for photon travel time)
-	  double minimum(100000.0);                           // true (continuous) maximum and minimum flux values
+	  std::vector< T > newflux(MAX_NUMBINS, 0.0);                       // rebinned flux (to account for photon travel time)
+	  T minimum(100000.0);                                // true (continuous) maximum and minimum flux values
 	 
 	  int ec1(0), ec2(0),j1,j2;
-	  double te1, te2, tt1, tt2, slope1, slope2;
+	  T te1, te2, slope1, slope2;
+	  double tt1, tt2;
 
   	                   
 	  /*******************************************/
@@ -1387,23 +1504,23 @@ class LightCurve ShiftCurve( class LightCurve* angles, double phishift) {
 		  k = i;
 		  t2 = curve.t[k]; // time to the right of the point we're interested in
 		}
-		newflux.at(i) = curve.f[p][k] - (curve.f[p][k]-curve.f[p][j])/(t2-t1) * (timeshift); // linear interpolation!
+		newflux[i] = curve.f[p][k] - (curve.f[p][k]-curve.f[p][j])/(t2-t1) * (timeshift); // linear interpolation!
 
 		if (curve.eclipse){
 		  if (curve.t[i] < te1 && curve.t[i] > te1 - 1.0/numbins){
 		    //std::cout << "time just before eclipse at te1=" << te1 <<"! i=" << i << " t = " << curve.t[i] << std::endl;
-		    newflux.at(i) = -slope1 * (timeshift) + curve.f[p][k];
+		    newflux[i] = -slope1 * (timeshift) + curve.f[p][k];
 		  }
 		  if (curve.t[i] < te1 + 1.0/numbins && curve.t[i] > te1)
-		    newflux.at(i) = 0.0;
+		    newflux[i] = 0.0;
 
 		  if (curve.t[i] > te2 && curve.t[i] < te2 + 1.0/numbins){
 		    // std::cout << "eclipse ends at te2=" << te2 <<"! i=" << i << " t = " << curve.t[i] << std::endl;
-		    newflux.at(i) = -slope2 * (timeshift) + curve.f[p][k];
+		    newflux[i] = -slope2 * (timeshift) + curve.f[p][k];
 		  }
 
 		  if (curve.t[i] > te1 && curve.t[i] < te2)
-		    newflux.at(i) = 0.0;
+		    newflux[i] = 0.0;
 		}
 
 		
@@ -1412,8 +1529,8 @@ class LightCurve ShiftCurve( class LightCurve* angles, double phishift) {
 		/* newflux vs t corresponds to the new shifted light curve.
 		   It corresponds to the old curve is curve.f */
 	    
-		if ( newflux.at(i) < 0.0 )
-		  newflux.at(i) = 0.0;
+		if ( newflux[i] < 0.0 )
+		  newflux[i] = 0.0;
 	  
 	  } // closes the for(i) loop, going through the curves.
     	
@@ -1423,11 +1540,11 @@ class LightCurve ShiftCurve( class LightCurve* angles, double phishift) {
 
 	  for ( unsigned int i(0); i < numbins; i++ ) {
 	    /*if ( p==0 ) 
-	      ttt << curve.t[i] << " " << curve.f[p][i] << " " << curve.t[i] << " " << newflux.at(i) 
+	      ttt << curve.t[i] << " " << curve.f[p][i] << " " << curve.t[i] << " " << newflux[i] 
 	    	  << " " << i
 	    	  << std::endl;
 	    */
-            curve.f[p][i] = newflux.at(i);
+            curve.f[p][i] = newflux[i];
 	  }
 	 
 
@@ -1435,7 +1552,7 @@ class LightCurve ShiftCurve( class LightCurve* angles, double phishift) {
     }// end for-p-loop
    
     
-    return curve;
+
 
 } // end ShiftCurve
 
@@ -1519,86 +1636,309 @@ class LightCurve Normalize2( double Flux[NCURVES][MAX_NUMBINS], unsigned int num
 
 
 #define TINY 1.0e-10
-#define NMAX 300
+#define NMAX 3000   // maximum number of chi^2 evaluations in a fit
 #define SWAP(a,b) {swap=(a);(a)=(b);(b)=swap;}
-#define NDIM 5
-#define MPTS 6
 
 /**************************************************************************************/
-/* recalc: 																			  */
-/*        this does not get called in Spot.cpp										  */
-/*																					  */
-/* pass: curve = flux in the light curve?                                             */
-/*       omega = spin frequency of the NS [unitless]                                  */
-/*       mass = mass of the NS [unitless]                                             */
-/*       theta_0 = angle from spin axis to center of spot bit [radians]               */
-/*       rspot = radius of the NS at the spot [unitless]                              */
+/* ParameterViolation:                                                                */
+/*           how far a full parameter vector (units as on the command line) is from   */
+/*           being physical: one for each broken constraint, plus how far outside it  */
+/*           is (relative to the size of the range). Zero if physical.                */
 /**************************************************************************************/
-class OblDeflectionTOA* recalc( class LightCurve* curve, double omega, double mass, 
-                                double theta_0, double rspot ) {
+double ParameterViolation( const double x[NDIM] ) {
+
+    double mass( x[0] ), req( x[1] ), incl( x[2] ), theta( x[3] ), rho( x[4] ), temperature( x[5] ),
+           violation(0.0);
+
+    if ( mass <= 0.0 ) 
+        violation += 1.0 - mass;
+    if ( req <= 0.0 ) 
+        violation += 1.0 - req;
+    else if ( mass/req * Units::GMC2 >= 1.0/3.0 ) // photon sphere outside the star
+        violation += 1.0 + 3.0 * mass/req * Units::GMC2 - 1.0;
+    if ( incl < 0.0 || incl > 180.0 ) 
+        violation += 1.0 + ( incl < 0.0 ? -incl : incl - 180.0 ) / 180.0;
+    if ( theta <= 0.0 || theta > 180.0 ) 
+        violation += 1.0 + ( theta <= 0.0 ? -theta : theta - 180.0 ) / 180.0;
+    if ( rho < 0.0 || rho > Units::PI/2.0 ) 
+        violation += 1.0 + ( rho < 0.0 ? -rho : rho - Units::PI/2.0 ) / (Units::PI/2.0);
+    if ( temperature < 0.0 ) 
+        violation += 1.0 - temperature;
+
+    return violation;
+}
 
-    /************************************/
-   	/* VARIABLE DECLARATIONS FOR recalc */
-    /************************************/
-    
-    double mu,        // = cos(theta_0), unitless
-	       cosgamma,  // Cos of the angle between the radial vector and surface normal vector, defined in MLCB13
-	       req,       // Radius of the neutron star at the equator, in km (but maybe unitless here)
-	       zeta,      // Defined in MLCB9
-	       epsilon,   // Doppler boost factor, defined in MLCB33
-	       P2,        // Legendre polynomial
-	       P4,        // Legendre polynomial
-	       b0,        // Coefficient in MLCB Table 1
-	       b2,        // Coefficient in MLCB Table 1
-	       b4,        // Coefficient in MLCB Table 1
-	       c2,        // Coefficient in MLCB Table 1
-	       c4;        // Coefficient in MLCB Table 1
-    
-    double mass_over_r;
-	           
-	//G = 1.32746E+11;
-	mu = cos( theta_0 );
-	//    pi = 4.0 * atan(1.0);
-	zeta = mass / rspot; // Since G = c = 1, with mass in gravitational units
-    epsilon = pow( rspot * omega, 2.0 ) / zeta;
+/**************************************************************************************/
+/* LoadFitParameters:                                                                 */
+/*           converts a full parameter vector (units as on the command line) into     */
+/*           the unitless values in curve->para. Returns false if unphysical.         */
+/**************************************************************************************/
+bool LoadFitParameters( class LightCurve* curve, const double x[NDIM] ) {
+
+    double mass( x[0] ), req( x[1] ), incl( x[2] ), theta( x[3] ), rho( x[4] ), temperature( x[5] );
+
+    if ( ParameterViolation( x ) > 0.0 )
+        return false;
+
+    curve->para.mass_over_r = mass/req * Units::GMC2;
+    curve->para.mass = Units::cgs_to_nounits( mass*Units::MSUN, Units::MASS );
+    curve->para.req = Units::cgs_to_nounits( req*1.0e5, Units::LENGTH );
+    curve->para.radius = curve->para.req;
+    curve->para.incl = incl * Units::PI/180.0;
+    if ( curve->flags.only_second_spot ) curve->para.incl = Units::PI - curve->para.incl;
+    curve->para.theta = theta * Units::PI/180.0;
+    curve->para.rho = rho;
+    curve->para.temperature = temperature;
+    curve->para.ts = x[6];
+    return true;
+}
 
-    b0 = 0.18*epsilon - 0.23*zeta*epsilon + 0.18*pow( epsilon, 2 );
-    b2 = 0.39*epsilon - 0.29*zeta*epsilon + 0.42*pow( epsilon, 2 );
-    b4 = -0.04*epsilon + 0.15*zeta*epsilon - 0.13*pow(epsilon, 2);
-    //b4 = -8.0/3.0 * (b0 - 0.5*b2);
+/**************************************************************************************/
+/* recalc:                                                                            */
+/*        returns look-up tables good for the star in curve. The tables passed in     */
+/*        are reused if they were built for the same star; otherwise they are         */
+/*        deleted and new ones built, so nothing is leaked from one call to the next. */
+/*                                                                                    */
+/* pass: curve = para.mass, req, mass_over_r, omega, theta and flags.NS_model         */
+/*       tables = tables from the last call, or 0                                     */
+/**************************************************************************************/
+class DeflTables* recalc( class LightCurve* curve, class DeflTables* tables ) {
 
-    c2 = 0.60 * pow( epsilon, 2 );
-    c4 = -0.12 * pow( epsilon, 2 );
+    if ( tables && tables->Matches( curve ) )
+        return tables;
 
-    P2 = LegP2( mu );
-    P4 = LegP4( mu );
+    delete tables;
+    return new DeflTables( curve );
 
-    req = rspot * (1.0 + b0 + b2*P2 + b4*P4 + P2*(c2*P2 + c4*P4));
-	/*
-	std::cout << "recalc: theta_0 = " << theta_0*180.0/Units::PI;
-    std::cout << "rspot_recalc = " << rspot <<std::endl;
-    std::cout << "req_recalc = " << req << std::endl;
-    */
-    OblModelBase* model;
-    model = new PolyOblModelNHQS( rspot, req,
-				PolyOblModelBase::zetaparam(mass,req),
-				PolyOblModelBase::epsparam(omega, mass, req)
-				);
-
-    cosgamma = model->cos_gamma( mu );
-    curve->para.cosgamma = cosgamma;
-    // defltoa is a structure that "points" to routines in the file "OblDeflectionTOA.cpp"
-    // used to compute deflection angles and times of arrivals 
-    
-    class OblDeflectionTOA* dt;
+} // end recalc
 
-    mass_over_r = mass/rspot;
+/**************************************************************************************/
+/* amotry:                                                                            */
+/*        extrapolates by a factor fac through the face of the simplex across from    */
+/*        the high point, and replaces the high point if the new point is better.     */
+/*        (Numerical Recipes 10.4)                                                    */
+/**************************************************************************************/
+double amotry( double p[][NDIM], double y[], double psum[], unsigned int ndim, 
+               int ihi, double fac, class FitContext* fit ) {
+
+    double fac1, fac2, ytry, ptry[NDIM] = {};
+
+    fac1 = (1.0 - fac)/ndim;
+    fac2 = fac1 - fac;
+    for ( unsigned int j(0); j < ndim; j++ ) ptry[j] = psum[j]*fac1 - p[ihi][j]*fac2;
+    ytry = fit->Evaluate( ptry, 0 );
+    if ( ytry < y[ihi] ) {
+        y[ihi] = ytry;
+        for ( unsigned int j(0); j < ndim; j++ ) {
+            psum[j] += ptry[j] - p[ihi][j];
+            p[ihi][j] = ptry[j];
+        }
+    }
+    return ytry;
 
-    dt = new OblDeflectionTOA( model, mass, mass_over_r, rspot );
+} // end amotry
 
-    return (dt);
+/**************************************************************************************/
+/* amoeba:                                                                            */
+/*        downhill simplex minimization of chi^2 (Numerical Recipes 10.4).            */
+/*                                                                                    */
+/*        With four or more threads the reflected, expanded and both contracted      */
+/*        trial points of a step are computed at the same time; the simplex then      */
+/*        moves exactly as it would computing them one at a time with amotry.         */
+/*        The points of a shrink are always computed in parallel.                     */
+/*                                                                                    */
+/* pass: p = ndim+1 starting points (rows); y = chi^2 at each                         */
+/*       chi_store, x_store = best chi^2 and point after each step (k_value steps)    */
+/* returns: true if it converged to ftol, false if it stopped after NMAX evaluations  */
+/**************************************************************************************/
+bool amoeba( double p[][NDIM], double y[], unsigned int ndim, double ftol, int *nfunk, 
+             class FitContext* fit, double chi_store[], double x_store[][NDIM], int *k_value ) {
+
+    unsigned int mpts( ndim+1 );
+    int ihi, ilo, inhi;
+    double rtol, swap, ysave, ytry, psum[NDIM];
+    bool speculate( fit->pool->size() >= 4 ), shrink;
+
+    *nfunk = 0;
+    *k_value = 0;
+    for ( unsigned int j(0); j < ndim; j++ ) {
+        double sum(0.0);
+        for ( unsigned int i(0); i < mpts; i++ ) sum += p[i][j];
+        psum[j] = sum;
+    }
 
-} // end recalc
+    for (;;) {
+        ilo = 0;
+        ihi = y[0] > y[1] ? (inhi=1, 0) : (inhi=0, 1);
+        for ( unsigned int i(0); i < mpts; i++ ) {
+            if ( y[i] <= y[ilo] ) ilo = i;
+            if ( y[i] > y[ihi] ) {
+                inhi = ihi;
+                ihi = i;
+            } 
+            else if ( y[i] > y[inhi] && static_cast<int>(i) != ihi ) inhi = i;
+        }
+
+        if ( *k_value < NMAX ) {
+            chi_store[*k_value] = y[ilo];
+            for ( unsigned int j(0); j < ndim; j++ ) x_store[*k_value][j] = p[ilo][j];
+            (*k_value)++;
+        }
+
+        rtol = 2.0*fabs(y[ihi]-y[ilo])/(fabs(y[ihi])+fabs(y[ilo])+TINY);
+        if ( rtol < ftol || *nfunk >= NMAX ) {
+            SWAP(y[0],y[ilo])
+            for ( unsigned int j(0); j < ndim; j++ ) SWAP(p[0][j],p[ilo][j])
+            if ( rtol < ftol ) return true;
+            LOG( LOG_WARNING, LOG_FIT, "amoeba: stopped after " << *nfunk << " evaluations (NMAX) without converging; "
+                 "chi^2 = " << y[0] << ", relative spread of the simplex " << rtol << ", not below ftol = " << ftol );
+            return false;
+        }
+
+        shrink = false;
+        if ( speculate ) {
+            // Trial points c + fac*(p[ihi] - c), c = centroid of the other points:
+            // reflection, expansion, outside and inside contraction.
+            const double facs[4] = { -1.0, -2.0, -0.5, 0.5 };
+            double ptry[4][NDIM], ytrys[4];
+            for ( unsigned int t(0); t < 4; t++ ) 
+                for ( unsigned int j(0); j < ndim; j++ ) {
+                    double c = (psum[j] - p[ihi][j])/ndim;
+                    ptry[t][j] = c + facs[t]*(p[ihi][j] - c);
+                }
+            fit->pool->Run( 4, [&]( unsigned int t, unsigned int thread ) {
+                ytrys[t] = fit->Evaluate( ptry[t], thread );
+            } );
+            *nfunk += 4;
+
+            // Same decisions as the serial version below; take = trial point replacing ihi
+            int take(-1);
+            ytry = ytrys[0];
+            if ( ytry < y[ihi] ) take = 0;
+            if ( ytry <= y[ilo] ) {
+                if ( ytrys[1] < ytry ) take = 1;
+            }
+            else if ( ytry >= y[inhi] ) {
+                ysave = ( take == 0 ? ytry : y[ihi] );
+                unsigned int t( take == 0 ? 2 : 3 ); // contract from the reflected point if it was taken
+                if ( ytrys[t] < ysave ) take = t;
+                if ( ytrys[t] >= ysave ) shrink = true;
+            }
+            if ( take >= 0 ) {
+                y[ihi] = ytrys[take];
+                for ( unsigned int j(0); j < ndim; j++ ) {
+                    psum[j] += ptry[take][j] - p[ihi][j];
+                    p[ihi][j] = ptry[take][j];
+                }
+            }
+        }
+        else {
+            *nfunk += 2;
+            ytry = amotry( p, y, psum, ndim, ihi, -1.0, fit );
+            if ( ytry <= y[ilo] )
+                ytry = amotry( p, y, psum, ndim, ihi, 2.0, fit );
+            else if ( ytry >= y[inhi] ) {
+                ysave = y[ihi];
+                ytry = amotry( p, y, psum, ndim, ihi, 0.5, fit );
+                if ( ytry >= ysave ) shrink = true;
+            } 
+            else 
+                --(*nfunk);
+        }
+
+        if ( shrink ) { // contract the whole simplex around the lowest point
+            for ( unsigned int i(0); i < mpts; i++ )
+                if ( static_cast<int>(i) != ilo )
+                    for ( unsigned int j(0); j < ndim; j++ )
+                        p[i][j] = 0.5*(p[i][j]+p[ilo][j]);
+            fit->pool->Run( mpts, [&]( unsigned int i, unsigned int thread ) {
+                if ( static_cast<int>(i) != ilo ) y[i] = fit->Evaluate( p[i], thread );
+            } );
+            *nfunk += ndim;
+            for ( unsigned int j(0); j < ndim; j++ ) {
+                double sum(0.0);
+                for ( unsigned int i(0); i < mpts; i++ ) sum += p[i][j];
+                psum[j] = sum;
+            }
+        }
+    }
+
+} // end amoeba
+
+/**************************************************************************************/
+/* FitCurve:                                                                          */
+/*          fits the light curve to the data in obsdata by minimizing chi^2 over the  */
+/*          parameters with vary[k] set, using numthreads threads.                    */
+/*          The history of the fit is written to log_file (if not empty) as           */
+/*          binary records; see the comment at the end of this function.              */
+/*                                                                                    */
+/* pass: curve = the light curve set up as for a single run of Spot                   */
+/*       x = starting point (M [Msun], R_eq [km], incl [deg], theta [deg], rho [rad], */
+/*           T [keV], ts); the best fit is returned in x                              */
+/*       step = size of the starting simplex in each parameter                        */
+/*       converged = set to false if the fit stopped after NMAX evaluations (if not 0) */
+/* returns: the smallest chi^2 found                                                  */
+/**************************************************************************************/
+double FitCurve( class LightCurve* curve, class DataStruct* obsdata, double x[NDIM],
+                 const double step[NDIM], const bool vary[NDIM], double ftol, 
+                 unsigned int numthreads, const char* log_file, bool* converged ) {
+
+    class ThreadPool pool( numthreads );
+    class FitContext fit( curve, obsdata, &pool, x, vary );
+    double p[MPTS][NDIM], y[MPTS];
+    std::vector< double > chi_store( NMAX ), x_store( NMAX * NDIM ); // best point of each step
+    double (*x_steps)[NDIM]( reinterpret_cast< double (*)[NDIM] >( &x_store[0] ) );
+    int nfunk(0), k_value(0);
+    unsigned int ndim( fit.ndim );
+
+    if ( ndim == 0 )
+        throw( Exception(" FitCurve: no parameters to vary. Exiting.\n") );
+
+    // Starting simplex: the starting point plus one step along each varied parameter
+    for ( unsigned int i(0); i < ndim+1; i++ ) 
+        for ( unsigned int j(0); j < ndim; j++ ) 
+            p[i][j] = x[fit.index[j]] + ( i == j+1 ? step[fit.index[j]] : 0.0 );
+    pool.Run( ndim+1, [&]( unsigned int i, unsigned int thread ) {
+        y[i] = fit.Evaluate( p[i], thread );
+    } );
+
+    bool done( amoeba( p, y, ndim, ftol, &nfunk, &fit, &chi_store[0], x_steps, &k_value ) );
+    if ( converged ) *converged = done;
+
+    for ( unsigned int j(0); j < ndim; j++ ) x[fit.index[j]] = p[0][j];
+
+    std::cout << "FitCurve: chi^2 = " << y[0] << " after " << nfunk + ndim + 1 
+              << " evaluations, " << k_value << " steps; look-up tables changed " 
+              << fit.Rebuilt() << " times on " << pool.size() << " threads"
+              << ( done ? "." : "; NOT CONVERGED (NMAX evaluations)." ) << std::endl;
+
+    // Binary log of the fit. Header: "SPOTFIT1", then int32 NDIM, int32 number of
+    // records, int32 vary[NDIM]. Each record: int32 step, double chi^2, double x[NDIM]
+    // (all NDIM parameters, in the units of x).
+    if ( log_file && log_file[0] != '\0' ) {
+        std::ofstream log( log_file, std::ios::binary | std::ios::trunc );
+        if ( !log )
+            throw( Exception(" FitCurve: couldn't open the fit log file. Exiting.\n") );
+        int n( NDIM );
+        log.write( "SPOTFIT1", 8 );
+        log.write( reinterpret_cast<const char*>(&n), sizeof(n) );
+        log.write( reinterpret_cast<const char*>(&k_value), sizeof(k_value) );
+        for ( unsigned int k(0); k < NDIM; k++ ) {
+            int v( vary[k] ? 1 : 0 );
+            log.write( reinterpret_cast<const char*>(&v), sizeof(v) );
+        }
+        for ( int s(0); s < k_value; s++ ) {
+            double full[NDIM];
+            fit.Expand( x_steps[s], full );
+            log.write( reinterpret_cast<const char*>(&s), sizeof(s) );
+            log.write( reinterpret_cast<const char*>(&chi_store[s]), sizeof(double) );
+            log.write( reinterpret_cast<const char*>(full), sizeof(full) );
+        }
+    }
+
+    return y[0];
+
+} // end FitCurve
 
 /**************************************************************************************/
 /* Blackbody:                                                                         */
@@ -1607,7 +1947,8 @@ class OblDeflectionTOA* recalc( class LightCurve* curve, double omega, double ma
 /* pass: T = the temperature of the hot spot, in keV                                  */
 /*       E = monochromatic energy in keV * redshift / eta                             */
 /**************************************************************************************/
-double BlackBody( double T, double E ) {   // Blackbody flux in units of erg/cm^2
+template <class Real>
+Real BlackBody( Real T, Real E ) {   // Blackbody flux in units of erg/cm^2
     return ( 2.0e9 / pow(Units::C * Units::H_PLANCK, 2) * pow(E * Units::EV, 3) / (exp(E/T) - 1) ); // shouldn't it have a pi?
     // the e9 is to switch E from keV to eV; Units::EV gets it from eV to erg, since it's first computed in erg units.
     // the switch from erg units to photon count units happens above just after this is called.
@@ -1633,6 +1974,25 @@ double Line( double T, double E , double E1, double E2) {   // Blackbody flux in
    
 } // end line
 
+#define BRADT_MAX_STEPS 12000 // ENERGY_BAND_STEPS * SPECTRAL_MAX_SCALE
+
+static double spectral_scale( 1.0 ); // set by SetSpectralSteps
+
+// The steps of a band integral with n built in
+static unsigned int BandSteps( unsigned int n ) {
+    return std::min( BRADT_MAX_STEPS, std::max( 8, static_cast<int>( lround( n * spectral_scale ) ) ) );
+}
+
+void SetSpectralSteps( double scale ) {
+    if ( !( scale > 0.0 && scale <= SPECTRAL_MAX_SCALE ) )
+        throw( Exception(" The steps of the band integrals can be scaled by more than 0, up to 4. Exiting.\n") );
+    spectral_scale = scale;
+}
+
+double SpectralSteps() {
+    return spectral_scale;
+}
+
 /**************************************************************************************/
 /* EnergyBandFlux:                                                                    */
 /*                computes the blackbody flux in units of erg/cm^2 using trapezoidal  */
@@ -1646,7 +2006,8 @@ double Line( double T, double E , double E1, double E2) {   // Blackbody flux in
 /*       L1 = lower limit of emitted energy in star's frame                           */
 /*       L2 = lower limit of emitted energy in star's frame                           */
 /**************************************************************************************/
-double LineBandFlux( double T, double E1, double E2, double L1, double L2 ) {
+template <class Real>
+Real LineBandFlux( Real T, Real E1, Real E2, double L1, double L2 ) {
   T *= 1e3; // from keV to eV
   // x = E / T
   E1 *= 1e3; // from keV to eV
@@ -1659,14 +2020,14 @@ double LineBandFlux( double T, double E1, double E2, double L1, double L2 ) {
   /********************************************/
 	
 	// a, b, x, n, h as defined by Mathematical Handbook eqn 15.16 (Trapezoidal rule to approximate definite integrals)
-	double a = E1 / T;          // lower bound of integration
-	double b = E2 / T;          // upper bound of integration
-	double current_x(0.0);      // current value of x, at which we are evaluating the integrand; x = E / T; unitless
+	Real a = E1 / T;          // lower bound of integration
+	Real b = E2 / T;          // upper bound of integration
+	Real current_x(0.0);      // current value of x, at which we are evaluating the integrand; x = E / T; unitless
 	unsigned int current_n(0);  // current step
-	unsigned int n_steps(400); // total number of steps
-	double h = (b - a) / n_steps;     // step amount for numerical integration; the size of each step
-	double integral_constants = 2.0 * pow(T*Units::EV,3) / pow(Units::C,2) / pow(Units::H_PLANCK,3); // what comes before the integral when calculating flux using Bradt eqn 6.6 (in units of photons/cm^2/s)
-	double flux(0.0);           // the resultant energy flux density; Bradt eqn 6.17
+	unsigned int n_steps( BandSteps(LINE_BAND_STEPS) ); // total number of steps
+	Real h = (b - a) / n_steps;     // step amount for numerical integration; the size of each step
+	Real integral_constants = 2.0 * pow(T*Units::EV,3) / pow(Units::C,2) / pow(Units::H_PLANCK,3); // what comes before the integral when calculating flux using Bradt eqn 6.6 (in units of photons/cm^2/s)
+	Real flux(0.0);           // the resultant energy flux density; Bradt eqn 6.17
 	
 	// begin trapezoidal rule
 	current_x = a + h * current_n;
@@ -1702,7 +2063,8 @@ double LineBandFlux( double T, double E1, double E2, double L1, double L2 ) {
 /*       E1 = lower bound of energy band in keV * redshift / eta                      */
 /*       E2 = upper bound of energy band in keV * redshift / eta                      */
 /**************************************************************************************/
-double EnergyBandFlux( double T, double E1, double E2 ) {
+template <class Real>
+Real EnergyBandFlux( Real T, Real E1, Real E2 ) {
 	T *= 1e3; // from keV to eV
 	// x = E / T
 	E1 *= 1e3; // from keV to eV
@@ -1713,14 +2075,14 @@ double EnergyBandFlux( double T, double E1, double E2 ) {
     /********************************************/
 	
 	// a, b, x, n, h as defined by Mathematical Handbook eqn 15.16 (Trapezoidal rule to approximate definite integrals)
-	double a = E1 / T;          // lower bound of integration
-	double b = E2 / T;          // upper bound of integration
-	double current_x(0.0);      // current value of x, at which we are evaluating the integrand; x = E / T; unitless
+	Real a = E1 / T;          // lower bound of integration
+	Real b = E2 / T;          // upper bound of integration
+	Real current_x(0.0);      // current value of x, at which we are evaluating the integrand; x = E / T; unitless
 	unsigned int current_n(0);  // current step
-	unsigned int n_steps(3000); // total number of steps
-	double h = (b - a) / n_steps;     // step amount for numerical integration; the size of each step
-	double integral_constants = 2.0 * pow(T*Units::EV,3) / pow(Units::C,2) / pow(Units::H_PLANCK,3); // what comes before the integral when calculating flux using Bradt eqn 6.6 (in units of photons/cm^2/s)
-	double flux(0.0);           // the resultant energy flux density; Bradt eqn 6.17
+	unsigned int n_steps( BandSteps(ENERGY_BAND_STEPS) ); // total number of steps
+	Real h = (b - a) / n_steps;     // step amount for numerical integration; the size of each step
+	Real integral_constants = 2.0 * pow(T*Units::EV,3) / pow(Units::C,2) / pow(Units::H_PLANCK,3); // what comes before the integral when calculating flux using Bradt eqn 6.6 (in units of photons/cm^2/s)
+	Real flux(0.0);           // the resultant energy flux density; Bradt eqn 6.17
 	
 	// begin trapezoidal rule
 	current_x = a + h * current_n;
@@ -1742,6 +2104,87 @@ double EnergyBandFlux( double T, double E1, double E2 ) {
 	return flux;
 } // end EnergyBandFlux
 
+/**************************************************************************************/
+/* BradtTrapezoid:                                                                    */
+/*                the trapezoidal sum of Bradt_flux_integrand in single precision,    */
+/*                over the same points x = a + n h, n = 0 ... n_steps-1, as the       */
+/*                double routines above, counting only lo <= x <= hi. Not yet         */
+/*                multiplied by h/2.                                                  */
+/*                                                                                    */
+/*                The loops have no branches, so the compiler can use the float SIMD  */
+/*                registers. exp(x) is carried along by multiplying by               */
+/*                exp(BRADT_LANES h) rather than worked out at every point, and       */
+/*                computed afresh every BRADT_RESEED points so the rounding does not  */
+/*                build up.                                                           */
+/**************************************************************************************/
+#define BRADT_LANES 8
+#define BRADT_RESEED 256
+
+static float BradtTrapezoid( double a, double h, unsigned int n_steps, double lo, double hi ) {
+    float g[BRADT_MAX_STEPS],                 // exp(x), then the integrand
+          partial[BRADT_LANES] = { 0.0f };
+    float step( std::exp( BRADT_LANES * h ) ), af( a ), hf( h );
+    int n( n_steps ), first(0), last( n_steps - 1 );
+    double total(0.0);
+
+    if ( n_steps > BRADT_MAX_STEPS )
+        throw( Exception(" BradtTrapezoid: too many steps. Exiting.\n") );
+
+    // x grows with n, so the points in [lo, hi] are n = first ... last; found in double,
+    // as in LineBandFlux, so the same points are counted
+    while ( first < n && a + h * first < lo ) first++;
+    while ( last >= first && a + h * last > hi ) last--;
+
+    for ( int c( first ); c <= last; c += BRADT_RESEED ) {
+        int end( c + BRADT_RESEED > last + 1 ? last + 1 : c + BRADT_RESEED );
+        for ( int m( c ); m < c + BRADT_LANES && m < end; m++ )
+            g[m] = std::exp( af + hf * m );
+        for ( int m( c + BRADT_LANES ); m < end; m++ )
+            g[m] = g[m - BRADT_LANES] * step;
+    }
+    for ( int m( first ); m <= last; m++ ) {
+        float x( af + hf * m );
+        g[m] = x * x / (g[m] - 1.0f);
+    }
+
+    // Every point counts twice, but the two ends once
+    int m( first );
+    for ( ; m + BRADT_LANES <= last + 1; m += BRADT_LANES )
+        for ( int j(0); j < BRADT_LANES; j++ )
+            partial[j] += g[m + j];
+    for ( ; m <= last; m++ )
+        partial[0] += g[m];
+    for ( int j(0); j < BRADT_LANES; j++ )
+        total += partial[j];
+    total *= 2.0;
+    if ( first == 0 && last >= 0 ) total -= g[0];
+    if ( last == n - 1 && last >= first && n > 1 ) total -= g[n - 1];
+
+    return total;
+}
+
+// Single precision LineBandFlux and EnergyBandFlux: the same integral by BradtTrapezoid.
+// The constant in front is worked out in double; it underflows in float.
+template <>
+float LineBandFlux( float T, float E1, float E2, double L1, double L2 ) {
+    double t( T * 1e3 ), a( E1 * 1e3 / t ), b( E2 * 1e3 / t );
+    unsigned int n_steps( BandSteps(LINE_BAND_STEPS) );
+    double h( (b - a) / n_steps );
+    double integral_constants = 2.0 * pow(t*Units::EV,3) / pow(Units::C,2) / pow(Units::H_PLANCK,3);
+
+    return BradtTrapezoid( a, h, n_steps, L1*1e3/t, L2*1e3/t ) * h/2.0 * integral_constants;
+}
+
+template <>
+float EnergyBandFlux( float T, float E1, float E2 ) {
+    double t( T * 1e3 ), a( E1 * 1e3 / t ), b( E2 * 1e3 / t );
+    unsigned int n_steps( BandSteps(ENERGY_BAND_STEPS) );
+    double h( (b - a) / n_steps );
+    double integral_constants = 2.0 * pow(t*Units::EV,3) / pow(Units::C,2) / pow(Units::H_PLANCK,3);
+
+    return BradtTrapezoid( a, h, n_steps, -HUGE_VALF, HUGE_VALF ) * h/2.0 * integral_constants;
+}
+
 /**************************************************************************************/
 /* Bradt_flux_integrand:                                                              */
 /*                      integrand of Bradt eqn 6.6 when integrating over nu, modified */
@@ -1750,7 +2193,8 @@ double EnergyBandFlux( double T, double E1, double E2 ) {
 /*																					  */
 /* pass: x = current_x from above routine                                             */
 /**************************************************************************************/
-double Bradt_flux_integrand( double x ) {
+template <class Real>
+Real Bradt_flux_integrand( Real x ) {
 	return ( pow(x,2) / (exp(x) - 1) );  // 2 (not 3) for photon number flux
 } // end Bradt_flux_integrand
 
@@ -1762,7 +2206,8 @@ double Bradt_flux_integrand( double x ) {
 /*																					  */
 /* pass: cosine = curve.cosbeta[i] * curve.eta[i]                                     */
 /**************************************************************************************/
-double Gray( double cosine ) {
+template <class Real>
+Real Gray( Real cosine ) {
 	
 	/**********************************/
    	/* VARIABLE DECLARATIONS FOR Gray */
@@ -1810,8 +2255,10 @@ double Gray( double cosine ) {
     int index(0);
     //i=1;
 
-    if (cosine == 1.0)
-    	index = 10;
+    if (cosine >= 1.0)
+    	return F[10];
+    if (cosine <= 0.0)
+    	return F[0];
     else {
         while ( cosine >= mu[index]) 
         	index++;
@@ -1911,5 +2358,31 @@ double calcreq( double omega, double mass, double theta_0, double rspot ) {
 	return req;
 } // end calcreq
 
+/**************************************************************************************/
+/* The routines templated on the scalar type, for double and for FitDual              */
+/**************************************************************************************/
+#define CHI_INSTANTIATE( T ) \
+    template T ChiSquare( class DataStruct*, LightCurveT< T >* ); \
+    template void ComputeAngles( LightCurveT< T >&, class OblDeflectionTOA* ); \
+    template void ComputeCurve( LightCurveT< T >& ); \
+    template void ShiftCurve( LightCurveT< T >&, const T& ); \
+    template T BlackBody( T, T ); \
+    template T LineBandFlux( T, T, T, double, double ); \
+    template T EnergyBandFlux( T, T, T ); \
+    template T Bradt_flux_integrand( T ); \
+    template T Gray( T );
+
+CHI_INSTANTIATE( double )
+CHI_INSTANTIATE( FitDual )
+
+// Single precision, for the spectra and the rebinning only (see SpotFlux in Engine.cpp)
+template void ComputeCurve( LightCurveT< float >& );
+template void ShiftCurve( LightCurveT< float >&, const float& );
+template float BlackBody( float, float );
+template float Bradt_flux_integrand( float );
+template float Gray( float );
+
+#undef CHI_INSTANTIATE
+
 // end Chi.cpp
 
@@ -8,79 +8,127 @@
 */
 /***************************************************************************************/
 
-#define NDIM 5  //
-#define MPTS 6  //
+#define NDIM 7  // Number of parameters the fitter can vary (M, R_eq, incl, theta, rho, T, ts)
+#define MPTS 8  // Points in the simplex, NDIM+1
 
 #define MAX_NUMBINS 512 // REMEMBER TO CHANGE THIS IN STRUCT.H AS WELL!!
 #define NCURVES 100      // REMEMBER TO CHANGE THIS IN STRUCT.H AS WELL!! number of different light curves that it will calculate
 
+#include "Dual.h"
+
+// The scalar carrying the derivatives with respect to the NDIM fit parameters, for the
+// routines templated on the scalar type (see Gradient in Engine.h)
+typedef Dual<NDIM> FitDual;
+
+template <class T> class LightCurveT;
 
 
 // Calculates chi^2
 double ChiSquare( class DataStruct* obsdata, class LightCurve* curve );
 
+template <class T>
+T ChiSquare( class DataStruct* obsdata, LightCurveT<T>* curve );
+
 
 // Calculates angles
 class LightCurve ComputeAngles( class LightCurve* incurve,
 				                class OblDeflectionTOA* defltoa );
 
+// The same, in place, for either scalar type; para.rpole must be set
+template <class T>
+void ComputeAngles( LightCurveT<T>& curve, class OblDeflectionTOA* defltoa );
+
 void Bend ( class LightCurve* incurve,
 	    class OblDeflectionTOA* defltoa);
 
 // Calculates the light curve, when given all the angles
 class LightCurve ComputeCurve( class LightCurve* angles );
 
+template <class T>
+void ComputeCurve( LightCurveT<T>& curve );
+
 class LightCurve ShiftCurve( class LightCurve* angles, double phishift);
 
+template <class T>
+void ShiftCurve( LightCurveT<T>& curve, const T& phishift );
+
 
-//
-int FitCurve( class LightCurve* angles, class DataStruct* obsdata,
-	          class OblDeflectionTOA* defltoa, char vert[180], char out_dir[80], 
-	          double rspot, double omega, double mass, int run, char min_file[180], 
-	          double ftol );
+// Fits the light curve to data by minimizing chi^2 with the downhill simplex method.
+// Parameters (x, step, vary): M [Msun], R_eq [km], incl [deg], theta [deg], rho [rad],
+// T [keV], ts. Returns the best chi^2; the best fit is returned in x, and *converged
+// (if given) is false if the fit stopped after the most evaluations allowed.
+double FitCurve( class LightCurve* curve, class DataStruct* obsdata, double x[NDIM],
+                 const double step[NDIM], const bool vary[NDIM], double ftol, 
+                 unsigned int numthreads, const char* log_file, bool* converged );
 	 
 	 
-//	      
-void amoeba(double p[][NDIM+1], double y[], double ftol, int *nfunk, 
-            class LightCurve* curve, class DataStruct* obsdata, 
-            class OblDeflectionTOA* defltoa, double omega, double mass, double theta, 
-            double rspot, double chi_store[], double i_store[], double a_store[], 
-            double t_store[], double b_store[], double p_store[], int *k_value );   //GC
+// Downhill simplex over the ndim varied parameters; p has ndim+1 rows. Returns false
+// if it stopped after the most evaluations allowed without converging.
+bool amoeba( double p[][NDIM], double y[], unsigned int ndim, double ftol, int *nfunk, 
+             class FitContext* fit, double chi_store[], double x_store[][NDIM], int *k_value );
+
 
+// One trial point of the simplex, by extrapolating through the face across from ihi
+double amotry( double p[][NDIM], double y[], double psum[], unsigned int ndim, 
+               int ihi, double fac, class FitContext* fit );
 
-//
-double amotry( double p[][NDIM+1], double y[], double psum[], int ihi, double fac, 
-               class LightCurve* curve, class DataStruct* obsdata, 
-               class OblDeflectionTOA* defltoa,  double omega, double mass, double theta, 
-               double rspot );  //GC -change psum
 
+// How far a full fit parameter vector is outside the physical range; 0 if inside
+double ParameterViolation( const double x[NDIM] );
 
-//
-class OblDeflectionTOA* recalc( class LightCurve* curve,  double omega, double mass, 
-                                double theta, double rspot );
+
+// Loads a full fit parameter vector (units as in FitCurve) into curve->para;
+// returns false if the parameters are unphysical
+bool LoadFitParameters( class LightCurve* curve, const double x[NDIM] );
+
+
+// Returns look-up tables for the star in curve, reusing tables if M and R are unchanged
+class DeflTables* recalc( class LightCurve* curve, class DeflTables* tables );
 
 
 
 // flux from a blackbody (bolometric, p = 0)
-double BlackBody( double T, double E );
+template <class Real>
+Real BlackBody( Real T, Real E );
 
 double Line( double T, double E , double E1, double E2);
 
-double LineBandFlux( double T, double E1, double E2, double L1, double L2 );
+template <class Real>
+Real LineBandFlux( Real T, Real E1, Real E2, double L1, double L2 );
 
 // flux from a specific energy band (E1 is lower bound, E2 is upper bound, both in keV) 
 //(p = NCURVES-1)
-double EnergyBandFlux( double T, double E1, double E2 );
+template <class Real>
+Real EnergyBandFlux( Real T, Real E1, Real E2 );
+
+// The band integrals in single precision, with a SIMD-friendly loop (see Chi.cpp)
+template <>
+float LineBandFlux( float T, float E1, float E2, double L1, double L2 );
+
+template <>
+float EnergyBandFlux( float T, float E1, float E2 );
+
+#define SPECTRAL_MAX_SCALE 4.0
+#define LINE_BAND_STEPS 400     // steps of LineBandFlux at spectral scale 1
+#define ENERGY_BAND_STEPS 3000  // steps of EnergyBandFlux at spectral scale 1
+
+// Sets the steps of the band integrals to scale (up to SPECTRAL_MAX_SCALE) times the
+// built-in LINE_BAND_STEPS and ENERGY_BAND_STEPS; for --tolerance, before any threads
+// start
+void SetSpectralSteps( double scale );
+double SpectralSteps(); // the scale set
 
 
 
 // Does the integral for the flux from a specific energy band
-double Bradt_flux_integrand( double x );
+template <class Real>
+Real Bradt_flux_integrand( Real x );
 
 
 
 // Calculates the graybody factor, if not negligible
-double Gray( double cosine );
+template <class Real>
+Real Gray( Real cosine );
 
 
 
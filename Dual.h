@@ -0,0 +1,182 @@
+/***************************************************************************************/
+/*                                      Dual.h
+
+    Dual numbers for forward-mode automatic differentiation. A Dual<N> holds a value
+    and its derivatives with respect to N independent variables; arithmetic and the
+    functions below carry the derivatives along by the chain rule, so a light curve
+    computed with Dual<NDIM> in place of double (see Gradient in Engine.h) comes out
+    with the exact derivatives of every flux bin with respect to the fit parameters.
+
+    Comparisons only look at the value. Wherever the code branches or searches on a
+    quantity (bin searches, visibility cuts, the special cases at b = b_max or
+    psi = 0), the derivative is that of the branch taken, i.e. of the piecewise
+    function the double version computes.
+
+    Value(x) gives the value of either a Dual or a double, for code templated on both.
+*/
+/***************************************************************************************/
+
+#ifndef DUAL_H
+#define DUAL_H
+
+#include <cmath>
+#include <ostream>
+
+template <unsigned int N>
+class Dual {
+ 	public:
+  		double v;         // value
+  		double d[N];      // derivatives with respect to the N variables
+
+  		Dual() : v(0.0) { for ( unsigned int k(0); k < N; k++ ) d[k] = 0.0; }
+  		Dual( double value ) : v(value) { for ( unsigned int k(0); k < N; k++ ) d[k] = 0.0; }
+
+  		// The k-th independent variable, with value value
+  		static Dual Variable( double value, unsigned int k ) {
+  		    Dual x( value );
+  		    x.d[k] = 1.0;
+  		    return x;
+  		}
+
+  		Dual& operator+=( const Dual& y ) { v += y.v; for ( unsigned int k(0); k < N; k++ ) d[k] += y.d[k]; return *this; }
+  		Dual& operator-=( const Dual& y ) { v -= y.v; for ( unsigned int k(0); k < N; k++ ) d[k] -= y.d[k]; return *this; }
+  		Dual& operator*=( const Dual& y ) {
+  		    for ( unsigned int k(0); k < N; k++ ) d[k] = d[k]*y.v + v*y.d[k];
+  		    v *= y.v;
+  		    return *this;
+  		}
+  		Dual& operator/=( const Dual& y ) {
+  		    v /= y.v;
+  		    for ( unsigned int k(0); k < N; k++ ) d[k] = (d[k] - v*y.d[k]) / y.v;
+  		    return *this;
+  		}
+  		Dual& operator+=( double y ) { v += y; return *this; }
+  		Dual& operator-=( double y ) { v -= y; return *this; }
+  		Dual& operator*=( double y ) { v *= y; for ( unsigned int k(0); k < N; k++ ) d[k] *= y; return *this; }
+  		Dual& operator/=( double y ) { v /= y; for ( unsigned int k(0); k < N; k++ ) d[k] /= y; return *this; }
+};
+
+inline double Value( double x ) { return x; }
+template <unsigned int N> inline double Value( const Dual<N>& x ) { return x.v; }
+
+// True for the Dual types, so templated code can skip work only needed for derivatives
+template <class T> struct IsDual { static const bool value = false; };
+template <unsigned int N> struct IsDual< Dual<N> > { static const bool value = true; };
+
+// Value x with derivative dfdx with respect to the argument a of the function. Where a
+// does not depend on a variable, neither does the result, even if dfdx is infinite
+// there (e.g. sqrt(1 - cosgamma^2) for a spherical star).
+template <unsigned int N> inline Dual<N> Chain( double x, double dfdx, const Dual<N>& a ) {
+    Dual<N> y( x );
+    for ( unsigned int k(0); k < N; k++ ) y.d[k] = a.d[k] == 0.0 ? 0.0 : dfdx * a.d[k];
+    return y;
+}
+
+// The derivative of x with respect to the k-th variable, and setting it; for double,
+// 0 and nothing
+inline double Derivative( double x, unsigned int k ) { return 0.0; }
+template <unsigned int N> inline double Derivative( const Dual<N>& x, unsigned int k ) { return x.d[k]; }
+inline void SetDerivative( double& x, unsigned int k, double dx ) { }
+template <unsigned int N> inline void SetDerivative( Dual<N>& x, unsigned int k, double dx ) { x.d[k] = dx; }
+
+// A root x0 of F(x; p) = 0 found by a search or from a table. F is F(x0; p) computed
+// with x0 held fixed, so it carries dF/dp; dFdx is the slope at x0. By the implicit
+// function theorem dx/dp = -(dF/dp) / (dF/dx).
+inline double ImplicitRoot( double x0, double F, double dFdx ) { return x0; }
+template <unsigned int N> inline Dual<N> ImplicitRoot( double x0, const Dual<N>& F, double dFdx ) {
+    Dual<N> x( x0 );
+    for ( unsigned int k(0); k < N; k++ ) x.d[k] = -F.d[k] / dFdx;
+    return x;
+}
+
+// x0, with the derivatives of x: for a value the code takes from somewhere other than
+// the formula x it stands for (e.g. b = b_max from the look-up table)
+inline double WithValue( double x0, double x ) { return x0; }
+template <unsigned int N> inline Dual<N> WithValue( double x0, Dual<N> x ) { x.v = x0; return x; }
+
+/********************/
+/* ARITHMETIC       */
+/********************/
+
+template <unsigned int N> inline Dual<N> operator+( const Dual<N>& x ) { return x; }
+template <unsigned int N> inline Dual<N> operator-( const Dual<N>& x ) { Dual<N> y( x ); y *= -1.0; return y; }
+
+template <unsigned int N> inline Dual<N> operator+( Dual<N> x, const Dual<N>& y ) { return x += y; }
+template <unsigned int N> inline Dual<N> operator+( Dual<N> x, double y ) { return x += y; }
+template <unsigned int N> inline Dual<N> operator+( double x, Dual<N> y ) { return y += x; }
+
+template <unsigned int N> inline Dual<N> operator-( Dual<N> x, const Dual<N>& y ) { return x -= y; }
+template <unsigned int N> inline Dual<N> operator-( Dual<N> x, double y ) { return x -= y; }
+template <unsigned int N> inline Dual<N> operator-( double x, const Dual<N>& y ) { Dual<N> z( -y ); return z += x; }
+
+template <unsigned int N> inline Dual<N> operator*( Dual<N> x, const Dual<N>& y ) { return x *= y; }
+template <unsigned int N> inline Dual<N> operator*( Dual<N> x, double y ) { return x *= y; }
+template <unsigned int N> inline Dual<N> operator*( double x, Dual<N> y ) { return y *= x; }
+
+template <unsigned int N> inline Dual<N> operator/( Dual<N> x, const Dual<N>& y ) { return x /= y; }
+template <unsigned int N> inline Dual<N> operator/( Dual<N> x, double y ) { return x /= y; }
+template <unsigned int N> inline Dual<N> operator/( double x, const Dual<N>& y ) {
+    return Chain( x / y.v, -x / (y.v*y.v), y );
+}
+
+/********************/
+/* COMPARISONS      */
+/********************/
+
+#define DUAL_COMPARISON( op ) \
+template <unsigned int N> inline bool operator op ( const Dual<N>& x, const Dual<N>& y ) { return x.v op y.v; } \
+template <unsigned int N> inline bool operator op ( const Dual<N>& x, double y ) { return x.v op y; } \
+template <unsigned int N> inline bool operator op ( double x, const Dual<N>& y ) { return x op y.v; }
+
+DUAL_COMPARISON( < )
+DUAL_COMPARISON( > )
+DUAL_COMPARISON( <= )
+DUAL_COMPARISON( >= )
+DUAL_COMPARISON( == )
+DUAL_COMPARISON( != )
+
+#undef DUAL_COMPARISON
+
+/********************/
+/* FUNCTIONS        */
+/********************/
+
+template <unsigned int N> inline Dual<N> sqrt( const Dual<N>& x ) {
+    double s( std::sqrt(x.v) );
+    return Chain( s, 0.5/s, x );
+}
+template <unsigned int N> inline Dual<N> pow( const Dual<N>& x, double p ) {
+    double y( std::pow(x.v, p) );
+    return Chain( y, p == 0.0 ? 0.0 : p * std::pow(x.v, p - 1.0), x );
+}
+template <unsigned int N> inline Dual<N> exp( const Dual<N>& x ) { double y( std::exp(x.v) ); return Chain( y, y, x ); }
+template <unsigned int N> inline Dual<N> log( const Dual<N>& x ) { return Chain( std::log(x.v), 1.0/x.v, x ); }
+template <unsigned int N> inline Dual<N> sin( const Dual<N>& x ) { return Chain( std::sin(x.v), std::cos(x.v), x ); }
+template <unsigned int N> inline Dual<N> cos( const Dual<N>& x ) { return Chain( std::cos(x.v), -std::sin(x.v), x ); }
+template <unsigned int N> inline Dual<N> tan( const Dual<N>& x ) {
+    double c( std::cos(x.v) );
+    return Chain( std::tan(x.v), 1.0/(c*c), x );
+}
+template <unsigned int N> inline Dual<N> asin( const Dual<N>& x ) {
+    return Chain( std::asin(x.v), 1.0/std::sqrt(1.0 - x.v*x.v), x );
+}
+template <unsigned int N> inline Dual<N> acos( const Dual<N>& x ) {
+    return Chain( std::acos(x.v), -1.0/std::sqrt(1.0 - x.v*x.v), x );
+}
+template <unsigned int N> inline Dual<N> atan( const Dual<N>& x ) {
+    return Chain( std::atan(x.v), 1.0/(1.0 + x.v*x.v), x );
+}
+template <unsigned int N> inline Dual<N> fabs( const Dual<N>& x ) { return x.v < 0.0 ? -x : x; }
+
+// Integer part in *ip (a constant), fractional part returned
+template <unsigned int N> inline Dual<N> modf( const Dual<N>& x, double* ip ) {
+    Dual<N> y( x );
+    y.v = std::modf( x.v, ip );
+    return y;
+}
+
+template <unsigned int N> inline std::ostream& operator<<( std::ostream& out, const Dual<N>& x ) {
+    return out << x.v;
+}
+
+#endif // DUAL_H
@@ -0,0 +1,1545 @@
+/***************************************************************************************/
+/*                                     Engine.cpp
+
+    This holds the set-up of the bending angle look-up table and the loop over the
+    mesh of the hot spot, moved here from main in Spot.cpp so that they can be
+    called once per light curve by the fitter as well.
+
+    Based on code written by Coire Cadeau and modified by Sharon Morsink and
+    Abigail Stevens.
+
+    MLCBxx refers to equation xx in Morsink, Leahy, Cadeau & Braga 2007, arxiv: 0703123v2
+*/
+/***************************************************************************************/
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <cmath>
+#include <exception>
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <map>
+#include "Engine.h"
+#include "Chi.h"
+#include "OblDeflectionTOA.h"
+#include "PolyOblModelNHQS.h"
+#include "PolyOblModelCFLQS.h"
+#include "PolyOblModelBase.h"
+#include "SphericalOblModel.h"
+#include "OblModelBase.h"
+#include "Units.h"
+#include "Exception.h"
+#include "Struct.h"
+#include "ThreadPool.h"
+#include "Healpix.h"
+#include "Profile.h"
+
+/**************************************************************************************/
+/* DeflTables:                                                                        */
+/*           sets up the shape model and the b vs psi look-up table for the star      */
+/*                                                                                    */
+/* pass: curve = para.mass, req, mass_over_r, omega, theta and flags.NS_model are used*/
+/**************************************************************************************/
+DeflTables::DeflTables( const class LightCurve* curve )
+  : model(0), defltoa(0),
+    mass(curve->para.mass), req(curve->para.req), rspot(curve->para.req),
+    mass_over_r(curve->para.mass_over_r), omega(curve->para.omega),
+    theta(curve->para.theta), quadrature(OblDeflectionTOA::Quadrature()),
+    NS_model(curve->flags.NS_model), problem(false) {
+
+    ProfileTimer timer( STAGE_TABLES );
+    double mu( cos(theta) );
+
+    /*********************************************************************************/
+    /* Set up model describing the shape of the NS; oblate, funky quark, & spherical */
+    /*********************************************************************************/
+
+    if ( NS_model == 1 ) { // Oblate Neutron Hybrid Quark Star model
+        // The shape coefficients only depend on M/R_eq and the spin, so a model built
+        // with Rspot = R_eq gives us R(theta) at the spot.
+        PolyOblModelNHQS shape( req, req,
+                                PolyOblModelBase::zetaparam(mass,req),
+                                PolyOblModelBase::epsparam(omega, mass, req) );
+        rspot = shape.R_poly( mu );
+        model = new PolyOblModelNHQS( rspot, req,
+                                      PolyOblModelBase::zetaparam(mass,req),
+                                      PolyOblModelBase::epsparam(omega, mass, req) );
+    }
+    else if ( NS_model == 2 ) { // Oblate Colour-Flavour Locked Quark Star model
+        PolyOblModelCFLQS shape( req, req,
+                                 PolyOblModelBase::zetaparam(mass,req),
+                                 PolyOblModelBase::epsparam(omega, mass, req) );
+        rspot = shape.R_poly( mu );
+        model = new PolyOblModelCFLQS( rspot, req,
+                                       PolyOblModelBase::zetaparam(mass,rspot),
+                                       PolyOblModelBase::epsparam(omega, mass, rspot) );
+    }
+    else if ( NS_model == 3 ) { // Standard spherical model
+        rspot = req;
+        model = new SphericalOblModel( rspot );
+    }
+    else {
+        throw( Exception("\nInvalid NS_model parameter. Exiting.\n") );
+    }
+
+    // defltoa "points" to the routines in OblDeflectionTOA.cpp used to compute
+    // deflection angles and times of arrivals
+    defltoa = new OblDeflectionTOA( model, mass, mass_over_r, rspot );
+
+    /**********************************************************/
+    /* Compute maximum deflection for purely outgoing photons */
+    /**********************************************************/
+
+    ProfileTimer psi_max_timer( STAGE_PSI_MAX );
+    defl.b_max = defltoa->bmax_outgoing( rspot );
+    defl.psi_max = defltoa->psi_max_outgoing_u( defl.b_max, rspot, &problem );
+    psi_max_timer.Stop();
+
+    /********************************************************************/
+    /* COMPUTE b VS psi LOOKUP TABLE, GOOD FOR THE SPECIFIED M/R AND mu */
+    /********************************************************************/
+
+    // 0 - 90% of b_max is large spacing, 90% - 100% is small spacing.
+    double b_mid( defl.b_max * 0.9 );
+    defl.b_psi[0] = 0.0;
+    defl.psi_b[0] = 0.0;
+
+    for ( unsigned int i(1); i < NN+1; i++ ) {
+        defl.b_psi[i] = b_mid * i / (NN * 1.0);
+        defl.psi_b[i] = defltoa->psi_outgoing_u( defl.b_psi[i], rspot, defl.b_max, defl.psi_max, &problem );
+    }
+    for ( unsigned int i(NN+1); i < 3*NN; i++ ) {
+        defl.b_psi[i] = b_mid + (defl.b_max - b_mid) / 2.0 * (i - NN) / (NN * 1.0);
+        defl.psi_b[i] = defltoa->psi_outgoing_u( defl.b_psi[i], rspot, defl.b_max, defl.psi_max, &problem );
+    }
+    defl.b_psi[3*NN] = defl.b_max;
+    defl.psi_b[3*NN] = defl.psi_max;
+}
+
+DeflTables::~DeflTables() {
+    delete defltoa;
+    delete model;
+}
+
+bool DeflTables::Matches( const class LightCurve* curve ) const {
+    return ( curve->para.mass == mass && curve->para.req == req
+             && curve->para.mass_over_r == mass_over_r && curve->para.omega == omega
+             && curve->flags.NS_model == NS_model && OblDeflectionTOA::Quadrature() == quadrature
+             && ( NS_model == 3 || curve->para.theta == theta ) ); // oblate rspot depends on theta
+}
+
+/**************************************************************************************/
+/* DeflCache:                                                                         */
+/*           see Engine.h                                                             */
+/**************************************************************************************/
+
+// Memory one set of tables takes, with the largest of the shape models
+static const double TABLES_BYTES( sizeof(DeflTables) + sizeof(OblDeflectionTOA)
+                                  + std::max( sizeof(PolyOblModelNHQS),
+                                              std::max( sizeof(PolyOblModelCFLQS), sizeof(SphericalOblModel) ) ) );
+
+bool DeflCache::Key::operator==( const Key& k ) const {
+    return mass_over_r == k.mass_over_r && req == k.req && mass == k.mass && omega == k.omega
+           && theta == k.theta && quadrature == k.quadrature && NS_model == k.NS_model;
+}
+
+size_t DeflCache::KeyHash::operator()( const Key& k ) const {
+    std::hash<double> h;
+    size_t seed( std::hash<unsigned int>()( k.NS_model ) );
+    for ( double x : { k.mass_over_r, k.req, k.mass, k.omega, k.theta, k.quadrature } )
+        seed ^= h( x ) + 0x9e3779b97f4a7c15ULL + (seed << 6) + (seed >> 2);
+    return seed;
+}
+
+DeflCache::Key DeflCache::MakeKey( const class LightCurve* curve ) {
+    Key k;
+    k.mass_over_r = curve->para.mass_over_r;
+    k.req = curve->para.req;
+    k.mass = curve->para.mass;
+    k.omega = curve->para.omega;
+    k.NS_model = curve->flags.NS_model;
+    k.theta = k.NS_model == 3 ? 0.0 : curve->para.theta; // only the oblate rspot depends on theta
+    k.quadrature = OblDeflectionTOA::Quadrature();
+    return k;
+}
+
+DeflCache::DeflCache( double megabytes )
+  : budget(megabytes * 1048576.0), hits(0), misses(0) {
+}
+
+std::shared_ptr< DeflTables > DeflCache::Get( const class LightCurve* curve, bool* built ) {
+
+    Key key( MakeKey( curve ) );
+    {
+        std::lock_guard< std::mutex > hold( lock );
+        auto found( index.find( key ) );
+        if ( found != index.end() ) {
+            entries.splice( entries.begin(), entries, found->second );
+            hits++;
+            if ( built ) *built = false;
+            return found->second->second;
+        }
+        misses++;
+    }
+
+    // Built outside the lock, so that threads on different stars build at the same time
+    std::shared_ptr< DeflTables > tables( new DeflTables( curve ) );
+    if ( built ) *built = true;
+
+    std::lock_guard< std::mutex > hold( lock );
+    if ( index.find( key ) == index.end() ) { // another thread may have built them meanwhile
+        entries.push_front( std::make_pair( key, tables ) );
+        index[key] = entries.begin();
+        Trim();
+    }
+    return tables;
+}
+
+void DeflCache::SetBudget( double megabytes ) {
+    std::lock_guard< std::mutex > hold( lock );
+    budget = megabytes * 1048576.0;
+    Trim();
+}
+
+// Drops the least recently used tables until the rest fit in the budget; called locked
+void DeflCache::Trim() {
+    while ( !entries.empty() && entries.size() * TABLES_BYTES > budget ) {
+        index.erase( entries.back().first );
+        entries.pop_back();
+    }
+}
+
+unsigned long DeflCache::Hits() const {
+    std::lock_guard< std::mutex > hold( lock );
+    return hits;
+}
+
+unsigned long DeflCache::Misses() const {
+    std::lock_guard< std::mutex > hold( lock );
+    return misses;
+}
+
+unsigned long DeflCache::Size() const {
+    std::lock_guard< std::mutex > hold( lock );
+    return entries.size();
+}
+
+double DeflCache::Megabytes() const {
+    return Size() * TABLES_BYTES / 1048576.0;
+}
+
+class DeflCache& SessionCache() {
+    static class DeflCache cache;
+    return cache;
+}
+
+/**************************************************************************************/
+/* SpotShape:                                                                         */
+/*           sets rspot, radius, rpole and cosgamma (at the centre of the spot, or    */
+/*           cosgamma at cos(theta) = *ring_mu if given) in para from the tables.     */
+/*           With derivatives, the values are still taken from the tables, and the    */
+/*           derivatives from the formulas DeflTables uses.                           */
+/*                                                                                    */
+/* pass: para = mass, req, omega and theta are used                                   */
+/**************************************************************************************/
+static void SpotShape( struct ParametersT<double>& para, const class DeflTables* tables,
+                       const double* ring_mu = 0 ) {
+    para.rspot = tables->rspot;
+    para.radius = tables->rspot; // radius used by ComputeAngles is the radius at the spot
+    para.rpole = tables->model->R_at_costheta( 1.0 );
+    para.cosgamma = tables->model->cos_gamma( ring_mu ? *ring_mu : cos(para.theta) );
+}
+
+template <unsigned int N>
+static void SpotShape( struct ParametersT< Dual<N> >& para, const class DeflTables* tables,
+                       const double* ring_mu = 0 ) {
+
+    Dual<N> rspot( para.req ), rpole( para.req ), cosgamma( 1.0 ), mu( cos(para.theta) );
+
+    if ( tables->NS_model == 1 || tables->NS_model == 2 ) {
+        const double* c( tables->NS_model == 1 ? PolyOblModelNHQS::COEFFICIENTS
+                                               : PolyOblModelCFLQS::COEFFICIENTS );
+        Dual<N> zeta( PolyOblModelBase::zetaparam(para.mass, para.req) ),
+                eps( PolyOblModelBase::epsparam(para.omega, para.mass, para.req) );
+        rspot = PolyOblShape< Dual<N> >( c, para.req, para.req, zeta, eps ).R_poly( mu );
+        if ( tables->NS_model == 2 ) { // the CFLQS model is built with M/R and eps at the spot
+            zeta = PolyOblModelBase::zetaparam( para.mass, rspot );
+            eps = PolyOblModelBase::epsparam( para.omega, para.mass, rspot );
+        }
+        PolyOblShape< Dual<N> > shape( c, rspot, para.req, zeta, eps );
+        rpole = shape.R_at_costheta( 1.0 );
+        cosgamma = shape.cos_gamma( ring_mu ? Dual<N>( *ring_mu ) : mu );
+    }
+    para.rspot = WithValue( tables->rspot, rspot );
+    para.radius = para.rspot;
+    para.rpole = WithValue( tables->model->R_at_costheta( 1.0 ), rpole );
+    para.cosgamma = WithValue( tables->model->cos_gamma( ring_mu ? *ring_mu : cos(Value(para.theta)) ),
+                               cosgamma );
+}
+
+/**************************************************************************************/
+/* Demote:                                                                            */
+/*           copies a ring with its angles worked out into a single precision light   */
+/*           curve, for ComputeCurve and ShiftCurve (see flags.single_precision in    */
+/*           Struct.h). The angles themselves are always computed in double.          */
+/**************************************************************************************/
+template <class T>
+static void Demote( const LightCurveT<T>& curve, LightCurveT<float>* ring ) {
+
+    const ParametersT<T>& a( curve.para );
+    ParametersT<float>& b( ring->para );
+
+    b.theta = Value(a.theta);  b.phi_0 = Value(a.phi_0);  b.dS = Value(a.dS);
+    b.rho = Value(a.rho);  b.incl = Value(a.incl);  b.temperature = Value(a.temperature);
+    b.mass = Value(a.mass);  b.radius = Value(a.radius);  b.req = Value(a.req);
+    b.rspot = Value(a.rspot);  b.rpole = Value(a.rpole);  b.mass_over_r = Value(a.mass_over_r);
+    b.cosgamma = Value(a.cosgamma);  b.ts = Value(a.ts);
+    b.aniso = a.aniso;  b.Gamma = a.Gamma;  b.Gamma1 = a.Gamma1;  b.Gamma2 = a.Gamma2;
+    b.Gamma3 = a.Gamma3;  b.omega = a.omega;  b.bbrat = a.bbrat;
+    b.E_band_lower_1 = a.E_band_lower_1;  b.E_band_upper_1 = a.E_band_upper_1;
+    b.E_band_lower_2 = a.E_band_lower_2;  b.E_band_upper_2 = a.E_band_upper_2;
+    b.distance = a.distance;  b.rsc = a.rsc;  b.Isc = a.Isc;  b.bmodel = a.bmodel;
+    b.E0 = a.E0;  b.E1 = a.E1;  b.E2 = a.E2;  b.DeltaE = a.DeltaE;
+
+    ring->flags = curve.flags;
+    ring->defl = curve.defl;
+    ring->numbins = curve.numbins;
+    ring->numbands = curve.numbands;
+    ring->numtheta = curve.numtheta;
+    ring->rings = curve.rings;
+    ring->elements = curve.elements;
+    ring->mesh_error = curve.mesh_error;
+    ring->eclipse = curve.eclipse;
+    ring->ingoing = curve.ingoing;
+    ring->problem = curve.problem;
+    for ( unsigned int p(0); p < NCURVES; p++ )
+        ring->background[p] = curve.background[p];
+    for ( unsigned int i(0); i < curve.numbins; i++ ) {
+        ring->t[i] = curve.t[i];
+        ring->visible[i] = curve.visible[i];
+        ring->t_o[i] = Value(curve.t_o[i]);
+        ring->cosbeta[i] = Value(curve.cosbeta[i]);
+        ring->eta[i] = Value(curve.eta[i]);
+        ring->psi[i] = Value(curve.psi[i]);
+        ring->R_dpsi_db[i] = Value(curve.R_dpsi_db[i]);
+        ring->b[i] = Value(curve.b[i]);
+        ring->dcosalpha_dcospsi[i] = Value(curve.dcosalpha_dcospsi[i]);
+        ring->dOmega_s[i] = Value(curve.dOmega_s[i]);
+    }
+}
+
+/**************************************************************************************/
+/* AddWrapped:                                                                        */
+/*           hands add( p, i, f[p][(i+j) mod numbins] ) each band and bin of f, in    */
+/*           two runs of bins that do not wrap around. NB is numbins when it is one   */
+/*           of 32, 64, 128 or 256, so that the runs have lengths fixed when compiled,*/
+/*           and 0 for any other numbins.                                             */
+/**************************************************************************************/
+template <unsigned int NB, class S, class Add>
+static void AddWrapped( const S f[NCURVES][MAX_NUMBINS], unsigned int j, unsigned int numbins,
+                        unsigned int numbands, Add& add ) {
+
+    const unsigned int n( NB ? NB : numbins );
+
+    for ( unsigned int p(0); p < numbands; p++ ) {
+        for ( unsigned int i(0); i < n - j; i++ )
+            add( p, i, f[p][i+j] );
+        for ( unsigned int i(n - j); i < n; i++ )
+            add( p, i, f[p][i+j-n] );
+    }
+}
+
+template <class S, class Add>
+static void AddWrapped( const S f[NCURVES][MAX_NUMBINS], unsigned int j, unsigned int numbins,
+                        unsigned int numbands, Add& add ) {
+    switch ( numbins ) {
+        case 32:  AddWrapped<32>( f, j, numbins, numbands, add ); break;
+        case 64:  AddWrapped<64>( f, j, numbins, numbands, add ); break;
+        case 128: AddWrapped<128>( f, j, numbins, numbands, add ); break;
+        case 256: AddWrapped<256>( f, j, numbins, numbands, add ); break;
+        default:  AddWrapped<0>( f, j, numbins, numbands, add ); break;
+    }
+}
+
+/**************************************************************************************/
+/* AddRing:                                                                           */
+/*           computes the light curve of one ring of the spot from its angles and     */
+/*           hands it to add( p, i, flux ) once for each of its numphi phi divisions, */
+/*           shifted by whole phase bins, and the last, part bin, shifted by phishift */
+/*                                                                                    */
+/* pass: ring = light curve with the angles of the ring worked out                    */
+/*       Temp = scratch space of numbands*numbins                                     */
+/**************************************************************************************/
+template <class S, class Add>
+static void AddRing( LightCurveT<S>& ring, unsigned int numphi, const S& phishift, double dphi,
+                     std::vector< S >& Temp, Add add ) {
+
+    unsigned int numbins( ring.numbins ), numbands( ring.numbands );
+
+    ComputeCurve( ring );
+
+    if ( ring.para.temperature == 0.0 ) {
+        for ( unsigned int i(0); i < numbins; i++ ) {
+            for ( unsigned int p(0); p < numbands; p++ )
+                ring.f[p][i] = 0.0;
+        }
+    }
+
+    ProfileTimer timer( STAGE_ADD );
+    for ( unsigned int j(0); j < numphi; j++ )   // looping through the phi divisions
+        AddWrapped( ring.f, j, numbins, numbands, add ); // Add curves, load into Flux array
+
+    // Add in the missing bit.
+    if ( phishift != 0.0 ) { // Add light from last bin, which requires shifting
+        for ( unsigned int i(0); i < numbins; i++ ) {
+            unsigned int q( (i + numphi + numbins - 1) % numbins ); // numphi can be 0 on the rim
+            for ( unsigned int p(0); p < numbands; p++ )
+                Temp[p*numbins+i] = ring.f[p][q];
+        }
+        for ( unsigned int p(0); p < numbands; p++ )
+            for ( unsigned int i(0); i < numbins; i++ )
+                ring.f[p][i] = Temp[p*numbins+i];
+
+        timer.Stop();
+        ShiftCurve( ring, phishift );
+        timer.Next( STAGE_ADD );
+
+        for ( unsigned int p(0); p < numbands; p++ )
+            for ( unsigned int i(0); i < numbins; i++ )
+                add( p, i, ring.f[p][i]*phishift/dphi );
+    }
+}
+
+/**************************************************************************************/
+/* RingGeometry:                                                                      */
+/*           the angles of one ring worked out by ComputeAngles: what ComputeCurve    */
+/*           needs that the temperature and the spectrum do not change. dOmega_s     */
+/*           goes as 1/distance^2 and is rescaled to the distance it is restored at.  */
+/**************************************************************************************/
+template <class T>
+struct RingGeometry {
+    bool done;                                // angles worked out
+    double distance;                          // distance dOmega_s is for
+    T dS, radius, rpole, cosgamma;
+    bool eclipse, ingoing, problem;
+    std::vector< T > t_o, cosbeta, eta, dOmega_s;
+
+    RingGeometry() : done(false), distance(0.0), eclipse(false), ingoing(false), problem(false) { }
+
+    void Save( const LightCurveT<T>& curve ) {
+        dS = curve.para.dS;  radius = curve.para.radius;
+        rpole = curve.para.rpole;  cosgamma = curve.para.cosgamma;
+        eclipse = curve.eclipse;  ingoing = curve.ingoing;  problem = curve.problem;
+        t_o.assign( curve.t_o, curve.t_o + curve.numbins );
+        cosbeta.assign( curve.cosbeta, curve.cosbeta + curve.numbins );
+        eta.assign( curve.eta, curve.eta + curve.numbins );
+        dOmega_s.assign( curve.dOmega_s, curve.dOmega_s + curve.numbins );
+        distance = curve.para.distance;
+        done = true;
+    }
+
+    void Restore( LightCurveT<T>* curve ) const {
+        curve->para.dS = dS;  curve->para.radius = radius;
+        curve->para.rpole = rpole;  curve->para.cosgamma = cosgamma;
+        curve->eclipse = eclipse;  curve->ingoing = ingoing;  curve->problem = problem;
+        std::copy( t_o.begin(), t_o.end(), curve->t_o );
+        std::copy( cosbeta.begin(), cosbeta.end(), curve->cosbeta );
+        std::copy( eta.begin(), eta.end(), curve->eta );
+        if ( curve->para.distance == distance )
+            std::copy( dOmega_s.begin(), dOmega_s.end(), curve->dOmega_s );
+        else {
+            double scale( pow( distance / curve->para.distance, 2 ) );
+            for ( unsigned int i(0); i < dOmega_s.size(); i++ )
+                curve->dOmega_s[i] = scale * dOmega_s[i];
+        }
+    }
+};
+
+/**************************************************************************************/
+/* SpotCache:                                                                         */
+/*           what a thread kept of its last light curve, so that the next one only    */
+/*           redoes what its changed inputs need. The inputs fall in tiers:           */
+/*             M, R_eq, spin and shape: the look-up tables (DeflCache)                */
+/*             incl: the angles of each ring, kept by the ring's latitude, phi_0     */
+/*                 and dS (RingStore), so rings a new theta or rho shares with the    */
+/*                 last one, or one spot shares with another at the same latitude,    */
+/*                 are not worked out again; a new distance only rescales dOmega_s    */
+/*             theta, rho, the mesh, T and the spectrum: the flux of each spot        */
+/*             distance alone: the flux is just rescaled by 1/distance^2              */
+/*           The background and the normalization are put on afterwards anyway (see   */
+/*           NormalizeFlux). Only kept in double: with derivatives everything depends */
+/*           on the point in parameter space.                                         */
+/**************************************************************************************/
+struct RingKey {
+    double incl, rspot, theta, phi_0, dS;
+    bool operator<( const RingKey& k ) const {
+        if ( incl != k.incl ) return incl < k.incl;
+        if ( rspot != k.rspot ) return rspot < k.rspot;
+        if ( theta != k.theta ) return theta < k.theta;
+        if ( phi_0 != k.phi_0 ) return phi_0 < k.phi_0;
+        return dS < k.dS;
+    }
+};
+
+// The star's inputs of the angles but the distance and the spot's latitude
+static std::vector< double > StarKey( const LightCurveT<double>& curve, const class DeflTables* tables ) {
+    std::vector< double > s;
+    s.push_back( tables->mass );  s.push_back( tables->req );  s.push_back( tables->omega );
+    s.push_back( tables->mass_over_r );  s.push_back( tables->NS_model );
+    s.push_back( curve.numbins );  s.push_back( tables->quadrature );
+    return s;
+}
+
+// The inputs of the flux of the spot in curve, but the distance
+static std::vector< double > SpotKey( const LightCurveT<double>& curve, const class DeflTables* tables ) {
+    std::vector< double > s( StarKey( curve, tables ) );
+    const struct ParametersT<double>& a( curve.para );
+    const struct Flags& g( curve.flags );
+    s.push_back( tables->rspot );  s.push_back( a.incl );
+    s.push_back( a.theta );  s.push_back( a.rho );  s.push_back( curve.numtheta );
+    s.push_back( g.mesh_tolerance );  s.push_back( g.single_precision );
+    s.push_back( a.temperature );  s.push_back( g.beaming_model );
+    s.push_back( g.spectral_model );  s.push_back( curve.numbands );
+    s.push_back( a.E0 );  s.push_back( a.E1 );  s.push_back( a.E2 );  s.push_back( a.DeltaE );
+    s.push_back( a.E_band_lower_1 );  s.push_back( a.E_band_upper_1 );
+    s.push_back( a.E_band_lower_2 );  s.push_back( a.E_band_upper_2 );
+    s.push_back( SpectralSteps() );
+    return s;
+}
+
+// The angles of the rings of the thread's last light curve, of all its spots
+struct RingStore {
+    typedef std::map< RingKey, RingGeometry<double> > Rings;
+
+    std::vector< double > star;         // StarKey the angles are for, at any distance
+    Rings last,                         // angles of the rings of the last light curve
+          current;                      // and of the one being computed
+
+    // Forgets the angles unless they are for this star
+    void Use( const LightCurveT<double>& curve, const class DeflTables* tables ) {
+        std::vector< double > s( StarKey( curve, tables ) );
+        if ( s == star ) return;
+        star = s;
+        last.clear();
+        current.clear();
+    }
+
+    // Sets the angles of the ring in curve, from the last light curve if it had the
+    // ring; adds its key to used
+    void Angles( LightCurveT<double>& curve, const class DeflTables* tables,
+                 std::vector< RingKey >* used ) {
+        RingKey key = { curve.para.incl, tables->rspot, curve.para.theta, curve.para.phi_0, curve.para.dS };
+        used->push_back( key );
+        Rings::iterator r( current.find( key ) );
+        if ( r == current.end() ) {
+            r = last.find( key );
+            if ( r == last.end() ) {
+                ComputeAngles( curve, tables->defltoa );
+                current[key].Save( curve );
+                return;
+            }
+            r = current.insert( std::make_pair( key, std::move( r->second ) ) ).first;
+        }
+        r->second.Restore( &curve );
+    }
+
+    // Keeps the rings of a spot whose flux was kept, for when it is needed again
+    void Touch( const std::vector< RingKey >& keys ) {
+        for ( unsigned int k(0); k < keys.size(); k++ ) {
+            Rings::iterator r( last.find( keys[k] ) );
+            if ( r != last.end() && current.find( keys[k] ) == current.end() )
+                current.insert( std::make_pair( keys[k], std::move( r->second ) ) );
+        }
+    }
+
+    // The rings of the light curve just computed are the ones kept
+    void Done() {
+        last.swap( current );
+        current.clear();
+    }
+};
+
+// The flux of one spot of the thread's last light curve
+struct SpotCache {
+    std::vector< double > spot;         // SpotKey the flux is for
+    double distance;                    // and distance
+    std::vector< double > f;            // flux of the spot, f[p*numbins+i]
+    std::vector< RingKey > keys;        // its rings
+    unsigned int rings;
+    unsigned long elements;
+    double mesh_error;
+
+    SpotCache() : distance(0.0) { }
+};
+
+struct ThreadCache {
+    RingStore rings;
+    std::vector< SpotCache > spots;     // one for each spot of ComputeFlux
+};
+
+static ThreadCache& Caches() {
+    static thread_local ThreadCache cache;
+    return cache;
+}
+
+// The rings of the light curve just computed are the ones kept
+static void CachesDone( const LightCurveT<double>* ) {
+    Caches().rings.Done();
+}
+
+template <unsigned int N>
+static void CachesDone( const LightCurveT< Dual<N> >* ) { }
+
+// The angles of the ring in curve, from store if there is one
+static void RingAngles( LightCurveT<double>& curve, const class DeflTables* tables, RingStore* store,
+                        std::vector< RingKey >* used ) {
+    if ( store )
+        store->Angles( curve, tables, used );
+    else
+        ComputeAngles( curve, tables->defltoa );
+}
+
+template <unsigned int N>
+static void RingAngles( LightCurveT< Dual<N> >& curve, const class DeflTables* tables, RingStore*,
+                        std::vector< RingKey >* ) {
+    ComputeAngles( curve, tables->defltoa );
+}
+
+/**************************************************************************************/
+/* RingFlux:                                                                          */
+/*           works out the light curve of the ring of the spot at latitude thetak,    */
+/*           deltatheta wide, and hands it to add( p, i, flux ). Returns the number   */
+/*           of mesh elements (phi divisions) of the ring.                            */
+/*                                                                                    */
+/* pass: curve = scratch copy of the light curve, as for SpotFlux                     */
+/*       theta_1, rho, rspot = centre and angular radius of the spot, radius there    */
+/*       whole = true for a ring all the way round, in a spot over the pole           */
+/*       point = true for the whole spot at its centre (numtheta = 1)                 */
+/*       work = scratch space                                                         */
+/**************************************************************************************/
+template <class T>
+struct RingWork {
+    std::vector< T > Temp;                      // Temp[p*numbins+i]
+    bool single;                                // see flags.single_precision in Struct.h
+    std::unique_ptr< LightCurveT<float> > ring; // the ring in single precision
+    std::vector< float > ring_temp;
+    RingStore* store;                           // where the angles of the rings are kept; 0 for none
+    std::vector< RingKey >* used;               // and the keys of the rings used go
+};
+
+template <class T, class Add>
+static unsigned long RingFlux( LightCurveT<T>* curve, class DeflTables* tables,
+                               const T& theta_1, const T& rho, const T& rspot,
+                               const T& thetak, const T& deltatheta, bool whole, bool point,
+                               RingWork<T>& work, Add add ) {
+
+    unsigned int numbins( curve->numbins ), numphi;
+    T phi_edge(0.0), phishift, phij;
+    double dphi;
+    ProfileTimer timer( STAGE_RING );
+    timer.Note( Value(thetak) );
+
+    if ( whole )
+        phi_edge = Units::PI;
+
+    dphi = 2.0*Units::PI/(numbins*1.0);
+
+    if ( !whole ) {
+        T cos_phi_edge = (cos(rho) - cos(theta_1)*cos(thetak))/(sin(theta_1)*sin(thetak));
+        if ( cos_phi_edge > 1.0 || cos_phi_edge < -1.0 )
+            cos_phi_edge = 1.0;
+
+        if ( fabs( sin(theta_1) * sin(thetak) ) > 0.0 ) { // checking for a divide by 0
+            phi_edge = acos( cos_phi_edge ); // value of phi at the edge of the circular spot at latitude thetak
+        }
+        else {  // trying to divide by zero
+            throw( Exception(" Tried to divide by zero in calculation of phi_edge. Likely, thetak = 0. Exiting.") );
+        }
+    }
+
+    numphi = Value( 2.0*phi_edge/dphi );
+    phishift = 2.0*phi_edge - numphi*dphi;
+
+    curve->para.dS = pow(rspot,2) * sin(thetak) * deltatheta * dphi;
+    curve->para.theta = thetak;
+
+    if ( point ) {
+        numphi = 1;
+        phi_edge = 0.0;
+        dphi = 0.0;
+        phishift = 0.0;
+        curve->para.dS = 2.0*Units::PI * pow(rspot,2) * (1.0 - cos(rho));
+    }
+    if ( tables->NS_model == 1 || tables->NS_model == 2 )
+        curve->para.dS /= curve->para.cosgamma;
+
+    // Only compute the first phi bin - the others are the same curve shifted
+    // by a whole number of phase bins
+    phij = -phi_edge + 0.5*dphi;
+    curve->para.phi_0 = phij;
+
+    RingAngles( *curve, tables, work.store, work.used );
+
+    if ( work.single ) {
+        Demote( *curve, work.ring.get() );
+        AddRing( *work.ring, numphi, static_cast<float>( Value(phishift) ), dphi, work.ring_temp,
+                 [&]( unsigned int p, unsigned int i, float x ) { add( p, i, T(x) ); } );
+    }
+    else {
+        AddRing( *curve, numphi, phishift, dphi, work.Temp, add );
+    }
+    return numphi + ( phishift != 0.0 ? 1 : 0 );
+}
+
+/**************************************************************************************/
+/* Refine:                                                                            */
+/*           adds the flux of the piece of the spot between latitudes a and a + h     */
+/*           into Flux, given coarse, its flux worked out with one ring at the        */
+/*           middle. The two halves are worked out with a ring each; if they add up   */
+/*           to coarse within the piece's share of the tolerance, they are kept, and  */
+/*           otherwise each half is refined in turn. The rings are a midpoint rule in */
+/*           theta, so the error of the halves is about a third of their difference   */
+/*           from coarse (Richardson).                                                */
+/**************************************************************************************/
+template <class T>
+struct MeshRefinement {
+    LightCurveT<T>* curve;              // scratch copy of the light curve
+    class DeflTables* tables;
+    T theta_1, rho, rspot;              // centre and angular radius of the spot, radius there
+    RingWork<T>* work;
+    T (*Flux)[MAX_NUMBINS];             // where the flux is added up
+    double tolerance;                   // largest error, as a fraction of the peak flux,
+                                        // per radian of latitude
+    std::vector< double > scale,        // peak flux of each band, as far as known so far
+                          error,        // estimated error of each band, so far
+                          total;        // flux of the rings kept, total[p*numbins+i]
+    unsigned int rings;                 // rings kept
+    unsigned long elements;             // and their phi divisions
+};
+
+template <class T>
+static unsigned long RingInto( MeshRefinement<T>& m, const T& thetak, const T& deltatheta, bool whole,
+                               std::vector< T >& f ) {
+    unsigned int numbins( m.curve->numbins );
+    f.assign( m.curve->numbands*numbins, T(0.0) );
+    return RingFlux( m.curve, m.tables, m.theta_1, m.rho, m.rspot, thetak, deltatheta, whole, false,
+                     *m.work, [&]( unsigned int p, unsigned int i, const T& x ) { f[p*numbins+i] += x; } );
+}
+
+template <class T>
+static void Refine( MeshRefinement<T>& m, const T& a, const T& h, bool whole,
+                    const std::vector< T >& coarse, unsigned int depth ) {
+
+    unsigned int numbins( m.curve->numbins ), numbands( m.curve->numbands );
+    std::vector< T > lower, upper;
+    unsigned long elements( RingInto( m, a + 0.25*h, 0.5*h, whole, lower ) );
+    elements += RingInto( m, a + 0.75*h, 0.5*h, whole, upper );
+
+    // The flux is never negative, so the peak of any piece is at most that of the spot
+    std::vector< double > error( numbands, 0.0 );
+    bool good( true );
+    for ( unsigned int p(0); p < numbands; p++ ) {
+        for ( unsigned int i(0); i < numbins; i++ ) {
+            unsigned int q( p*numbins + i );
+            double fine( Value( lower[q] + upper[q] ) ), diff( fabs( fine - Value( coarse[q] ) ) / 3.0 );
+            if ( diff > error[p] ) error[p] = diff;
+            if ( fabs( fine ) > m.scale[p] ) m.scale[p] = fabs( fine );
+        }
+        if ( error[p] > m.tolerance * m.scale[p] * Value(h) ) good = false;
+    }
+
+    if ( good || depth + 1 >= MESH_MAX_DEPTH ) {
+        for ( unsigned int p(0); p < numbands; p++ ) {
+            for ( unsigned int i(0); i < numbins; i++ ) {
+                unsigned int q( p*numbins + i );
+                m.Flux[p][i] += lower[q] + upper[q];
+                m.total[q] += Value( lower[q] + upper[q] );
+            }
+            m.error[p] += error[p];
+        }
+        m.rings += 2;
+        m.elements += elements;
+    }
+    else {
+        Refine( m, a, 0.5*h, whole, lower, depth + 1 );
+        Refine( m, a + 0.5*h, 0.5*h, whole, upper, depth + 1 );
+    }
+}
+
+/**************************************************************************************/
+/* SpotFlux:                                                                          */
+/*           adds the flux from one circular spot into Flux. The spot is cut into     */
+/*           numtheta rings; each ring is computed once and shifted by whole phase    */
+/*           bins for its other phi divisions. With flags.mesh_tolerance set, the     */
+/*           numtheta rings are only the start, and are halved until the flux is good */
+/*           to the tolerance (see Refine). Sets rings, elements and mesh_error.      */
+/*                                                                                    */
+/* pass: curve = scratch copy of the light curve; para.incl, theta, rho set, and      */
+/*               rspot, radius, rpole, cosgamma set by SpotShape                      */
+/*       store = where the angles of the rings are kept; 0 for none                   */
+/*       used = where the keys of the rings used go, with store                       */
+/**************************************************************************************/
+template <class T>
+static void SpotFlux( LightCurveT<T>* curve, class DeflTables* tables, RingStore* store,
+                      std::vector< RingKey >* used, T Flux[NCURVES][MAX_NUMBINS] ) {
+
+    unsigned int numbins( curve->numbins ), numbands( curve->numbands ),
+                 numtheta( curve->numtheta );
+    T theta_1( curve->para.theta ), rho( curve->para.rho ), rspot( curve->para.rspot );
+    bool adaptive( curve->flags.mesh_tolerance > 0.0 && rho > 0.0 );
+
+    // In single precision each ring's light curve is worked out in ring, and the rings
+    // are added up in total (see flags.single_precision in Struct.h)
+    RingWork<T> work;
+    work.Temp.resize( numbands*numbins );
+    work.single = !IsDual<T>::value && curve->flags.single_precision;
+    work.store = store;
+    work.used = used;
+    if ( work.single ) {
+        work.ring.reset( new LightCurveT<float> );
+        work.ring_temp.resize( numbands*numbins );
+    }
+    bool single( work.single && !adaptive );
+    std::vector< float > total( single ? numbands*numbins : 0, 0.0f ),
+                         compensation( single ? numbands*numbins : 0, 0.0f );
+    auto kahan = [&]( unsigned int p, unsigned int i, const T& x ) {
+        // Kahan summation, so the many small rings add up in float
+        unsigned int q( p*numbins + i );
+        float xf( Value(x) ), y( xf - compensation[q] ), t( total[q] + y );
+        compensation[q] = (t - total[q]) - y;
+        total[q] = t;
+    };
+    auto plain = [&]( unsigned int p, unsigned int i, const T& x ) { Flux[p][i] += x; };
+
+    // The spot is cut into pieces of latitude: one, or if it goes over the pole, the
+    // rings all the way round it and the rest
+    unsigned int pieces;
+    T start[2], width[2];
+    if ( rho > theta_1 ) { // yes
+        pieces = 2;
+        start[0] = 0.0;
+        width[0] = rho - theta_1;
+        start[1] = rho - theta_1;
+        width[1] = 2.0*theta_1;
+    }
+    else { //no
+        pieces = 1;
+        start[0] = theta_1 - rho;
+        width[0] = 2.0*rho;
+    }
+
+    curve->rings = 0;
+    curve->elements = 0;
+    curve->mesh_error = 0.0;
+
+    if ( !adaptive ) {
+        for ( unsigned int p(0); p < pieces; p++ ) {
+            T deltatheta = width[p]/numtheta;
+
+            // Looping through the mesh of the spot
+            for ( unsigned int k(0); k < numtheta; k++ ) { // Loop through the circles
+                T thetak = start[p] + (k+0.5)*deltatheta;
+                bool whole( pieces == 2 && p == 0 );
+                if ( single )
+                    curve->elements += RingFlux( curve, tables, theta_1, rho, rspot, thetak, deltatheta,
+                                                 whole, numtheta == 1, work, kahan );
+                else
+                    curve->elements += RingFlux( curve, tables, theta_1, rho, rspot, thetak, deltatheta,
+                                                 whole, numtheta == 1, work, plain );
+                curve->rings++;
+            } // closing for loop through theta divisions
+        } // end loop through pieces
+
+        if ( single ) {
+            ProfileTimer timer( STAGE_ADD );
+            for ( unsigned int p(0); p < numbands; p++ )
+                for ( unsigned int i(0); i < numbins; i++ )
+                    Flux[p][i] += total[p*numbins+i];
+        }
+        return;
+    }
+
+    /**********************************************************/
+    /* ADAPTIVE MESH: THE numtheta RINGS OF EACH PIECE FIRST, */
+    /* FOR THE PEAK FLUX, THEN EACH REFINED                   */
+    /**********************************************************/
+
+    MeshRefinement<T> m;
+    m.curve = curve;
+    m.tables = tables;
+    m.theta_1 = theta_1;
+    m.rho = rho;
+    m.rspot = rspot;
+    m.work = &work;
+    m.Flux = Flux;
+    m.tolerance = curve->flags.mesh_tolerance / Value( pieces == 2 ? width[0] + width[1] : width[0] );
+    m.scale.assign( numbands, 0.0 );
+    m.error.assign( numbands, 0.0 );
+    m.total.assign( numbands*numbins, 0.0 );
+    m.rings = 0;
+    m.elements = 0;
+
+    std::vector< std::vector< T > > coarse( pieces*numtheta );
+    std::vector< T > sum( numbands*numbins, T(0.0) );
+    for ( unsigned int p(0); p < pieces; p++ ) {
+        T deltatheta = width[p]/numtheta;
+        for ( unsigned int k(0); k < numtheta; k++ ) {
+            std::vector< T >& f( coarse[p*numtheta+k] );
+            RingInto( m, start[p] + (k+0.5)*deltatheta, deltatheta, pieces == 2 && p == 0, f );
+            for ( unsigned int q(0); q < numbands*numbins; q++ )
+                sum[q] += f[q];
+        }
+    }
+    for ( unsigned int p(0); p < numbands; p++ )
+        for ( unsigned int i(0); i < numbins; i++ )
+            m.scale[p] = std::max( m.scale[p], fabs( Value( sum[p*numbins+i] ) ) );
+
+    for ( unsigned int p(0); p < pieces; p++ ) {
+        T deltatheta = width[p]/numtheta;
+        for ( unsigned int k(0); k < numtheta; k++ )
+            Refine( m, start[p] + k*deltatheta, deltatheta, pieces == 2 && p == 0, coarse[p*numtheta+k], 0 );
+    }
+
+    curve->rings = m.rings;
+    curve->elements = m.elements;
+    for ( unsigned int p(0); p < numbands; p++ ) {
+        double peak(0.0);
+        for ( unsigned int i(0); i < numbins; i++ )
+            peak = std::max( peak, fabs( m.total[p*numbins+i] ) );
+        if ( peak > 0.0 )
+            curve->mesh_error = std::max( curve->mesh_error, m.error[p] / peak );
+    }
+}
+
+/**************************************************************************************/
+/* AddShifted:                                                                        */
+/*           computes the light curve of a ring of pixels from its angles, for a      */
+/*           pixel at phi = 0, and adds it into Flux shifted by m bins with weight    */
+/*           kernel[m]                                                                */
+/**************************************************************************************/
+template <class S, class T>
+static void AddShifted( LightCurveT<S>& ring, const std::vector< double >& kernel,
+                        T Flux[NCURVES][MAX_NUMBINS] ) {
+
+    unsigned int numbins( ring.numbins ), numbands( ring.numbands );
+
+    ComputeCurve( ring );
+    if ( ring.para.temperature == 0.0 ) return;
+
+    ProfileTimer timer( STAGE_ADD );
+    for ( unsigned int m(0); m < numbins; m++ ) {
+        if ( kernel[m] == 0.0 ) continue;
+        const double weight( kernel[m] );
+        auto add = [&]( unsigned int p, unsigned int i, const S& x ) { Flux[p][i] += weight * x; };
+        AddWrapped( ring.f, m, numbins, numbands, add );
+    }
+}
+
+/**************************************************************************************/
+/* SurfaceGeometry:                                                                   */
+/*           the angles of each ring of pixels of the equal-area mesh, for a pixel at */
+/*           phi = 0 (see PixelFlux). A ring's angles are worked out the first time   */
+/*           one of its pixels shines, and kept while the star, the observer and the  */
+/*           mesh stay the same; a new map only redoes the spectra.                   */
+/**************************************************************************************/
+template <class T>
+struct SurfaceGeometry {
+    double mass, req, omega, mass_over_r, rspot, theta, incl, distance, quadrature;
+    unsigned int NS_model, numbins, nside;
+    std::vector< RingGeometry<T> > rings;
+
+    SurfaceGeometry() : nside(0) { }
+
+    // Forgets the angles unless they are for this star, observer, mesh and quadrature. With
+    // derivatives they are never kept, as they depend on the point in parameter space.
+    void Use( const LightCurveT<T>& curve, const class DeflTables* tables, const class Healpix& grid ) {
+        if ( !IsDual<T>::value && nside == grid.Nside() && numbins == curve.numbins
+             && mass == tables->mass && req == tables->req && omega == tables->omega
+             && mass_over_r == tables->mass_over_r && rspot == tables->rspot
+             && theta == tables->theta && NS_model == tables->NS_model && quadrature == tables->quadrature
+             && incl == Value(curve.para.incl) && distance == curve.para.distance )
+            return;
+        mass = tables->mass;  req = tables->req;  omega = tables->omega;
+        mass_over_r = tables->mass_over_r;  rspot = tables->rspot;  theta = tables->theta;
+        NS_model = tables->NS_model;  quadrature = tables->quadrature;
+        incl = Value(curve.para.incl);  distance = curve.para.distance;
+        numbins = curve.numbins;  nside = grid.Nside();
+        rings.assign( grid.Rings(), RingGeometry<T>() );
+    }
+};
+
+// The angles kept by this thread
+template <class T>
+static SurfaceGeometry<T>& PixelGeometry() {
+    static thread_local SurfaceGeometry<T> geometry;
+    return geometry;
+}
+
+/**************************************************************************************/
+/* PixelFlux:                                                                         */
+/*           adds the flux of the pixels of the equal-area mesh (see Healpix.h) into  */
+/*           Flux, each times its weight in mask, at its temperature and beaming      */
+/*           model in map. A ring of pixels is one latitude: its angles are worked    */
+/*           out once, for a pixel at phi = 0, and its light curve once for each      */
+/*           temperature and beaming model its pixels have; the pixel at phi adds it  */
+/*           in shifted by phi/dphi bins, between whole bins by linear interpolation  */
+/*           as ShiftCurve does. Sets rings and elements. The radius is the one at    */
+/*           the spot, as for the rings of SpotFlux.                                  */
+/*                                                                                    */
+/* pass: curve = scratch copy of the light curve; para.theta is the centre of the     */
+/*               spot, which the tables (rspot) are for                               */
+/*       mask = weight of each pixel; 0 for 1 everywhere                              */
+/*       map = temperature and beaming model of each pixel; 0 for para.temperature    */
+/*             and flags.beaming_model everywhere                                     */
+/*       geometry = angles of the rings, kept from the last call if still good        */
+/**************************************************************************************/
+template <class T>
+static void PixelFlux( LightCurveT<T>* curve, class DeflTables* tables, const class Healpix& grid,
+                       const std::vector< double >* mask, const class HealpixMap* map,
+                       SurfaceGeometry<T>& geometry, T Flux[NCURVES][MAX_NUMBINS] ) {
+
+    typedef std::map< std::pair< double, unsigned int >, std::vector< double > > Kernels;
+
+    unsigned int numbins( curve->numbins );
+    T theta_1( curve->para.theta ), rspot( curve->para.rspot ), temperature( curve->para.temperature );
+    double dphi( 2.0*Units::PI/(numbins*1.0) );
+    bool single( !IsDual<T>::value && curve->flags.single_precision );
+    std::unique_ptr< LightCurveT<float> > ring( single ? new LightCurveT<float> : 0 );
+    Kernels kernels;
+
+    curve->rings = 0;
+    curve->elements = 0;
+    curve->mesh_error = 0.0;
+    geometry.Use( *curve, tables, grid );
+
+    for ( unsigned int r(0); r < grid.Rings(); r++ ) {
+        const struct HealpixRing& pixels( grid.Ring( r ) );
+
+        // Weight of the ring's light curve shifted by m bins, kernel[m], for each
+        // (temperature, beaming model) of its pixels that shine
+        kernels.clear();
+        for ( unsigned int j(0); j < pixels.pixels; j++ ) {
+            unsigned long n( pixels.first + j );
+            double w( mask ? (*mask)[n] : 1.0 );
+            if ( w == 0.0 || ( map && map->temperature[n] == 0.0 ) ) continue;
+            std::vector< double >& kernel( kernels[ std::make_pair(
+                map ? map->temperature[n] : 0.0,
+                map && !map->beaming.empty() ? map->beaming[n] : curve->flags.beaming_model ) ] );
+            if ( kernel.empty() ) kernel.assign( numbins, 0.0 );
+            double s( grid.Phi( r, j ) / dphi ), m( floor( s ) );
+            unsigned int k( static_cast<unsigned int>( m ) % numbins );
+            kernel[k] += w * (1.0 - (s - m));
+            kernel[(k + 1) % numbins] += w * (s - m);
+            curve->elements++;
+        }
+        if ( kernels.empty() ) continue;
+        curve->rings++;
+        ProfileTimer timer( STAGE_RING );
+        timer.Note( pixels.theta );
+
+        RingGeometry<T>& angles( geometry.rings[r] );
+        curve->para.theta = pixels.theta;
+        curve->para.phi_0 = 0.0;
+        if ( angles.done ) {
+            angles.Restore( curve );
+        }
+        else {
+            double mu( cos( pixels.theta ) );
+            curve->para.theta = theta_1;
+            SpotShape( curve->para, tables, &mu );
+            curve->para.theta = pixels.theta;
+            curve->para.dS = pow(rspot,2) * grid.PixelArea();
+            if ( tables->NS_model == 1 || tables->NS_model == 2 )
+                curve->para.dS /= curve->para.cosgamma;
+            ComputeAngles( *curve, tables->defltoa );
+            angles.Save( *curve );
+        }
+
+        for ( typename Kernels::const_iterator k( kernels.begin() ); k != kernels.end(); ++k ) {
+            curve->para.temperature = map ? T( k->first.first ) : temperature;
+            curve->flags.beaming_model = k->first.second;
+            if ( single ) {
+                Demote( *curve, ring.get() );
+                AddShifted( *ring, k->second, Flux );
+            }
+            else {
+                AddShifted( *curve, k->second, Flux );
+            }
+        }
+    }
+}
+
+/**************************************************************************************/
+/* CachedSpotFlux:                                                                    */
+/*           adds the flux from one spot into Flux as SpotFlux does, from what this   */
+/*           thread kept of its last light curve (see SpotCache) where the inputs     */
+/*           are the same                                                             */
+/*                                                                                    */
+/* pass: spot = which spot of ComputeFlux it is                                       */
+/**************************************************************************************/
+static void CachedSpotFlux( LightCurveT<double>* curve, class DeflTables* tables, unsigned int spot,
+                            double Flux[NCURVES][MAX_NUMBINS] ) {
+
+    unsigned int numbins( curve->numbins ), numbands( curve->numbands );
+    struct ThreadCache& threadcache( Caches() );
+    if ( threadcache.spots.size() <= spot ) threadcache.spots.resize( spot + 1 );
+    struct SpotCache& cache( threadcache.spots[spot] );
+    std::vector< double > key( SpotKey( *curve, tables ) );
+
+    threadcache.rings.Use( *curve, tables );
+    if ( key != cache.spot ) {
+        // Another spot of the last light curve may have been just this one
+        unsigned int other( 0 );
+        while ( other < threadcache.spots.size() && threadcache.spots[other].spot != key ) other++;
+        if ( other < threadcache.spots.size() ) {
+            cache = threadcache.spots[other];
+        }
+        else {
+            std::vector< double > f( NCURVES*MAX_NUMBINS, 0.0 );
+            cache.keys.clear();
+            SpotFlux( curve, tables, &threadcache.rings, &cache.keys,
+                      reinterpret_cast< double (*)[MAX_NUMBINS] >( &f[0] ) );
+            cache.spot = key;
+            cache.distance = curve->para.distance;
+            cache.f.resize( numbands*numbins );
+            for ( unsigned int p(0); p < numbands; p++ )
+                for ( unsigned int i(0); i < numbins; i++ )
+                    cache.f[p*numbins+i] = f[p*MAX_NUMBINS+i];
+            cache.rings = curve->rings;
+            cache.elements = curve->elements;
+            cache.mesh_error = curve->mesh_error;
+        }
+    }
+    threadcache.rings.Touch( cache.keys );
+
+    double scale( 1.0 );
+    if ( curve->para.distance != cache.distance )
+        scale = pow( cache.distance / curve->para.distance, 2 );
+    for ( unsigned int p(0); p < numbands; p++ )
+        for ( unsigned int i(0); i < numbins; i++ )
+            Flux[p][i] += scale * cache.f[p*numbins+i];
+    curve->rings = cache.rings;
+    curve->elements = cache.elements;
+    curve->mesh_error = cache.mesh_error;
+}
+
+template <unsigned int N>
+static void CachedSpotFlux( LightCurveT< Dual<N> >* curve, class DeflTables* tables, unsigned int,
+                            Dual<N> Flux[NCURVES][MAX_NUMBINS] ) {
+    SpotFlux( curve, tables, 0, 0, Flux );
+}
+
+/**************************************************************************************/
+/* AddRotated:                                                                        */
+/*           adds f into Flux rotated by phi: the light curve of a spot at longitude  */
+/*           phi from that of the same spot at phi = 0. Between whole bins by linear  */
+/*           interpolation.                                                           */
+/**************************************************************************************/
+template <class T>
+static void AddRotated( T f[NCURVES][MAX_NUMBINS], double phi, unsigned int numbins, unsigned int numbands,
+                        T Flux[NCURVES][MAX_NUMBINS] ) {
+
+    ProfileTimer timer( STAGE_ADD );
+    double s( phi / (2.0*Units::PI) * numbins ), m( floor( s ) ), w( s - m );
+    unsigned int k( static_cast<unsigned int>( fmod( m, numbins*1.0 ) + numbins ) % numbins );
+
+    if ( w == 0.0 ) {
+        auto add = [&]( unsigned int p, unsigned int i, const T& x ) { Flux[p][i] += x; };
+        AddWrapped( f, k, numbins, numbands, add );
+        return;
+    }
+    for ( unsigned int p(0); p < numbands; p++ )
+        for ( unsigned int i(0); i < numbins; i++ )
+            Flux[p][i] += (1.0 - w)*f[p][(i+k) % numbins] + w*f[p][(i+k+1) % numbins];
+}
+
+/**************************************************************************************/
+/* ComputeFlux:                                                                       */
+/*           computes the light curve of the hot spot, the antipodal spot if          */
+/*           two_spots is set, and the spots of flags.spots into curve->f             */
+/*                                                                                    */
+/* pass: curve = star, spot, spectrum and flags; on return f and t are filled in      */
+/*       tables = shape model and look-up table for this star (see DeflTables)        */
+/**************************************************************************************/
+template <class T>
+struct OtherSpot {
+    T theta, rho, temperature, incl;    // as it is computed: theta <= PI/2, seen from incl
+    double phi;                         // and then rotated by phi
+};
+
+template <class T>
+void ComputeFlux( LightCurveT<T>* curve, class DeflTables* tables ) {
+
+    ProfileTimer timer( STAGE_FLUX );
+    // on the heap: with derivatives a light curve is several MB
+    std::unique_ptr< LightCurveT<T> > scratch( new LightCurveT<T> );
+    unsigned int numbins( curve->numbins ), numbands( curve->numbands ), rings(0);
+    unsigned long elements(0);
+    double mesh_error(0.0);
+    const std::vector< struct SpotSpec >* spots( curve->flags.spots );
+
+    /****************************/
+    /* Initialize time and flux */
+    /****************************/
+
+    for ( unsigned int i(0); i < numbins; i++ ) {
+        curve->t[i] = i / (1.0 * numbins);
+        for ( unsigned int p(0); p < numbands; p++ )
+            curve->f[p][i] = 0.0;
+    }
+
+    if ( curve->flags.nside > 0 ) {
+        // Pixels of the whole surface: the spot and the antipodal one are just a mask,
+        // and a map gives each pixel its own temperature; each of flags.spots is
+        // another mask, at its own temperature
+        class Healpix grid( curve->flags.nside );
+        std::vector< double > caps;
+        const std::vector< double >* mask( curve->flags.pixel_mask );
+        const class HealpixMap* map( curve->flags.pixel_map );
+        if ( !mask && !map ) {
+            grid.Cap( Value(curve->para.theta), 0.0, Value(curve->para.rho), 1.0, caps );
+            if ( curve->flags.two_spots )
+                grid.Cap( Units::PI - Value(curve->para.theta), Units::PI, Value(curve->para.rho), 1.0, caps );
+            mask = &caps;
+        }
+        if ( mask && mask->size() != grid.Pixels() )
+            throw( Exception(" The pixel mask is not 12 nside^2 long. Exiting.\n") );
+        if ( map && map->temperature.size() != grid.Pixels() )
+            throw( Exception(" The pixel map is not 12 nside^2 long. Exiting.\n") );
+
+        for ( unsigned int s(0); s <= ( spots ? spots->size() : 0 ); s++ ) {
+            *scratch = *curve;
+            scratch->defl = tables->defl;
+            SpotShape( scratch->para, tables );
+            if ( s > 0 ) {
+                const struct SpotSpec& spot( (*spots)[s-1] );
+                caps.clear();
+                grid.Cap( spot.theta, spot.phi, spot.rho, 1.0, caps );
+                mask = &caps;
+                map = 0;
+                scratch->para.temperature = spot.temperature;
+            }
+            PixelFlux( scratch.get(), tables, grid, mask, map, PixelGeometry<T>(), curve->f );
+            rings += scratch->rings;
+            elements += scratch->elements;
+        }
+        curve->rings = rings;
+        curve->elements = elements;
+        curve->mesh_error = 0.0;
+        ProfileCount( COUNT_ELEMENTS, elements );
+        return;
+    }
+
+    // The other spots. One in the southern hemisphere is its mirror image in the
+    // north seen from PI - incl, so the antipodal spot is the first spot seen from
+    // PI - incl, half a spin period later. Each is computed at phi = 0 and rotated.
+    std::vector< OtherSpot<T> > others;
+    if ( curve->flags.two_spots ) {
+        OtherSpot<T> o = { curve->para.theta, curve->para.rho, curve->para.temperature,
+                           Units::PI - curve->para.incl, Units::PI };
+        others.push_back( o );
+    }
+    for ( unsigned int s(0); spots && s < spots->size(); s++ ) {
+        const struct SpotSpec& spot( (*spots)[s] );
+        bool south( spot.theta > 0.5*Units::PI );
+        OtherSpot<T> o = { south ? Units::PI - spot.theta : spot.theta, spot.rho, spot.temperature,
+                           south ? Units::PI - curve->para.incl : curve->para.incl, spot.phi };
+        others.push_back( o );
+    }
+
+    std::shared_ptr< DeflTables > own;           // the tables of a spot at another latitude
+    std::vector< T > f( others.empty() ? 0 : NCURVES*MAX_NUMBINS );
+    for ( unsigned int s(0); s < others.size(); s++ ) {
+        // An oblate star needs the tables for the spot's latitude (see DeflTables)
+        class DeflTables* spot_tables( tables );
+        if ( tables->NS_model != 3 && Value(others[s].theta) != tables->theta ) {
+            std::unique_ptr< LightCurve > star( new LightCurve );
+            star->para.mass = Value(curve->para.mass);
+            star->para.req = Value(curve->para.req);
+            star->para.mass_over_r = Value(curve->para.mass_over_r);
+            star->para.omega = Value(curve->para.omega);
+            star->para.theta = Value(others[s].theta);
+            star->flags.NS_model = tables->NS_model;
+            own = SessionCache().Get( star.get() );
+            spot_tables = own.get();
+        }
+
+        *scratch = *curve;
+        scratch->defl = spot_tables->defl;
+        scratch->para.theta = others[s].theta;
+        scratch->para.rho = others[s].rho;
+        scratch->para.temperature = others[s].temperature;
+        SpotShape( scratch->para, spot_tables );
+        scratch->para.incl = others[s].incl;
+        std::fill( f.begin(), f.end(), T(0.0) );
+        T (*spot_f)[MAX_NUMBINS]( reinterpret_cast< T (*)[MAX_NUMBINS] >( &f[0] ) );
+        CachedSpotFlux( scratch.get(), spot_tables, s + 1, spot_f );
+        AddRotated( spot_f, others[s].phi, numbins, numbands, curve->f );
+        rings += scratch->rings;
+        elements += scratch->elements;
+        mesh_error += scratch->mesh_error;
+    }
+
+    *scratch = *curve;
+    scratch->defl = tables->defl;
+    SpotShape( scratch->para, tables );
+    CachedSpotFlux( scratch.get(), tables, 0, curve->f );
+    curve->rings = rings + scratch->rings;
+    curve->elements = elements + scratch->elements;
+    curve->mesh_error = mesh_error + scratch->mesh_error;
+    ProfileCount( COUNT_ELEMENTS, curve->elements );
+    CachesDone( curve );
+}
+
+/**************************************************************************************/
+/* ReadSpots:                                                                         */
+/*           see Engine.h. Blank lines and lines starting with # are skipped.         */
+/**************************************************************************************/
+void ReadSpots( const char* file, std::vector< struct SpotSpec >& spots ) {
+
+    std::ifstream in( file );
+    if ( !in )
+        throw( Exception(" Couldn't open the hot spots file. Exiting.\n") );
+
+    spots.clear();
+    std::string line;
+    while ( std::getline( in, line ) ) {
+        std::istringstream fields( line );
+        struct SpotSpec spot;
+        if ( line.empty() || line[0] == '#' || !(fields >> spot.theta) ) continue;
+        if ( !(fields >> spot.phi >> spot.rho >> spot.temperature) )
+            throw( Exception(" A line of the hot spots file has fewer than 4 numbers. Exiting.\n") );
+        if ( spot.theta < 0.0 || spot.theta > 180.0 || spot.rho <= 0.0 || spot.temperature < 0.0 )
+            throw( Exception(" Hot spots need 0 <= theta <= 180, rho > 0 and T >= 0. Exiting.\n") );
+        spot.theta *= Units::PI / 180.0;
+        spot.phi *= Units::PI / 180.0;
+        spots.push_back( spot );
+    }
+}
+
+/**************************************************************************************/
+/* Normalize:                                                                         */
+/*           normalizes each band of Flux to an average of 1, in place, as Normalize1 */
+/*           in Chi.cpp does; a band that is 0 everywhere is set to 1                 */
+/**************************************************************************************/
+template <class T>
+static void Normalize( T Flux[NCURVES][MAX_NUMBINS], unsigned int numbins, unsigned int numbands ) {
+
+    for ( unsigned int p(0); p < numbands; p++ ) {
+        T norm(0.0);
+        for ( unsigned int i(0); i < numbins; i++ )
+            norm += Flux[p][i];
+        if ( norm != 0.0 ) norm /= (numbins*1.0); // makes norm the average value for each curve
+
+        for ( unsigned int i(0); i < numbins; i++ ) {
+            if ( norm != 0.0 ) Flux[p][i] /= norm;
+            else Flux[p][i] = 1.0;
+        }
+    }
+}
+
+/**************************************************************************************/
+/* NormalizeFlux:                                                                     */
+/*           normalizes the flux to 1, adds the background and renormalizes to 1      */
+/*                                                                                    */
+/* pass: curve = light curve with f filled in by ComputeFlux                          */
+/**************************************************************************************/
+template <class T>
+void NormalizeFlux( LightCurveT<T>* curve ) {
+
+    if ( !curve->flags.normalize_flux ) return;
+
+    ProfileTimer timer( STAGE_NORMALIZE );
+    unsigned int numbins( curve->numbins ), numbands( curve->numbands );
+
+    Normalize( curve->f, numbins, numbands );
+
+    // Add background to normalized flux
+    for ( unsigned int i(0); i < numbins; i++ )
+        for ( unsigned int p(0); p < numbands; p++ )
+            curve->f[p][i] = curve->f[p][i] + curve->background[p];
+
+    // Renormalize to 1.0
+    Normalize( curve->f, numbins, numbands );
+}
+
+template void ComputeFlux( LightCurveT<double>*, class DeflTables* );
+template void ComputeFlux( LightCurveT<FitDual>*, class DeflTables* );
+template void NormalizeFlux( LightCurveT<double>* );
+template void NormalizeFlux( LightCurveT<FitDual>* );
+
+/**************************************************************************************/
+/* FitContext:                                                                        */
+/*           sets up a light curve and (empty) look-up tables for each thread         */
+/*                                                                                    */
+/* pass: curve = the light curve set up as for a single run of Spot                   */
+/*       x = full parameter vector; the fixed parameters are taken from here          */
+/*       vary = which parameters are varied                                           */
+/**************************************************************************************/
+FitContext::FitContext( class LightCurve* c, class DataStruct* data, class ThreadPool* p,
+                        const double x[NDIM], const bool vary[NDIM] )
+  : curve(c), obsdata(data), pool(p), ndim(0) {
+
+    for ( unsigned int k(0); k < NDIM; k++ ) {
+        x0[k] = x[k];
+        if ( vary[k] ) index[ndim++] = k;
+    }
+    for ( unsigned int t(0); t < pool->size(); t++ ) {
+        scratch.push_back( new LightCurve );
+        tables.push_back( std::shared_ptr< DeflTables >() );
+        rebuilt.push_back( 0 );
+    }
+}
+
+FitContext::~FitContext() {
+    for ( unsigned int t(0); t < scratch.size(); t++ )
+        delete scratch[t];
+}
+
+void FitContext::Expand( const double x[], double full[NDIM] ) const {
+    for ( unsigned int k(0); k < NDIM; k++ ) full[k] = x0[k];
+    for ( unsigned int k(0); k < ndim; k++ ) full[index[k]] = x[k];
+}
+
+unsigned long FitContext::Rebuilt() const {
+    unsigned long n(0);
+    for ( unsigned int t(0); t < rebuilt.size(); t++ ) n += rebuilt[t];
+    return n;
+}
+
+/**************************************************************************************/
+/* FitContext::Evaluate:                                                              */
+/*           computes the light curve at x and its chi^2 against the data. Returns    */
+/*           HUGE_CHI for unphysical parameters or if the light curve has NaNs.       */
+/**************************************************************************************/
+double FitContext::Evaluate( const double x[], unsigned int thread ) {
+
+    double full[NDIM], chi;
+    class LightCurve* c( scratch[thread] );
+
+    Expand( x, full );
+    *c = *curve;
+    if ( !LoadFitParameters( c, full ) ) return HUGE_CHI;
+
+    if ( !tables[thread] || !tables[thread]->Matches( c ) ) {
+        tables[thread] = SessionCache().Get( c );
+        rebuilt[thread]++;
+    }
+    if ( tables[thread]->problem ) return HUGE_CHI;
+
+    ComputeFlux( c, tables[thread].get() );
+    NormalizeFlux( c );
+    chi = ChiSquare( obsdata, c );
+    if ( std::isnan(chi) ) return HUGE_CHI;
+    return chi;
+}
+
+/**************************************************************************************/
+/* Promote:                                                                           */
+/*           copies the inputs of ComputeFlux from c into d, with zero derivatives    */
+/**************************************************************************************/
+static void Promote( const class LightCurve& c, LightCurveT<FitDual>* d ) {
+
+    for ( unsigned int i(0); i < MAX_NUMBINS; i++ ) d->t[i] = c.t[i];
+    for ( unsigned int p(0); p < NCURVES; p++ ) d->background[p] = c.background[p];
+
+    d->para.theta = c.para.theta;
+    d->para.phi_0 = c.para.phi_0;
+    d->para.dS = c.para.dS;
+    d->para.rho = c.para.rho;
+    d->para.incl = c.para.incl;
+    d->para.aniso = c.para.aniso;
+    d->para.Gamma = c.para.Gamma;
+    d->para.Gamma1 = c.para.Gamma1;
+    d->para.Gamma2 = c.para.Gamma2;
+    d->para.Gamma3 = c.para.Gamma3;
+    d->para.temperature = c.para.temperature;
+    d->para.mass = c.para.mass;
+    d->para.radius = c.para.radius;
+    d->para.req = c.para.req;
+    d->para.rspot = c.para.rspot;
+    d->para.rpole = c.para.rpole;
+    d->para.mass_over_r = c.para.mass_over_r;
+    d->para.omega = c.para.omega;
+    d->para.cosgamma = c.para.cosgamma;
+    d->para.bbrat = c.para.bbrat;
+    d->para.ts = c.para.ts;
+    d->para.E_band_lower_1 = c.para.E_band_lower_1;
+    d->para.E_band_upper_1 = c.para.E_band_upper_1;
+    d->para.E_band_lower_2 = c.para.E_band_lower_2;
+    d->para.E_band_upper_2 = c.para.E_band_upper_2;
+    d->para.distance = c.para.distance;
+    d->para.rsc = c.para.rsc;
+    d->para.Isc = c.para.Isc;
+    d->para.bmodel = c.para.bmodel;
+    d->para.E0 = c.para.E0;
+    d->para.E1 = c.para.E1;
+    d->para.E2 = c.para.E2;
+    d->para.DeltaE = c.para.DeltaE;
+
+    d->flags = c.flags;
+    d->defl = c.defl;
+    d->numbins = c.numbins;
+    d->numbands = c.numbands;
+    d->numtheta = c.numtheta;
+    d->rings = c.rings;
+    d->elements = c.elements;
+    d->mesh_error = c.mesh_error;
+    d->eclipse = c.eclipse;
+    d->ingoing = c.ingoing;
+    d->problem = c.problem;
+    d->count = c.count;
+}
+
+/**************************************************************************************/
+/* FitContext::Gradient:                                                              */
+/*           computes chi^2 at x and its gradient with respect to the varied          */
+/*           parameters, by carrying FitDual through the light curve. The k-th        */
+/*           derivative of each FitDual is with respect to the k-th full parameter,   */
+/*           in the units of LoadFitParameters.                                       */
+/**************************************************************************************/
+double FitContext::Gradient( const double x[], double grad[], unsigned int thread ) {
+
+    double full[NDIM];
+    const double degree( Units::PI/180.0 );
+    class LightCurve* c( scratch[thread] );
+
+    for ( unsigned int k(0); k < ndim; k++ ) grad[k] = 0.0;
+
+    Expand( x, full );
+    *c = *curve;
+    if ( !LoadFitParameters( c, full ) ) return HUGE_CHI;
+
+    if ( !tables[thread] || !tables[thread]->Matches( c ) ) {
+        tables[thread] = SessionCache().Get( c );
+        rebuilt[thread]++;
+    }
+    if ( tables[thread]->problem ) return HUGE_CHI;
+
+    // on the heap: with derivatives a light curve is several MB
+    std::unique_ptr< LightCurveT<FitDual> > d( new LightCurveT<FitDual> );
+    Promote( *c, d.get() );
+
+    // Seed the derivatives of what LoadFitParameters set with respect to the parameters
+    d->para.mass.d[0] = c->para.mass / full[0];
+    d->para.mass_over_r.d[0] = c->para.mass_over_r / full[0];
+    d->para.mass_over_r.d[1] = -c->para.mass_over_r / full[1];
+    d->para.req.d[1] = c->para.req / full[1];
+    d->para.radius = d->para.req;
+    d->para.incl.d[2] = c->flags.only_second_spot ? -degree : degree;
+    d->para.theta.d[3] = degree;
+    d->para.rho.d[4] = 1.0;
+    d->para.temperature.d[5] = 1.0;
+    d->para.ts.d[6] = 1.0;
+
+    ComputeFlux( d.get(), tables[thread].get() );
+    NormalizeFlux( d.get() );
+    FitDual chi( ChiSquare( obsdata, d.get() ) );
+    if ( std::isnan(chi.v) ) return HUGE_CHI;
+
+    for ( unsigned int k(0); k < ndim; k++ ) grad[k] = chi.d[index[k]];
+    return chi.v;
+}
@@ -0,0 +1,174 @@
+/***************************************************************************************/
+/*                                      Engine.h
+
+    This is the header file for Engine.cpp, which holds the pieces of Spot.cpp that
+    are needed every time a light curve is computed: the shape model and bending
+    angle look-up table for a star, and the loop over the mesh of the hot spot(s).
+
+    Pulling them out of main lets the fitter (FitCurve in Chi.cpp) compute many
+    light curves in one run, and reuse the tables while M and R are unchanged.
+*/
+/***************************************************************************************/
+
+#ifndef ENGINE_H
+#define ENGINE_H
+
+#include <vector>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include "Struct.h"
+#include "Chi.h"
+
+class OblModelBase;
+class OblDeflectionTOA;
+class ThreadPool;
+
+#define HUGE_CHI 1.0e30  // chi^2 given to parameters outside the physical range
+#define DEFL_CACHE_MB 64 // default memory budget of the session cache of look-up tables
+#define MESH_MAX_DEPTH 8 // most times a ring of the starting mesh is halved by the adaptive mesh
+
+// Everything that depends only on the star (M, R_eq, spin, shape model) and the spot
+// latitude: the shape model, the deflection/time-of-arrival routines, and the b vs psi
+// look-up table. Building it is the expensive part of setting up a light curve.
+class DeflTables {
+ 	public:
+  		DeflTables( const class LightCurve* curve );
+  		~DeflTables();
+
+  		// True if these tables were built for the star (and spot, if oblate) in curve
+  		bool Matches( const class LightCurve* curve ) const;
+
+  		OblModelBase* model;        // shape of the star
+  		OblDeflectionTOA* defltoa;  // deflection angles and times of arrival
+  		class Defl defl;            // b vs psi look-up table, b_max, psi_max
+  		double mass,                // unitless
+  		       req,                 // unitless
+  		       rspot,               // radius at the spot, unitless
+  		       mass_over_r,         // as passed in from the command line
+  		       omega,               // unitless
+  		       theta,               // spot latitude the oblate rspot was computed for
+  		       quadrature;          // OblDeflectionTOA::Quadrature() they were built with
+  		unsigned int NS_model;
+  		bool problem;               // set if a NaN showed up building the table
+
+ 	private:
+  		DeflTables( const DeflTables& );
+  		DeflTables& operator=( const DeflTables& );
+};
+
+// Least recently used cache of look-up tables, keyed by the star (M/R, R_eq, M, spin,
+// shape model, and the spot latitude if oblate; the same things Matches compares).
+// Light curves that only differ in the angles, temperature or time shift get the tables
+// already built. All the threads share it; tables in the cache are never changed, and
+// a thread keeps its own tables alive (shared_ptr) after they drop out of the cache.
+// When the tables kept take more than the memory budget, the least recently used go.
+class DeflCache {
+ 	public:
+  		explicit DeflCache( double megabytes = DEFL_CACHE_MB );
+
+  		// Tables for the star in curve, from the cache or built now and kept. *built
+  		// is set if they had to be built.
+  		std::shared_ptr< DeflTables > Get( const class LightCurve* curve, bool* built = 0 );
+
+  		// Sets the memory budget, dropping the least recently used tables if over it
+  		void SetBudget( double megabytes );
+
+  		unsigned long Hits() const;      // number of Gets that found the tables
+  		unsigned long Misses() const;    // number of Gets that built them
+  		unsigned long Size() const;      // number of tables kept
+  		double Megabytes() const;        // memory they take
+
+ 	private:
+  		struct Key {
+  		    double mass_over_r, req, mass, omega, theta, quadrature;
+  		    unsigned int NS_model;
+  		    bool operator==( const Key& k ) const;
+  		};
+  		struct KeyHash {
+  		    size_t operator()( const Key& k ) const;
+  		};
+  		typedef std::list< std::pair< Key, std::shared_ptr< DeflTables > > > Entries;
+
+  		static Key MakeKey( const class LightCurve* curve );
+  		void Trim();
+
+  		Entries entries;                                            // most recently used first
+  		std::unordered_map< Key, Entries::iterator, KeyHash > index;
+  		double budget;                                              // bytes
+  		unsigned long hits, misses;
+  		mutable std::mutex lock;
+
+  		DeflCache( const DeflCache& );
+  		DeflCache& operator=( const DeflCache& );
+};
+
+// The cache used for every light curve of a run of spot: by main and the fitters
+class DeflCache& SessionCache();
+
+// Adds up the flux from the whole mesh of the spot (and the antipodal spot, if
+// curve->flags.two_spots, and each of curve->flags.spots) into curve->f; also sets curve->t, and the size and error
+// of the mesh (rings, elements, mesh_error). With curve->flags.mesh_tolerance set, the
+// numtheta rings are halved where the flux needs it, up to MESH_MAX_DEPTH times. With
+// curve->flags.nside set, the mesh is the equal-area pixels of the whole surface,
+// weighted by flags.pixel_mask and at the temperatures of flags.pixel_map if given;
+// each thread keeps the angles of the pixels while the star and observer stay the same.
+// T is double, or FitDual to get the derivatives of the flux along with it (see
+// Gradient).
+template <class T>
+void ComputeFlux( LightCurveT<T>* curve, class DeflTables* tables );
+
+// Reads the hot spots besides the one in para from a file of lines <theta [deg]>
+// <phi [deg]> <rho [rad]> <T [keV]>, for flags.spots
+void ReadSpots( const char* file, std::vector< struct SpotSpec >& spots );
+
+// Normalizes curve->f to 1, adds curve->background and renormalizes, if
+// curve->flags.normalize_flux is set.
+template <class T>
+void NormalizeFlux( LightCurveT<T>* curve );
+
+// What the fitter and the samplers need to turn a point in parameter space into a
+// chi^2: which of the NDIM parameters are varied, the values of the fixed ones, and a
+// light curve and set of look-up tables for each thread of the pool.
+// Parameters, in order: M [Msun], R_eq [km], incl [deg], theta [deg], rho [rad],
+// T [keV], ts [phase] (see LoadFitParameters in Chi.h).
+class FitContext {
+ 	public:
+  		FitContext( class LightCurve* curve, class DataStruct* obsdata, class ThreadPool* pool,
+  		            const double x[NDIM], const bool vary[NDIM] );
+  		~FitContext();
+
+  		// chi^2 at the point x of the ndim varied parameters, using thread's workspace
+  		double Evaluate( const double x[], unsigned int thread );
+
+  		// chi^2 at x as Evaluate, and its derivatives with respect to the ndim varied
+  		// parameters in grad, exact to rounding: the light curve is computed once with
+  		// FitDual in place of double (forward-mode automatic differentiation, see
+  		// Dual.h). grad is 0 where HUGE_CHI is returned.
+  		double Gradient( const double x[], double grad[], unsigned int thread );
+
+  		// Fills in the fixed parameters around the varied ones
+  		void Expand( const double x[], double full[NDIM] ) const;
+
+  		// Number of times a thread needed tables for a new star, over all threads; they
+  		// were built then unless the session cache had them (see DeflCache)
+  		unsigned long Rebuilt() const;
+
+  		class LightCurve* curve;                    // flags, bands, mesh and fixed parameters
+  		class DataStruct* obsdata;
+  		class ThreadPool* pool;
+  		double x0[NDIM];                            // full parameter vector; varied entries are overwritten
+  		unsigned int index[NDIM];                   // which full parameter each varied coordinate is
+  		unsigned int ndim;                          // number of varied parameters
+
+ 	private:
+  		std::vector< class LightCurve* > scratch;   // one light curve per thread
+  		std::vector< std::shared_ptr< DeflTables > > tables;  // the look-up tables each thread is using
+  		std::vector< unsigned long > rebuilt;       // number of times each thread changed star
+
+  		FitContext( const FitContext& );
+  		FitContext& operator=( const FitContext& );
+};
+
+#endif // ENGINE_H
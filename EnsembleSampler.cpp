@@ -0,0 +1,285 @@
+/***************************************************************************************/
+/*                                EnsembleSampler.cpp
+
+    Affine-invariant ensemble MCMC (Goodman & Weare 2010, Comm. App. Math. Comp. Sci.
+    5, 65; parallel half-ensemble update of Foreman-Mackey et al. 2013, PASP 125, 306).
+*/
+/***************************************************************************************/
+
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <random>
+#include <vector>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "EnsembleSampler.h"
+#include "Engine.h"
+#include "Prior.h"
+#include "ThreadPool.h"
+#include "Exception.h"
+#include "Struct.h"
+
+struct ChainHeader {         // 64 bytes; see EnsembleSampler.h
+    char magic[8];
+    int32_t ndim;
+    int32_t nwalkers;
+    int32_t nsteps;
+    int32_t steps_done;
+    uint64_t seed;
+    int32_t vary[NDIM];
+    char padding[64 - 32 - 4*NDIM];
+};
+
+struct ChainRecord {
+    double lnpost;
+    double x[NDIM];
+};
+
+/**************************************************************************************/
+/* ChainFile:                                                                         */
+/*           the memory-mapped chain; opens (and checks) an existing one to resume,   */
+/*           otherwise creates it. Grows the file if more steps are asked for.        */
+/**************************************************************************************/
+class ChainFile {
+ 	public:
+  		ChainFile( const char* name, unsigned int nwalkers, unsigned int nsteps,
+  		           const bool vary[NDIM], bool resume );
+  		~ChainFile();
+  		ChainRecord* Step( unsigned int s ) { return records + s * header->nwalkers; }
+  		void Checkpoint( unsigned int steps_done );
+
+  		ChainHeader* header;
+ 	private:
+  		ChainRecord* records;
+  		void* base;
+  		size_t size;
+  		int fd;
+};
+
+ChainFile::ChainFile( const char* name, unsigned int nwalkers, unsigned int nsteps,
+                      const bool vary[NDIM], bool resume )
+  : header(0), records(0), base(MAP_FAILED), size(0), fd(-1) {
+
+    bool fresh( true );
+    struct stat st;
+
+    if ( resume && stat( name, &st ) == 0 && st.st_size >= static_cast<off_t>(sizeof(ChainHeader)) ) {
+        fd = open( name, O_RDWR );
+        ChainHeader old;
+        if ( fd < 0 || pread( fd, &old, sizeof(old), 0 ) != static_cast<ssize_t>(sizeof(old)) )
+            throw( Exception(" Couldn't read the chain file to resume. Exiting.\n") );
+        bool same( memcmp( old.magic, "SPOTMCMC", 8 ) == 0 && old.ndim == NDIM
+                   && old.nwalkers == static_cast<int32_t>(nwalkers) );
+        for ( unsigned int k(0); k < NDIM; k++ )
+            same = same && ( old.vary[k] != 0 ) == vary[k];
+        if ( !same )
+            throw( Exception(" The chain file is for different parameters or walkers; can't resume. Exiting.\n") );
+        fresh = false;
+        if ( static_cast<unsigned int>(old.nsteps) > nsteps ) nsteps = old.nsteps;
+    }
+    else {
+        fd = open( name, O_RDWR | O_CREAT | O_TRUNC, 0644 );
+        if ( fd < 0 )
+            throw( Exception(" Couldn't create the chain file. Exiting.\n") );
+    }
+
+    size = sizeof(ChainHeader) + sizeof(ChainRecord) * static_cast<size_t>(nwalkers) * nsteps;
+    if ( ftruncate( fd, size ) != 0 )
+        throw( Exception(" Couldn't size the chain file. Exiting.\n") );
+    base = mmap( 0, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 );
+    if ( base == MAP_FAILED )
+        throw( Exception(" Couldn't memory-map the chain file. Exiting.\n") );
+
+    header = static_cast<ChainHeader*>( base );
+    records = reinterpret_cast<ChainRecord*>( static_cast<char*>(base) + sizeof(ChainHeader) );
+
+    if ( fresh ) {
+        memset( header, 0, sizeof(ChainHeader) );
+        memcpy( header->magic, "SPOTMCMC", 8 );
+        header->ndim = NDIM;
+        header->nwalkers = nwalkers;
+        header->seed = 20071;
+        for ( unsigned int k(0); k < NDIM; k++ ) header->vary[k] = vary[k] ? 1 : 0;
+    }
+    header->nsteps = nsteps;
+}
+
+ChainFile::~ChainFile() {
+    if ( base != MAP_FAILED ) {
+        msync( base, size, MS_SYNC );
+        munmap( base, size );
+    }
+    if ( fd >= 0 ) close( fd );
+}
+
+// Flushes the records, then marks them as done, so steps_done never runs ahead of
+// what is on disk.
+void ChainFile::Checkpoint( unsigned int steps_done ) {
+    msync( base, size, MS_SYNC );
+    header->steps_done = steps_done;
+    msync( base, sizeof(ChainHeader), MS_SYNC );
+}
+
+/**************************************************************************************/
+/* LogPosterior:                                                                      */
+/*           log prior + log likelihood (-chi^2/2) at the varied parameters x         */
+/**************************************************************************************/
+static double LogPosterior( class FitContext* fit, const class PriorSet* priors,
+                            const bool vary[NDIM], const double x[], unsigned int thread ) {
+    double full[NDIM], lp, chi;
+
+    fit->Expand( x, full );
+    lp = priors->LogDensity( full, vary );
+    if ( !(lp > -std::numeric_limits<double>::infinity()) ) return lp;
+    chi = fit->Evaluate( x, thread );
+    if ( chi >= HUGE_CHI ) return -std::numeric_limits<double>::infinity();
+    return lp - 0.5 * chi;
+}
+
+/**************************************************************************************/
+/* EnsembleSample:                                                                    */
+/*           see EnsembleSampler.h                                                    */
+/**************************************************************************************/
+double EnsembleSample( class LightCurve* curve, class DataStruct* obsdata, double x[NDIM],
+                       const double step[NDIM], const bool vary[NDIM], const class PriorSet* priors,
+                       unsigned int nwalkers, unsigned int nsteps, unsigned int numthreads,
+                       const char* chain_file, bool resume ) {
+
+    class ThreadPool pool( numthreads );
+    class FitContext fit( curve, obsdata, &pool, x, vary );
+    unsigned int ndim( fit.ndim ), half, start(0);
+    const double minus_inf( -std::numeric_limits<double>::infinity() );
+
+    if ( ndim == 0 )
+        throw( Exception(" EnsembleSample: no parameters to vary. Exiting.\n") );
+    if ( nwalkers < 2*ndim ) nwalkers = 2*ndim;
+    if ( nwalkers % 2 ) nwalkers++;
+    half = nwalkers/2;
+
+    class ChainFile chain( chain_file, nwalkers, nsteps, vary, resume );
+    nsteps = chain.header->nsteps;
+    uint64_t seed( chain.header->seed );
+
+    std::vector< std::vector<double> > walker( nwalkers, std::vector<double>(ndim) );
+    std::vector< double > lnpost( nwalkers, minus_inf );
+    std::vector< unsigned int > accepted( nwalkers, 0 );
+
+    // Every random number is drawn from a generator seeded by (seed, step, walker), so
+    // the chain does not depend on the number of threads, and a resumed run carries
+    // on exactly as if it had never stopped.
+    auto generator = [seed]( unsigned int s, unsigned int k ) {
+        std::seed_seq seq{ static_cast<uint32_t>(seed), static_cast<uint32_t>(seed >> 32),
+                           static_cast<uint32_t>(s), static_cast<uint32_t>(k) };
+        return std::mt19937_64( seq );
+    };
+
+    if ( chain.header->steps_done > 0 ) {
+        start = chain.header->steps_done;
+        ChainRecord* last( chain.Step( start-1 ) );
+        for ( unsigned int k(0); k < nwalkers; k++ ) {
+            for ( unsigned int j(0); j < ndim; j++ ) walker[k][j] = last[k].x[fit.index[j]];
+            lnpost[k] = last[k].lnpost;
+        }
+        std::cout << "EnsembleSample: resuming " << chain_file << " at step " << start << std::endl;
+    }
+    else {
+        // Start in a small ball around x, redrawing walkers the posterior rules out
+        pool.Run( nwalkers, [&]( unsigned int k, unsigned int thread ) {
+            std::mt19937_64 rng( generator( 0xffffffffu, k ) );
+            std::normal_distribution<double> normal( 0.0, 1.0 );
+            for ( unsigned int tries(0); tries < 100 && !(lnpost[k] > minus_inf); tries++ ) {
+                for ( unsigned int j(0); j < ndim; j++ )
+                    walker[k][j] = x[fit.index[j]] + 0.1 * step[fit.index[j]] * normal( rng );
+                lnpost[k] = LogPosterior( &fit, priors, vary, &walker[k][0], thread );
+            }
+        } );
+        for ( unsigned int k(0); k < nwalkers; k++ )
+            if ( !(lnpost[k] > minus_inf) )
+                throw( Exception(" EnsembleSample: couldn't start the walkers; the starting point is outside the prior. Exiting.\n") );
+    }
+
+    /**********************************************/
+    /* STRETCH MOVES, ONE HALF-ENSEMBLE AT A TIME */
+    /**********************************************/
+
+    for ( unsigned int s(start); s < nsteps; s++ ) {
+        for ( unsigned int h(0); h < 2; h++ ) {
+            unsigned int first( h*half ), other( (1-h)*half );
+            pool.Run( half, [&]( unsigned int n, unsigned int thread ) {
+                unsigned int k( first + n );
+                std::mt19937_64 rng( generator( s, k ) );
+                std::uniform_real_distribution<double> uniform( 0.0, 1.0 );
+                double a( MCMC_STRETCH ), y[NDIM];
+
+                unsigned int partner( other + static_cast<unsigned int>( uniform(rng) * half ) % half );
+                double z( pow( (a - 1.0) * uniform(rng) + 1.0, 2 ) / a ); // g(z) ~ 1/sqrt(z) on [1/a, a]
+                for ( unsigned int j(0); j < ndim; j++ )
+                    y[j] = walker[partner][j] + z * ( walker[k][j] - walker[partner][j] );
+
+                double lnp( LogPosterior( &fit, priors, vary, y, thread ) );
+                double lnq( (ndim - 1.0) * log(z) + lnp - lnpost[k] );
+                if ( lnp > minus_inf && log( uniform(rng) ) < lnq ) {
+                    for ( unsigned int j(0); j < ndim; j++ ) walker[k][j] = y[j];
+                    lnpost[k] = lnp;
+                    accepted[k]++;
+                }
+            } );
+        }
+
+        ChainRecord* record( chain.Step( s ) );
+        for ( unsigned int k(0); k < nwalkers; k++ ) {
+            record[k].lnpost = lnpost[k];
+            fit.Expand( &walker[k][0], record[k].x );
+        }
+        if ( (s+1) % MCMC_CHECKPOINT == 0 || s+1 == nsteps ) {
+            chain.Checkpoint( s+1 );
+            std::cout << "EnsembleSample: step " << s+1 << " of " << nsteps << " checkpointed" << std::endl;
+        }
+    }
+
+    /*********************************************/
+    /* SUMMARY OVER THE SECOND HALF OF THE CHAIN */
+    /*********************************************/
+
+    unsigned int total(0);
+    for ( unsigned int k(0); k < nwalkers; k++ ) total += accepted[k];
+    double acceptance( nsteps > start ? total / (1.0 * nwalkers * (nsteps - start)) : 0.0 );
+
+    double best( minus_inf );
+    std::vector< double > mean( NDIM, 0.0 ), var( NDIM, 0.0 );
+    unsigned int count(0);
+    for ( unsigned int s(0); s < nsteps; s++ ) {
+        ChainRecord* record( chain.Step( s ) );
+        for ( unsigned int k(0); k < nwalkers; k++ ) {
+            if ( record[k].lnpost > best ) {
+                best = record[k].lnpost;
+                for ( unsigned int j(0); j < NDIM; j++ ) x[j] = record[k].x[j];
+            }
+            if ( s >= nsteps/2 ) {
+                for ( unsigned int j(0); j < NDIM; j++ ) {
+                    mean[j] += record[k].x[j];
+                    var[j] += record[k].x[j] * record[k].x[j];
+                }
+                count++;
+            }
+        }
+    }
+
+    const char* names[NDIM] = { "M", "R_eq", "incl", "theta", "rho", "T", "ts" };
+    std::cout << "EnsembleSample: " << nwalkers << " walkers, " << nsteps << " steps, acceptance = "
+              << acceptance << ", look-up tables changed " << fit.Rebuilt() << " times on "
+              << pool.size() << " threads." << std::endl;
+    for ( unsigned int j(0); j < ndim; j++ ) {
+        unsigned int k( fit.index[j] );
+        double m( mean[k]/count );
+        std::cout << "  " << names[k] << " = " << m << " +/- "
+                  << sqrt( fabs( var[k]/count - m*m ) ) << std::endl;
+    }
+
+    return acceptance;
+}
@@ -0,0 +1,43 @@
+/***************************************************************************************/
+/*                                 EnsembleSampler.h
+
+    This is the header file for EnsembleSampler.cpp, an affine-invariant ensemble
+    MCMC sampler (the "stretch move" of Goodman & Weare 2010, as in emcee) over the
+    fit parameters M, R_eq, incl, theta, rho, T and ts.
+
+    The ensemble is split in two halves; every walker in one half is moved using the
+    other half, so a half-ensemble is computed in parallel on the thread pool, each
+    thread with its own light curve and look-up tables (see FitContext in Engine.h).
+
+    The chain is written to a memory-mapped binary file:
+      header (64 bytes): char[8] "SPOTMCMC", int32 NDIM, int32 nwalkers,
+                         int32 nsteps, int32 steps_done, uint64 seed,
+                         int32 vary[NDIM], 4 bytes padding
+      records: [nsteps][nwalkers] of { double log posterior, double x[NDIM] }
+    so it can be read with numpy.memmap. steps_done is only advanced at a checkpoint,
+    after the records before it have been synced to disk; a run that is stopped can
+    be resumed from the last checkpoint.
+*/
+/***************************************************************************************/
+
+#ifndef ENSEMBLESAMPLER_H
+#define ENSEMBLESAMPLER_H
+
+#include "Chi.h"
+
+#define MCMC_STRETCH 2.0      // scale a of the stretch move, z in [1/a, a]
+#define MCMC_CHECKPOINT 10    // steps between checkpoints of the chain file
+
+class PriorSet;
+
+// Samples the posterior of the parameters with vary[k] set. x is the centre of the
+// starting ball (of size 0.1 step) and returns the highest posterior point found.
+// If resume is set and chain_file holds a chain for the same parameters and number of
+// walkers, carries on from its last checkpoint (up to nsteps in total).
+// Returns the acceptance fraction of this run.
+double EnsembleSample( class LightCurve* curve, class DataStruct* obsdata, double x[NDIM],
+                       const double step[NDIM], const bool vary[NDIM], const class PriorSet* priors,
+                       unsigned int nwalkers, unsigned int nsteps, unsigned int numthreads,
+                       const char* chain_file, bool resume );
+
+#endif // ENSEMBLESAMPLER_H
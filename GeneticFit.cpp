@@ -0,0 +1,221 @@
+/***************************************************************************************/
+/*                                     GeneticFit.cpp
+
+    Genetic algorithm with tournament selection, uniform crossover, Gaussian mutation,
+    elitism and feasibility-first constraint handling (Deb 2000, Comput. Methods Appl.
+    Mech. Engrg. 186, 311).
+*/
+/***************************************************************************************/
+
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <random>
+#include <vector>
+#include <algorithm>
+#include <stdint.h>
+#include "GeneticFit.h"
+#include "Engine.h"
+#include "Prior.h"
+#include "ThreadPool.h"
+#include "Exception.h"
+#include "Struct.h"
+
+struct Individual {
+    std::vector<double> u;     // genes, in the unit hypercube
+    double x[NDIM];            // full parameter vector the genes map onto
+    double chi;                // chi^2
+    double violation;          // how unphysical; 0 if physical
+};
+
+// Feasibility first, then chi^2
+static bool Fitter( const Individual& a, const Individual& b ) {
+    if ( a.violation != b.violation ) return a.violation < b.violation;
+    return a.chi < b.chi;
+}
+
+/**************************************************************************************/
+/* GeneticFit:                                                                        */
+/*           see GeneticFit.h                                                         */
+/**************************************************************************************/
+double GeneticFit( class LightCurve* curve, class DataStruct* obsdata, double x[NDIM],
+                   const bool vary[NDIM], const class PriorSet* priors,
+                   unsigned int population, unsigned int generations,
+                   unsigned int numthreads, const char* log_file ) {
+
+    class ThreadPool pool( numthreads );
+    class FitContext fit( curve, obsdata, &pool, x, vary );
+    unsigned int ndim( fit.ndim ), stars(0);
+    const uint64_t seed( 20071 );
+    bool oblate( curve->flags.NS_model != 3 );
+    int incl_gene(-1), theta_gene(-1), mass_gene(-1), req_gene(-1);
+
+    if ( ndim == 0 )
+        throw( Exception(" GeneticFit: no parameters to vary. Exiting.\n") );
+    if ( population == 0 ) population = 10 * ndim;
+    if ( population < GA_ELITE + 2 ) population = GA_ELITE + 2;
+    for ( unsigned int j(0); j < ndim; j++ ) {
+        if ( fit.index[j] == 0 ) mass_gene = j;
+        if ( fit.index[j] == 1 ) req_gene = j;
+        if ( fit.index[j] == 2 ) incl_gene = j;
+        if ( fit.index[j] == 3 ) theta_gene = j;
+    }
+
+    std::ofstream log( log_file );
+    if ( !log )
+        throw( Exception(" Couldn't open the genetic algorithm log file. Exiting.\n") );
+    log.precision( 10 );
+    log << "# generation, best chi^2, median chi^2, physical, stars, best M R_eq incl theta rho T ts" << std::endl;
+
+    // Each random number comes from a generator seeded by (seed, generation, child),
+    // as in the samplers, so the run does not depend on the number of threads.
+    auto generator = [seed]( unsigned int s, unsigned int k ) {
+        std::seed_seq seq{ static_cast<uint32_t>(seed), static_cast<uint32_t>(seed >> 32),
+                           static_cast<uint32_t>(s), static_cast<uint32_t>(k) };
+        return std::mt19937_64( seq );
+    };
+
+    // Maps the genes onto the parameters, folding onto theta <= 90
+    auto express = [&]( Individual& a ) {
+        double xr[NDIM];
+        for ( unsigned int j(0); j < ndim; j++ )
+            xr[j] = (*priors)[ fit.index[j] ]->Transform( a.u[j] );
+        fit.Expand( xr, a.x );
+        if ( incl_gene >= 0 && theta_gene >= 0 && a.x[3] > 90.0 ) {
+            const Prior* pi( (*priors)[2] );
+            const Prior* pe( (*priors)[3] );
+            double incl( 180.0 - a.x[2] ), theta( 180.0 - a.x[3] );
+            if ( pi->LogDensity( incl ) > -std::numeric_limits<double>::infinity()
+                 && pe->LogDensity( theta ) > -std::numeric_limits<double>::infinity() ) {
+                a.u[incl_gene] = pi->Cdf( incl );
+                a.u[theta_gene] = pe->Cdf( theta );
+                a.x[2] = incl;
+                a.x[3] = theta;
+            }
+        }
+        a.violation = ParameterViolation( a.x );
+        if ( a.violation != a.violation ) a.violation = std::numeric_limits<double>::max();
+    };
+
+    // Computes chi^2 for the individuals in list, a star at a time on each thread
+    auto evaluate = [&]( std::vector<Individual>& pop, std::vector<unsigned int> list ) {
+        auto star_less = [&]( unsigned int a, unsigned int b ) {
+            if ( pop[a].x[0] != pop[b].x[0] ) return pop[a].x[0] < pop[b].x[0];
+            if ( pop[a].x[1] != pop[b].x[1] ) return pop[a].x[1] < pop[b].x[1];
+            return oblate && pop[a].x[3] < pop[b].x[3];
+        };
+        std::stable_sort( list.begin(), list.end(), star_less );
+        std::vector<unsigned int> first;
+        for ( unsigned int n(0); n < list.size(); n++ )
+            if ( n == 0 || star_less( list[n-1], list[n] ) ) first.push_back( n );
+        first.push_back( list.size() );
+        stars += first.size() - 1;
+
+        pool.Run( first.size() - 1, [&]( unsigned int g, unsigned int thread ) {
+            for ( unsigned int n( first[g] ); n < first[g+1]; n++ ) {
+                Individual& a( pop[list[n]] );
+                double xr[NDIM];
+                for ( unsigned int j(0); j < ndim; j++ ) xr[j] = a.x[fit.index[j]];
+                a.chi = a.violation > 0.0 ? HUGE_CHI : fit.Evaluate( xr, thread );
+            }
+        } );
+    };
+
+    /********************************************************/
+    /* FIRST GENERATION: THE STARTING POINT AND RANDOM ONES */
+    /********************************************************/
+
+    std::vector<Individual> pop( population ), next( population );
+    std::vector<unsigned int> list;
+    for ( unsigned int k(0); k < population; k++ ) {
+        std::mt19937_64 rng( generator( 0xffffffffu, k ) );
+        std::uniform_real_distribution<double> uniform( 0.0, 1.0 );
+        pop[k].u.resize( ndim );
+        for ( unsigned int j(0); j < ndim; j++ )
+            pop[k].u[j] = k == 0 ? (*priors)[ fit.index[j] ]->Cdf( x[fit.index[j]] ) : uniform( rng );
+        express( pop[k] );
+        list.push_back( k );
+    }
+    evaluate( pop, list );
+
+    for ( unsigned int gen(0); ; gen++ ) {
+        std::stable_sort( pop.begin(), pop.end(), Fitter );
+
+        unsigned int physical(0);
+        for ( unsigned int k(0); k < population; k++ )
+            if ( pop[k].violation == 0.0 ) physical++;
+        log << gen << "\t" << pop[0].chi << "\t" << pop[population/2].chi << "\t"
+            << physical << "\t" << stars;
+        for ( unsigned int k(0); k < NDIM; k++ ) log << "\t" << pop[0].x[k];
+        log << std::endl;
+        if ( gen == generations ) break;
+
+        /******************************************************/
+        /* BREED THE NEXT GENERATION; THE ELITE CARRY ON      */
+        /******************************************************/
+
+        list.clear();
+        for ( unsigned int k(0); k < population; k++ ) {
+            next[k] = pop[k];
+            if ( k < GA_ELITE ) continue;
+
+            std::mt19937_64 rng( generator( gen, k ) );
+            std::uniform_real_distribution<double> uniform( 0.0, 1.0 );
+            std::normal_distribution<double> normal( 0.0, GA_MUTATION );
+            auto tournament = [&]() {
+                unsigned int best( population );
+                for ( unsigned int t(0); t < GA_TOURNAMENT; t++ ) {
+                    unsigned int c( static_cast<unsigned int>( uniform(rng) * population ) % population );
+                    if ( c < best ) best = c;      // pop is sorted, so a lower index is fitter
+                }
+                return best;
+            };
+
+            const Individual& mother( pop[tournament()] );
+            const Individual& father( pop[tournament()] );
+            Individual& child( next[k] );
+            child.u = mother.u;
+            if ( uniform( rng ) < GA_CROSSOVER ) {
+                bool star_from_father( uniform( rng ) < 0.5 );
+                for ( unsigned int j(0); j < ndim; j++ ) {
+                    bool from_father;
+                    if ( static_cast<int>(j) == mass_gene || static_cast<int>(j) == req_gene )
+                        from_father = star_from_father;   // M and R_eq go together
+                    else
+                        from_father = uniform( rng ) < 0.5;
+                    if ( from_father ) child.u[j] = father.u[j];
+                }
+            }
+
+            // Mutate each gene with chance 1/ndim (the star as one gene), reflecting
+            // back into the unit hypercube
+            bool mutate_star( uniform( rng ) * ndim < 1.0 );
+            for ( unsigned int j(0); j < ndim; j++ ) {
+                bool mutate;
+                if ( static_cast<int>(j) == mass_gene || static_cast<int>(j) == req_gene )
+                    mutate = mutate_star;
+                else
+                    mutate = uniform( rng ) * ndim < 1.0;
+                if ( !mutate ) continue;
+                double u( child.u[j] + normal( rng ) );
+                u = fabs( u );
+                u = 1.0 - fabs( 1.0 - fmod( u, 2.0 ) );
+                child.u[j] = u;
+            }
+            express( child );
+            list.push_back( k );
+        }
+        pop.swap( next );
+        evaluate( pop, list );
+    }
+
+    for ( unsigned int k(0); k < NDIM; k++ ) x[k] = pop[0].x[k];
+    log.close();
+
+    std::cout << "GeneticFit: " << generations << " generations of " << population
+              << ", " << stars << " stars computed, look-up tables changed " << fit.Rebuilt()
+              << " times on " << pool.size() << " threads. Best chi^2 = " << pop[0].chi << std::endl;
+
+    return pop[0].chi;
+}
@@ -0,0 +1,47 @@
+/***************************************************************************************/
+/*                                     GeneticFit.h
+
+    This is the header file for GeneticFit.cpp, a genetic algorithm over the fit
+    parameters M, R_eq, incl, theta, rho, T and ts. It does in one process what the
+    Ferret + param_degen scripts did by running spot once per individual.
+
+    Genes are points of the unit hypercube, mapped onto the parameters by the priors
+    (Prior::Transform), so the priors (-Y) set the search ranges. Each generation is
+    evaluated in parallel on the thread pool. Individuals with the same star (M and
+    R_eq, and theta if oblate) are given to one thread together, so the look-up tables
+    are built once per star. M and R_eq are inherited together to keep such groups.
+
+    Constraints: an unphysical individual (see ParameterViolation in Chi.h) always
+    loses to a physical one, and among themselves the least unphysical wins (Deb 2000).
+    The light curve is the same under (incl, theta) -> (180-incl, 180-theta), so
+    individuals are folded onto theta <= 90 when both are varied and the priors allow
+    it, rather than splitting the population between the two mirror solutions.
+
+    The best GA_ELITE individuals carry over to the next generation unchanged.
+    Each generation is logged to a text file: generation, best chi^2, median chi^2,
+    number of physical individuals, number of stars computed, then the best M, R_eq,
+    incl, theta, rho, T, ts.
+*/
+/***************************************************************************************/
+
+#ifndef GENETICFIT_H
+#define GENETICFIT_H
+
+#include "Chi.h"
+
+#define GA_ELITE 2           // best individuals kept unchanged from one generation to the next
+#define GA_TOURNAMENT 3      // individuals per tournament when choosing a parent
+#define GA_CROSSOVER 0.9     // chance that a child has two parents rather than one
+#define GA_MUTATION 0.1      // standard deviation of a mutation, in the unit hypercube
+
+class PriorSet;
+
+// Minimizes chi^2 over the parameters with vary[k] set, starting from a population with
+// x (the command line values) and random individuals. population = 0 picks 10 per
+// varied parameter. Returns the best chi^2; the best individual is returned in x.
+double GeneticFit( class LightCurve* curve, class DataStruct* obsdata, double x[NDIM],
+                   const bool vary[NDIM], const class PriorSet* priors,
+                   unsigned int population, unsigned int generations,
+                   unsigned int numthreads, const char* log_file );
+
+#endif // GENETICFIT_H
@@ -0,0 +1,133 @@
+/***************************************************************************************/
+/*                                     Healpix.cpp
+
+    Equal-area pixelization of the surface of the star, in the HEALPix ring scheme
+    (Gorski et al. 2005, ApJ 622, 759, section 4).
+*/
+/***************************************************************************************/
+
+#include <cmath>
+#include <cstring>
+#include <stdint.h>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include "Healpix.h"
+#include "Units.h"
+#include "Exception.h"
+
+/**************************************************************************************/
+/* Healpix:                                                                           */
+/*           sets up the rings. Ring i = 1 .. 4 nside - 1 from the north pole: in the */
+/*           polar caps (i < nside) it has 4i pixels at z = 1 - i^2/(3 nside^2),      */
+/*           in the equatorial belt 4 nside pixels at z = 4/3 - 2i/(3 nside), every   */
+/*           other ring shifted by half a pixel; the south is the mirror image.       */
+/**************************************************************************************/
+Healpix::Healpix( unsigned int nside ) : nside(nside) {
+
+    if ( nside < 1 )
+        throw( Exception(" HEALPix needs nside >= 1. Exiting.\n") );
+
+    double n( nside );
+    unsigned long first(0);
+    for ( unsigned int i(1); i < 4*nside; i++ ) {
+        struct HealpixRing ring;
+        unsigned int k( i < 2*nside ? i : 4*nside - i ); // ring counted from the nearer pole
+        double z;
+        if ( k < nside ) { // polar cap
+            z = 1.0 - k*k / (3.0*n*n);
+            ring.pixels = 4*k;
+            ring.phi0 = Units::PI / (4.0*k);
+        }
+        else {             // equatorial belt
+            z = 4.0/3.0 - 2.0*k / (3.0*n);
+            ring.pixels = 4*nside;
+            ring.phi0 = (k - nside + 1) % 2 == 0 ? 0.0 : Units::PI / (4.0*n);
+        }
+        ring.theta = i < 2*nside ? acos( z ) : Units::PI - acos( z );
+        ring.first = first;
+        first += ring.pixels;
+        rings.push_back( ring );
+    }
+}
+
+double Healpix::PixelArea() const {
+    return 4.0*Units::PI / Pixels();
+}
+
+double Healpix::Phi( unsigned int r, unsigned int j ) const {
+    return rings[r].phi0 + 2.0*Units::PI * j / rings[r].pixels;
+}
+
+void Healpix::Cap( double theta, double phi, double rho, double weight,
+                   std::vector< double >& mask ) const {
+
+    double cosrho( cos(rho) ), costheta( cos(theta) ), sintheta( sin(theta) );
+    mask.resize( Pixels(), 0.0 );
+    for ( unsigned int r(0); r < rings.size(); r++ ) {
+        double c( cos(rings[r].theta) * costheta ), s( sin(rings[r].theta) * sintheta );
+        if ( c + s < cosrho ) continue; // no pixel of the ring is close enough
+        for ( unsigned int j(0); j < rings[r].pixels; j++ )
+            if ( c + s * cos( Phi( r, j ) - phi ) >= cosrho )
+                mask[rings[r].first + j] = weight;
+    }
+}
+
+void Healpix::ReadMask( const char* file, std::vector< double >& mask ) const {
+
+    std::ifstream in( file );
+    if ( !in )
+        throw( Exception(" Couldn't open the pixel mask file. Exiting.\n") );
+
+    mask.assign( Pixels(), 0.0 );
+    std::string line;
+    while ( std::getline( in, line ) ) {
+        std::istringstream fields( line );
+        unsigned long pixel;
+        double weight(1.0);
+        if ( line.empty() || line[0] == '#' || !(fields >> pixel) ) continue;
+        fields >> weight;
+        if ( pixel >= Pixels() )
+            throw( Exception(" Pixel index in the mask file is beyond 12 nside^2. Exiting.\n") );
+        mask[pixel] = weight;
+    }
+}
+
+HealpixMap::HealpixMap( const char* file ) : nside(0) {
+
+    std::ifstream in( file, std::ios::binary );
+    if ( !in )
+        throw( Exception(" Couldn't open the pixel map file. Exiting.\n") );
+
+    char magic[8];
+    uint32_t header[2];
+    in.read( magic, sizeof(magic) );
+    in.read( reinterpret_cast<char*>( header ), sizeof(header) );
+    if ( !in || std::memcmp( magic, "SPOTMAP1", sizeof(magic) ) != 0 )
+        throw( Exception(" The pixel map file does not start with SPOTMAP1. Exiting.\n") );
+    if ( header[0] < 1 || header[1] < 1 || header[1] > 2 )
+        throw( Exception(" The pixel map file needs nside >= 1 and 1 or 2 columns. Exiting.\n") );
+
+    nside = header[0];
+    unsigned long pixels( 12UL * nside * nside );
+    std::vector< double > column( pixels );
+    for ( unsigned int c(0); c < header[1]; c++ ) {
+        in.read( reinterpret_cast<char*>( &column[0] ), pixels * sizeof(double) );
+        if ( !in )
+            throw( Exception(" The pixel map file is shorter than its header says. Exiting.\n") );
+        if ( c == 0 ) {
+            temperature = column;
+            for ( unsigned long j(0); j < pixels; j++ )
+                if ( !(temperature[j] >= 0.0) )
+                    throw( Exception(" Temperatures in the pixel map file must be >= 0. Exiting.\n") );
+        }
+        else {
+            beaming.resize( pixels );
+            for ( unsigned long j(0); j < pixels; j++ ) {
+                if ( column[j] != 0.0 && column[j] != 1.0 )
+                    throw( Exception(" Beaming models in the pixel map file must be 0 or 1. Exiting.\n") );
+                beaming[j] = static_cast<unsigned int>( column[j] );
+            }
+        }
+    }
+}
@@ -0,0 +1,71 @@
+/***************************************************************************************/
+/*                                     Healpix.h
+
+    This is the header file for Healpix.cpp, an equal-area pixelization of the whole
+    surface of the star in the ring scheme of HEALPix (Gorski et al. 2005, ApJ 622,
+    759): 12 nside^2 pixels of the same solid angle, on 4 nside - 1 rings of constant
+    latitude, the pixels of each ring evenly spaced in phi.
+
+    A ring of pixels is one latitude, so its light curve is worked out once and each
+    of its pixels adds it in shifted by the pixel's phi (see PixelFlux in Engine.cpp).
+    What emits is given by a weight per pixel, a pixel mask: a circular spot is the
+    pixels whose centres are within rho of its centre (Cap), and any other shape
+    (crescents, bands, several spots) is just another mask (ReadMask). A map of the
+    temperature (and beaming model) of each pixel, at any nside, is a HealpixMap.
+*/
+/***************************************************************************************/
+
+#ifndef HEALPIX_H
+#define HEALPIX_H
+
+#include <vector>
+
+struct HealpixRing {
+	double theta;          // colatitude of the ring, in radians
+	double phi0;           // phi of its first pixel
+	unsigned int pixels;   // number of pixels in the ring
+	unsigned long first;   // index of its first pixel; pixels are numbered ring by ring
+};
+
+class Healpix {
+ 	public:
+  		explicit Healpix( unsigned int nside );
+
+  		unsigned int Nside() const { return nside; }
+  		unsigned long Pixels() const { return 12UL * nside * nside; }
+  		unsigned int Rings() const { return rings.size(); }
+  		const struct HealpixRing& Ring( unsigned int r ) const { return rings[r]; }
+
+  		// Solid angle of each pixel, 4 pi / Pixels()
+  		double PixelArea() const;
+
+  		// phi of pixel j of ring r
+  		double Phi( unsigned int r, unsigned int j ) const;
+
+  		// Sets mask to weight for each pixel whose centre is within rho of (theta, phi)
+  		void Cap( double theta, double phi, double rho, double weight,
+  		          std::vector< double >& mask ) const;
+
+  		// Reads a mask from a file of lines <pixel index> [weight]; a missing weight is 1
+  		void ReadMask( const char* file, std::vector< double >& mask ) const;
+
+ 	private:
+  		unsigned int nside;
+  		std::vector< struct HealpixRing > rings;
+};
+
+// Temperature, and optionally beaming model, of each pixel, read from a binary file:
+// the 8 characters SPOTMAP1, then nside and the number of columns (1 or 2) as 32-bit
+// unsigned integers, then each column as 12 nside^2 64-bit floats in pixel order, all
+// in the byte order of the machine. Column 1 is the temperature in keV, 0 for a pixel
+// that does not shine; column 2 the beaming model of the pixel (see Flags in Struct.h).
+class HealpixMap {
+ 	public:
+  		explicit HealpixMap( const char* file );
+
+  		unsigned int nside;
+  		std::vector< double > temperature;     // in keV, by pixel
+  		std::vector< unsigned int > beaming;   // by pixel; empty if the file has no column 2
+};
+
+#endif // HEALPIX_H
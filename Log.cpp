@@ -0,0 +1,85 @@
+/***************************************************************************************/
+/*                                        Log.cpp
+
+    Messages by level and category, and counters of numerical trouble. See Log.h.
+*/
+/***************************************************************************************/
+
+#include <atomic>
+#include <mutex>
+#include <iostream>
+#include <cstdlib>
+#include <cstring>
+#include "Log.h"
+#include "Exception.h"
+
+static const char* category_names[LOG_CATEGORIES] = { "angles", "curve", "defl", "mesh", "fit" };
+static const char* level_names[LOG_DEBUG + 1] = { "", "error", "warning", "info", "debug" };
+static const char* event_names[LOG_EVENTS] = {
+    "NaN integrands in the deflection routines",
+    "deflection routines giving up (-7888)",
+    "phase bins with NaN angles",
+    "light curves with a NaN or zero redshift, Doppler or graybody factor",
+    "impact parameters set back to b_max",
+    "Doppler factors divided by zero"
+};
+
+static std::atomic<int> log_level( LOG_WARNING );
+static std::atomic<unsigned int> log_categories( (1u << LOG_CATEGORIES) - 1 );
+static std::atomic<unsigned long> log_counts[LOG_EVENTS];
+static std::mutex log_lock;
+
+void LogSetup( const char* setting ) {
+
+    char* end;
+    long level( strtol( setting, &end, 10 ) );
+    if ( end == setting || level < 0 || level > LOG_DEBUG || ( *end != '\0' && *end != ':' ) )
+        throw( Exception(" --log takes <level 0-4>[:<category>,...]. Exiting.\n") );
+
+    unsigned int categories( (1u << LOG_CATEGORIES) - 1 );
+    if ( *end == ':' ) {
+        categories = 0;
+        for ( const char* c( end + 1 ); *c != '\0'; ) {
+            size_t length( strcspn( c, "," ) );
+            unsigned int k(0);
+            while ( k < LOG_CATEGORIES
+                    && !( strlen( category_names[k] ) == length && strncmp( c, category_names[k], length ) == 0 ) )
+                k++;
+            if ( k == LOG_CATEGORIES )
+                throw( Exception(" The --log categories are angles, curve, defl, mesh and fit. Exiting.\n") );
+            categories |= 1u << k;
+            c += length;
+            if ( *c == ',' ) c++;
+        }
+    }
+    log_level = level;
+    log_categories = categories;
+}
+
+bool LogEnabled( int level, LogCategory category ) {
+    return level <= log_level.load( std::memory_order_relaxed )
+        && ( log_categories.load( std::memory_order_relaxed ) >> category & 1u );
+}
+
+void LogWrite( int level, LogCategory category, const std::string& message ) {
+    std::lock_guard< std::mutex > hold( log_lock );
+    std::clog << "[" << level_names[level] << " " << category_names[category] << "] "
+              << message << std::endl;
+}
+
+void LogCount( LogEvent event ) {
+    log_counts[event].fetch_add( 1, std::memory_order_relaxed );
+}
+
+unsigned long LogCounted( LogEvent event ) {
+    return log_counts[event].load( std::memory_order_relaxed );
+}
+
+std::string LogSummary() {
+    std::ostringstream summary;
+    for ( unsigned int e(0); e < LOG_EVENTS; e++ )
+        if ( LogCounted( static_cast<LogEvent>( e ) ) > 0 )
+            summary << "Counted: " << LogCounted( static_cast<LogEvent>( e ) ) << " "
+                    << event_names[e] << std::endl;
+    return summary.str();
+}
@@ -0,0 +1,79 @@
+/***************************************************************************************/
+/*                                        Log.h
+
+    This is the header file for Log.cpp: messages by level and part of the code, and
+    counters of the numerical trouble (NaNs, the -7888 values the deflection routines
+    return when they give up) that used to be printed where it happened.
+
+    LOG( level, category, message ) writes message (anything that can follow <<) to
+    std::clog if level is at most the level set at run time (--log) and category is one
+    of those set. Messages of a level above LOG_LEVEL, which the build sets (make
+    veryclean, then make LOG_LEVEL=4 for the debug ones), are compiled out, so in the usual build the debug
+    messages of the per-bin loops cost nothing at all.
+
+    LogCount( event ) adds one to the counter of event; LogSummary gives the counts at
+    the end of a run.
+*/
+/***************************************************************************************/
+
+#ifndef LOG_H
+#define LOG_H
+
+#include <sstream>
+#include <string>
+
+#define LOG_ERROR   1
+#define LOG_WARNING 2
+#define LOG_INFO    3
+#define LOG_DEBUG   4
+
+#ifndef LOG_LEVEL
+#define LOG_LEVEL LOG_INFO // most detailed level compiled in
+#endif
+
+enum LogCategory {
+    LOG_ANGLES,        // ComputeAngles, Bend
+    LOG_CURVE,         // ComputeCurve, the spectra
+    LOG_DEFL,          // OblDeflectionTOA, the look-up tables
+    LOG_MESH,          // ComputeFlux, the mesh over the spot(s)
+    LOG_FIT,           // fits, samplers, batch
+    LOG_CATEGORIES
+};
+
+enum LogEvent {
+    EVENT_NAN_INTEGRAND,   // an integrand of OblDeflectionTOA was NaN
+    EVENT_SENTINEL,        // a routine of OblDeflectionTOA gave up and returned -7888
+    EVENT_NAN_ANGLES,      // ComputeAngles got NaN in a phase bin
+    EVENT_NAN_FLUX,        // ComputeCurve got a NaN or 0 redshift, Doppler or graybody factor
+    EVENT_B_MAX,           // b came out just above b_max and was set to b_max
+    EVENT_DIVIDE_BY_ZERO,  // the Doppler factor divided by zero
+    LOG_EVENTS
+};
+
+#define LOG( level, category, message )                                    \
+    do {                                                                   \
+        if ( (level) <= LOG_LEVEL && LogEnabled( (level), (category) ) ) { \
+            std::ostringstream log_message;                                \
+            log_message << message;                                        \
+            LogWrite( (level), (category), log_message.str() );            \
+        }                                                                  \
+    } while ( 0 )
+
+// Sets the level (LOG_ERROR .. LOG_DEBUG) and categories of the messages written, from
+// a string "<level>[:<category>,<category>...]", e.g. "4:angles,defl"; all categories
+// if none are given. The default is LOG_WARNING, all categories.
+void LogSetup( const char* setting );
+
+// True if messages of level and category are written
+bool LogEnabled( int level, LogCategory category );
+
+// Writes one message, a line of its own
+void LogWrite( int level, LogCategory category, const std::string& message );
+
+void LogCount( LogEvent event );
+unsigned long LogCounted( LogEvent event );
+
+// The events counted, one line each; empty if there were none
+std::string LogSummary();
+
+#endif // LOG_H
@@ -0,0 +1,274 @@
+/***************************************************************************************/
+/*                                  NestedSampler.cpp
+
+    Nested sampling (Skilling 2006, Bayesian Analysis 1, 833) with slice sampling
+    replacements along whitened random directions (Handley, Hobson & Lasenby 2015,
+    MNRAS 450, L61). Several of the lowest live points are replaced at once; the
+    prior volume then shrinks by 1/(n-j) in log for the j-th of them.
+*/
+/***************************************************************************************/
+
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <random>
+#include <vector>
+#include <algorithm>
+#include <stdint.h>
+#include "NestedSampler.h"
+#include "Engine.h"
+#include "Prior.h"
+#include "ThreadPool.h"
+#include "Exception.h"
+#include "Struct.h"
+
+struct DeadPoint {
+    double lnL;
+    double logwt;          // log of likelihood times prior volume
+    double x[NDIM];
+};
+
+static double LogAddExp( double a, double b ) {
+    if ( a < b ) std::swap( a, b );
+    if ( b == -std::numeric_limits<double>::infinity() ) return a;
+    return a + log1p( exp( b - a ) );
+}
+
+/**************************************************************************************/
+/* LogLikelihood:                                                                     */
+/*           -chi^2/2 at the point u of the unit hypercube of the varied parameters;  */
+/*           xr returns the parameters u maps onto                                    */
+/**************************************************************************************/
+static double LogLikelihood( class FitContext* fit, const class PriorSet* priors,
+                             const double u[], double xr[], unsigned int thread ) {
+    for ( unsigned int j(0); j < fit->ndim; j++ )
+        xr[j] = (*priors)[ fit->index[j] ]->Transform( u[j] );
+    return -0.5 * fit->Evaluate( xr, thread );
+}
+
+/**************************************************************************************/
+/* Cholesky:                                                                          */
+/*           lower triangular l with l l^T = a, for the n x n matrix a (row major).   */
+/*           Returns false if a is not positive definite.                             */
+/**************************************************************************************/
+static bool Cholesky( const std::vector<double>& a, std::vector<double>& l, unsigned int n ) {
+    l.assign( n*n, 0.0 );
+    for ( unsigned int i(0); i < n; i++ ) {
+        for ( unsigned int j(0); j <= i; j++ ) {
+            double sum( a[i*n+j] );
+            for ( unsigned int k(0); k < j; k++ ) sum -= l[i*n+k] * l[j*n+k];
+            if ( i == j ) {
+                if ( !(sum > 0.0) ) return false;
+                l[i*n+i] = sqrt( sum );
+            }
+            else
+                l[i*n+j] = sum / l[j*n+j];
+        }
+    }
+    return true;
+}
+
+/**************************************************************************************/
+/* NestedSample:                                                                      */
+/*           see NestedSampler.h                                                      */
+/**************************************************************************************/
+double NestedSample( class LightCurve* curve, class DataStruct* obsdata, double x[NDIM],
+                     const bool vary[NDIM], const class PriorSet* priors,
+                     unsigned int nlive, unsigned int numthreads,
+                     const char* samples_file, double* logz_error ) {
+
+    class ThreadPool pool( numthreads );
+    class FitContext fit( curve, obsdata, &pool, x, vary );
+    unsigned int ndim( fit.ndim ), batch( NEST_BATCH ), iteration(0);
+    const double minus_inf( -std::numeric_limits<double>::infinity() );
+    const uint64_t seed( 20071 );
+
+    if ( ndim == 0 )
+        throw( Exception(" NestedSample: no parameters to vary. Exiting.\n") );
+    if ( nlive < 2*batch ) nlive = 2*batch;
+
+    std::vector< std::vector<double> > live( nlive, std::vector<double>(ndim) );
+    std::vector< double > lnL( nlive );
+    std::vector< DeadPoint > dead;
+    double logZ( minus_inf );
+    std::vector< unsigned long > calls( nlive, 0 );   // likelihood calls, per live point or slot
+
+    // As in EnsembleSample, each random number comes from a generator seeded by
+    // (seed, iteration, slot), so the run does not depend on the number of threads.
+    auto generator = [seed]( unsigned int s, unsigned int k ) {
+        std::seed_seq seq{ static_cast<uint32_t>(seed), static_cast<uint32_t>(seed >> 32),
+                           static_cast<uint32_t>(s), static_cast<uint32_t>(k) };
+        return std::mt19937_64( seq );
+    };
+
+    // Live points drawn from the prior
+    pool.Run( nlive, [&]( unsigned int k, unsigned int thread ) {
+        std::mt19937_64 rng( generator( 0xffffffffu, k ) );
+        std::uniform_real_distribution<double> uniform( 0.0, 1.0 );
+        double xr[NDIM];
+        for ( unsigned int j(0); j < ndim; j++ ) live[k][j] = uniform( rng );
+        lnL[k] = LogLikelihood( &fit, priors, &live[k][0], xr, thread );
+        calls[k]++;
+    } );
+
+    // A finished point, with its parameters
+    auto retire = [&]( unsigned int k, double logwt ) {
+        DeadPoint d;
+        d.lnL = lnL[k];
+        d.logwt = logwt;
+        fit.Expand( &live[k][0], d.x );
+        for ( unsigned int i(0); i < ndim; i++ )
+            d.x[fit.index[i]] = (*priors)[ fit.index[i] ]->Transform( live[k][i] );
+        dead.push_back( d );
+        logZ = LogAddExp( logZ, logwt );
+    };
+
+    double logX( 0.0 );        // log of the prior volume inside the lowest live point
+    std::vector< unsigned int > order( nlive );
+    std::vector< double > cov( ndim*ndim ), chol;
+    std::vector< std::vector<double> > fresh( batch, std::vector<double>(ndim) );
+    std::vector< double > fresh_lnL( batch );
+
+    /********************************************************/
+    /* REPLACE THE LOWEST LIVE POINTS UNTIL Z HAS CONVERGED */
+    /********************************************************/
+
+    while ( true ) {
+        for ( unsigned int k(0); k < nlive; k++ ) order[k] = k;
+        std::stable_sort( order.begin(), order.end(),
+                          [&]( unsigned int a, unsigned int b ) { return lnL[a] < lnL[b]; } );
+
+        double remaining( lnL[order[nlive-1]] + logX );  // at most this much evidence is left
+        if ( logZ > minus_inf && LogAddExp( logZ, remaining ) - logZ < NEST_DLOGZ ) break;
+
+        for ( unsigned int j(0); j < batch; j++ ) {
+            double logX_new( logX - 1.0 / (nlive - j) );
+            retire( order[j], lnL[order[j]] + logX + log1p( -exp( logX_new - logX ) ) );
+            logX = logX_new;
+        }
+        double lnL_star( lnL[order[batch-1]] );
+
+        // Covariance of the surviving live points, to scale the slice directions
+        std::vector<double> mean( ndim, 0.0 );
+        unsigned int nsurvive( nlive - batch );
+        for ( unsigned int s(batch); s < nlive; s++ )
+            for ( unsigned int i(0); i < ndim; i++ ) mean[i] += live[order[s]][i] / nsurvive;
+        std::fill( cov.begin(), cov.end(), 0.0 );
+        for ( unsigned int s(batch); s < nlive; s++ )
+            for ( unsigned int i(0); i < ndim; i++ )
+                for ( unsigned int l(0); l < ndim; l++ )
+                    cov[i*ndim+l] += ( live[order[s]][i] - mean[i] ) * ( live[order[s]][l] - mean[l] ) / nsurvive;
+        for ( unsigned int i(0); i < ndim; i++ ) cov[i*ndim+i] += 1e-12;
+        if ( !Cholesky( cov, chol, ndim ) ) {
+            chol.assign( ndim*ndim, 0.0 );
+            for ( unsigned int i(0); i < ndim; i++ ) chol[i*ndim+i] = sqrt( cov[i*ndim+i] );
+        }
+
+        pool.Run( batch, [&]( unsigned int j, unsigned int thread ) {
+            std::mt19937_64 rng( generator( iteration, j ) );
+            std::uniform_real_distribution<double> uniform( 0.0, 1.0 );
+            std::normal_distribution<double> normal( 0.0, 1.0 );
+            unsigned int start( order[ batch + static_cast<unsigned int>( uniform(rng) * nsurvive ) % nsurvive ] );
+            std::vector<double> u( live[start] );
+            std::vector<double> d( ndim ), y( ndim ), g( ndim );
+            double lnL_u( lnL[start] ), xr[NDIM]; // the survivor's own, if no step is taken
+
+            // Is u + t d inside the unit cube and above the likelihood contour?
+            auto inside = [&]( double t, double* lnL_y ) {
+                for ( unsigned int i(0); i < ndim; i++ ) {
+                    y[i] = u[i] + t * d[i];
+                    if ( y[i] <= 0.0 || y[i] >= 1.0 ) return false;
+                }
+                calls[j]++;
+                *lnL_y = LogLikelihood( &fit, priors, &y[0], xr, thread );
+                return *lnL_y > lnL_star;
+            };
+
+            for ( unsigned int step(0); step < NEST_SLICE_STEPS * ndim; step++ ) {
+                double norm(0.0), lnL_y, lo, hi, t;
+                for ( unsigned int i(0); i < ndim; i++ ) { g[i] = normal( rng ); norm += g[i]*g[i]; }
+                norm = sqrt( norm );
+                for ( unsigned int i(0); i < ndim; i++ ) {
+                    d[i] = 0.0;
+                    for ( unsigned int l(0); l <= i; l++ ) d[i] += chol[i*ndim+l] * g[l] / norm;
+                }
+
+                // Step out a slice of width one in the whitened metric, then shrink it
+                lo = -uniform( rng );
+                hi = lo + 1.0;
+                for ( unsigned int n(0); n < 100 && inside( lo, &lnL_y ); n++ ) lo -= 1.0;
+                for ( unsigned int n(0); n < 100 && inside( hi, &lnL_y ); n++ ) hi += 1.0;
+                for ( unsigned int n(0); n < 100; n++ ) {
+                    t = lo + uniform( rng ) * (hi - lo);
+                    if ( inside( t, &lnL_y ) ) {
+                        u = y;
+                        lnL_u = lnL_y;
+                        break;
+                    }
+                    if ( t < 0.0 ) lo = t;
+                    else hi = t;
+                }
+            }
+            fresh[j] = u;
+            fresh_lnL[j] = lnL_u;
+        } );
+
+        for ( unsigned int j(0); j < batch; j++ ) {
+            live[order[j]] = fresh[j];
+            lnL[order[j]] = fresh_lnL[j];
+        }
+        iteration++;
+        if ( iteration % 100 == 0 )
+            std::cout << "NestedSample: iteration " << iteration << ", log Z = " << logZ
+                      << ", log L* = " << lnL_star << std::endl;
+    }
+
+    // What is left of the prior volume is shared between the final live points
+    for ( unsigned int k(0); k < nlive; k++ )
+        retire( k, lnL[k] + logX - log( 1.0 * nlive ) );
+
+    /***********************************************************/
+    /* INFORMATION, POSTERIOR SAMPLES AND THE SUMMARY          */
+    /***********************************************************/
+
+    double H( -logZ ), best( minus_inf );
+    std::vector< double > mean( NDIM, 0.0 ), var( NDIM, 0.0 );
+    std::ofstream out( samples_file );
+    if ( !out )
+        throw( Exception(" Couldn't open the nested sampling output file. Exiting.\n") );
+    out.precision( 10 );
+    for ( unsigned int n(0); n < dead.size(); n++ ) {
+        double w( exp( dead[n].logwt - logZ ) );
+        if ( w > 0.0 ) H += w * dead[n].lnL;
+        out << w << "\t" << dead[n].lnL;
+        for ( unsigned int k(0); k < NDIM; k++ ) {
+            out << "\t" << dead[n].x[k];
+            mean[k] += w * dead[n].x[k];
+            var[k] += w * dead[n].x[k] * dead[n].x[k];
+        }
+        out << std::endl;
+        if ( dead[n].lnL > best ) {
+            best = dead[n].lnL;
+            for ( unsigned int k(0); k < NDIM; k++ ) x[k] = dead[n].x[k];
+        }
+    }
+    out.close();
+
+    unsigned long total(0);
+    for ( unsigned int n(0); n < calls.size(); n++ ) total += calls[n];
+    *logz_error = sqrt( fabs(H) / nlive );
+
+    const char* names[NDIM] = { "M", "R_eq", "incl", "theta", "rho", "T", "ts" };
+    std::cout << "NestedSample: " << nlive << " live points, " << iteration << " iterations, "
+              << total << " likelihood calls, look-up tables changed " << fit.Rebuilt()
+              << " times on " << pool.size() << " threads." << std::endl
+              << "  log Z = " << logZ << " +/- " << *logz_error << ", H = " << H << " nats" << std::endl;
+    for ( unsigned int j(0); j < ndim; j++ ) {
+        unsigned int k( fit.index[j] );
+        std::cout << "  " << names[k] << " = " << mean[k] << " +/- "
+                  << sqrt( fabs( var[k] - mean[k]*mean[k] ) ) << std::endl;
+    }
+
+    return logZ;
+}
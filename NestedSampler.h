@@ -0,0 +1,43 @@
+/***************************************************************************************/
+/*                                  NestedSampler.h
+
+    This is the header file for NestedSampler.cpp, a nested sampler (Skilling 2006)
+    over the fit parameters M, R_eq, incl, theta, rho, T and ts, for the Bayesian
+    evidence of a model (one spot vs two, NS_model 1 vs 3, blackbody vs line, ...).
+
+    Live points live in the unit hypercube and are mapped onto the parameters by the
+    priors (Prior::Transform). A point is replaced PolyChord-style, by slice sampling
+    along random directions scaled to the covariance of the live points, starting from
+    a surviving live point. The NEST_BATCH lowest points are replaced together each
+    iteration, on the thread pool; the batch size is fixed, so the result does not
+    depend on the number of threads.
+
+    The likelihood is exp(-chi^2/2), without the normalization of the errors, so
+    log Z is only meaningful relative to other models of the same data.
+
+    The posterior samples (the dead points plus the final live points) are written to
+    a text file, one per line: posterior weight, log likelihood, M [Msun], R_eq [km],
+    incl [deg], theta [deg], rho [rad], T [keV], ts. The weights add up to 1.
+*/
+/***************************************************************************************/
+
+#ifndef NESTEDSAMPLER_H
+#define NESTEDSAMPLER_H
+
+#include "Chi.h"
+
+#define NEST_BATCH 8          // live points replaced per iteration
+#define NEST_SLICE_STEPS 3    // slice sampling steps per replacement, times the number of parameters
+#define NEST_DLOGZ 0.1        // stop once the live points could add less than this to log Z
+
+class PriorSet;
+
+// Computes the evidence of the data for the parameters with vary[k] set; the others are
+// held at x. Returns log Z and sets *logz_error to its uncertainty; x returns the highest
+// likelihood point found.
+double NestedSample( class LightCurve* curve, class DataStruct* obsdata, double x[NDIM],
+                     const bool vary[NDIM], const class PriorSet* priors,
+                     unsigned int nlive, unsigned int numthreads,
+                     const char* samples_file, double* logz_error );
+
+#endif // NESTEDSAMPLER_H
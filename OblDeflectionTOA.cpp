@@ -18,105 +18,40 @@
 
 #include <exception>
 #include <cmath>
+#include <limits>
 #include <iostream>
+#include <atomic>
+#include <algorithm>
 #include "OblDeflectionTOA.h"
 #include "OblModelBase.h"
 #include "Exception.h"
 #include "Units.h"
 #include "Struct.h" //Jan 21 (year? prior to 2012)
+#include "Chi.h"
+#include "Dual.h"
+#include "Log.h"
+#include "Profile.h"
 // Globals are bad, but there's no easy way to get around it
 // for this particular case (need to pass a member function
 // to a Matpack routine which does not have a signature to accomodate
 // passing in the object pointer).
 
-class LightCurve curve; //Jan 21 (year? prior to 2012)
-
-const OblDeflectionTOA* OblDeflectionTOA_object;
-double OblDeflectionTOA_b_value;
-double OblDeflectionTOA_b_over_r;
-double OblDeflectionTOA_costheta_value;
-double OblDeflectionTOA_psi_value;
-double OblDeflectionTOA_b_max_value;
-double OblDeflectionTOA_psi_max_value;
-double OblDeflectionTOA_b_guess;
-double OblDeflectionTOA_psi_guess;
-
-/**********************************************************/
-/* OblDeflectionTOA_psi_integrand_wrapper:                */
-/*                                                        */
-/* Passed r (NS radius, unitless), *prob (problem toggle) */
-/* Returns integrand if it is not nan.                    */
-/**********************************************************/
-double OblDeflectionTOA_psi_integrand_wrapper ( double r,  bool *prob ) {
-  double integrand( OblDeflectionTOA_object->psi_integrand( OblDeflectionTOA_b_value, r)); 
-  //OblDeflectionTOA_object is looking up psi_integrand by feeding it OblDeflectionTOA_b_value, which is defined in psi_outgoing
-  	if( std::isnan(integrand) ) {
-    	std::cout << "integrand is nan!" << std::endl;
-    	std::cout << "r (km) = " << r  << std::endl;
-    	std::cerr << "ERROR in OblDeflectionTOA_psi_integrand_wrapper(): returned NaN." << std::endl;
-    	*prob = true;
-    	integrand = -7888.0;
-    	return integrand;
-  	}
-  	return integrand;
-}
+// The globals are thread_local so that several light curves can be computed at once
+// (see FitCurve in Chi.cpp); each thread gets its own copy.
 
-double OblDeflectionTOA_psi_integrand_wrapper_u ( double u,  bool *prob ) {
-  double integrand( OblDeflectionTOA_object->psi_integrand_u( OblDeflectionTOA_b_over_r, u)); 
-  //OblDeflectionTOA_object is looking up psi_integrand by feeding it OblDeflectionTOA_b_over_r, which is defined in psi_outgoing
-  	if( std::isnan(integrand) ) {
-    	std::cout << "integrand is nan!" << std::endl;
-    	std::cout << "u = " << u  << std::endl;
-    	std::cerr << "ERROR in OblDeflectionTOA_psi_integrand_wrapper_u(): returned NaN." << std::endl;
-    	*prob = true;
-    	integrand = -7888.0;
-    	return integrand;
-  	}
-  	return integrand;
-}
+thread_local bool OblDeflectionTOA_problem(false); // replaces the global LightCurve curve; only its problem flag was used
 
+thread_local const OblDeflectionTOA* OblDeflectionTOA_object;
+thread_local double OblDeflectionTOA_b_value;
+thread_local double OblDeflectionTOA_costheta_value;
+thread_local double OblDeflectionTOA_psi_value;
+thread_local double OblDeflectionTOA_b_max_value;
+thread_local double OblDeflectionTOA_psi_max_value;
+thread_local double OblDeflectionTOA_b_guess;
+thread_local double OblDeflectionTOA_psi_guess;
+thread_local OblRing OblDeflectionTOA_ring; // zero: serial 0 is no ring
 
-/************************************************************/
-/* OblDeflectionTOA_dpsi_db_integrand_wrapper:              */
-/*                                                          */
-/* Passed r (NS radius, unitless), *prob (problem toggle)   */
-/* Returns integrand if it is not nan.                      */
-/************************************************************/
-double OblDeflectionTOA_dpsi_db_integrand_wrapper ( double r, bool *prob ) {
-	double integrand( OblDeflectionTOA_object->dpsi_db_integrand( OblDeflectionTOA_b_value, r ) );
-  
-  	if ( std::isnan(integrand) ) {
-    	std::cout << "dpsi_db integrand is nan!" << std::endl;
-    	std::cout << "r (km) = " << Units::nounits_to_cgs(r, Units::LENGTH)/1.0e5 << std::endl;
-    	std::cerr << "ERROR in OblDeflectionTOA_dpsi_db_integrand_wrapper(): returned NaN." << std::endl;
-    	*prob = true;
-    	integrand = -7888.0;
-    	return integrand;
-  	}
-  
-  	return integrand;
-}
-
-/************************************************************/
-/* OblDeflectionTOA_dpsi_db_integrand_wrapper:              */
-/*                                                          */
-/* Passed r (NS radius, unitless), *prob (problem toggle)   */
-/* Returns integrand if it is not nan.                      */
-/************************************************************/
-double OblDeflectionTOA_dpsi_db_integrand_wrapper_u ( double u, bool *prob ) {
-	double integrand( OblDeflectionTOA_object->dpsi_db_integrand_u( OblDeflectionTOA_b_over_r, u ) );
-  
-  	if ( std::isnan(integrand) ) {
-    	std::cout << "dpsi_db_u integrand is nan!" << std::endl;
-    	std::cout << "u (km) = " << Units::nounits_to_cgs(u, Units::LENGTH)/1.0e5 << std::endl;
-    	std::cerr << "ERROR in OblDeflectionTOA_dpsi_db_integrand_wrapper(): returned NaN." << std::endl;
-    	*prob = true;
-    	integrand = -7888.0;
-    	return integrand;
-  	}
-  
-  	return integrand;
-}
+static std::atomic<unsigned long> OblDeflectionTOA_serials(0);
 
 /***********************************************************/
 /* OblDeflectionTOA_toa_integrand_wrapper:                 */
@@ -127,47 +62,8 @@ double OblDeflectionTOA_dpsi_db_integrand_wrapper_u ( double u, bool *prob ) {
 double OblDeflectionTOA_toa_integrand_wrapper ( double r, bool *prob ) {
   	double integrand( OblDeflectionTOA_object->toa_integrand( OblDeflectionTOA_b_value, r ) );
   	if ( std::isnan(integrand) ) {
-    	std::cout << "toa_minus_toa integrand is nan!" << std::endl;
-    	std::cout << "r (km) = " << Units::nounits_to_cgs(r, Units::LENGTH)/1.0e5 << std::endl;
-    	std::cerr << "ERROR in OblDeflectionTOA_toa_integrand_wrapper(): returned NaN." << std::endl;
-    	*prob = true;
-    	integrand = -7888.0;
-    	return integrand;
-  	}
-  	return integrand;
-}
-
-/***********************************************************/
-/* OblDeflectionTOA_toa_integrand_minus_b0_wrapper:        */
-/*                                                         */
-/* Passed r (NS radius, unitless), *prob (problem toggle)  */
-/* Returns integrand if it is not nan.                     */
-/***********************************************************/
-double OblDeflectionTOA_toa_integrand_minus_b0_wrapper ( double r, bool *prob ) {
-  	double integrand( OblDeflectionTOA_object->toa_integrand_minus_b0( OblDeflectionTOA_b_value, r ) );
-  	if ( std::isnan(integrand) ) {
-    	std::cout << "toa_minus_b0 integrand is nan!" << std::endl;
-    	std::cout << "r (km) = " << Units::nounits_to_cgs(r, Units::LENGTH)/1.0e5 << std::endl;
-    	std::cerr << "ERROR in OblDeflectionTOA_toa_integrand_minus_b0_wrapper(): returned NaN." << std::endl;
-    	*prob = true;
-    	integrand = -7888.0;
-    	return integrand;
-  	}
-  	return integrand;
-}
-
-/***********************************************************/
-/* OblDeflectionTOA_toa_integrand_minus_b0_wrapper:        */
-/*                                                         */
-/* Passed r (NS radius, unitless), *prob (problem toggle)  */
-/* Returns integrand if it is not nan.                     */
-/***********************************************************/
-double OblDeflectionTOA_toa_integrand_minus_b0_wrapper_u ( double u, bool *prob ) {
-  	double integrand( OblDeflectionTOA_object->toa_integrand_minus_b0_u( OblDeflectionTOA_b_over_r, u ) );
-  	if ( std::isnan(integrand) ) {
-    	std::cout << "toa_minus_b0_u integrand is nan!" << std::endl;
-    	std::cout << "r (km) = " << Units::nounits_to_cgs(u, Units::LENGTH)/1.0e5 << std::endl;
-    	std::cerr << "ERROR in OblDeflectionTOA_toa_integrand_minus_b0_wrapper(): returned NaN." << std::endl;
+    	LogCount( EVENT_NAN_INTEGRAND );
+    	LOG( LOG_DEBUG, LOG_DEFL, "toa_minus_toa integrand is nan at r (km) = " << Units::nounits_to_cgs(r, Units::LENGTH)/1.0e5 );
     	*prob = true;
     	integrand = -7888.0;
     	return integrand;
@@ -178,6 +74,7 @@ double OblDeflectionTOA_toa_integrand_minus_b0_wrapper_u ( double u, bool *prob
 /*****************************************************/
 /*****************************************************/
 double OblDeflectionTOA_rcrit_zero_func_wrapper ( double rc ) {
+	ProfileCount( COUNT_FINDZERO );
   	return double ( OblDeflectionTOA_object->rcrit_zero_func( rc, 
   	                	OblDeflectionTOA_b_value ) );
 }
@@ -216,20 +113,307 @@ const double OblDeflectionTOA::FINDZERO_EPS = 1.0e-6;
 const double OblDeflectionTOA::RFINAL_MASS_MULTIPLE = 1.0e7;
 //const double OblDeflectionTOA::DIVERGENCE_GUARD = 2.0e-2; // set to 0 to turn off
 const double OblDeflectionTOA::DIVERGENCE_GUARD = 0.0;
-const long int OblDeflectionTOA::TRAPEZOIDAL_INTEGRAL_N_MAX = 100000;
-const long int OblDeflectionTOA::TRAPEZOIDAL_INTEGRAL_N_MAX_1 = 1000;
-const long int OblDeflectionTOA::TRAPEZOIDAL_INTEGRAL_N = 1000;
-const long int OblDeflectionTOA::TRAPEZOIDAL_INTEGRAL_N_1 = 1000;
+long int OblDeflectionTOA::TRAPEZOIDAL_INTEGRAL_N_MAX = QUADRATURE_N_MAX;
+long int OblDeflectionTOA::TRAPEZOIDAL_INTEGRAL_N_MAX_1 = QUADRATURE_N;
+long int OblDeflectionTOA::TRAPEZOIDAL_INTEGRAL_N = QUADRATURE_N;
+long int OblDeflectionTOA::TRAPEZOIDAL_INTEGRAL_N_1 = QUADRATURE_N;
+double OblDeflectionTOA::quadrature_scale = 1.0;
 const long int OblDeflectionTOA::TRAPEZOIDAL_INTEGRAL_INGOING_N = 400;
+const long int OblDeflectionTOA::INGOING_BISECTIONS = 60;
 const double OblDeflectionTOA::TRAPEZOIDAL_INTEGRAL_POWER = 4.0; 
 //const double OblDeflectionTOA::TRAPEZOIDAL_INTEGRAL_POWER = 8.0;
 
+void OblDeflectionTOA::SetQuadrature( double scale ) {
+	quadrature_scale = scale;
+	// even, and at least 20: the split integrals take N/10
+	TRAPEZOIDAL_INTEGRAL_N_MAX = std::max( 20L, 2 * lround( QUADRATURE_N_MAX/2 * scale ) );
+	TRAPEZOIDAL_INTEGRAL_N_MAX_1 = std::max( 20L, 2 * lround( QUADRATURE_N/2 * scale ) );
+	TRAPEZOIDAL_INTEGRAL_N = std::max( 20L, 2 * lround( QUADRATURE_N/2 * scale ) );
+	TRAPEZOIDAL_INTEGRAL_N_1 = std::max( 20L, 2 * lround( QUADRATURE_N/2 * scale ) );
+}
+
 OblDeflectionTOA::OblDeflectionTOA ( OblModelBase* modptr, const double& mass_nounits, const double& mass_over_r_nounits, const double& radius_nounits ) 
   : r_final( RFINAL_MASS_MULTIPLE * mass_nounits ) {
   this->modptr = modptr;
   mass = mass_nounits;
   mass_over_r = mass_over_r_nounits;
   rspot = radius_nounits;
+  rpole = modptr->R_at_costheta(1.0);
+  requator = modptr->R_at_costheta(0.0);
+  serial = ++OblDeflectionTOA_serials;
+}
+
+/*****************************************************/
+/* OblDeflectionTOA::Ring                            */
+/*                                                   */
+/* The model's R and dR/dtheta at cos_theta, from    */
+/* this thread's cache if the last ring asked about  */
+/* was the same; the ingoing limits are reset.       */
+/*****************************************************/
+const OblRing& OblDeflectionTOA::Ring ( const double& cos_theta ) const {
+  	OblRing& ring( OblDeflectionTOA_ring );
+  	if ( ring.serial != serial || ring.cos_theta != cos_theta ) {
+    	ring.serial = serial;
+    	ring.cos_theta = cos_theta;
+    	ring.rsurface = modptr->R_at_costheta( cos_theta );
+    	ring.drdth = modptr->Dtheta_R( cos_theta );
+    	ring.rspot = -1.0;
+  	}
+  	return ring;
+}
+
+/*****************************************************/
+/* Lagrange4                                         */
+/*                                                   */
+/* Cubic through y[0..3] at t = 0, 1, 2, 3,          */
+/* evaluated at t                                    */
+/*****************************************************/
+static inline double Lagrange4 ( const double* y, const double& t ) {
+  	return -y[0] * (t - 1.0) * (t - 2.0) * (t - 3.0) / 6.0 + y[1] * t * (t - 2.0) * (t - 3.0) / 2.0
+  	       - y[2] * t * (t - 1.0) * (t - 3.0) / 2.0 + y[3] * t * (t - 1.0) * (t - 2.0) / 6.0;
+}
+
+// A column of the ring's table at x; below the first node it is extrapolated
+static inline double IngoingColumn ( const double* column, const double& x ) {
+  	double s( x * NN_IN - 1.0 );
+  	int j( static_cast<int>( floor(s) ) - 1 );
+  	if ( j < 0 ) j = 0;
+  	if ( j > NN_IN - 4 ) j = NN_IN - 4;
+  	return Lagrange4( column + j, s - j );
+}
+
+/*****************************************************/
+/* OblDeflectionTOA::IngoingTable                    */
+/*                                                   */
+/* Works out psi, dpsi/db and the time of arrival of */
+/* the ingoing rays from rspot at the NN_IN nodes of */
+/* the ring's table (see OblRing). Above b_hi,       */
+/* rcrit would be above the surface.                 */
+/*****************************************************/
+void OblDeflectionTOA::IngoingTable ( const double& rspot, const double& cos_theta ) const {
+  	OblRing& ring( OblDeflectionTOA_ring );
+  	OblStar<double> in( star( Ring( cos_theta ).rsurface ) ), // as psi_ingoing sees it
+  	                s( star( rspot ) );
+  	double b_top( s.rspot / sqrt( 1.0 - 2.0 * s.mass / s.rspot ) ); // rcrit( b_top ) = rspot
+
+  	ring.rspot = rspot;
+  	ring.bmin_in = bmin_ingoing( rspot, cos_theta );
+  	ring.b_hi = std::min( bmax_outgoing( rspot ), b_top );
+  	if ( !(ring.bmin_in < ring.b_hi) ) {
+    	ring.psi_in_max = -1.0;
+    	return;
+  	}
+
+  	for ( int k(0); k < NN_IN; k++ ) {
+    	double x( (k + 1.0) / NN_IN ),
+    	       b( k == NN_IN - 1 ? ring.bmin_in : ring.b_hi - (ring.b_hi - ring.bmin_in) * x * x );
+    	ring.psi[k] = psi_ingoing( b, cos_theta, in, &OblDeflectionTOA_problem );
+    	ring.dpsi_db_x[k] = dpsi_db_ingoing( b, cos_theta, s, &OblDeflectionTOA_problem ) * x;
+    	ring.toa[k] = toa_ingoing( b, cos_theta, s, &OblDeflectionTOA_problem );
+  	}
+  	ring.psi_in_max = ring.psi[NN_IN - 1];
+
+  	// psi_ingoing need not fall all the way from bmin_in to b_hi: on most rings it has
+  	// a minimum in between. Rays are taken on the side of bmin_in, from the minimum on.
+  	int kmin(-1);
+  	ring.psi_turn = IngoingColumn( ring.psi, 0.0 );
+  	for ( int k(0); k < NN_IN; k++ )
+    	if ( ring.psi[k] < ring.psi_turn ) {
+      		ring.psi_turn = ring.psi[k];
+      		kmin = k;
+    	}
+  	ring.x_turn = 0.0;
+  	if ( kmin == NN_IN - 1 ) { // psi_ingoing is lowest at bmin_in: no rays
+    	ring.psi_in_max = -1.0;
+    	return;
+  	}
+  	if ( kmin >= 0 ) { // golden section between the neighbouring nodes
+    	const double g( 0.5 * (sqrt(5.0) - 1.0) );
+    	double lo( kmin / double(NN_IN) ), hi( (kmin + 2.0) / NN_IN );
+    	for ( long int n(0); n < INGOING_BISECTIONS; n++ ) {
+      		double x1( hi - g * (hi - lo) ), x2( lo + g * (hi - lo) );
+      		if ( IngoingColumn( ring.psi, x1 ) < IngoingColumn( ring.psi, x2 ) ) hi = x2;
+      		else lo = x1;
+    	}
+    	ring.x_turn = 0.5 * (lo + hi);
+    	ring.psi_turn = IngoingColumn( ring.psi, ring.x_turn );
+  	}
+}
+
+double OblDeflectionTOA::IngoingX ( const double& b, const double& rspot, const double& cos_theta ) const {
+  	const OblRing& ring( Ring( cos_theta ) );
+  	if ( ring.rspot != rspot || ring.psi_in_max < 0.0 || b >= ring.b_hi || b < ring.bmin_in )
+    	return -1.0;
+  	return sqrt( (ring.b_hi - b) / (ring.b_hi - ring.bmin_in) );
+}
+
+/*****************************************************/
+/* CheckIntegrand                                    */
+/*                                                   */
+/* Returns integrand if it is not nan; otherwise     */
+/* flags the problem and returns -7888.              */
+/*****************************************************/
+template <class T>
+static T CheckIntegrand ( const T& integrand, const char* name, const double& x ) {
+  	if ( std::isnan( Value(integrand) ) ) {
+    	LogCount( EVENT_NAN_INTEGRAND );
+    	LOG( LOG_DEBUG, LOG_DEFL, name << " integrand is nan at r or u = " << x );
+    	OblDeflectionTOA_problem = true;
+    	return T(-7888.0);
+  	}
+  	return integrand;
+}
+
+/*****************************************************/
+/* OblDeflectionTOA::TrapezoidalInteg                */
+/*                                                   */
+/* Numerically integrates using the trapezoid rule.  */
+/* The lower limit a may carry derivatives (the      */
+/* surface of the star), b is a number.              */
+/*****************************************************/
+template <class A, class Integrand>
+auto OblDeflectionTOA::TrapezoidalInteg ( const A& a, const double& b, Integrand func,
+					   					  const long int& N ) -> decltype( func(a) ) {
+  	decltype( func(a) ) integral(0.0);
+  	if ( a == b ) return integral;
+  	ProfileCount( COUNT_INTEGRAND, N );
+
+  	//const long int N( OblDeflectionTOA::TRAPEZOIDAL_INTEGRAL_N );
+  	const double power( OblDeflectionTOA::TRAPEZOIDAL_INTEGRAL_POWER );
+
+  	for ( int i(1); i <= N; i++ ) {
+    	A left, right, mid, width;
+    	left = TrapezoidalInteg_pt( a, b, power, N, i-1, &OblDeflectionTOA_problem );
+    	right = TrapezoidalInteg_pt( a, b, power, N, i, &OblDeflectionTOA_problem );
+    	mid = (left + right) / 2.0;
+    	width = right - left;
+    
+    	integral += (width * func(mid));
+  	}
+
+  	return integral;
+}
+
+/*******************************************************/
+/* OblDeflectionTOA::TrapezoidalInteg_pt               */
+/*                                                     */
+/* Called in TrapezoidalInteg                          */
+/* Power spacing of subdivisions for TrapezoidalInteg  */
+/* i ranges from 0 to N                                */
+/*******************************************************/
+template <class A>
+A OblDeflectionTOA::TrapezoidalInteg_pt ( const A& a, const double& b, 
+					      				  const double& power, const long int& N,
+					      				  const long int& i, bool *prob ) {
+  	A dummy;
+  	if ( N <= 0 ) {
+    	LogCount( EVENT_SENTINEL );
+    	LOG( LOG_DEBUG, LOG_DEFL, "OblDeflectionTOA::TrapezoidalInteg_pt: N <= 0." );
+    	*prob = true;
+    	dummy = -7888.0;
+    	return dummy;
+  	}
+  	if ( i < 0 || i > N ) {
+    	LogCount( EVENT_SENTINEL );
+    	LOG( LOG_DEBUG, LOG_DEFL, "OblDeflectionTOA::TrapezoidalInteg_pt: i out of range." );
+    	*prob = true;
+    	dummy = -7888.0;
+    	return dummy;
+  	}
+  	return A( a + (b - a) * pow( 1.0 * i / N , power ) );
+}
+
+/*******************************************************/
+/* OblDeflectionTOA::Integration                       */
+/*                                                     */
+/* Integrates! By calling TrapezoidalInteg             */
+/* Here, N = TRAPEZOIDAL_INTEGRAL_N                    */
+/*******************************************************/
+template <class A, class Integrand>
+inline auto OblDeflectionTOA::Integration ( const A& a, const double& b, Integrand func,
+					     					const long int& N ) -> decltype( func(a) ) {
+  	return TrapezoidalInteg( a, b, func, N );
+  	//return MATPACK::AdaptiveSimpson( a, b, func, OblDeflectionTOA::INTEGRAL_EPS );
+}
+
+/*****************************************************/
+// gives the integrand from equation 20, MLCB
+/*****************************************************/
+template <class T>
+T OblDeflectionTOA::psi_integrand ( const T& b, const T& r, const OblStar<T>& star ) const { 
+  T integrand( b / (r * r * sqrt( 1.0 - pow( b / r, 2.0 ) * (1.0 - 2.0 * star.mass_over_r * star.rspot/r ) )) );
+  	return integrand;
+}
+
+/*****************************************************/
+// Integrand with respect to u=R/r. b_R = b/R
+/*****************************************************/
+template <class T>
+T OblDeflectionTOA::psi_integrand_u ( const T& b_R, const double& u, const OblStar<T>& star ) const { 
+  // double integrand( b / (r * r * sqrt( 1.0 - pow( b / r, 2.0 ) * (1.0 - 2.0 * get_mass_over_r() * get_rspot()/r ) )) );
+  T integrand ( b_R / sqrt( 1.0 - pow(u*b_R,2)*(1.0-2.0*star.mass_over_r*u) ));
+  	return integrand;
+}
+
+/*****************************************************/
+// integrand for the derivative of equation 20, MLCB
+/*****************************************************/
+template <class T>
+T OblDeflectionTOA::dpsi_db_integrand ( const T& b, const T& r, const OblStar<T>& star ) const { 
+  // double integrand( (1.0 / ( r * r * sqrt( 1.0 - pow( b / r , 2.0 ) * (1.0 - 2.0 * get_mass_over_r() * get_rspot()/r) )) ) 
+  //		    + (b * b * (1.0 - 2.0 * get_mass_over_r() * get_rspot()/r) 
+  //		       / (pow( r , 4.0 ) * pow( 1.0 - pow( b / r , 2.0 ) * (1.0 - 2.0 * get_mass_over_r() * get_rspot()/r) , 1.5) ) ) );
+
+  T integrand ( 1.0/(r*r) *  
+		     pow( 1.0 - pow( b / r , 2.0 ) * (1.0 - 2.0 * star.mass_over_r * star.rspot/r) , -1.5));
+
+  	return integrand;
+}
+
+/*****************************************************/
+// integrand for the derivative of equation 20, MLCB
+/*****************************************************/
+template <class T>
+T OblDeflectionTOA::dpsi_db_integrand_u ( const T& b_R, const double& u, const OblStar<T>& star ) const { 
+  T integrand ( 1.0/star.rspot *  pow( 1.0 - pow( b_R*u , 2.0 ) * (1.0 - 2.0 * star.mass_over_r * u) , -1.5));
+
+  	return integrand;
+}
+
+/*****************************************************/
+// gives the integrand from equation 38, MLCB
+/*****************************************************/
+template <class T>
+T OblDeflectionTOA::toa_integrand_minus_b0 ( const T& b, const T& r, const OblStar<T>& star ) const {   
+  T integrand( (1.0 / (1.0 - 2.0 * star.mass_over_r*star.rspot/r)) 
+		    * ( (1.0 / sqrt( 1.0 - pow( b / r , 2.0 ) * (1.0 - 2.0 * star.mass_over_r*star.rspot/r) )) - 1.0) );
+  	return integrand;
+}
+
+/*****************************************************/
+// gives the integrand from equation 38, MLCB
+/*****************************************************/
+template <class T>
+T OblDeflectionTOA::toa_integrand_minus_b0_u ( const T& b_R, const double& u, const OblStar<T>& star ) const {   
+  T integrand(  star.rspot/(u*u) * (1.0 / (1.0 - 2.0 * star.mass_over_r*u)) 
+		    * ( (1.0 / sqrt( 1.0 - pow( b_R * u , 2.0 ) * (1.0 - 2.0 * star.mass_over_r*u) )) - 1.0) );
+  	return integrand;
+}
+
+/*****************************************************/
+/* OblDeflectionTOA::star                            */
+/*                                                   */
+/* The star as seen by the double versions of the    */
+/* routines: this object's mass and M/R, the radius  */
+/* passed in, and the radius at the pole.            */
+/*****************************************************/
+OblStar<double> OblDeflectionTOA::star ( const double& rspot ) const {
+  	OblStar<double> s;
+  	s.mass = get_mass();
+  	s.mass_over_r = get_mass_over_r();
+  	s.rspot = rspot;
+  	s.rpole = rpole;
+  	return s;
 }
 
 /************************************************************/
@@ -259,12 +443,13 @@ double OblDeflectionTOA::bmin_ingoing ( const double& rspot, const double& cos_t
 
   	// Need to return the value of b corresponding to dR/dtheta of the surface.
 
-  	double drdth ( modptr->Dtheta_R( cos_theta ) );
+  	double drdth ( Ring( cos_theta ).drdth );
 	double b ( rspot / sqrt( (1.0 - 2.0 * get_mass_over_r()) + pow( drdth / rspot , 2.0 ) ) );
  
   	// NaN check:
   	if ( std::isnan(b) ) {
-    	std::cerr << "ERROR in OblDeflectionTOA::bmin_ingoing(): returned NaN." << std::endl;
+    	LogCount( EVENT_SENTINEL );
+    	LOG( LOG_DEBUG, LOG_DEFL, "OblDeflectionTOA::bmin_ingoing(): returned NaN." );
     	b = -7888.0;
     	return b;
   	}
@@ -283,7 +468,7 @@ double OblDeflectionTOA::bmin_ingoing ( const double& rspot, const double& cos_t
 bool OblDeflectionTOA::ingoing_allowed ( const double& cos_theta ) {
   	// ingoing rays can be a consideration for locations where dR/dtheta \neq 0
   	//costheta_check( cos_theta );
-  	return bool ( modptr->Dtheta_R( cos_theta ) != 0.0 );
+  	return bool ( Ring( cos_theta ).drdth != 0.0 );
 }
 
 /************************************************************************/
@@ -296,23 +481,33 @@ bool OblDeflectionTOA::ingoing_allowed ( const double& cos_theta ) {
 /* Returns                                    */
 /************************************************************************/
 double OblDeflectionTOA::rcrit ( const double& b, const double& cos_theta, bool *prob ) const {
-  	double candidate;
-       
-  	double r ( modptr->R_at_costheta( cos_theta ) );
- 
-  	if ( b == bmax_outgoing(r) ) {
-    	return double(r);
-  	}
+  	return rcrit( b, cos_theta, star( Ring( cos_theta ).rsurface ), prob );
+}
 
+double OblDeflectionTOA::rcrit_root ( const double& b ) const {
   	OblDeflectionTOA_object = this;
   	OblDeflectionTOA_b_value = b;
 
- 	candidate = MATPACK::FindZero(modptr->R_at_costheta(1.0),
-				modptr->R_at_costheta(0.0),
+ 	return MATPACK::FindZero(rpole,
+				requator,
 				OblDeflectionTOA_rcrit_zero_func_wrapper); // rcrit_guess
+}
 
- 
-  	return candidate;
+// The root is found with FindZero; its derivatives follow from those of
+// rcrit_zero_func, rc - b sqrt(1 - 2M/rc), through b and M.
+template <class T>
+T OblDeflectionTOA::rcrit ( const T& b, const double& cos_theta, const OblStar<T>& star, bool *prob ) const {
+  	double candidate;
+       
+  	if ( b == star.rspot / sqrt( 1.0 - 2.0 * star.mass_over_r ) ) { // bmax_outgoing
+    	return star.rspot;
+  	}
+
+   	candidate = rcrit_root( Value(b) );
+
+  	double m( Value(star.mass) );
+  	return ImplicitRoot( candidate, candidate - b * sqrt( 1.0 - 2.0 * star.mass / candidate ),
+  	                     1.0 - Value(b) * m / (candidate * candidate * sqrt( 1.0 - 2.0 * m / candidate )) );
 }
 
 /*****************************************************/
@@ -320,27 +515,34 @@ double OblDeflectionTOA::rcrit ( const double& b, const double& cos_theta, bool
 double OblDeflectionTOA::psi_outgoing ( const double& b, const double& rspot,
 				       					const double& b_max, const double& psi_max, 
 				       					bool *prob ) const{
+  	return psi_outgoing( b, star(rspot), b_max, psi_max, prob );
+}
 
-  	double dummy;
+template <class T>
+T OblDeflectionTOA::psi_outgoing ( const T& b, const OblStar<T>& star,
+				       			   const double& b_max, const double& psi_max, 
+				       			   bool *prob ) const{
+
+  	T dummy;
 
   	if ( b > b_max || b < 0.0 ) {
-    	std::cerr << "ERROR in OblDeflectionTOA::psi_outgoing(): b out-of-range." << std::endl;
+    	LogCount( EVENT_SENTINEL );
+    	LOG( LOG_DEBUG, LOG_DEFL, "OblDeflectionTOA::psi_outgoing(): b out-of-range." );
     	*prob = true;
     	dummy = -7888.0;
     	return dummy;
   	}
 
   	if ( fabs( b - b_max ) < 1e-7 ) { // essentially the same as b=b_max
-    	return psi_max;
+    	return T(psi_max);
 	}
-  	else {  // set globals
-    	OblDeflectionTOA_object = this;
-    	OblDeflectionTOA_b_value = b;     // this will be fed to another function
-
-    	double psi(0.0);
+  	else {
+    	T psi(0.0);
 
     	if ( b != 0.0 ) {
-      		psi = Integration( rspot, get_rfinal(), OblDeflectionTOA_psi_integrand_wrapper ); // integrating from r_surf to ~infinity
+      		psi = Integration( star.rspot, get_rfinal(), [&]( const T& r ) {
+      		    return CheckIntegrand( psi_integrand( b, r, star ), "psi_integrand", Value(r) );
+      		} ); // integrating from r_surf to ~infinity
     	}				
     	return psi;
   	}
@@ -350,34 +552,44 @@ double OblDeflectionTOA::psi_outgoing ( const double& b, const double& rspot,
 double OblDeflectionTOA::psi_outgoing_u ( const double& b, const double& rspot,
 				       					const double& b_max, const double& psi_max, 
 				       					bool *prob ) const{
+  	return psi_outgoing_u( b, star(rspot), b_max, psi_max, prob );
+}
 
-  	double dummy;
+template <class T>
+T OblDeflectionTOA::psi_outgoing_u ( const T& b, const OblStar<T>& star,
+				       				 const double& b_max, const double& psi_max, 
+				       				 bool *prob ) const{
+
+  	T dummy;
 
   	if ( b > b_max || b < 0.0 ) {
-    	std::cerr << "ERROR in OblDeflectionTOA::psi_outgoing_u(): b out-of-range." << std::endl;
+    	LogCount( EVENT_SENTINEL );
+    	LOG( LOG_DEBUG, LOG_DEFL, "OblDeflectionTOA::psi_outgoing_u(): b out-of-range." );
     	*prob = true;
     	dummy = -7888.0;
     	return dummy;
   	}
 
   	if ( fabs( b - b_max ) < 1e-7 ) { // essentially the same as b=b_max
-    	return psi_max;
+    	return T(psi_max);
 	}
-  	else {  // set globals
-    	OblDeflectionTOA_object = this;
-    	OblDeflectionTOA_b_over_r = b/rspot;     // this will be fed to another function
+  	else {
+    	T b_R( b/star.rspot );
+    	auto integrand = [&]( const double& u ) {
+    	    return CheckIntegrand( psi_integrand_u( b_R, u, star ), "psi_integrand_u", u );
+    	};
 
-    	double psi(0.0);
+    	T psi(0.0);
 
     	if ( b != 0.0 ) {
-	  //psi = Integration( 0.0, 1.0, OblDeflectionTOA_psi_integrand_wrapper_u ); // integrating from r_surf to ~infinity
+	  //psi = Integration( 0.0, 1.0, integrand ); // integrating from r_surf to ~infinity
 	  if ( b > 0.995*b_max){
 	    double split(0.95);  	
-	    psi = Integration( 0.0, split, OblDeflectionTOA_psi_integrand_wrapper_u,TRAPEZOIDAL_INTEGRAL_N );
-	    psi += Integration( split, 1.0, OblDeflectionTOA_psi_integrand_wrapper_u,TRAPEZOIDAL_INTEGRAL_N_1 );
+	    psi = Integration( 0.0, split, integrand,TRAPEZOIDAL_INTEGRAL_N );
+	    psi += Integration( split, 1.0, integrand,TRAPEZOIDAL_INTEGRAL_N_1 );
 	  }
 	  else
-	    psi = Integration( 0.0, 1.0, OblDeflectionTOA_psi_integrand_wrapper_u,TRAPEZOIDAL_INTEGRAL_N );
+	    psi = Integration( 0.0, 1.0, integrand,TRAPEZOIDAL_INTEGRAL_N );
     	}				
     	return psi;
   	}
@@ -389,20 +601,20 @@ double OblDeflectionTOA::psi_outgoing_u ( const double& b, const double& rspot,
 double OblDeflectionTOA::psi_max_outgoing ( const double& b, const double& rspot, bool *prob ) {
   	double dummy;
   	if ( b > bmax_outgoing(rspot) || b < 0.0 ) {
-    	std::cerr << "ERROR in OblDeflectionTOA::psi_outgoing(): b out-of-range." << std::endl;
+    	LogCount( EVENT_SENTINEL );
+    	LOG( LOG_DEBUG, LOG_DEFL, "OblDeflectionTOA::psi_outgoing(): b out-of-range." );
     	*prob = true;
     	dummy = -7888.0;
     	return dummy;
   	}
 
-  	// set globals
-  	OblDeflectionTOA_object = this;
-  	OblDeflectionTOA_b_value = b;
+  	OblStar<double> s( star(rspot) );
   	
-  	double psi = Integration( rspot, get_rfinal(), OblDeflectionTOA_psi_integrand_wrapper );
+  	double psi = Integration( rspot, get_rfinal(), [&]( const double& r ) {
+  	    return CheckIntegrand( psi_integrand( b, r, s ), "psi_integrand", r );
+  	} );
 					
-	std::cout << "Psi_max: b/r = " << b/rspot << " rspot = " << rspot << " r_final = " << get_rfinal() << std::endl;
-	std::cout << "psi = " << psi << std::endl;
+	LOG( LOG_DEBUG, LOG_DEFL, "Psi_max: b/r = " << b/rspot << " rspot = " << rspot << " r_final = " << get_rfinal() << " psi = " << psi );
 
   	return psi;
 }
@@ -410,22 +622,30 @@ double OblDeflectionTOA::psi_max_outgoing ( const double& b, const double& rspot
 double OblDeflectionTOA::psi_max_outgoing_u ( const double& b, const double& rspot, bool *prob ) const{
   	double dummy;
   	if ( b > bmax_outgoing(rspot) || b < 0.0 ) {
-    	std::cerr << "ERROR in OblDeflectionTOA::psi_outgoing(): b out-of-range." << std::endl;
+    	LogCount( EVENT_SENTINEL );
+    	LOG( LOG_DEBUG, LOG_DEFL, "OblDeflectionTOA::psi_outgoing(): b out-of-range." );
     	*prob = true;
     	dummy = -7888.0;
     	return dummy;
   	}
 
-  	// set globals
-  	OblDeflectionTOA_object = this;
-  	OblDeflectionTOA_b_over_r = b/rspot;
+  	double psi( psi_max_outgoing_u( b, star(rspot), prob ) );
+					
+	LOG( LOG_DEBUG, LOG_DEFL, "Psi_max_u: b/r = " << b/rspot << " rspot = " << rspot << " r_final = " << get_rfinal() << " psi = " << psi );
+
+  	return psi;
+}
+
+template <class T>
+T OblDeflectionTOA::psi_max_outgoing_u ( const T& b, const OblStar<T>& star, bool *prob ) const{
+  	T b_R( b/star.rspot );
+  	auto integrand = [&]( const double& u ) {
+  	    return CheckIntegrand( psi_integrand_u( b_R, u, star ), "psi_integrand_u", u );
+  	};
 
 	double split(0.9);  	
-  	double psi = Integration( 0.0, split, OblDeflectionTOA_psi_integrand_wrapper_u,TRAPEZOIDAL_INTEGRAL_N_MAX_1 );
-	psi += Integration( split, 1.0, OblDeflectionTOA_psi_integrand_wrapper_u,TRAPEZOIDAL_INTEGRAL_N_MAX );
-					
-	std::cout << "Psi_max_u: b/r = " << b/rspot << " rspot = " << rspot << " r_final = " << get_rfinal() << std::endl;
-	std::cout << "psi = " << psi << std::endl;
+  	T psi = Integration( 0.0, split, integrand,TRAPEZOIDAL_INTEGRAL_N_MAX_1 );
+	psi += Integration( split, 1.0, integrand,TRAPEZOIDAL_INTEGRAL_N_MAX );
 
   	return psi;
 }
@@ -433,31 +653,20 @@ double OblDeflectionTOA::psi_max_outgoing_u ( const double& b, const double& rsp
 /*****************************************************/
 /*****************************************************/
 double OblDeflectionTOA::psi_ingoing ( const double& b, const double& cos_theta, bool *prob ) const {
+  	return psi_ingoing( b, cos_theta, star( Ring( cos_theta ).rsurface ), prob );
+}
+
+template <class T>
+T OblDeflectionTOA::psi_ingoing ( const T& b, const double& cos_theta, const OblStar<T>& star, bool *prob ) const {
   //costheta_check( cos_theta );
   
-  	double rspot ( modptr->R_at_costheta( cos_theta ) );
-  	//double dummy;
-  	// std::cout << "psi_ingoing: cos_theta = " << cos_theta << " b = " << b << " r = " << rspot << std::endl;
-	/*
-  	if ( b > bmax_outgoing(rspot) || b < bmin_ingoing( rspot, cos_theta ) ) {
-    	std::cerr << "ERROR in OblDeflectionTOA::psi_ingoing(): b out-of-range." << std::endl;
-    	*prob = true;
-    	dummy = -7888.0;
-    	return dummy;
- 	}
-	*/
-  	// set globals
-  	OblDeflectionTOA_object = this;
-  	OblDeflectionTOA_b_value = b;
-
- 
   	// See psi_outgoing. Use an approximate formula for the integral near rcrit, and the real formula elsewhere
   
-  	double rcrit = this->rcrit( b, cos_theta, &curve.problem );
+  	T rcrit = this->rcrit( b, cos_theta, star, &OblDeflectionTOA_problem );
 
-  	double psi_in = 2.0 * sqrt( 2.0 * (rspot - rcrit) / (rcrit - 3.0 * get_mass()) );
+  	T psi_in = 2.0 * sqrt( 2.0 * (star.rspot - rcrit) / (rcrit - 3.0 * star.mass) );
 
-  	return double( psi_in + this->psi_outgoing( b, rspot, 100.0, 100.0, &curve.problem ) );
+  	return T( psi_in + this->psi_outgoing( b, star, 100.0, 100.0, &OblDeflectionTOA_problem ) );
 }
 
 /*****************************************************/
@@ -487,14 +696,16 @@ bool OblDeflectionTOA::b_from_psi ( const double& psi, const double& rspot, cons
     OblDeflectionTOA_psi_guess = psi_guess;
 
   	if ( std::isinf(psi_out_max) ) {
-    	std::cerr << "ERROR in OblDeflectionTOA::b_from_psi(): psi_out_max = infinity" << std::endl;
+    	LogCount( EVENT_SENTINEL );
+    	LOG( LOG_DEBUG, LOG_DEFL, "OblDeflectionTOA::b_from_psi(): psi_out_max = infinity" );
     	*prob = true;
     	dummyb = -7888.0;
     	return dummyb;
   	}
 
   	if ( psi < 0 ) {
-    	std::cerr << "ERROR in OblDeflectionTOA::b_from_psi: need psi >= 0" << std::endl;
+    	LogCount( EVENT_SENTINEL );
+    	LOG( LOG_DEBUG, LOG_DEFL, "OblDeflectionTOA::b_from_psi: need psi >= 0" );
     	*prob = true;
     	dummypsi = -7888.0;
     	return dummypsi;
@@ -519,7 +730,8 @@ bool OblDeflectionTOA::b_from_psi ( const double& psi, const double& rspot, cons
  
 
     	if ( fabs(bcand) <= std::numeric_limits<double>::epsilon() || fabs(bmax_out - bcand) <= std::numeric_limits<double>::epsilon() ) { // this indicates no soln
-      		std::cerr << "ERROR in OblDeflectionTOA::b_from_psi(): outgoing returned no solution?" << std::endl;
+      		LogCount( EVENT_SENTINEL );
+      		LOG( LOG_DEBUG, LOG_DEFL, "OblDeflectionTOA::b_from_psi(): outgoing returned no solution?" );
       		*prob = true;
       		b = -7888.0;
       		return b;
@@ -540,9 +752,12 @@ bool OblDeflectionTOA::b_from_psi ( const double& psi, const double& rspot, cons
     	//std::cout << "b_from_psi: psi > psi_out_max" << std::endl;
 
     	if ( ingoing_allowed ) {
-	  bmin_in = bmin_ingoing( rspot, cos_theta );
-       
-	  psi_in_max = psi_ingoing( bmin_in, cos_theta, &curve.problem );
+	  // the same for every phase bin of the ring, so tabulated once per ring
+	  if ( OblDeflectionTOA_ring.rspot != rspot )
+	    IngoingTable( rspot, cos_theta );
+	  const OblRing& ring( OblDeflectionTOA_ring );
+	  bmin_in = ring.bmin_in;
+	  psi_in_max = ring.psi_in_max;
 
 	  if ( psi > psi_in_max ) {
 	    return false;
@@ -552,26 +767,22 @@ bool OblDeflectionTOA::b_from_psi ( const double& psi, const double& rspot, cons
 	    rdot = -1;
 	    return true;
 	  }
-	  else { // psi_out_max < psi < psi_in_max
-	    OblDeflectionTOA_object = this;
-	    OblDeflectionTOA_costheta_value = cos_theta;
-	    OblDeflectionTOA_psi_value = psi;
-
-	    bcand = MATPACK::FindZero(bmin_in, bmax_out,
-				      OblDeflectionTOA_b_from_psi_ingoing_zero_func_wrapper,
-				      OblDeflectionTOA::FINDZERO_EPS);
- 
-	    if( fabs(bmin_in - bcand) <= std::numeric_limits<double>::epsilon() || fabs(bmax_out - bcand) <= std::numeric_limits<double>::epsilon() ) { // this indicates no soln
-	      std::cerr << "ERROR in OblDeflectionTOA::b_from_psi(): ingoing returned no solution?" << std::endl;
-	      *prob = true;
-	      b = -7888.0;
-	      return b;
-	    }
-	    else {
-	      b = bcand;
-	      rdot = -1;
-	      return true;
+	  else if ( psi < ring.psi_turn ) {
+	    // No ray: below the bottom of the branch. FindZero used to land next to b_max
+	    // here, within its tolerance.
+	    return false;
+	  }
+	  else { // psi_turn <= psi < psi_in_max: psi(x) = psi on the table, by bisection
+	    double lo(ring.x_turn), hi(1.0);
+	    for ( long int n(0); n < INGOING_BISECTIONS; n++ ) {
+	      double x( 0.5 * (lo + hi) );
+	      if ( IngoingColumn( ring.psi, x ) < psi ) lo = x;
+	      else hi = x;
 	    }
+	    double x( 0.5 * (lo + hi) );
+	    b = ring.b_hi - (ring.b_hi - bmin_in) * x * x;
+	    rdot = -1;
+	    return true;
 	  }
     	} // end ingoing photons are allowed
     	else { // ingoing photons not allowed.
@@ -579,38 +790,73 @@ bool OblDeflectionTOA::b_from_psi ( const double& psi, const double& rspot, cons
       		return false;
     	}
   	}
-  	std::cerr << "ERROR in OblDeflectionTOA::b_from_psi(): reached end of function?" << std::endl;
+  	LogCount( EVENT_SENTINEL );
+  	LOG( LOG_DEBUG, LOG_DEFL, "OblDeflectionTOA::b_from_psi(): reached end of function?" );
   	*prob = true;
   	return false;
 }
 
+/*****************************************************/
+/* OblDeflectionTOA::b_of_psi                        */
+/*                                                   */
+/* b as found by b_from_psi, with the derivatives of */
+/* the way it was found. Outgoing, b is the 4-point  */
+/* interpolation in the look-up table, b_table;      */
+/* ingoing, FindZero solves psi(b) = psi, so the     */
+/* derivatives follow from those of psi(b) - psi at  */
+/* fixed b (see ImplicitRoot in Dual.h), with the    */
+/* slope of the same psi(b). For double, just b.     */
+/*****************************************************/
+template <class T>
+T OblDeflectionTOA::b_of_psi ( const double& b, const int& rdot, const T& b_table, const T& psi,
+							   const double& cos_theta, const OblStar<T>& star, const double& b_max,
+							   const double& psi_max, bool *prob ) const {
+  	if ( !IsDual<T>::value ) return T(b);
+
+  	if ( b == b_max ) 
+    	return WithValue( b, T( star.rspot / sqrt( 1.0 - 2.0 * star.mass_over_r ) ) );
+
+  	if ( rdot > 0 )
+    	return WithValue( b, b_table );
+
+  	OblStar<T> fixed = { T(Value(star.mass)), T(Value(star.mass_over_r)), T(Value(star.rspot)), T(Value(star.rpole)) };
+  	T b_var( b );
+  	SetDerivative( b_var, 0, 1.0 );
+  	return ImplicitRoot( b, T( psi_ingoing( T(b), cos_theta, star, prob ) - psi ),
+  	                     Derivative( psi_ingoing( b_var, cos_theta, fixed, prob ), 0 ) );
+}
+
 /*****************************************************/
 // warning: this integral will diverge near bmax_out. You can't remove
   	// the divergence in the same manner as the one for the deflection.
   	// check the output!
 /*****************************************************/
 double OblDeflectionTOA::dpsi_db_outgoing( const double& b, const double& rspot, bool *prob ) {
+  	return dpsi_db_outgoing( b, star(rspot), prob );
+}
+
+template <class T>
+T OblDeflectionTOA::dpsi_db_outgoing( const T& b, const OblStar<T>& star, bool *prob ) const {
   	//costheta_check(cos_theta);
   
-  	double dummy; //
+  	T dummy; //
+  	double b_max( Value(star.rspot) / sqrt( 1.0 - 2.0 * Value(star.mass_over_r) ) ); // bmax_outgoing
 
-  	if ( (b > bmax_outgoing(rspot) || b < 0.0) ) { 
-    	std::cerr << "ERROR inOblDeflectionTOA::dpsi_db_outgoing(): b out-of-range." << std::endl;
-    	std::cerr << "b = " << b << ", bmax = " << bmax_outgoing(rspot) << ", |b - bmax| = " << fabs(b - bmax_outgoing(rspot)) << std::endl;
+  	if ( (b > b_max || b < 0.0) ) { 
+    	LogCount( EVENT_SENTINEL );
+    	LOG( LOG_DEBUG, LOG_DEFL, "OblDeflectionTOA::dpsi_db_outgoing(): b out-of-range, b = " << b << ", bmax = " << b_max );
     	*prob = true;
     	dummy = -7888.0;
     	return dummy;
   	}
   
-  	// set globals
-  	OblDeflectionTOA_object = this;
-  	OblDeflectionTOA_b_value = b;
-
   	//double rsurf = modptr->R_at_costheta(cos_theta);
 
   	//rsurf = rspot;
 
-  	double dpsidb = Integration( rspot, get_rfinal(), OblDeflectionTOA_dpsi_db_integrand_wrapper );
+  	T dpsidb = Integration( star.rspot, get_rfinal(), [&]( const T& r ) {
+  	    return CheckIntegrand( dpsi_db_integrand( b, r, star ), "dpsi_db_integrand", Value(r) );
+  	} );
   	
   	return dpsidb;
 }
@@ -621,45 +867,51 @@ double OblDeflectionTOA::dpsi_db_outgoing( const double& b, const double& rspot,
   	// check the output!
 /*****************************************************/
 double OblDeflectionTOA::dpsi_db_outgoing_u( const double& b, const double& rspot, bool *prob ) const {
+  	return dpsi_db_outgoing_u( b, star(rspot), prob );
+}
+
+template <class T>
+T OblDeflectionTOA::dpsi_db_outgoing_u( const T& b, const OblStar<T>& star, bool *prob ) const {
   	//costheta_check(cos_theta);
   
-  	double dummy; //
+  	T dummy; //
 
-	double b_max = bmax_outgoing(rspot);
+	double b_max( Value(star.rspot) / sqrt( 1.0 - 2.0 * Value(star.mass_over_r) ) ); // bmax_outgoing
 
   	if ( (b > b_max || b < 0.0) ) { 
-    	std::cerr << "ERROR inOblDeflectionTOA::dpsi_db_outgoing(): b out-of-range." << std::endl;
-    	std::cerr << "b = " << b << ", bmax = " << bmax_outgoing(rspot) << ", |b - bmax| = " << fabs(b - bmax_outgoing(rspot)) << std::endl;
+    	LogCount( EVENT_SENTINEL );
+    	LOG( LOG_DEBUG, LOG_DEFL, "OblDeflectionTOA::dpsi_db_outgoing(): b out-of-range, b = " << b << ", bmax = " << b_max );
     	*prob = true;
     	dummy = -7888.0;
     	return dummy;
   	}
   
-  	// set globals
-  	OblDeflectionTOA_object = this;
-  	OblDeflectionTOA_b_over_r = b/rspot;
+  	T b_R( b/star.rspot );
+  	auto integrand = [&]( const double& u ) {
+  	    return CheckIntegrand( dpsi_db_integrand_u( b_R, u, star ), "dpsi_db_integrand_u", u );
+  	};
 
   	//double rsurf = modptr->R_at_costheta(cos_theta);
 
   	//rsurf = rspot;
 
-	double dpsidb(0.0);
+	T dpsidb(0.0);
 	double split(0.9);
 
 	if (b < 0.95*b_max)
-	  dpsidb = Integration( 0.0, 1.0, OblDeflectionTOA_dpsi_db_integrand_wrapper_u,TRAPEZOIDAL_INTEGRAL_N );
+	  dpsidb = Integration( 0.0, 1.0, integrand,TRAPEZOIDAL_INTEGRAL_N );
 	else
 	  if ( b < 0.99995*b_max){
 	      	
-	    dpsidb = Integration( 0.0, split, OblDeflectionTOA_dpsi_db_integrand_wrapper_u,TRAPEZOIDAL_INTEGRAL_N );
-	    dpsidb += Integration( split, 1.0, OblDeflectionTOA_dpsi_db_integrand_wrapper_u,TRAPEZOIDAL_INTEGRAL_N_1 );
+	    dpsidb = Integration( 0.0, split, integrand,TRAPEZOIDAL_INTEGRAL_N );
+	    dpsidb += Integration( split, 1.0, integrand,TRAPEZOIDAL_INTEGRAL_N_1 );
 	    //std::cout << "b/r = " << b/rspot << " b_max/r = " << b_max/rspot 
 	    //	      << " b/b_max = " << b/b_max << " dpsidb = " << dpsidb << std::endl; 
 
 	  }
 	  else{
-	    dpsidb = Integration( 0.0, split, OblDeflectionTOA_dpsi_db_integrand_wrapper_u,TRAPEZOIDAL_INTEGRAL_N );
-	    dpsidb += Integration( split, 1.0, OblDeflectionTOA_dpsi_db_integrand_wrapper_u,TRAPEZOIDAL_INTEGRAL_N_1*100 );
+	    dpsidb = Integration( 0.0, split, integrand,TRAPEZOIDAL_INTEGRAL_N );
+	    dpsidb += Integration( split, 1.0, integrand,TRAPEZOIDAL_INTEGRAL_N_1*100 );
 	    //std::cout << "*******b/r = " << b/rspot << " b_max/r = " << b_max/rspot 
 	    //	      << " b/b_max = " << b/b_max << " dpsidb = " << dpsidb << std::endl; 
 
@@ -668,7 +920,7 @@ double OblDeflectionTOA::dpsi_db_outgoing_u( const double& b, const double& rspo
 	  
 	    
 
-	  //double dpsidb = Integration( 0.0, 1.0, OblDeflectionTOA_dpsi_db_integrand_wrapper_u );
+	  //double dpsidb = Integration( 0.0, 1.0, integrand );
   	
   	return dpsidb;
 }
@@ -682,17 +934,25 @@ double OblDeflectionTOA::dpsi_db_outgoing_u( const double& b, const double& rspo
 // so we use it instead for the derivative.
 /*****************************************************/
 double OblDeflectionTOA::dpsi_db_ingoing( const double& b, const double& rspot, const double& cos_theta, bool *prob ) {
+  	double x( IngoingX( b, rspot, cos_theta ) );
+  	if ( x > 0.0 ) // from the table b_from_psi made for the ring
+    	return IngoingColumn( OblDeflectionTOA_ring.dpsi_db_x, x ) / x;
+  	return dpsi_db_ingoing( b, cos_theta, star(rspot), prob );
+}
 
-  	double rcrit = this->rcrit( b, cos_theta, &curve.problem );
-  	double m = this->get_mass();
-  	double drcrit_db = sqrt( 1.0 - 2.0 * m / rcrit ) / (1.0 - ( (b / rcrit) * (m / rcrit)
-	        		   / sqrt( 1.0 - 2.0 * m / rcrit )) );
+template <class T>
+T OblDeflectionTOA::dpsi_db_ingoing( const T& b, const double& cos_theta, const OblStar<T>& star, bool *prob ) const {
 
-	double dpsidb_in = -sqrt(2.0) * (drcrit_db) * (rspot - 3.0 * m)
-					   / (sqrt( (rspot - rcrit) / (rcrit - 3.0 * m) ) 
-					   * pow( rcrit - 3.0 * m , 2.0 ) );
+  	T rcrit = this->rcrit( b, cos_theta, star, &OblDeflectionTOA_problem );
+  	T m = star.mass;
+  	T drcrit_db = sqrt( 1.0 - 2.0 * m / rcrit ) / (1.0 - ( (b / rcrit) * (m / rcrit)
+	        	  / sqrt( 1.0 - 2.0 * m / rcrit )) );
 
-  	return double ( dpsidb_in + this->dpsi_db_outgoing( b, rspot, &curve.problem ) );
+	T dpsidb_in = -sqrt(2.0) * (drcrit_db) * (star.rspot - 3.0 * m)
+				  / (sqrt( (star.rspot - rcrit) / (rcrit - 3.0 * m) ) 
+				  * pow( rcrit - 3.0 * m , 2.0 ) );
+
+  	return T( dpsidb_in + this->dpsi_db_outgoing( b, star, &OblDeflectionTOA_problem ) );
 }
 
 /********************************************************************************/
@@ -704,13 +964,14 @@ double OblDeflectionTOA::dpsi_db_ingoing( const double& b, const double& rspot,
 /* Returns the time of arrival of the photon                                    */
 /********************************************************************************/
 double OblDeflectionTOA::toa_outgoing ( const double& b, const double& rspot, bool *prob ) {
+  	return toa_outgoing( b, star(rspot), prob );
+}
+
+template <class T>
+T OblDeflectionTOA::toa_outgoing ( const T& b, const OblStar<T>& star, bool *prob ) const {
 	// costheta_check(cos_theta);
   	//double dummy;
 
-  	// set globals
-  	OblDeflectionTOA_object = this;
-  	OblDeflectionTOA_b_value = b;
-
   	// Note: Use an approximation to the integral near the surface
   	// to avoid divergence problems, and then use the real
   	// integral afterwards. See astro-ph/07030123 for the formula.
@@ -724,29 +985,36 @@ double OblDeflectionTOA::toa_outgoing ( const double& b, const double& rspot, bo
 
   	//double rsurf = modptr->R_at_costheta(cos_theta);
  
-  	double rsurf = rspot;
-  	double rpole = modptr->R_at_costheta(1.0);
+  	T rsurf = star.rspot;
+  	T rpole = star.rpole;
 
   	//std::cout << "toa_outgoing: rpole = " << rpole << std::endl;
 
-  	double toa = Integration( rsurf, get_rfinal(), OblDeflectionTOA_toa_integrand_minus_b0_wrapper );
+  	T toa = Integration( rsurf, get_rfinal(), [&]( const T& r ) {
+  	    return CheckIntegrand( toa_integrand_minus_b0( b, r, star ), "toa_integrand_minus_b0", Value(r) );
+  	} );
 
-  	double toa_b0_polesurf = (rsurf - rpole) + 2.0 * get_mass() * ( log( rsurf - 2.0 * get_mass() )
-		       				 - log( rpole - 2.0 * get_mass() ) );
+  	T toa_b0_polesurf = (rsurf - rpole) + 2.0 * star.mass * ( log( rsurf - 2.0 * star.mass )
+		       			- log( rpole - 2.0 * star.mass ) );
 
-  	return double( toa - toa_b0_polesurf);
+  	return T( toa - toa_b0_polesurf);
 }
 
 double OblDeflectionTOA::toa_outgoing_u ( const double& b, const double& rspot, bool *prob ) {
+  	return toa_outgoing_u( b, star(rspot), prob );
+}
+
+template <class T>
+T OblDeflectionTOA::toa_outgoing_u ( const T& b, const OblStar<T>& star, bool *prob ) const {
 	// costheta_check(cos_theta);
   	//double dummy;
 
-  	// set globals
+  double b_max( Value(star.rspot) / sqrt( 1.0 - 2.0 * Value(star.mass_over_r) ) ); // bmax_outgoing
 
-  double b_max=bmax_outgoing(rspot);
-
-  OblDeflectionTOA_object = this;
-  OblDeflectionTOA_b_over_r = b/rspot;
+  T b_R( b/star.rspot );
+  auto integrand = [&]( const double& u ) {
+      return CheckIntegrand( toa_integrand_minus_b0_u( b_R, u, star ), "toa_integrand_minus_b0_u", u );
+  };
 
   	// Note: Use an approximation to the integral near the surface
   	// to avoid divergence problems, and then use the real
@@ -761,27 +1029,27 @@ double OblDeflectionTOA::toa_outgoing_u ( const double& b, const double& rspot,
 
   	//double rsurf = modptr->R_at_costheta(cos_theta);
  
-  	double rsurf = rspot;
-  	double rpole = modptr->R_at_costheta(1.0);
+  	T rsurf = star.rspot;
+  	T rpole = star.rpole;
 
   	//std::cout << "toa_outgoing: rpole = " << rpole << std::endl;
-	double toa(0.0);
+	T toa(0.0);
 	double split(0.99);
 
 	if (b < 0.95*b_max)
-	  toa = Integration( 0.0, 1.0, OblDeflectionTOA_toa_integrand_minus_b0_wrapper_u,TRAPEZOIDAL_INTEGRAL_N/10 );
+	  toa = Integration( 0.0, 1.0, integrand,TRAPEZOIDAL_INTEGRAL_N/10 );
 	else
 	  if ( b < 0.9999999*b_max){
 	      	
-	    toa = Integration( 0.0, split, OblDeflectionTOA_toa_integrand_minus_b0_wrapper_u,TRAPEZOIDAL_INTEGRAL_N );
-	    toa += Integration( split, 1.0, OblDeflectionTOA_toa_integrand_minus_b0_wrapper_u,TRAPEZOIDAL_INTEGRAL_N_1/10 );
+	    toa = Integration( 0.0, split, integrand,TRAPEZOIDAL_INTEGRAL_N );
+	    toa += Integration( split, 1.0, integrand,TRAPEZOIDAL_INTEGRAL_N_1/10 );
 	    //std::cout << "b/r = " << b/rspot << " b_max/r = " << b_max/rspot 
 	    //	      << " b/b_max = " << b/b_max << " toa = " << toa << std::endl; 
 
 	  }
 	  else{
-	    toa = Integration( 0.0, split, OblDeflectionTOA_toa_integrand_minus_b0_wrapper_u,TRAPEZOIDAL_INTEGRAL_N );
-	    toa += Integration( split, 1.0, OblDeflectionTOA_toa_integrand_minus_b0_wrapper_u,TRAPEZOIDAL_INTEGRAL_N_1*10 );
+	    toa = Integration( 0.0, split, integrand,TRAPEZOIDAL_INTEGRAL_N );
+	    toa += Integration( split, 1.0, integrand,TRAPEZOIDAL_INTEGRAL_N_1*10 );
 	    //std::cout << "*******b/r = " << b/rspot << " b_max/r = " << b_max/rspot 
 	    //	      << " b/b_max = " << b/b_max << " toa = " << toa << std::endl; 
 
@@ -789,92 +1057,42 @@ double OblDeflectionTOA::toa_outgoing_u ( const double& b, const double& rspot,
 	  }
 	  
 	    
-  	//double toa = Integration( 0.0, 1.0, OblDeflectionTOA_toa_integrand_minus_b0_wrapper_u );
+  	//double toa = Integration( 0.0, 1.0, integrand );
 
-  	double toa_b0_polesurf = (rsurf - rpole) + 2.0 * get_mass() * ( log( rsurf - 2.0 * get_mass() )
-		       				 - log( rpole - 2.0 * get_mass() ) );
+  	T toa_b0_polesurf = (rsurf - rpole) + 2.0 * star.mass * ( log( rsurf - 2.0 * star.mass )
+		       			- log( rpole - 2.0 * star.mass ) );
 
-  	return double( toa - toa_b0_polesurf);
+  	return T( toa - toa_b0_polesurf);
 }
 
 
 /*****************************************************/
 /*****************************************************/
 double OblDeflectionTOA::toa_ingoing ( const double& b, const double& rspot, const double& cos_theta, bool *prob ) {
+  	double x( IngoingX( b, rspot, cos_theta ) );
+  	if ( x >= 0.0 ) // from the table b_from_psi made for the ring
+    	return IngoingColumn( OblDeflectionTOA_ring.toa, x );
+  	return toa_ingoing( b, cos_theta, star(rspot), prob );
+}
+
+template <class T>
+T OblDeflectionTOA::toa_ingoing ( const T& b, const double& cos_theta, const OblStar<T>& star, bool *prob ) const {
   //double dummy;
   	//costheta_check(cos_theta);
-	/*
-  	if ( b > bmax_outgoing(rspot) || b < bmin_ingoing(rspot, cos_theta) ) {
-    	std::cerr << "ERROR in OblDeflectionTOA::toa_ingoing(): b out-of-range." << std::endl;
-    	*prob = true;
-    	dummy = -7888.0;
-    	return dummy;
-  	}
-	*/
   	// std::cerr << "DEBUG: rcrit (km) = " << Units::nounits_to_cgs(this->rcrit(b,cos_theta), Units::LENGTH)/1.0e5 << std::endl;
 
-  	OblDeflectionTOA_object = this;
-  	OblDeflectionTOA_b_value = b;
-
   	// See psi_ingoing. Use an approximate formula for the integral near rcrit, and the real formula elsewhere
   
-  	double rcrit = this->rcrit( b, cos_theta, &curve.problem );
+  	T rcrit = this->rcrit( b, cos_theta, star, &OblDeflectionTOA_problem );
  
-  	double toa_in = rcrit / sqrt( 1 - 2.0 * get_mass() / rcrit ) * 2.0 * 
-  					sqrt( 2.0 * (modptr->R_at_costheta(cos_theta) - rcrit) / 
-  					(rcrit - 3.0 * get_mass()) );
-
-	//  	double rspot( modptr->R_at_costheta(cos_theta) );
-
-  	return double( toa_in + this->toa_outgoing( b, rspot, &curve.problem ) );
-
-}
-
-/*****************************************************/
-// gives the integrand from equation 20, MLCB
-/*****************************************************/
-double OblDeflectionTOA::psi_integrand ( const double& b, const double& r) const { 
-  double integrand( b / (r * r * sqrt( 1.0 - pow( b / r, 2.0 ) * (1.0 - 2.0 * get_mass_over_r() * get_rspot()/r ) )) );
-  	return integrand;
-}
-
-/*****************************************************/
-// Integrand with respect to u=R/r. b_R = b/R
-/*****************************************************/
-double OblDeflectionTOA::psi_integrand_u ( const double& b_R, const double& u) const { 
-  // double integrand( b / (r * r * sqrt( 1.0 - pow( b / r, 2.0 ) * (1.0 - 2.0 * get_mass_over_r() * get_rspot()/r ) )) );
-  double integrand ( b_R / sqrt( 1.0 - pow(u*b_R,2)*(1.0-2.0*get_mass_over_r()*u) ));
-  	return integrand;
-}
-
-/*****************************************************/
-// integrand for the derivative of equation 20, MLCB
-/*****************************************************/
-double OblDeflectionTOA::dpsi_db_integrand ( const double& b, const double& r ) const { 
-  // double integrand( (1.0 / ( r * r * sqrt( 1.0 - pow( b / r , 2.0 ) * (1.0 - 2.0 * get_mass_over_r() * get_rspot()/r) )) ) 
-  //		    + (b * b * (1.0 - 2.0 * get_mass_over_r() * get_rspot()/r) 
-  //		       / (pow( r , 4.0 ) * pow( 1.0 - pow( b / r , 2.0 ) * (1.0 - 2.0 * get_mass_over_r() * get_rspot()/r) , 1.5) ) ) );
+  	T toa_in = rcrit / sqrt( 1 - 2.0 * star.mass / rcrit ) * 2.0 * 
+  			   sqrt( 2.0 * (star.rspot - rcrit) / 
+  			   (rcrit - 3.0 * star.mass) );
 
-  double integrand ( 1.0/(r*r) *  
-		     pow( 1.0 - pow( b / r , 2.0 ) * (1.0 - 2.0 * get_mass_over_r() * get_rspot()/r) , -1.5));
+  	return T( toa_in + this->toa_outgoing( b, star, &OblDeflectionTOA_problem ) );
 
-  	return integrand;
 }
 
-/*****************************************************/
-// integrand for the derivative of equation 20, MLCB
-/*****************************************************/
-double OblDeflectionTOA::dpsi_db_integrand_u ( const double& b_R, const double& u ) const { 
-  // double integrand( (1.0 / ( r * r * sqrt( 1.0 - pow( b / r , 2.0 ) * (1.0 - 2.0 * get_mass_over_r() * get_rspot()/r) )) ) 
-  //		    + (b * b * (1.0 - 2.0 * get_mass_over_r() * get_rspot()/r) 
-  //		       / (pow( r , 4.0 ) * pow( 1.0 - pow( b / r , 2.0 ) * (1.0 - 2.0 * get_mass_over_r() * get_rspot()/r) , 1.5) ) ) );
-
-  double integrand ( 1.0/get_rspot() *  pow( 1.0 - pow( b_R*u , 2.0 ) * (1.0 - 2.0 * get_mass_over_r() * u) , -1.5));
-
-  	return integrand;
-}
-
-
 /*****************************************************/
 // integrand from equation 38, MLCB, without the -1
 /*****************************************************/
@@ -884,24 +1102,6 @@ double OblDeflectionTOA::toa_integrand ( const double& b, const double& r ) cons
   	return integrand;
 }
 
-/*****************************************************/
-// gives the integrand from equation 38, MLCB
-/*****************************************************/
-double OblDeflectionTOA::toa_integrand_minus_b0 ( const double& b, const double& r ) const {   
-  double integrand( (1.0 / (1.0 - 2.0 * get_mass_over_r()*get_rspot()/r)) 
-		    * ( (1.0 / sqrt( 1.0 - pow( b / r , 2.0 ) * (1.0 - 2.0 * get_mass_over_r()*get_rspot()/r) )) - 1.0) );
-  	return integrand;
-}
-
-/*****************************************************/
-// gives the integrand from equation 38, MLCB
-/*****************************************************/
-double OblDeflectionTOA::toa_integrand_minus_b0_u ( const double& b_R, const double& u ) const {   
-  double integrand(  get_rspot()/(u*u) * (1.0 / (1.0 - 2.0 * get_mass_over_r()*u)) 
-		    * ( (1.0 / sqrt( 1.0 - pow( b_R * u , 2.0 ) * (1.0 - 2.0 * get_mass_over_r()*u) )) - 1.0) );
-  	return integrand;
-}
-
 /*****************************************************/
 // used in oblate shape of star
 /*****************************************************/
@@ -915,7 +1115,7 @@ double OblDeflectionTOA::rcrit_zero_func ( const double& rc, const double& b ) c
 double OblDeflectionTOA::b_from_psi_ingoing_zero_func ( const double& b, 
 														const double& cos_theta, 
 														const double& psi ) const { 
-  	return double( psi - this->psi_ingoing(b, cos_theta, &curve.problem) );
+  	return double( psi - this->psi_ingoing(b, cos_theta, &OblDeflectionTOA_problem) );
 }
 
 /*****************************************************/
@@ -927,78 +1127,28 @@ double OblDeflectionTOA::b_from_psi_outgoing_zero_func ( const double& b,
 														 const double& psi_max, 
 														 const double& b_guess, 
 														 const double& psi_guess ) const {
-  	return double( psi - this->psi_outgoing( b, cos_theta, b_max, psi_max, &curve.problem ) );
+  	return double( psi - this->psi_outgoing( b, cos_theta, b_max, psi_max, &OblDeflectionTOA_problem ) );
 }
 
 /*****************************************************/
-/* OblDeflectionTOA::TrapezoidalInteg                */
-/*                                                   */
-/* Numerically integrates using the trapezoid rule.  */
+/* The routines used by ComputeAngles, for double    */
+/* and for the derivatives with respect to the fit   */
+/* parameters (see Chi.h)                            */
 /*****************************************************/
-double OblDeflectionTOA::TrapezoidalInteg ( const double& a, const double& b, 
-                                            double (*func)(double x, bool *prob),
-					   						const long int& N ) {
-  	if ( a == b ) return double(0.0);
-
-  	double integral(0.0);
-  	//const long int N( OblDeflectionTOA::TRAPEZOIDAL_INTEGRAL_N );
-  	const double power( OblDeflectionTOA::TRAPEZOIDAL_INTEGRAL_POWER );
-
-  	for ( int i(1); i <= N; i++ ) {
-    	double left, right, mid, width, fmid;
-    	left = TrapezoidalInteg_pt( a, b, power, N, i-1, &curve.problem );
-    	right = TrapezoidalInteg_pt( a, b, power, N, i, &curve.problem );
-    	mid = (left + right) / 2.0;
-    	width = right - left;
-    	fmid = (*func)(mid, &curve.problem); //Double Check
-    
-    	integral += (width * fmid);
-  	}
-
-  	return integral;
-}
-
-/*****************************************************/
-/* OblDeflectionTOA::TrapezoidalInteg                */
-/*                                                   */
-/* Numerically integrates using the trapezoid rule.  */
-
-
-/*******************************************************/
-/* OblDeflectionTOA::TrapezoidalInteg_pt               */
-/*                                                     */
-/* Called in TrapezoidalInteg                          */
-/* Power spacing of subdivisions for TrapezoidalInteg  */
-/* i ranges from 0 to N                                */
-/*******************************************************/
-double OblDeflectionTOA::TrapezoidalInteg_pt ( const double& a, const double& b, 
-					      					   const double& power, const long int& N,
-					      					   const long int& i, bool *prob ) {
-  	double dummy;
-  	if ( N <= 0 ) {
-    	std::cerr << "ERROR in OblDeflectionTOA::TrapezoidalInteg_pt: N <= 0." << std::endl;
-    	*prob = true;
-    	dummy = -7888.0;
-    	return dummy;
-  	}
-  	if ( i < 0 || i > N ) {
-    	std::cerr << "ERROR in OblDeflectionTOA::TrapezoidalInteg_pt: i out of range." << std::endl;
-    	*prob = true;
-    	dummy = -7888.0;
-    	return dummy;
-  	}
-  	return double( a + (b - a) * pow( 1.0 * i / N , power ) );
-}
-/*******************************************************/
-/* OblDeflectionTOA::Integration                       */
-/*                                                     */
-/* Integrates! By calling TrapezoidalInteg             */
-/* Here, N = TRAPEZOIDAL_INTEGRAL_N                    */
-/*******************************************************/
-inline double OblDeflectionTOA::Integration ( const double& a, const double& b, 
-                                              double (*func)(double x, bool *prob),
-					     					  const long int& N ) {
-  	return TrapezoidalInteg( a, b, func, N );
-  	//return MATPACK::AdaptiveSimpson( a, b, func, OblDeflectionTOA::INTEGRAL_EPS );
-}
-
+#define OBLDEFLECTIONTOA_INSTANTIATE( T ) \
+template T OblDeflectionTOA::psi_outgoing_u( const T&, const OblStar<T>&, const double&, const double&, bool* ) const; \
+template T OblDeflectionTOA::dpsi_db_outgoing_u( const T&, const OblStar<T>&, bool* ) const; \
+template T OblDeflectionTOA::toa_outgoing_u( const T&, const OblStar<T>&, bool* ) const; \
+template T OblDeflectionTOA::psi_outgoing( const T&, const OblStar<T>&, const double&, const double&, bool* ) const; \
+template T OblDeflectionTOA::dpsi_db_outgoing( const T&, const OblStar<T>&, bool* ) const; \
+template T OblDeflectionTOA::toa_outgoing( const T&, const OblStar<T>&, bool* ) const; \
+template T OblDeflectionTOA::dpsi_db_ingoing( const T&, const double&, const OblStar<T>&, bool* ) const; \
+template T OblDeflectionTOA::toa_ingoing( const T&, const double&, const OblStar<T>&, bool* ) const; \
+template T OblDeflectionTOA::psi_max_outgoing_u( const T&, const OblStar<T>&, bool* ) const; \
+template T OblDeflectionTOA::b_of_psi( const double&, const int&, const T&, const T&, const double&, \
+                                       const OblStar<T>&, const double&, const double&, bool* ) const;
+
+OBLDEFLECTIONTOA_INSTANTIATE( double )
+OBLDEFLECTIONTOA_INSTANTIATE( FitDual )
+
+#undef OBLDEFLECTIONTOA_INSTANTIATE
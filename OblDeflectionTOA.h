@@ -18,56 +18,109 @@
 
 #include "OblModelBase.h"
 #include "Exception.h"
+#include "Dual.h"
 
 // Globals are bad, but there's no easy way to get around it
 // for this particular case (need to pass member functions
 // to Matpack routines which do not have a signature to accomodate
 // passing in the object pointer).
 
-double OblDeflectionTOA_psi_integrand_wrapper( double r, bool *prob );
-double OblDeflectionTOA_dpsi_db_integrand_wrapper( double r, bool *prob );
 double OblDeflectionTOA_toa_integrand_wrapper( double r, bool *prob );
-double OblDeflectionTOA_toa_integrand_minus_b0_wrapper( double r, bool *prob );
 double OblDeflectionTOA_rcrit_zero_func_wrapper( double rc );
 double OblDeflectionTOA_b_from_psi_ingoing_zero_func_wrapper( double b );
 double OblDeflectionTOA_b_from_psi_outgoing_zero_func_wrapper( double b );
 
-double OblDeflectionTOA_psi_integrand_wrapper_u ( double u,  bool *prob );
-double OblDeflectionTOA_dpsi_db_integrand_wrapper_u ( double u, bool *prob );
-double OblDeflectionTOA_toa_integrand_minus_b0_wrapper_u ( double u, bool *prob );
-
 
 // End global pollution.
 
+// What the deflection and time of arrival integrals need to know about the star, for
+// the routines templated on the scalar type T (double, or Dual<NDIM> to carry the
+// derivatives with respect to the fit parameters; see Dual.h). The double versions
+// below fill it in from the object, so both give the same numbers.
+template <class T>
+struct OblStar {
+	T mass;               // unitless
+	T mass_over_r;        // M/R as passed in from the command line
+	T rspot;              // radius at the spot, unitless
+	T rpole;              // radius at the pole, unitless
+};
+
+#define NN_IN 16 // nodes of the per-ring table of the ingoing branch (see OblRing)
+
+#define QUADRATURE_N 1000       // points of the trapezoid rules at quadrature scale 1 (see SetQuadrature)
+#define QUADRATURE_N_MAX 100000 //   and of the one over the whole outgoing ray
+
+// The shape of the star at one ring of the mesh, and the ingoing photon branch there,
+// which b_from_psi needs for every phase bin of the ring. The branch is tabulated
+// between bmin_in and b_hi at b = b_hi - (b_hi - bmin_in) x^2, x = (k+1)/NN_IN: psi
+// and the time of arrival go like sqrt(b_hi - b) near b_hi, so they are smooth in x.
+struct OblRing {
+	unsigned long serial; // of the OblDeflectionTOA it is for; 0 if none yet
+	double cos_theta;
+	double rsurface;      // R(theta)
+	double drdth;         // dR/dtheta; ingoing photons are only allowed if it is not 0
+	double rspot;         // radius the table was worked out for; -1 if not yet
+	double bmin_in;       // b of the most ingoing ray, see bmin_ingoing
+	double b_hi;          // b_max, or lower if rcrit reaches rspot first
+	double psi_in_max;    // psi_ingoing at bmin_in; -1 if there are no ingoing rays
+	double x_turn,        // where psi_ingoing is lowest; rays are taken from there to bmin_in
+	       psi_turn;      // psi_ingoing there
+	double psi[NN_IN],    // psi_ingoing at the nodes
+	       dpsi_db_x[NN_IN], // dpsi_db_ingoing times x, which stays finite at b_hi
+	       toa[NN_IN];    // toa_ingoing
+};
+
+template <class T>
+inline OblStar<double> Value( const OblStar<T>& star ) {
+	OblStar<double> s = { Value(star.mass), Value(star.mass_over_r), Value(star.rspot), Value(star.rpole) };
+	return s;
+}
+
 class OblDeflectionTOA {
 	static const double INTEGRAL_EPS;                     //
 	static const double FINDZERO_EPS;                     //
 	static const double RFINAL_MASS_MULTIPLE;             //
 	static const double DIVERGENCE_GUARD;                 //
-  	static const long int TRAPEZOIDAL_INTEGRAL_N;         //
-  	static const long int TRAPEZOIDAL_INTEGRAL_N_MAX;         //
-  	static const long int TRAPEZOIDAL_INTEGRAL_N_1;         //
-  	static const long int TRAPEZOIDAL_INTEGRAL_N_MAX_1;         //
+  	static long int TRAPEZOIDAL_INTEGRAL_N;         // these four are set by SetQuadrature
+  	static long int TRAPEZOIDAL_INTEGRAL_N_MAX;         //
+  	static long int TRAPEZOIDAL_INTEGRAL_N_1;         //
+  	static long int TRAPEZOIDAL_INTEGRAL_N_MAX_1;         //
+  	static double quadrature_scale;                       // of the four, as SetQuadrature was given
 	static const long int TRAPEZOIDAL_INTEGRAL_INGOING_N; //
+	static const long int INGOING_BISECTIONS;             // to find b on the ingoing table
   	static const double TRAPEZOIDAL_INTEGRAL_POWER;       //
 
  	private:
   		OblModelBase* modptr; // pointer to the model?
+  		double rpole,         // modptr->R_at_costheta(1.0), asked once when the object is made
+  		       requator;      // modptr->R_at_costheta(0.0)
+  		unsigned long serial; // tells the objects apart in the ring cache (see Ring)
   		double mass;          // NS mass should be stored in internal (unitless?) units.
 		double mass_over_r;
 		double rspot;
   		const double r_final; //
 
+  		// What the model says about the ring of the mesh at cos_theta, kept per thread
+  		// since b_from_psi asks for every phase bin of the ring
+  		const struct OblRing& Ring( const double& cos_theta ) const;
+
+  		// Fills in the ring's table of the ingoing branch, for rays from rspot
+  		void IngoingTable( const double& rspot, const double& cos_theta ) const;
+
+  		// x of the ingoing ray b in the ring's table (see OblRing), or -1 if the
+  		// table is not for this ring and rspot or b is not on it
+  		double IngoingX( const double& b, const double& rspot, const double& cos_theta ) const;
+
+  		// the root of rcrit_zero_func, see rcrit
+  		double rcrit_root( const double& b ) const;
+
   		void costheta_check( const double& cos_theta ) const throw(std::exception){
     		if( fabs(cos_theta) > 1 )
       		throw(Exception("cos_theta out of range."));
   		}
 
  	public: // all of the member functions for which we provide hooks for MATPACK
- 		double psi_integrand ( const double& b, const double& r) const;
-  		double dpsi_db_integrand ( const double& b, const double& r ) const;
-  		double toa_integrand ( const double& b, const double& r ) const;
-  		double toa_integrand_minus_b0 ( const double& b, const double& r ) const;
+ 		double toa_integrand ( const double& b, const double& r ) const;
   		double rcrit_zero_func( const double& rc, const double& b ) const;
   		double b_from_psi_ingoing_zero_func ( const double& b, const double& cos_theta, 
   								              const double& psi) const;
@@ -76,9 +129,14 @@ class OblDeflectionTOA {
   		                                       const double& psi_max, 
   		                                       const double &b_guess, 
   		                                       const double& psi_guess ) const;
-		double psi_integrand_u ( const double& b_R, const double& u) const;
-		double dpsi_db_integrand_u ( const double& b_R, const double& u ) const ;
-		double toa_integrand_minus_b0_u ( const double& b_R, const double& u ) const;
+
+ 	public: // integrands, in r and in u = R/r (b_R = b/R)
+  		template <class T> T psi_integrand ( const T& b, const T& r, const OblStar<T>& star ) const;
+  		template <class T> T dpsi_db_integrand ( const T& b, const T& r, const OblStar<T>& star ) const;
+  		template <class T> T toa_integrand_minus_b0 ( const T& b, const T& r, const OblStar<T>& star ) const;
+		template <class T> T psi_integrand_u ( const T& b_R, const double& u, const OblStar<T>& star ) const;
+		template <class T> T dpsi_db_integrand_u ( const T& b_R, const double& u, const OblStar<T>& star ) const;
+		template <class T> T toa_integrand_minus_b0_u ( const T& b_R, const double& u, const OblStar<T>& star ) const;
 
 	public:
  		OblDeflectionTOA ( OblModelBase* modptr, const double& mass_nounits ,const double& mass_over_r_nounits, const double& radius_nounits);
@@ -90,6 +148,12 @@ class OblDeflectionTOA {
 		double get_rspot() const { return rspot;}
   		double get_rfinal() const { return r_final; }
 
+  		// Sets the points of the trapezoid rules to scale times the built-in numbers
+  		// (1000, 100000 for psi_max); for --tolerance, before any tables are built or
+  		// threads started
+  		static void SetQuadrature( double scale );
+  		static double Quadrature() { return quadrature_scale; }
+
   		double rcrit ( const double& b, const double& cos_theta, bool *prob ) const;
   
   		double psi_outgoing ( const double& b, const double& rspot, const double& b_max, 
@@ -112,20 +176,43 @@ class OblDeflectionTOA {
   		double toa_outgoing ( const double& b, const double& cos_theta, bool *prob );
   		double toa_ingoing ( const double& b, const double& rspot, const double& cos_theta, bool *prob );
 
+		// The same, for any scalar type T; star takes the place of the object's
+		// mass, M/R and radius at the spot, and also gives rspot (see OblStar)
+  		OblStar<double> star ( const double& rspot ) const;
+		template <class T> T psi_outgoing_u ( const T& b, const OblStar<T>& star,
+						      const double& b_max, const double& psi_max, bool *prob ) const;
+		template <class T> T psi_max_outgoing_u ( const T& b, const OblStar<T>& star, bool *prob ) const;
+		template <class T> T dpsi_db_outgoing_u( const T& b, const OblStar<T>& star, bool *prob ) const;
+		template <class T> T toa_outgoing_u ( const T& b, const OblStar<T>& star, bool *prob ) const;
+  		template <class T> T psi_outgoing ( const T& b, const OblStar<T>& star, const double& b_max,
+  		                                    const double& psi_max, bool *prob ) const;
+  		template <class T> T dpsi_db_outgoing ( const T& b, const OblStar<T>& star, bool *prob ) const;
+  		template <class T> T toa_outgoing ( const T& b, const OblStar<T>& star, bool *prob ) const;
+  		template <class T> T rcrit ( const T& b, const double& cos_theta, const OblStar<T>& star, bool *prob ) const;
+  		template <class T> T psi_ingoing ( const T& b, const double& cos_theta, const OblStar<T>& star, bool *prob ) const;
+  		template <class T> T dpsi_db_ingoing ( const T& b, const double& cos_theta, const OblStar<T>& star, bool *prob ) const;
+  		template <class T> T toa_ingoing ( const T& b, const double& cos_theta, const OblStar<T>& star, bool *prob ) const;
+
+		// b for a ray found by b_from_psi (value b, rdot as returned), with the
+		// derivatives of the way it was found: b_table is the interpolation in the
+		// look-up table as a function of the star, for outgoing rays; just b for double
+		template <class T> T b_of_psi ( const double& b, const int& rdot, const T& b_table, const T& psi,
+						const double& cos_theta, const OblStar<T>& star, const double& b_max,
+						const double& psi_max, bool *prob ) const;
+
  		// a trapezoidal integrator which will not evaluate func at the first endpoint, a
-  		static double TrapezoidalInteg ( const double& a, const double& b, 
-  										 double (*func)(double x, bool *prob),
-				  						 const long int& N );
+  		template <class A, class Integrand>
+  		static auto TrapezoidalInteg ( const A& a, const double& b, Integrand func,
+  		                               const long int& N ) -> decltype( func(a) );
   	
   		// power spacing of subdivisions for above integrator, i ranges from 0 to N.
-  		static double TrapezoidalInteg_pt ( const double& a, const double& b, 
-				     					    const double& power, const long int& N,
-				     					    const long int& i, bool *prob);
-  		inline static double Integration ( const double& a, const double& b, 
-  										   double (*func)(double x, bool *prob),
-				    					   const long int& N = TRAPEZOIDAL_INTEGRAL_N );
-
-  	
+  		template <class A>
+  		static A TrapezoidalInteg_pt ( const A& a, const double& b, 
+				     				   const double& power, const long int& N,
+				     				   const long int& i, bool *prob);
+  		template <class A, class Integrand>
+  		inline static auto Integration ( const A& a, const double& b, Integrand func,
+				    					 const long int& N = TRAPEZOIDAL_INTEGRAL_N ) -> decltype( func(a) );
 };
 
 #endif // OBLDEFLECTIONTOA_H
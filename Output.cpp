@@ -0,0 +1,117 @@
+/***************************************************************************************/
+/*                                       Output.cpp
+
+    The binary output file of spot: a text header, then the light curve as blocks of
+    floats that can be memory-mapped. See Output.h.
+*/
+/***************************************************************************************/
+
+#include <stdint.h>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include "Output.h"
+#include "Exception.h"
+#include "Struct.h"
+
+// The floats of the phases, then of each band, as type F
+template <class F>
+static void Values( const class LightCurve* curve, std::vector< char >& data ) {
+
+    unsigned int numbins( curve->numbins ), numbands( curve->numbands );
+    std::vector< F > values( (numbands + 1) * numbins );
+
+    for ( unsigned int i(0); i < numbins; i++ ) values[i] = curve->t[i];
+    for ( unsigned int p(0); p < numbands; p++ )
+        for ( unsigned int i(0); i < numbins; i++ )
+            values[(p+1)*numbins + i] = curve->f[p][i];
+
+    const char* bytes( reinterpret_cast<const char*>( &values[0] ) );
+    data.assign( bytes, bytes + values.size() * sizeof(F) );
+}
+
+/**************************************************************************************/
+/* WriteBinaryCurve:                                                                  */
+/*           see Output.h                                                             */
+/**************************************************************************************/
+void WriteBinaryCurve( const char* file, const class LightCurve* curve,
+                       const std::string& description, unsigned int bits ) {
+
+    if ( bits != 32 && bits != 64 )
+        throw( Exception(" Binary output is in 32- or 64-bit floats. Exiting.\n") );
+
+    std::ostringstream text;
+    text << description
+         << "#\n"
+         << "# Row 0: phase bins (0 to 1)\n";
+    for ( unsigned int p(0); p < curve->numbands; p++ ) {
+        text << "# Row " << p+1 << ": ";
+        if ( curve->flags.spectral_model == 0 )
+            text << "Monochromatic Number flux (photons/(cm^2 s keV)) measured at energy (at infinity) of "
+                 << curve->para.E0 << " keV\n";
+        else if ( curve->flags.spectral_model == 1 )
+            text << "Number flux (photons/(cm^2 s)) at photon energy (observer's frame) "
+                 << curve->para.E0 + p*curve->para.DeltaE << " keV, band width "
+                 << curve->para.DeltaE << " keV\n";
+        else
+            text << "Number flux (photons/(cm^2 s)) of band " << p << "\n";
+    }
+
+    std::vector< char > data;
+    if ( bits == 32 ) Values< float >( curve, data );
+    else              Values< double >( curve, data );
+
+    const std::string header( text.str() );
+    uint32_t sizes[4] = { curve->numbins, curve->numbands, bits, static_cast<uint32_t>( header.size() ) };
+    uint64_t offset( 8 + sizeof(sizes) + sizeof(offset) + header.size() );
+    offset = ( offset + OUTPUT_ALIGN - 1 ) / OUTPUT_ALIGN * OUTPUT_ALIGN;
+    std::vector< char > padding( offset - 8 - sizeof(sizes) - sizeof(offset) - header.size(), 0 );
+
+    std::ofstream out( file, std::ios::binary | std::ios::trunc );
+    if ( !out )
+        throw( Exception(" Couldn't open the output file. Exiting.\n") );
+    out.write( "SPOTBIN1", 8 );
+    out.write( reinterpret_cast<const char*>( sizes ), sizeof(sizes) );
+    out.write( reinterpret_cast<const char*>( &offset ), sizeof(offset) );
+    out.write( header.data(), header.size() );
+    if ( !padding.empty() ) out.write( &padding[0], padding.size() );
+    out.write( &data[0], data.size() );
+    out.close();
+    if ( !out )
+        throw( Exception(" Couldn't write the output file. Exiting.\n") );
+}
+
+/**************************************************************************************/
+/* ReadBinaryCurve:                                                                   */
+/*           see Output.h                                                             */
+/**************************************************************************************/
+void ReadBinaryCurve( const char* file, class LightCurve* curve ) {
+
+    std::ifstream in( file, std::ios::binary );
+    char magic[8];
+    uint32_t sizes[4];
+    uint64_t offset;
+    in.read( magic, 8 );
+    in.read( reinterpret_cast<char*>( sizes ), sizeof(sizes) );
+    in.read( reinterpret_cast<char*>( &offset ), sizeof(offset) );
+    if ( !in || std::string( magic, 8 ) != "SPOTBIN1" )
+        throw( Exception(" Not a binary light curve of spot. Exiting.\n") );
+    if ( sizes[0] > MAX_NUMBINS || sizes[1] > NCURVES || ( sizes[2] != 32 && sizes[2] != 64 ) )
+        throw( Exception(" The binary light curve has too many bins or bands for this build. Exiting.\n") );
+
+    unsigned int numbins( sizes[0] ), numbands( sizes[1] ), bytes( sizes[2] / 8 );
+    std::vector< char > data( (numbands + 1) * numbins * bytes );
+    in.seekg( offset );
+    if ( !data.empty() ) in.read( &data[0], data.size() );
+    if ( !in )
+        throw( Exception(" The binary light curve is cut short. Exiting.\n") );
+
+    curve->numbins = numbins;
+    curve->numbands = numbands;
+    for ( unsigned int k(0); k < (numbands + 1) * numbins; k++ ) {
+        double value( bytes == 4 ? reinterpret_cast<const float*>( &data[0] )[k]
+                                 : reinterpret_cast<const double*>( &data[0] )[k] );
+        if ( k < numbins ) curve->t[k] = value;
+        else               curve->f[k / numbins - 1][k % numbins] = value;
+    }
+}
@@ -0,0 +1,38 @@
+/***************************************************************************************/
+/*                                       Output.h
+
+    This is the header file for Output.cpp, the binary form of the output file of spot
+    (--binary), for runs where writing the light curve as text takes real time.
+
+    The file is the 8 characters SPOTBIN1; numbins, numbands, bits per value (32 or 64)
+    and the length of the text that follows as 32-bit unsigned integers; the byte offset
+    of the data as a 64-bit unsigned integer; the text, which says what the light curve
+    is (the # lines of the text output, then the units and energy of each band), padded
+    with zeros up to the offset, a multiple of 64; then numbands + 1 rows of numbins
+    floats: the phase of each bin (0 to 1), then the flux of each band. All in the byte
+    order of the machine, so e.g. with NumPy
+
+        numbins, numbands, bits, length = numpy.fromfile( file, 'u4', 4, offset=8 )
+        offset = numpy.fromfile( file, 'u8', 1, offset=24 )[0]
+        curve = numpy.memmap( file, 'f%d' % (bits//8), 'r', offset, (numbands+1, numbins) )
+*/
+/***************************************************************************************/
+
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+#include <string>
+#include "Struct.h"
+
+#define OUTPUT_ALIGN 64 // the data start at a multiple of this many bytes
+
+// Writes the phases and fluxes of curve to file, in floats of bits = 32 or 64 bits,
+// after a header of description (lines starting with #) and the units of the bands
+void WriteBinaryCurve( const char* file, const class LightCurve* curve,
+                       const std::string& description, unsigned int bits );
+
+// Reads the phases and fluxes of a file written by WriteBinaryCurve into curve: t, f,
+// numbins and numbands; the rest of curve is left as it was
+void ReadBinaryCurve( const char* file, class LightCurve* curve );
+
+#endif // OUTPUT_H
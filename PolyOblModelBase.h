@@ -20,40 +20,109 @@
 #define POLYOBLMODELBASE_H
 
 #include "OblModelBase.h"
+#include <cmath>
 #include <exception>
 
+// The polynomial shape R(theta) = R_eq (1 + a0 P0 + a2 P2 + a4 P4), for any scalar type
+// T: double, or Dual<NDIM> to carry the derivatives with respect to the fit parameters
+// (see Dual.h). a_l = c[3l] eps + c[3l+1] zeta eps + c[3l+2] eps^2, where c is the
+// COEFFICIENTS table of the model (NHQS or CFLQS). The a_l and the radii at the equator
+// and the pole are worked out once, when the shape is made.
+template <class T>
+class PolyOblShape {
+ 	private:
+  		T Rspot_nounits, Req_nounits, zeta, eps;
+  		T A0, A2, A4, Requator, Rpole;
+
+ 	public:
+  		PolyOblShape( const double* c, const T& Rspot_nounits, const T& Req_nounits,
+  		              const T& zeta, const T& eps )
+  		  : Rspot_nounits(Rspot_nounits), Req_nounits(Req_nounits), zeta(zeta), eps(eps),
+  		    A0( c[0]*eps + c[1]*zeta*eps + c[2]*eps*eps ),
+  		    A2( c[3]*eps + c[4]*zeta*eps + c[5]*eps*eps ),
+  		    A4( c[6]*eps + c[7]*zeta*eps + c[8]*eps*eps ),
+  		    Requator( Req_nounits*( 1.0 + A0 + A2*(-0.5) + A4*(3.0/8.0) ) ),
+  		    Rpole( Req_nounits*( 1.0 + A0 + A2 + A4 ) ) { }
+
+  		const T& a0() const { return A0; }
+  		const T& a2() const { return A2; }
+  		const T& a4() const { return A4; }
+
+  		// R(theta) at the equator and the pole, Rspot elsewhere
+  		T R_at_costheta( const T& costheta ) const {
+  		    if ( costheta == 0.0 )
+  		        return Requator;
+  		    else if ( costheta == 1.0 )
+  		        return Rpole;
+  		    else
+  		        return Rspot_nounits;
+  		}
+
+  		// full polynomial R(theta), for any theta
+  		T R_poly( const T& costheta ) const {
+  		    return Req_nounits*( 1.0 + a0()*P0(costheta) + a2()*P2(costheta) + a4()*P4(costheta) );
+  		}
+
+  		// dR(theta) / dtheta = -sin(theta) * Dcostheta(R)
+  		T Dtheta_R( const T& costheta ) const {
+  		    if ( costheta == 0.0 || fabs(costheta) == 1.0 ) return T(0.0);
+  		    return -sqrt(1.0-costheta*costheta) * Req_nounits
+  		           *( a0()*Dmu_P0(costheta) + a2()*Dmu_P2(costheta) + a4()*Dmu_P4(costheta) );
+  		}
+
+  		T z( const T& costheta ) const {
+  		    return 1.0/sqrt(1.0 - 2.0*zeta*Req_nounits/R_at_costheta(costheta) ) - 1.0;
+  		}
+
+  		T f( const T& costheta ) const {
+  		    return (1.0 + z(costheta))*Dtheta_R(costheta)/R_at_costheta(costheta);
+  		}
+
+  		T cos_gamma( const T& costheta ) const {
+  		    return 1.0/sqrt(1.0 + pow(f(costheta),2.0));
+  		}
+
+  		static T P0( const T& mu ) { return T(1.0); }
+  		static T P2( const T& mu ) { return (3.0 * mu * mu - 1.0) / 2.0; }
+  		static T P4( const T& mu ) { return (35.0 * pow( mu , 4.0 ) - 30.0 * mu * mu + 3.0) / 8.0; }
+  		static T Dmu_P0( const T& mu ) { return T(0.0); }
+  		static T Dmu_P2( const T& mu ) { return 3.0*mu; }
+  		static T Dmu_P4( const T& mu ) { return mu*(35.0*mu*mu - 15.0)/2.0; }
+};
+
 class PolyOblModelBase : public OblModelBase {
  	private:
   		double Rspot_nounits;
   		double Req_nounits, zeta, eps;
-  		double z(const double& costheta) const;
+  		PolyOblShape<double> frozen; // the shape, with its coefficients worked out
 
  	public:
-  		PolyOblModelBase( const double& Rspot_nounits, const double& Req_nounits, const double& zeta, const double& eps );
+  		// coefficients = c[0..8] of the model, see PolyOblShape
+  		PolyOblModelBase( const double* coefficients, const double& Rspot_nounits,
+  		                  const double& Req_nounits, const double& zeta, const double& eps );
   		double R_at_costheta( const double& costheta ) const throw(std::exception);
   		double Dtheta_R( const double& costheta ) const throw(std::exception);
   		double f(const double& costheta)  const throw(std::exception);
   		double cos_gamma(const double& costheta) const throw(std::exception);
-  		static double zetaparam( const double& Mass_nounits, const double& Req_nounits );
-  		static double epsparam( const double& Omega_nounits, const double& Mass_nounits, const double& Req_nounits );
+  		double R_poly( const double& costheta ) const; // full polynomial R(theta), for any theta
   		virtual ~PolyOblModelBase() { }
 
+  		template <class T>
+  		static T zetaparam( const T& Mass_nounits, const T& Req_nounits ) {
+  		    return Mass_nounits / Req_nounits;
+  		}
+  		template <class T>
+  		static T epsparam( const double& Omega_nounits, const T& Mass_nounits, const T& Req_nounits ) {
+  		    return pow(Omega_nounits,2.0) * pow(Req_nounits,3.0) / Mass_nounits;
+  		}
+
  	protected:
-  		static double P0(const double& mu);
-  		static double P2(const double& mu);
-  		static double P4(const double& mu);
-  		static double Dmu_P0(const double& mu);
-  		static double Dmu_P2(const double& mu);
-  		static double Dmu_P4(const double& mu);
-
-  	virtual double a0() const = 0;
-  	virtual double a2() const = 0;
-  	virtual double a4() const = 0;
-  
-  	double get_Req_nounits() const;
-  	double get_zeta() const;
-  	double get_eps() const;
-  	double get_Rspot_nounits() const;
+  		const PolyOblShape<double>& shape() const { return frozen; }
+  	
+  		double get_Req_nounits() const;
+  		double get_zeta() const;
+  		double get_eps() const;
+  		double get_Rspot_nounits() const;
 };
 
 #endif // POLYOBLMODELBASE_H
@@ -17,22 +17,10 @@
 #include "PolyOblModelCFLQS.h"
 
 PolyOblModelCFLQS::PolyOblModelCFLQS(const double& Rspot_nounits, const double& Req_nounits, const double& zeta, const double& eps )
-  : PolyOblModelBase(Rspot_nounits, Req_nounits, zeta, eps) { }
+  : PolyOblModelBase(COEFFICIENTS, Rspot_nounits, Req_nounits, zeta, eps) { }
 
-double PolyOblModelCFLQS::a0() const {
-  double eps(this->get_eps());
-  double zeta(this->get_zeta());
-  return double(-0.26*eps + 0.50*zeta*eps - 0.04*eps*eps);
-}
+// a0, a2, a4: coefficients of eps, zeta*eps and eps^2 (see PolyOblShape)
+const double PolyOblModelCFLQS::COEFFICIENTS[9] = { -0.26, 0.50, -0.04,
+                                                -0.53, 0.85, 0.06,
+                                                0.02, -0.14, 0.09 };
 
-double PolyOblModelCFLQS::a2() const {
-  double eps(this->get_eps());
-  double zeta(this->get_zeta());
-  return double(-0.53*eps + 0.85*zeta*eps + 0.06*eps*eps);
-}
-
-double PolyOblModelCFLQS::a4() const {
-  double eps(this->get_eps());
-  double zeta(this->get_zeta());
-  return double(0.02*eps - 0.14*zeta*eps + 0.09*eps*eps );
-}
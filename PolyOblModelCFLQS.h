@@ -21,10 +21,7 @@
 class PolyOblModelCFLQS : public PolyOblModelBase {
  	public:
   		PolyOblModelCFLQS( const double& Rspot_nounits, const double& Req_nounits, const double& zeta, const double& eps );
- 	protected:
-  		double a0() const;
-  		double a2() const;
-  		double a4() const;
+  		static const double COEFFICIENTS[9]; // of a0, a2, a4, see PolyOblShape
 };
 
 #endif // POLYOBLMODELCFLQS_H
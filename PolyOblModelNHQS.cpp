@@ -16,25 +16,10 @@
 #include "PolyOblModelNHQS.h"
 
 PolyOblModelNHQS::PolyOblModelNHQS( const double& Rspot_nounits, const double& Req_nounits, const double& zeta, const double& eps )
-  : PolyOblModelBase(Rspot_nounits, Req_nounits, zeta, eps) { }
+  : PolyOblModelBase(COEFFICIENTS, Rspot_nounits, Req_nounits, zeta, eps) { }
 
-double PolyOblModelNHQS::a0() const {
-  double eps(this->get_eps());
-  double zeta(this->get_zeta());
-  return double(-0.18*eps + 0.23*zeta*eps - 0.05*eps*eps);
-}
+// a0, a2, a4: coefficients of eps, zeta*eps and eps^2 (see PolyOblShape)
+const double PolyOblModelNHQS::COEFFICIENTS[9] = { -0.18, 0.23, -0.05,
+                                                -0.39, 0.29, 0.13,
+                                                0.04, -0.15, 0.07 };
 
-double PolyOblModelNHQS::a2() const {
-  double eps(this->get_eps());
-  double zeta(this->get_zeta());
-  return double(-0.39*eps + 0.29*zeta*eps + 0.13*eps*eps);
-}
-
-double PolyOblModelNHQS::a4() const {
-  double eps(this->get_eps());
-  double zeta(this->get_zeta());
-    return double(0.04*eps - 0.15*zeta*eps + 0.07*eps*eps );
-
-  //return double( -8.0/3.0*(-0.18*eps + 0.23*zeta*eps - 0.05*eps*eps - 0.5*(-0.39*eps + 0.29*zeta*eps + 0.13*eps*eps)));
-
-}
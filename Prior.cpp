@@ -0,0 +1,143 @@
+/***************************************************************************************/
+/*                                     Prior.cpp
+
+    Prior probability distributions for the fit parameters.
+*/
+/***************************************************************************************/
+
+#include <cmath>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <cstring>
+#include <limits>
+#include "Prior.h"
+#include "Units.h"
+#include "Exception.h"
+
+UniformPrior::UniformPrior( double lo, double hi ) : lower(lo), upper(hi) {
+    if ( !(upper > lower) )
+        throw( Exception(" Uniform prior needs lower < upper. Exiting.\n") );
+}
+
+double UniformPrior::LogDensity( double x ) const {
+    if ( x < lower || x > upper ) return -std::numeric_limits<double>::infinity();
+    return -log( upper - lower );
+}
+
+double UniformPrior::Transform( double u ) const {
+    return lower + u * (upper - lower);
+}
+
+double UniformPrior::Cdf( double x ) const {
+    if ( x <= lower ) return 0.0;
+    if ( x >= upper ) return 1.0;
+    return (x - lower) / (upper - lower);
+}
+
+GaussianPrior::GaussianPrior( double m, double s ) : mean(m), sigma(s) {
+    if ( !(sigma > 0.0) )
+        throw( Exception(" Gaussian prior needs sigma > 0. Exiting.\n") );
+}
+
+double GaussianPrior::LogDensity( double x ) const {
+    return -0.5 * pow( (x - mean)/sigma, 2 ) - log( sigma * sqrt(2.0*Units::PI) );
+}
+
+double GaussianPrior::Cdf( double x ) const {
+    return 0.5 * erfc( (mean - x) / (sigma * sqrt(2.0)) );
+}
+
+/**************************************************************************************/
+/* GaussianPrior::Transform:                                                          */
+/*           inverse of the normal cumulative distribution, by the rational           */
+/*           approximation of P. J. Acklam (relative error < 1.2e-9)                  */
+/**************************************************************************************/
+double GaussianPrior::Transform( double u ) const {
+
+    static const double a[6] = { -3.969683028665376e+01,  2.209460984245205e+02,
+                                 -2.759285104469687e+02,  1.383577518672690e+02,
+                                 -3.066479806614716e+01,  2.506628277459239e+00 };
+    static const double b[5] = { -5.447609879822406e+01,  1.615858368580409e+02,
+                                 -1.556989798598866e+02,  6.680131188771972e+01,
+                                 -1.328068155288572e+01 };
+    static const double c[6] = { -7.784894002430293e-03, -3.223964580411365e-01,
+                                 -2.400758277161838e+00, -2.549732539343734e+00,
+                                  4.374664141464968e+00,  2.938163982698783e+00 };
+    static const double d[4] = {  7.784695709041462e-03,  3.224671290700398e-01,
+                                  2.445134137142996e+00,  3.754408661907416e+00 };
+    const double plow( 0.02425 );
+    double q, r, z;
+
+    if ( u <= 0.0 ) return -std::numeric_limits<double>::infinity();
+    if ( u >= 1.0 ) return std::numeric_limits<double>::infinity();
+
+    if ( u < plow ) {
+        q = sqrt( -2.0*log(u) );
+        z = (((((c[0]*q+c[1])*q+c[2])*q+c[3])*q+c[4])*q+c[5]) / ((((d[0]*q+d[1])*q+d[2])*q+d[3])*q+1.0);
+    }
+    else if ( u <= 1.0 - plow ) {
+        q = u - 0.5;
+        r = q*q;
+        z = (((((a[0]*r+a[1])*r+a[2])*r+a[3])*r+a[4])*r+a[5])*q / (((((b[0]*r+b[1])*r+b[2])*r+b[3])*r+b[4])*r+1.0);
+    }
+    else {
+        q = sqrt( -2.0*log(1.0-u) );
+        z = -(((((c[0]*q+c[1])*q+c[2])*q+c[3])*q+c[4])*q+c[5]) / ((((d[0]*q+d[1])*q+d[2])*q+d[3])*q+1.0);
+    }
+    return mean + sigma * z;
+}
+
+/**************************************************************************************/
+/* PriorSet:                                                                          */
+/*           defaults are uniform over M [1,3] Msun, R_eq [8,16] km, incl [0,180],    */
+/*           theta [0,180] degrees, rho [0,0.5] rad, T [0.05,2] keV and ts [0,1]      */
+/**************************************************************************************/
+PriorSet::PriorSet() {
+    const double lower[NDIM] = { 1.0,  8.0,   0.0,   0.0, 0.0, 0.05, 0.0 };
+    const double upper[NDIM] = { 3.0, 16.0, 180.0, 180.0, 0.5, 2.0,  1.0 };
+    for ( unsigned int k(0); k < NDIM; k++ )
+        prior[k] = new UniformPrior( lower[k], upper[k] );
+}
+
+PriorSet::~PriorSet() {
+    for ( unsigned int k(0); k < NDIM; k++ )
+        delete prior[k];
+}
+
+void PriorSet::Set( unsigned int k, Prior* p ) {
+    delete prior[k];
+    prior[k] = p;
+}
+
+void PriorSet::Read( const char* prior_file ) {
+
+    std::ifstream in( prior_file );
+    if ( !in )
+        throw( Exception(" Couldn't open the prior file. Exiting.\n") );
+
+    const char* letters = "mriepTl";
+    std::string line;
+    while ( std::getline( in, line ) ) {
+        std::istringstream fields( line );
+        std::string name, kind;
+        double a, b;
+        if ( !(fields >> name) || name[0] == '#' ) continue;
+        const char* at = strchr( letters, name[0] );
+        if ( name.size() != 1 || !at || !(fields >> kind >> a >> b) )
+            throw( Exception(" Prior file lines are: <m|r|i|e|p|T|l> <uniform|gaussian> <a> <b>. Exiting.\n") );
+        if ( kind == "uniform" )
+            Set( at - letters, new UniformPrior( a, b ) );
+        else if ( kind == "gaussian" )
+            Set( at - letters, new GaussianPrior( a, b ) );
+        else
+            throw( Exception(" Unknown prior; use uniform or gaussian. Exiting.\n") );
+    }
+}
+
+double PriorSet::LogDensity( const double x[NDIM], const bool vary[NDIM] ) const {
+    double lp(0.0);
+    for ( unsigned int k(0); k < NDIM; k++ )
+        if ( vary[k] ) lp += prior[k]->LogDensity( x[k] );
+    return lp;
+}
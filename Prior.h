@@ -0,0 +1,77 @@
+/***************************************************************************************/
+/*                                      Prior.h
+
+    This is the header file for Prior.cpp, which holds the prior probability
+    distributions used by the samplers (EnsembleSampler.cpp, NestedSampler.cpp) and, as the
+    search ranges, by the genetic algorithm (GeneticFit.cpp).
+
+    Each fit parameter (M, R_eq, incl, theta, rho, T, ts; see FitCurve in Chi.h) gets
+    its own one-dimensional prior. New kinds of prior are added by deriving from
+    Prior and teaching PriorSet::Read their name.
+*/
+/***************************************************************************************/
+
+#ifndef PRIOR_H
+#define PRIOR_H
+
+#include <exception>
+#include "Chi.h"
+
+// Prior on one parameter
+class Prior {
+ 	public:
+  		virtual ~Prior() { }
+  		// log of the prior density at x (up to a constant); -infinity outside the support
+  		virtual double LogDensity( double x ) const = 0;
+  		// the x below which a fraction u of the prior lies (maps the unit interval onto x)
+  		virtual double Transform( double u ) const = 0;
+  		// the fraction of the prior below x (the inverse of Transform)
+  		virtual double Cdf( double x ) const = 0;
+};
+
+// Flat between lower and upper
+class UniformPrior : public Prior {
+ 	public:
+  		UniformPrior( double lower, double upper );
+  		double LogDensity( double x ) const;
+  		double Transform( double u ) const;
+  		double Cdf( double x ) const;
+ 	private:
+  		double lower, upper;
+};
+
+// Gaussian with the given mean and standard deviation
+class GaussianPrior : public Prior {
+ 	public:
+  		GaussianPrior( double mean, double sigma );
+  		double LogDensity( double x ) const;
+  		double Transform( double u ) const;
+  		double Cdf( double x ) const;
+ 	private:
+  		double mean, sigma;
+};
+
+// One prior for each of the NDIM fit parameters
+class PriorSet {
+ 	public:
+  		PriorSet();   // uniform over a broad default range for every parameter
+  		~PriorSet();
+
+  		// Reads lines "<flag letter> uniform <lower> <upper>" or
+  		// "<flag letter> gaussian <mean> <sigma>", where the letter is the command line
+  		// flag of the parameter (m r i e p T l). Lines starting with # are skipped.
+  		void Read( const char* prior_file );
+
+  		// Sum of the log priors of the varied parameters in the full vector x
+  		double LogDensity( const double x[NDIM], const bool vary[NDIM] ) const;
+
+  		const Prior* operator[]( unsigned int k ) const { return prior[k]; }
+  		void Set( unsigned int k, Prior* p );  // takes ownership of p
+
+ 	private:
+  		Prior* prior[NDIM];
+  		PriorSet( const PriorSet& );
+  		PriorSet& operator=( const PriorSet& );
+};
+
+#endif // PRIOR_H
@@ -0,0 +1,263 @@
+/***************************************************************************************/
+/*                                      Profile.cpp
+
+    Stage timers, work counters and hardware counters for --profile, and the timelines
+    of the threads for --trace. See Profile.h.
+*/
+/***************************************************************************************/
+
+#include <chrono>
+#include <atomic>
+#include <mutex>
+#include <memory>
+#include <vector>
+#include <string>
+#include <fstream>
+#include <cstring>
+#include <cerrno>
+#include "Profile.h"
+#include "Exception.h"
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+bool profile_enabled( false ), trace_enabled( false );
+
+static const char* stage_names[PROFILE_STAGES] = {
+    "flux", "tables", "psi_max", "ring", "angles", "solve", "integrals",
+    "spectra", "rebin", "shift", "add", "normalize", "chi_square", "output"
+};
+// What the note of an event of the stage is, in the trace; 0 for none
+static const char* note_names[PROFILE_STAGES] = {
+    0, 0, 0, "theta", "ingoing_bins", 0, 0, 0, 0, 0, 0, 0, 0, 0
+};
+static const char* counter_names[PROFILE_COUNTERS] = {
+    "integrand_evaluations", "findzero_evaluations", "mesh_elements",
+    "bins", "invisible_bins", "ingoing_bins"
+};
+
+#define PROFILE_HARDWARE 4
+static const char* hardware_names[PROFILE_HARDWARE] = {
+    "cycles", "instructions", "cache_misses", "branch_misses"
+};
+
+struct TraceEvent {
+    uint64_t start, end;                // ns
+    double note;                        // NaN for none
+    uint64_t stage;
+};
+
+struct ThreadProfile {
+    struct ProfileSums sums;
+    int hardware[PROFILE_HARDWARE];     // perf_event_open file descriptors; -1 for none
+    std::vector< TraceEvent > trace;    // ring buffer of the timeline, when tracing
+    std::atomic< uint64_t > traced;     // events put in it so far; only this thread adds
+
+    ThreadProfile() : traced( 0 ) { }
+};
+
+static std::mutex profile_lock;
+static std::vector< std::unique_ptr< ThreadProfile > > profile_threads; // kept after the threads end
+static std::string hardware_error;                                     // why there are no hardware counters
+static uint64_t profile_start(0);
+
+// Counters of this thread's cycles etc., from now on
+static void OpenHardware( ThreadProfile& profile ) {
+    for ( unsigned int h(0); h < PROFILE_HARDWARE; h++ )
+        profile.hardware[h] = -1;
+#ifdef __linux__
+    static const uint64_t configs[PROFILE_HARDWARE] = {
+        PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+        PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES
+    };
+    for ( unsigned int h(0); h < PROFILE_HARDWARE; h++ ) {
+        struct perf_event_attr attr;
+        memset( &attr, 0, sizeof(attr) );
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = configs[h];
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        profile.hardware[h] = syscall( __NR_perf_event_open, &attr, 0, -1, -1, 0 );
+        if ( profile.hardware[h] < 0 && hardware_error.empty() )
+            hardware_error = std::string( "perf_event_open: " ) + strerror( errno );
+    }
+#else
+    hardware_error = "no perf_event_open on this system";
+#endif
+}
+
+static ThreadProfile& Mine() {
+    static thread_local ThreadProfile* mine( 0 );
+    if ( !mine ) {
+        std::unique_ptr< ThreadProfile > profile( new ThreadProfile() );
+        if ( trace_enabled )
+            profile->trace.resize( PROFILE_TRACE_EVENTS );
+        std::lock_guard< std::mutex > hold( profile_lock );
+        OpenHardware( *profile );
+        mine = profile.get();
+        profile_threads.push_back( std::move( profile ) );
+    }
+    return *mine;
+}
+
+struct ProfileSums& ProfileThread() {
+    return Mine().sums;
+}
+
+void ProfileTraceEvent( ProfileStage stage, uint64_t start, uint64_t end, double note ) {
+    if ( stage == STAGE_SOLVE || stage == STAGE_INTEGRALS ) return; // one per bin: too many
+    ThreadProfile& profile( Mine() );
+    uint64_t n( profile.traced.load( std::memory_order_relaxed ) );
+    TraceEvent& event( profile.trace[n % PROFILE_TRACE_EVENTS] );
+    event.start = start;
+    event.end = end;
+    event.note = note;
+    event.stage = stage;
+    profile.traced.store( n + 1, std::memory_order_release );
+}
+
+uint64_t ProfileClock() {
+    return std::chrono::duration_cast< std::chrono::nanoseconds >(
+               std::chrono::steady_clock::now().time_since_epoch() ).count();
+}
+
+void ProfileStart() {
+    if ( profile_enabled ) return;
+    profile_enabled = true;
+    profile_start = ProfileClock();
+    Mine();
+}
+
+void ProfileTraceStart() {
+    trace_enabled = true;
+    if ( profile_enabled ) // the main thread's buffer
+        Mine().trace.resize( PROFILE_TRACE_EVENTS );
+    ProfileStart();
+}
+
+/**************************************************************************************/
+/* ProfileReport:                                                                     */
+/*           see Profile.h. Reading the sums of threads still running gives them as   */
+/*           they were a moment ago; it is meant for the end of the run.              */
+/**************************************************************************************/
+void ProfileReport( const char* file ) {
+
+    struct ProfileSums total;
+    memset( &total, 0, sizeof(total) );
+    uint64_t hardware[PROFILE_HARDWARE] = { 0 };
+    bool have_hardware( hardware_error.empty() );
+    unsigned int threads(0);
+    {
+        std::lock_guard< std::mutex > hold( profile_lock );
+        threads = profile_threads.size();
+        for ( unsigned int t(0); t < threads; t++ ) {
+            const ThreadProfile& profile( *profile_threads[t] );
+            for ( unsigned int s(0); s < PROFILE_STAGES; s++ ) {
+                total.nanoseconds[s] += profile.sums.nanoseconds[s];
+                total.calls[s] += profile.sums.calls[s];
+            }
+            for ( unsigned int c(0); c < PROFILE_COUNTERS; c++ )
+                total.counts[c] += profile.sums.counts[c];
+#ifdef __linux__
+            for ( unsigned int h(0); h < PROFILE_HARDWARE && have_hardware; h++ ) {
+                uint64_t value(0);
+                if ( profile.hardware[h] < 0
+                     || read( profile.hardware[h], &value, sizeof(value) ) != sizeof(value) ) {
+                    have_hardware = false;
+                    hardware_error = "could not read the hardware counters";
+                }
+                hardware[h] += value;
+            }
+#endif
+        }
+    }
+    double evaluations( total.calls[STAGE_FLUX] );
+
+    std::ofstream out( file, std::ios_base::trunc );
+    if ( !out )
+        throw( Exception(" Couldn't open the --profile file. Exiting.\n") );
+    out.precision( 9 );
+    out << "{\n"
+        << "  \"wall_seconds\": " << ( ProfileClock() - profile_start ) * 1e-9 << ",\n"
+        << "  \"threads\": " << threads << ",\n"
+        << "  \"evaluations\": " << total.calls[STAGE_FLUX] << ",\n"
+        << "  \"stages\": {\n";
+    for ( unsigned int s(0); s < PROFILE_STAGES; s++ ) {
+        out << "    \"" << stage_names[s] << "\": { \"seconds\": " << total.nanoseconds[s] * 1e-9
+            << ", \"calls\": " << total.calls[s] << ", \"seconds_per_evaluation\": "
+            << ( evaluations > 0 ? total.nanoseconds[s] * 1e-9 / evaluations : 0.0 ) << " }"
+            << ( s + 1 < PROFILE_STAGES ? ",\n" : "\n" );
+    }
+    out << "  },\n"
+        << "  \"counters\": {\n";
+    for ( unsigned int c(0); c < PROFILE_COUNTERS; c++ )
+        out << "    \"" << counter_names[c] << "\": " << total.counts[c]
+            << ( c + 1 < PROFILE_COUNTERS ? ",\n" : "\n" );
+    out << "  },\n";
+    if ( have_hardware ) {
+        out << "  \"hardware\": {\n";
+        for ( unsigned int h(0); h < PROFILE_HARDWARE; h++ )
+            out << "    \"" << hardware_names[h] << "\": " << hardware[h]
+                << ( h + 1 < PROFILE_HARDWARE ? ",\n" : "\n" );
+        out << "  }\n";
+    }
+    else {
+        std::string reason;
+        for ( unsigned int k(0); k < hardware_error.size(); k++ ) { // escaped for JSON
+            if ( hardware_error[k] == '"' || hardware_error[k] == '\\' ) reason += '\\';
+            reason += hardware_error[k];
+        }
+        out << "  \"hardware\": null,\n"
+            << "  \"hardware_error\": \"" << reason << "\"\n";
+    }
+    out << "}\n";
+    out.close();
+    if ( !out )
+        throw( Exception(" Couldn't write the --profile file. Exiting.\n") );
+}
+
+/**************************************************************************************/
+/* ProfileTraceWrite:                                                                 */
+/*           see Profile.h. Complete ("X") events, times in microseconds from the     */
+/*           start of profiling; thread 0 is the main thread.                         */
+/**************************************************************************************/
+void ProfileTraceWrite( const char* file ) {
+
+    std::ofstream out( file, std::ios_base::trunc );
+    if ( !out )
+        throw( Exception(" Couldn't open the --trace file. Exiting.\n") );
+    out.precision( 12 );
+    out << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+
+    uint64_t dropped(0);
+    std::lock_guard< std::mutex > hold( profile_lock );
+    for ( unsigned int t(0); t < profile_threads.size(); t++ ) {
+        const ThreadProfile& profile( *profile_threads[t] );
+        out << ( t > 0 ? ",\n" : "" )
+            << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": " << t
+            << ", \"args\": {\"name\": \"" << ( t == 0 ? "main" : "thread " );
+        if ( t > 0 ) out << t;
+        out << "\"}}";
+
+        uint64_t n( profile.traced.load( std::memory_order_acquire ) ),
+                 first( n > PROFILE_TRACE_EVENTS ? n - PROFILE_TRACE_EVENTS : 0 );
+        dropped += first;
+        for ( uint64_t k(first); k < n && !profile.trace.empty(); k++ ) {
+            const TraceEvent& event( profile.trace[k % PROFILE_TRACE_EVENTS] );
+            out << ",\n{\"name\": \"" << stage_names[event.stage] << "\", \"cat\": \"spot\", \"ph\": \"X\", "
+                << "\"pid\": 1, \"tid\": " << t << ", \"ts\": " << ( event.start - profile_start ) * 1e-3
+                << ", \"dur\": " << ( event.end - event.start ) * 1e-3;
+            if ( note_names[event.stage] && event.note == event.note ) // not NaN
+                out << ", \"args\": {\"" << note_names[event.stage] << "\": " << event.note << "}";
+            out << "}";
+        }
+    }
+    out << "\n], \"otherData\": {\"dropped_events\": " << dropped << "}}\n";
+    out.close();
+    if ( !out )
+        throw( Exception(" Couldn't write the --trace file. Exiting.\n") );
+}
@@ -0,0 +1,128 @@
+/***************************************************************************************/
+/*                                       Profile.h
+
+    This is the header file for Profile.cpp, which times the stages of working out a
+    light curve and counts the work done in them, for --profile <file>: a JSON report
+    at the end of the run of where the time went.
+
+    ProfileTimer timer( stage ) times its scope (or up to timer.Stop(), or up to
+    timer.Next( other ), which goes on timing other). ProfileCount( counter, n ) adds n
+    to a counter. Each thread keeps its own sums, so the threads do not share cache
+    lines, and the times are added up over the threads: with several threads they are
+    thread time, not wall time. Some stages are inside others (ANGLES holds SOLVE and
+    INTEGRALS; RING holds ANGLES, SPECTRA, REBIN, SHIFT and ADD; TABLES holds PSI_MAX;
+    FLUX, one evaluation, holds all but TABLES, CHI and OUTPUT), so the times do not add
+    up to the wall time.
+
+    Without --profile all this is one test of profile_enabled each; the clock is not
+    read. On Linux, the hardware counters of each thread (cycles, instructions, cache
+    misses, branch misses) are read through perf_event_open as well, where the system
+    allows it (/proc/sys/kernel/perf_event_paranoid).
+
+    --trace <file> also keeps each timed stage (but the per-bin SOLVE and INTEGRALS) as
+    an event of its thread's timeline, in a ring buffer of its own that only the thread
+    writes, so there are no locks; when it fills, the oldest events go. At the end of
+    the run they are written as a Chrome trace (chrome://tracing, ui.perfetto.dev), one
+    row per thread, to show how the work was spread over the threads. timer.Note( x )
+    puts a number on the event: the latitude of a ring, the ingoing bins of ComputeAngles.
+*/
+/***************************************************************************************/
+
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stdint.h>
+#include <limits>
+
+enum ProfileStage {
+    STAGE_FLUX,        // ComputeFlux: one evaluation of the light curve
+    STAGE_TABLES,      // DeflTables: the shape model and the b vs psi table of a star
+    STAGE_PSI_MAX,     //   of which b_max and psi_max
+    STAGE_RING,        // RingFlux: one ring of the mesh, from its angles to its flux added in
+    STAGE_ANGLES,      // ComputeAngles
+    STAGE_SOLVE,       //   of which finding b from psi in each bin
+    STAGE_INTEGRALS,   //   of which dpsi/db and the time of arrival
+    STAGE_SPECTRA,     // ComputeCurve: the flux of each bin
+    STAGE_REBIN,       // ComputeCurve: the time delays, rebinning onto the phase bins
+    STAGE_SHIFT,       // ShiftCurve
+    STAGE_ADD,         // adding the curves of the phi divisions and the spots into the total
+    STAGE_NORMALIZE,   // NormalizeFlux
+    STAGE_CHI,         // ChiSquare
+    STAGE_OUTPUT,      // writing the light curve(s)
+    PROFILE_STAGES
+};
+
+enum ProfileCounter {
+    COUNT_INTEGRAND,   // integrand evaluations of the trapezoid rule
+    COUNT_FINDZERO,    // function evaluations of FindZero (rcrit, ingoing photons)
+    COUNT_ELEMENTS,    // mesh elements: phi divisions of the rings, or pixels
+    COUNT_BINS,        // phase bins worked out by ComputeAngles
+    COUNT_INVISIBLE,   //   of which not visible
+    COUNT_INGOING,     //   of which initially ingoing
+    PROFILE_COUNTERS
+};
+
+extern bool profile_enabled, // set by ProfileStart, before any threads start
+            trace_enabled;   // and by ProfileTraceStart
+
+// This thread's sums; the first call from a thread sets them up
+struct ProfileSums {
+    uint64_t nanoseconds[PROFILE_STAGES];
+    uint64_t calls[PROFILE_STAGES];
+    uint64_t counts[PROFILE_COUNTERS];
+};
+struct ProfileSums& ProfileThread();
+
+uint64_t ProfileClock(); // nanoseconds, steady
+
+// Adds the event of stage from start to end [ns] to this thread's timeline
+void ProfileTraceEvent( ProfileStage stage, uint64_t start, uint64_t end, double note );
+
+class ProfileTimer {
+    public:
+        explicit ProfileTimer( ProfileStage s )
+            : stage( s ), start( profile_enabled ? ProfileClock() : 0 ),
+              note( std::numeric_limits<double>::quiet_NaN() ) { }
+        ~ProfileTimer() { Stop(); }
+        void Stop() {
+            if ( profile_enabled && stage != PROFILE_STAGES ) {
+                uint64_t end( ProfileClock() );
+                struct ProfileSums& sums( ProfileThread() );
+                sums.nanoseconds[stage] += end - start;
+                sums.calls[stage]++;
+                if ( trace_enabled ) ProfileTraceEvent( stage, start, end, note );
+            }
+            stage = PROFILE_STAGES;
+        }
+        void Next( ProfileStage s ) {
+            Stop();
+            stage = s;
+            note = std::numeric_limits<double>::quiet_NaN();
+            if ( profile_enabled ) start = ProfileClock();
+        }
+        void Note( double x ) { note = x; }
+    private:
+        ProfileStage stage;
+        uint64_t start;
+        double note;
+};
+
+inline void ProfileCount( ProfileCounter counter, uint64_t n = 1 ) {
+    if ( profile_enabled ) ProfileThread().counts[counter] += n;
+}
+
+// Turns the timers and counters on; call before starting any threads
+void ProfileStart();
+
+// Writes the sums of all threads so far to file, as JSON
+void ProfileReport( const char* file );
+
+#define PROFILE_TRACE_EVENTS 262144 // events kept per thread (32 bytes each)
+
+// Turns the timelines on as well (and ProfileStart); call before starting any threads
+void ProfileTraceStart();
+
+// Writes the timelines of all threads to file, as a Chrome trace
+void ProfileTraceWrite( const char* file );
+
+#endif // PROFILE_H
@@ -0,0 +1,367 @@
+/***************************************************************************************/
+/*                                       Server.cpp
+
+    Light curves on request over a Unix domain socket or standard input and output,
+    with the requests that come in together computed together on the thread pool.
+    See Server.h.
+*/
+/***************************************************************************************/
+
+#include <cmath>
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <stdint.h>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <deque>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "Server.h"
+#include "Engine.h"
+#include "Log.h"
+#include "Profile.h"
+#include "ThreadPool.h"
+#include "Units.h"
+#include "Exception.h"
+#include "Struct.h"
+
+#define SPIN NDIM       // a row of a request is the NDIM fit parameters, then the spin
+#define ROW (NDIM+1)    // values in a row
+
+static int reply_fd( -1 );                  // standard output as it was, for --serve -
+static volatile sig_atomic_t stopping( 0 ); // set by SIGINT and SIGTERM
+
+static void Stop( int ) {
+    stopping = 1;
+}
+
+void ServerReserveStdout() {
+    std::cout.flush();
+    reply_fd = dup( STDOUT_FILENO );
+    if ( reply_fd < 0 || dup2( STDERR_FILENO, STDOUT_FILENO ) < 0 )
+        throw( Exception(" Couldn't set standard output aside for --serve -. Exiting.\n") );
+}
+
+// Makes fd non-blocking; returns its flags as they were
+static int NonBlocking( int fd ) {
+    int flags( fcntl( fd, F_GETFL ) );
+    if ( flags < 0 || fcntl( fd, F_SETFL, flags | O_NONBLOCK ) < 0 )
+        throw( Exception(" --serve: couldn't make a client's file non-blocking. Exiting.\n") );
+    return flags;
+}
+
+// A client, with its file descriptors non-blocking so that one that stops reading its
+// replies doesn't hold up the others: the replies wait in output until it can take them
+struct Client {
+    int in, out, in_flags, out_flags;
+    bool socket;
+    bool closed;        // no more requests: the end of its input
+    bool failed;        // an error, or too much waiting for it; dropped
+    std::string input;  // what has come in and is not a whole request yet
+    std::deque< std::vector< double > > output; // replies not written yet
+    size_t sent;        // bytes of output.front() written
+    size_t queued;      // bytes of output not written
+
+    Client( int in, int out, bool socket )
+      : in( in ), out( out ), in_flags( NonBlocking( in ) ), out_flags( out == in ? in_flags : NonBlocking( out ) ),
+        socket( socket ), closed( false ), failed( false ), sent( 0 ), queued( 0 ) { }
+    ~Client() {
+        fcntl( in, F_SETFL, in_flags ); // standard input and output are shared with whoever started spot
+        close( in );
+        if ( out != in ) {
+            fcntl( out, F_SETFL, out_flags );
+            close( out );
+        }
+    }
+
+    // Done with: failed, or no more requests and all the replies written
+    bool Done() const { return failed || ( closed && output.empty() ); }
+
+    // Writes what it can of the replies waiting, without blocking
+    void Flush() {
+        while ( !output.empty() && !failed ) {
+            const char* next( reinterpret_cast< const char* >( &output.front()[0] ) + sent );
+            size_t bytes( output.front().size() * sizeof(double) - sent );
+            ssize_t n( socket ? send( out, next, bytes, MSG_NOSIGNAL ) : write( out, next, bytes ) );
+            if ( n < 0 && errno == EINTR ) continue;
+            if ( n < 0 && ( errno == EAGAIN || errno == EWOULDBLOCK ) ) return;
+            if ( n <= 0 ) {
+                LOG( LOG_WARNING, LOG_FIT, "--serve: a client went away before its reply: " << strerror( errno ) );
+                failed = true;
+                return;
+            }
+            sent += n;
+            queued -= n;
+            if ( sent == output.front().size() * sizeof(double) ) {
+                output.pop_front();
+                sent = 0;
+            }
+        }
+    }
+
+    // Adds a reply to the ones waiting and writes what it can. A client still behind
+    // on earlier replies with more than SERVER_MAX_QUEUED bytes waiting is dropped.
+    void Send( std::vector< double >&& reply ) {
+        const bool behind( !output.empty() );
+        queued += reply.size() * sizeof(double);
+        output.push_back( std::move( reply ) );
+        if ( behind && queued > SERVER_MAX_QUEUED ) {
+            LOG( LOG_WARNING, LOG_FIT, "--serve: a client isn't reading its replies, " << queued
+                 << " bytes waiting; dropping it" );
+            failed = true;
+            return;
+        }
+        Flush();
+    }
+
+    // The hello of Server.h, in the room of two doubles
+    void Hello( unsigned int numbins, unsigned int numbands ) {
+        std::vector< double > hello( 2 );
+        uint32_t sizes[2] = { numbins, numbands };
+        std::memcpy( &hello[0], "SPOTSRV1", 8 );
+        std::memcpy( &hello[1], sizes, sizeof(sizes) );
+        Send( std::move( hello ) );
+    }
+};
+
+struct Request {
+    Client* client;
+    uint32_t id, rows;
+    std::vector< double > values;   // rows * ROW
+    std::vector< double > reply;    // the id and rows in the first 8 bytes, then the records
+};
+
+/**************************************************************************************/
+/* Receive:                                                                           */
+/*           reads what the client has sent and adds the whole requests in it to      */
+/*           pending; marks the client closed at the end of its input                 */
+/**************************************************************************************/
+static void Receive( Client* client, unsigned int record, std::vector< Request >& pending ) {
+
+    char buffer[65536];
+    ssize_t n( read( client->in, buffer, sizeof(buffer) ) );
+    if ( n < 0 && ( errno == EINTR || errno == EAGAIN ) ) return;
+    if ( n <= 0 ) {
+        client->closed = true;
+        return;
+    }
+    client->input.append( buffer, n );
+
+    size_t used(0);
+    uint32_t head[2];
+    while ( client->input.size() - used >= sizeof(head) ) {
+        std::memcpy( head, client->input.data() + used, sizeof(head) );
+        if ( head[1] > SERVER_MAX_ROWS ) {
+            LOG( LOG_WARNING, LOG_FIT, "--serve: a request of " << head[1] << " rows, more than "
+                 << SERVER_MAX_ROWS << "; dropping its client" );
+            client->failed = true;
+            return;
+        }
+        const size_t bytes( sizeof(head) + size_t( head[1] ) * ROW * sizeof(double) );
+        if ( client->input.size() - used < bytes ) break;
+
+        Request r;
+        r.client = client;
+        r.id = head[0];
+        r.rows = head[1];
+        r.values.resize( size_t( r.rows ) * ROW );
+        if ( r.rows > 0 )
+            std::memcpy( &r.values[0], client->input.data() + used + sizeof(head), bytes - sizeof(head) );
+        r.reply.assign( 1 + size_t( r.rows ) * record, 0.0 );
+        std::memcpy( &r.reply[0], head, sizeof(head) );
+        pending.push_back( std::move( r ) );
+        used += bytes;
+    }
+    client->input.erase( 0, used );
+}
+
+// The socket at path, listening; one left by a server that was killed is replaced,
+// one a server is still listening on is an error
+static int Listen( const char* path ) {
+
+    struct sockaddr_un address;
+    std::memset( &address, 0, sizeof(address) );
+    address.sun_family = AF_UNIX;
+    if ( strlen( path ) >= sizeof(address.sun_path) )
+        throw( Exception(" The path of the --serve socket is too long. Exiting.\n") );
+    strcpy( address.sun_path, path );
+
+    // A socket left by a server that has gone refuses connections; one that answers
+    // belongs to a server still running, and is left to it
+    struct stat status;
+    if ( stat( path, &status ) == 0 && S_ISSOCK( status.st_mode ) ) {
+        int probe( socket( AF_UNIX, SOCK_STREAM, 0 ) );
+        if ( probe < 0 )
+            throw( Exception(" --serve: couldn't make a socket. Exiting.\n") );
+        int connected( connect( probe, reinterpret_cast< struct sockaddr* >( &address ), sizeof(address) ) );
+        int error( errno );
+        close( probe );
+        if ( connected == 0 || error != ECONNREFUSED ) {
+            std::string message( std::string( " --serve: already serving on " ) + path + ". Exiting.\n" );
+            throw( Exception( message.c_str() ) );
+        }
+        unlink( path );
+    }
+
+    int fd( socket( AF_UNIX, SOCK_STREAM, 0 ) );
+    if ( fd < 0 || bind( fd, reinterpret_cast< struct sockaddr* >( &address ), sizeof(address) ) < 0
+         || listen( fd, SERVER_BACKLOG ) < 0 ) {
+        std::string message( std::string( " Couldn't listen on " ) + path + ": " + strerror( errno ) + ". Exiting.\n" );
+        if ( fd >= 0 ) close( fd );
+        throw( Exception( message.c_str() ) );
+    }
+    return fd;
+}
+
+/**************************************************************************************/
+/* RunServer:                                                                         */
+/*           see Server.h                                                             */
+/**************************************************************************************/
+unsigned long RunServer( class LightCurve* curve, class DataStruct* obsdata, const char* path,
+                         unsigned int numthreads ) {
+
+    const bool pipe( strcmp( path, "-" ) == 0 );
+    const unsigned int numbins( curve->numbins ), numbands( curve->numbands ),
+                       record( 2 + numbands*numbins );
+    class ThreadPool pool( numthreads );
+
+    std::vector< std::unique_ptr< class LightCurve > > scratch( pool.size() );
+    std::vector< std::shared_ptr< DeflTables > > tables( pool.size() );
+    for ( unsigned int t(0); t < pool.size(); t++ ) scratch[t].reset( new class LightCurve );
+
+    struct sigaction stop;
+    std::memset( &stop, 0, sizeof(stop) );
+    stop.sa_handler = Stop; // no SA_RESTART, so that poll returns
+    sigaction( SIGINT, &stop, 0 );
+    sigaction( SIGTERM, &stop, 0 );
+    signal( SIGPIPE, SIG_IGN );
+
+    int listener( -1 );
+    std::vector< std::unique_ptr< Client > > clients;
+    if ( pipe ) {
+        if ( reply_fd < 0 ) ServerReserveStdout();
+        clients.push_back( std::unique_ptr< Client >( new Client( STDIN_FILENO, reply_fd, false ) ) );
+        clients.back()->Hello( numbins, numbands );
+    }
+    else
+        listener = Listen( path );
+
+    std::cout << "Serving light curves of " << numbins << " bins and " << numbands << " bands on "
+              << ( pipe ? "standard input and output" : path ) << ", " << pool.size() << " threads"
+              << std::endl;
+
+    unsigned long nclients( pipe ? 1 : 0 ), nrequests(0), nrows(0), nrounds(0);
+    std::vector< Request > pending;
+    std::vector< std::pair< Request*, uint32_t > > rows; // request and row, in the order computed
+    std::vector< struct pollfd > fds;
+
+    while ( !stopping && !( pipe && clients.empty() ) ) {
+
+        // Two for each client, at 2k and 2k+1: its input, and its output if replies are
+        // waiting (poll passes over negative descriptors)
+        fds.clear();
+        for ( unsigned int k(0); k < clients.size(); k++ ) {
+            struct pollfd in = { clients[k]->closed ? -1 : clients[k]->in, POLLIN, 0 },
+                          out = { clients[k]->output.empty() ? -1 : clients[k]->out, POLLOUT, 0 };
+            fds.push_back( in );
+            fds.push_back( out );
+        }
+        if ( listener >= 0 ) {
+            struct pollfd fd = { listener, POLLIN, 0 };
+            fds.push_back( fd );
+        }
+        if ( poll( &fds[0], fds.size(), -1 ) < 0 ) {
+            if ( errno == EINTR ) continue;
+            throw( Exception(" --serve: poll failed. Exiting.\n") );
+        }
+
+        // Everything the clients have sent since the last round, and the replies they
+        // can take now
+        pending.clear();
+        for ( unsigned int k(0); k < clients.size(); k++ ) {
+            if ( fds[2*k+1].revents != 0 )
+                clients[k]->Flush();
+            if ( fds[2*k].revents != 0 && !clients[k]->failed )
+                Receive( clients[k].get(), record, pending );
+        }
+        if ( listener >= 0 && ( fds.back().revents & POLLIN ) ) {
+            int fd( accept( listener, 0, 0 ) );
+            if ( fd >= 0 ) {
+                clients.push_back( std::unique_ptr< Client >( new Client( fd, fd, true ) ) );
+                clients.back()->Hello( numbins, numbands );
+                nclients++;
+            }
+        }
+
+        // All their rows at once, the rows of each star next to each other as in --batch
+        rows.clear();
+        for ( unsigned int r(0); r < pending.size(); r++ )
+            for ( uint32_t n(0); n < pending[r].rows; n++ )
+                rows.push_back( std::make_pair( &pending[r], n ) );
+        static const unsigned int order[ROW] = { 0, 1, SPIN, 3, 2, 4, 5, 6 };
+        std::stable_sort( rows.begin(), rows.end(),
+                          [&]( const std::pair< Request*, uint32_t >& a, const std::pair< Request*, uint32_t >& b ) {
+                              const double* x( &a.first->values[a.second * ROW] );
+                              const double* y( &b.first->values[b.second * ROW] );
+                              for ( unsigned int k(0); k < ROW; k++ )
+                                  if ( x[order[k]] != y[order[k]] ) return x[order[k]] < y[order[k]];
+                              return false; } );
+
+        pool.Run( rows.size(), [&]( unsigned int k, unsigned int thread ) {
+            class LightCurve* c( scratch[thread].get() );
+            const double* row( &rows[k].first->values[rows[k].second * ROW] );
+            double* out( &rows[k].first->reply[1 + size_t( rows[k].second ) * record] );
+
+            *c = *curve;
+            out[0] = -1.0;
+            if ( row[SPIN] < 0.0 || !LoadFitParameters( c, row ) )
+                return;
+            c->para.omega = Units::cgs_to_nounits( 2.0*Units::PI*row[SPIN], Units::INVTIME );
+
+            if ( !tables[thread] || !tables[thread]->Matches( c ) )
+                tables[thread] = SessionCache().Get( c );
+            if ( tables[thread]->problem )
+                return;
+
+            ComputeFlux( c, tables[thread].get() );
+            NormalizeFlux( c );
+            out[0] = 1.0;
+            out[1] = obsdata ? ChiSquare( obsdata, c ) : 0.0;
+            for ( unsigned int p(0); p < numbands; p++ )
+                std::copy( c->f[p], c->f[p] + numbins, out + 2 + p*numbins );
+        } );
+
+        {
+            ProfileTimer timer( STAGE_OUTPUT );
+            for ( unsigned int r(0); r < pending.size(); r++ )
+                if ( !pending[r].client->failed )
+                    pending[r].client->Send( std::move( pending[r].reply ) );
+        }
+        if ( !pending.empty() ) nrounds++;
+        nrequests += pending.size();
+        nrows += rows.size();
+
+        clients.erase( std::remove_if( clients.begin(), clients.end(),
+                                       []( const std::unique_ptr< Client >& c ) { return c->Done(); } ),
+                       clients.end() );
+    }
+
+    clients.clear();
+    if ( listener >= 0 ) {
+        close( listener );
+        unlink( path );
+    }
+
+    std::cout << "Served " << nrequests << " requests of " << nrows << " rows from " << nclients
+              << " clients, in " << nrounds << " rounds" << std::endl;
+    return nrows;
+}
@@ -0,0 +1,55 @@
+/***************************************************************************************/
+/*                                       Server.h
+
+    This is the header file for Server.cpp, which keeps spot running to answer requests
+    for light curves (--serve), for samplers in Python or MATLAB that would otherwise
+    run spot once per likelihood and build the look-up tables afresh each time. The
+    settings of the command line, the data file (-I) and the tables in the cache (see
+    DeflCache in Engine.h) stay loaded from one request to the next.
+
+    It listens on a Unix domain socket, for any number of clients at once, or with "-"
+    talks to one client over standard input and output (what spot prints goes to
+    standard error instead). Everything is binary, in the byte order of the machine:
+
+        the server, on connecting:  the 8 characters SPOTSRV1, numbins and numbands
+                                    as 32-bit unsigned integers
+        a request:                  an id and a number of rows as 32-bit unsigned
+                                    integers, then the rows, each the 8 values
+                                    M R_eq incl theta rho T ts spin as 64-bit floats
+                                    (the letters m r i e p T l f of --batch)
+        its reply:                  the same id and rows, then a record per row as in
+                                    the output of --batch: status (1, or -1 if the
+                                    parameters are unphysical and the flux is left 0),
+                                    chi^2 (0 without a data file), then f[p][i] band
+                                    by band, as 64-bit floats
+
+    A client need not wait for a reply before sending its next request, and the replies
+    to each client come in the order of its requests. Nothing waits on a client that is
+    slow to read its replies: they are kept until it takes them, and a client that falls
+    behind by more than SERVER_MAX_QUEUED bytes is dropped. Whatever requests have come in
+    from all the clients while the last ones were being computed are computed together
+    on the thread pool, rows with the same star next to each other.
+*/
+/***************************************************************************************/
+
+#ifndef SERVER_H
+#define SERVER_H
+
+#include "Chi.h"
+
+#define SERVER_MAX_ROWS 1048576 // most rows in one request; a client sending more is dropped
+#define SERVER_BACKLOG 16       // connections waiting to be accepted
+#define SERVER_MAX_QUEUED ( size_t( 1 ) << 30 ) // most bytes of replies waiting for a client behind on them
+
+// For --serve -: keeps standard output for the replies and sends what spot prints to
+// standard error instead. Call before anything else is printed.
+void ServerReserveStdout();
+
+// Answers requests on the Unix domain socket at path, or on standard input and output
+// for "-", with the light curves of curve (the rows giving its parameters and spin)
+// and, with obsdata, chi^2 against it. Runs until SIGINT or SIGTERM, or for "-" until
+// standard input ends. Returns the number of rows computed.
+unsigned long RunServer( class LightCurve* curve, class DataStruct* obsdata, const char* path,
+                         unsigned int numthreads );
+
+#endif // SERVER_H
@@ -39,6 +39,7 @@
 #include <exception>
 #include <vector>
 #include <string>
+#include <memory>
 #include "OblDeflectionTOA.h"
 #include "Chi.h"
 #include "PolyOblModelNHQS.h"
@@ -48,6 +49,19 @@
 #include "Units.h"
 #include "Exception.h"
 #include "Struct.h"
+#include "Engine.h"
+#include "EnsembleSampler.h"
+#include "NestedSampler.h"
+#include "Batch.h"
+#include "Server.h"
+#include "Output.h"
+#include "Log.h"
+#include "Profile.h"
+#include "GeneticFit.h"
+#include "Prior.h"
+#include "ThreadPool.h"
+#include "Healpix.h"
+#include "Accuracy.h"
 #include "time.h"
 #include <string.h>
 
@@ -64,9 +78,7 @@ int main ( int argc, char** argv ) try {  // argc, number of cmd line args;
   std::ofstream param_out;// piping out the parameters and chisquared
     
   double incl_1(90.0),               // Inclination angle of the observer, in degrees
-    incl_2(90.0),               // PI - incl_1; needed for computing flux from second hot spot, since cannot have a theta greater than 
     theta_1(90.0),              // Emission angle (latitude) of the first upper spot, in degrees, down from spin pole
-    theta_2(90.0),              // Emission angle (latitude) of the second lower spot, in degrees, up from spin pole (180 across from first spot)
     mass,                       // Mass of the star, in M_sun
     rspot,                      // Radius of the star at the spot, in km
     mass_over_r, // Dimensionless mass divided by radius ratio
@@ -75,34 +87,24 @@ int main ( int argc, char** argv ) try {  // argc, number of cmd line args;
     bbrat(1.0),                 // Ratio of blackbody to Compton scattering effects, unitless
     ts(0.0),                    // Phase shift or time off-set from data; Used in chi^2 calculation
     spot_temperature(0.0),      // Inner temperature of the spot, in the star's frame, in keV
-    phi_0_1,                    // Equatorial azimuth at the center of the piece of the spot that we're looking at
-    phi_0_2,                    // Equatorial azimuth at the center of the piece of the second hot spot that we're looking at
-    theta_0_1,                  // Latitude at the center of the piece of the spot we're looking at
-    theta_0_2,                  // Latitude at the center of the piece of the second hot spot that we're looking at
     rho(0.0),                   // Angular radius of the inner bullseye part of the spot, in degrees (converted to radians)
-    dphi(1.0),                  // Each chunk of azimuthal angle projected onto equator, when broken up into the bins (see numphi)
-    dtheta(1.0),                // Each chunk of latitudinal angle, when broken up into the bins (see numtheta)
-    phi_edge_2(0.0),            // Equatorial azimuth at the edge of the second spot at some latitude theta_0_2
-    theta_edge_2(0.0),          // Latitudinal edge of lower (second) hot spot at -rho
-    phishift,
     aniso(0.586),               // Anisotropy parameter
     Gamma1(2.0),                // Spectral index
     Gamma2(2.0),                // Spectral index
     Gamma3(2.0),                // Spectral index
-    mu_1(1.0),                  // = cos(theta_1), unitless
-    mu_2(1.0),                  // = cos(theta_2), unitless
-    cosgamma,                   // Cos of the angle between the radial vector and the vector normal to the surface; defined in equation 13, MLCB
-    Flux[NCURVES][MAX_NUMBINS], // Array of fluxes; Each curve gets its own vector of fluxes based on photons in bins.
-    Temp[NCURVES][MAX_NUMBINS],
-    trueSurfArea(0.0),          // The true geometric surface area of the spot
     E_band_lower_1(2.0),        // Lower bound of first energy band to calculate flux over, in keV.
     E_band_upper_1(3.0),        // Upper bound of first energy band to calculate flux over, in keV.
     E_band_lower_2(5.0),        // Lower bound of second energy band to calculate flux over, in keV.
     E_band_upper_2(6.0),        // Upper bound of second energy band to calculate flux over, in keV.
-    background[NCURVES],
-    T_mesh[30][30],             // Temperature mesh over the spot; same mesh as theta and phi bins, assuming square mesh
+    background[NCURVES] = { 0.0 },
     chisquared(1.0),             // The chi^2 of the data; only used if a data file of fluxes is inputed
     distance(3.0857e22),        // Distance from earth to the NS, in meters; default is 10kpc
+    ftol(1.0e-4),               // Fractional tolerance in chi^2 at which the fit (-F) stops
+    cache_mb(DEFL_CACHE_MB),    // Memory budget of the cache of look-up tables, in MB
+    mesh_tolerance(0.0),        // Adaptive spot mesh: error of the flux allowed, as a fraction of the peak; 0 = -t rings
+    tolerance(0.0),             // Error of the flux allowed overall (--tolerance), see Accuracy.h; 0 = the built-in resolutions
+    fit_x[NDIM],                // Starting point of the fit, in command line units (see FitCurve in Chi.h)
+    fit_step[NDIM] = { 0.1, 0.5, 5.0, 5.0, 0.05, 0.02, 0.05 }, // Size of the starting simplex
     B;                          // from param_degen/equations.pdf 2
    
 
@@ -114,14 +116,28 @@ int main ( int argc, char** argv ) try {  // argc, number of cmd line args;
     numbins(MAX_NUMBINS), // Number of time or phase bins for one spin period; Also the number of flux data points
     numphi(1),            // Number of azimuthal (projected) angular bins per spot
     numtheta(1),          // Number of latitudinal angular bins per spot
-    numbands(NCURVES); // Number of energy bands;
+    numbands(NCURVES), // Number of energy bands;
+    numthreads(0),        // Number of threads used by the fit; 0 = one per core
+    mcmc_steps(0),        // Number of ensemble MCMC steps; 0 = fit with the simplex instead
+    mcmc_walkers(0),      // Number of MCMC walkers; 0 = 2*(number of fit parameters)
+    nested_live(0),       // Number of nested sampling live points; 0 = no nested sampling
+    ga_generations(0),    // Number of generations of the genetic algorithm; 0 = no genetic algorithm
+    ga_population(0),     // Number of individuals per generation; 0 = 10*(number of fit parameters)
+    nside(0),             // Equal-area pixel mesh of the whole surface, 12 nside^2 pixels; 0 = rings of the spot
+    binary_bits(0);       // Binary output of the light curve in 32- or 64-bit floats; 0 = text
 
   char out_file[256] = "flux.txt",    // Name of file we send the output to; unused here, done in the shell script
          out_dir[80],                   // Directory we could send to; unused here, done in the shell script
-         T_mesh_file[100],              // Input file name for a temperature mesh, to make a spot of any shape
          data_file[256],                // Name of input file for reading in data
 	  //testout_file[256] = "test_output.txt", // Name of test output file; currently does time and two energy bands with error bars
-         filenameheader[256]="Run";
+         prior_file[256] = "",          // Input file of priors for the MCMC and nested sampling (ranges for the GA)
+         mask_file[256] = "",           // Input file of the weights of the pixels of the -H mesh
+         map_file[256] = "",            // Input file of the temperature (and beaming) of each pixel
+         spots_file[256] = "",          // Input file of more hot spots, each with its own centre, radius and temperature
+         batch_file[256] = "",          // Input table of parameter sets, one light curve each (--batch)
+         serve_path[256] = "",          // Unix domain socket to answer requests on, or - for standard input and output (--serve)
+         profile_file[256] = "",        // Output file of the time taken by each stage, JSON (--profile)
+         trace_file[256] = "";          // Output file of the timeline of each thread, Chrome trace (--trace)
 
          
   // flags!
@@ -133,16 +149,20 @@ int main ( int argc, char** argv ) try {  // argc, number of cmd line args;
     	 model_is_set(false),        // True if NS model is set at the command line (NS model is a necessary variable)
     	 datafile_is_set(false),     // True if a data file for inputting is set at the command line
     	 ignore_time_delays(false),  // True if we are ignoring time delays
-    	 T_mesh_in(false),           // True if we are varying spot shape by inputting a temperature mesh for the hot spot's temperature
     	 normalize_flux(false),      // True if we are normalizing the output flux to 1
     	 E_band_lower_2_set(false),  // True if the lower bound of the second energy band is set
     	 E_band_upper_2_set(false),  // True if the upper bound of the second energy band is set
     	 two_spots(false),           // True if we are modelling a NS with two antipodal hot spots
     	 only_second_spot(false),    // True if we only want to see the flux from the second hot spot (does best with normalize_flux = false)
-    	 pd_neg_soln(false);
+    	 fit_is_set(false),          // True if we are fitting some of the parameters to the data file
+    	 mcmc_resume(false),         // True if the MCMC carries on from an existing chain file
+    	 batch_overwrite(false),     // True if --batch may replace an output file from another table or other options
+    	 gradient_check(false),      // True if we print chi^2 and its gradient over the -F parameters instead of fitting
+    	 single_precision(false),    // True if the spectra and rebinning are computed in float, with an accuracy report
+    	 fit_vary[NDIM] = { false, false, false, false, false, false, false }; // Which parameters are fit
 		
   // Create LightCurve data structure
-  class LightCurve curve, normcurve;  // variables curve and normalized curve, of type LightCurve
+  class LightCurve curve;             // variable curve, of type LightCurve
   class DataStruct obsdata;           // observational data as read in from a file
 
 
@@ -151,7 +171,7 @@ int main ( int argc, char** argv ) try {  // argc, number of cmd line args;
   /*********************************************************/
     
     for ( int i(1); i < argc; i++ ) {
-        if ( argv[i][0] == '-' ) {  // the '-' flag lets the computer know that we're giving it information from the cmd line
+        if ( argv[i][0] == '-' && argv[i][1] != '\0' ) {  // the '-' flag lets the computer know that we're giving it information from the cmd line; a lone - is a value (--serve -)
             switch ( argv[i][1] ) {
 	    case 'a':  // Anisotropy parameter
 	                sscanf(argv[i+1], "%lf", &aniso);
@@ -161,6 +181,18 @@ int main ( int argc, char** argv ) try {  // argc, number of cmd line args;
 	            	sscanf(argv[i+1], "%lf", &bbrat);
 	            	break;
 
+	    case 'B': // Input file of more hot spots
+	            	sscanf(argv[i+1], "%s", spots_file);
+	            	break;
+
+	    case 'c': // Fractional tolerance in chi^2 for the fit
+	                sscanf(argv[i+1], "%lf", &ftol);
+	                break;
+
+	    case 'C': // Memory budget of the cache of look-up tables, in MB
+	                sscanf(argv[i+1], "%lf", &cache_mb);
+	                break;
+
 	    case 'd': //toggle ignore_time_delays (only affects output)
 	                ignore_time_delays = true;
 	                break;
@@ -174,15 +206,38 @@ int main ( int argc, char** argv ) try {  // argc, number of cmd line args;
 	                theta_is_set = true;
 	                break;
 
+	    case 'E':  // Error allowed of the adaptive spot mesh, as a fraction of the peak flux
+	                sscanf(argv[i+1], "%lf", &mesh_tolerance);
+	                break;
+
 	    case 'f':  // Spin frequency (Hz)
 	                sscanf(argv[i+1], "%lf", &omega);
 	                omega_is_set = true;
 	                break;
 
+	    case 'F':  // Parameters to fit, by their command line letters, e.g. "mrie"
+	                for ( const char* c = argv[i+1]; *c != '\0'; c++ ) {
+	                    const char* letters = "mriepTl";
+	                    const char* at = strchr( letters, *c );
+	                    if ( !at ) 
+	                        throw( Exception(" -F takes some of the letters m r i e p T l. Exiting.\n") );
+	                    fit_vary[at - letters] = true;
+	                }
+	                fit_is_set = true;
+	                break;
+
+	    case 'G':  // Number of generations of the genetic algorithm over the -F parameters
+	                sscanf(argv[i+1], "%u", &ga_generations);
+	                break;
+
 	    case 'g':  // Spectral Model, beaming (graybody factor)
 	                sscanf(argv[i+1],"%u", &beaming_model);
 	                break;
 	                
+	    case 'H':  // Equal-area (HEALPix) pixel mesh of the whole surface, with 12 nside^2 pixels
+	                sscanf(argv[i+1], "%u", &nside);
+	                break;
+
 	    case 'i':  // Inclination angle of the observer (degrees)
 	                sscanf(argv[i+1], "%lf", &incl_1);
 	                incl_is_set = true;
@@ -196,7 +251,15 @@ int main ( int argc, char** argv ) try {  // argc, number of cmd line args;
 	    case 'j':  // Flag for calculating only the second (antipodal) hot spot
 	            	only_second_spot = true;
 	            	break;
+
+	    case 'J':  // Flag for printing the gradient of chi^2 over the -F parameters
+	            	gradient_check = true;
+	            	break;
 	          	          
+	    case 'L':  // Number of live points of the nested sampler over the -F parameters
+	                sscanf(argv[i+1], "%u", &nested_live);
+	                break;
+
 	    case 'l':  // Time shift, phase shift.
 	                sscanf(argv[i+1], "%lf", &ts);
 	                break;
@@ -209,6 +272,10 @@ int main ( int argc, char** argv ) try {  // argc, number of cmd line args;
 	      sscanf(argv[i+1], "%lf", &background[3]);
 	      break;
 	          	          
+	    case 'M':  // Number of steps of the ensemble MCMC over the -F parameters
+	                sscanf(argv[i+1], "%u", &mcmc_steps);
+	                break;
+
 	    case 'm':  // Mass of the star (solar mass units)
 	                sscanf(argv[i+1], "%lf", &mass);
 	                mass_is_set = true;
@@ -238,6 +305,10 @@ int main ( int argc, char** argv ) try {  // argc, number of cmd line args;
 	                sscanf(argv[i+1], "%u", &numphi);
 	                break;	          
 
+	    case 'Q':  // Number of individuals per generation of the genetic algorithm
+	                sscanf(argv[i+1], "%u", &ga_population);
+	                break;
+
 	    case 'q':  // Oblateness model (default is 1)
 	                sscanf(argv[i+1], "%u", &NS_model);
 	                model_is_set = true;
@@ -248,6 +319,10 @@ int main ( int argc, char** argv ) try {  // argc, number of cmd line args;
 	                rspot_is_set = true;
 	                break;
 
+	    case 'R':  // Resume the MCMC from its chain file
+	                mcmc_resume = true;
+	                break;
+
 	    case 's':  // Spectral Model
 	                sscanf(argv[i+1], "%u", &spectral_model);
 			// 0 = blackbody
@@ -286,6 +361,14 @@ int main ( int argc, char** argv ) try {  // argc, number of cmd line args;
 	            	E_band_upper_2_set = true;
 	            	break;
 	            
+	    case 'w': // Number of threads for the fit
+	                sscanf(argv[i+1], "%u", &numthreads);
+	                break;
+
+	    case 'W': // Number of MCMC walkers
+	                sscanf(argv[i+1], "%u", &mcmc_walkers);
+	                break;
+
 	    case 'x': // Scattering radius, in kpc
 	            	sscanf(argv[i+1], "%lf", &E0);
 	            	break;
@@ -294,47 +377,106 @@ int main ( int argc, char** argv ) try {  // argc, number of cmd line args;
 	            	sscanf(argv[i+1], "%lf", &DeltaE);
 	            	break;
 	            	
-	    case 'z': // Input file for temperature mesh
-	            	sscanf(argv[i+1], "%s", T_mesh_file);
-	            	T_mesh_in = true;
+	    case 'y': // Input file of the pixel mask for the -H mesh
+	            	sscanf(argv[i+1], "%s", mask_file);
+	            	break;
+
+	    case 'Y': // Input file of priors for the MCMC and nested sampling
+	            	sscanf(argv[i+1], "%s", prior_file);
+	            	break;
+
+	    case 'Z': // Flag for computing the spectra and rebinning in single precision
+	            	single_precision = true;
+	            	break;
+
+	    case 'z': // Input file of the temperature map over the pixels of the -H mesh
+	            	sscanf(argv[i+1], "%s", map_file);
 	            	break;
 	            	
 	    case '2': // If the user want two spots
 	            	two_spots = true;
 	            	break;
+
+	    case '-': // Long options
+	            	if ( strcmp( argv[i], "--batch" ) == 0 && i+1 < argc ) { // Table of parameter sets
+	            	    sscanf(argv[i+1], "%s", batch_file);
+	            	    break;
+	            	}
+	            	if ( strcmp( argv[i], "--binary" ) == 0 && i+1 < argc ) { // Binary output, 32 or 64 bits
+	            	    sscanf(argv[i+1], "%u", &binary_bits);
+	            	    if ( binary_bits != 32 && binary_bits != 64 )
+	            	        throw( Exception(" --binary takes 32 or 64. Exiting.\n") );
+	            	    break;
+	            	}
+	            	if ( strcmp( argv[i], "--overwrite" ) == 0 ) { // --batch may replace any output file
+	            	    batch_overwrite = true;
+	            	    break;
+	            	}
+	            	if ( strcmp( argv[i], "--log" ) == 0 && i+1 < argc ) { // Level and categories of messages
+	            	    LogSetup( argv[i+1] );
+	            	    break;
+	            	}
+	            	if ( strcmp( argv[i], "--profile" ) == 0 && i+1 < argc ) { // Timing of each stage
+	            	    sscanf(argv[i+1], "%s", profile_file);
+	            	    ProfileStart();
+	            	    break;
+	            	}
+	            	if ( strcmp( argv[i], "--serve" ) == 0 && i+1 < argc ) { // Light curves on request
+	            	    sscanf(argv[i+1], "%s", serve_path);
+	            	    if ( strcmp( serve_path, "-" ) == 0 ) ServerReserveStdout(); // before anything is printed
+	            	    break;
+	            	}
+	            	if ( strcmp( argv[i], "--trace" ) == 0 && i+1 < argc ) { // Timeline of each thread
+	            	    sscanf(argv[i+1], "%s", trace_file);
+	            	    ProfileTraceStart();
+	            	    break;
+	            	}
+	            	if ( strcmp( argv[i], "--tolerance" ) == 0 && i+1 < argc ) { // Error of the flux allowed
+	            	    sscanf(argv[i+1], "%lf", &tolerance);
+	            	    break;
+	            	}
+	            	throw( Exception(" Unknown option; spot -h lists them. Exiting.\n") );
 	            	
-	            case '3': // Header for file name
-	            	sscanf(argv[i+1],"%s", filenameheader);
-	            	break;
-	            
-	            case '8': // Param_degen gave a negative solution
-	            	pd_neg_soln = true;
-	            	break;
-	            
                 case 'h': default: // Prints help
        	            std::cout << "\n\nSpot help:  -flag description [default value]\n" << std::endl
                               << "-a Anisotropy parameter. [0.586]" << std::endl
                               << "-b Ratio of blackbody flux to comptonized flux. [1.0]" << std::endl
+                              << "-B Input file of more hot spots, besides the -e -p -T one; lines of:" << std::endl
+                              << "      <theta [deg], 0 to 180> <phi [deg], from the first spot> <rho [rad]> <T [keV]>." << std::endl
+                              << "-c Fractional tolerance in chi^2 at which the fit stops. [1e-4]" << std::endl
+                              << "-C Memory budget of the cache of look-up tables shared by the fit, in MB; 0 for none. [64]" << std::endl
                               << "-d Ignores time delays in output (see source). [0]" << std::endl
                               << "-D Distance from earth to star, in meters. [~10kpc]" << std::endl
                               << "-e * Latitudinal location of emission region, in degrees, between 0 and 90." << std::endl
+                              << "-E Adaptive spot mesh: halves the -t rings where needed until the estimated error of the flux" << std::endl
+                              << "      is below this fraction of the peak flux in each band; 0 for the -t rings as they are. [0]" << std::endl
                               << "-f * Spin frequency of star, in Hz." << std::endl
+                              << "-F Fit these parameters to the data file (-I), by their flags: m r i e p T l." << std::endl
+                              << "      The values given on the command line are the starting point." << std::endl
+                              << "-G Number of generations of a genetic algorithm fit of the -F parameters, over the -Y ranges. [0]" << std::endl
                               << "-g Graybody factor of beaming model: 0 = isotropic, 1 = Gray Atmosphere. [0]" << std::endl
+                              << "-H Equal-area pixel mesh of the whole surface with 12 nside^2 pixels (HEALPix), instead of" << std::endl
+                              << "      the -t rings; the spot(s) are the pixels within rho of their centres, or the -y mask. [0]" << std::endl
 		                      << "-i * Inclination of observer, in degrees, between 0 and 90." << std::endl
                               << "-I Input filename." << std::endl
 		                      << "-j Flag for computing only the second (antipodal) hot spot. [false]" << std::endl
+		                      << "-J Flag for printing chi^2 and its gradient over the -F parameters, with a finite difference check, instead of fitting. [false]" << std::endl
 		                      << "-l Time shift (or phase shift), in seconds." << std::endl
+		                      << "-L Number of live points of nested sampling over the -F parameters, for the evidence. [0]" << std::endl
 		                      << "-m * Mass of star in Msun." << std::endl          
+		                      << "-M Number of steps of ensemble MCMC over the -F parameters, instead of fitting. [0]" << std::endl
       	  	                  << "-n Number of phase or time bins. [128]" << std::endl
       	  	                  << "-N Flag for normalizing the flux. Using this sets it to true. [false]" << std::endl
 		                      << "-o Output filename." << std::endl
 		                      << "-O Name of the output directory." << std::endl
 		                      << "-p Angular radius of spot, rho, in radians. [0.0]" << std::endl
+		                      << "-Q Number of individuals per generation of the genetic algorithm. [10 x number of -F parameters]" << std::endl
 		                      << "-q * Model of star: [3]" << std::endl
 		                      << "      1 for Neutron/Hybrid quark star poly model" << std::endl
 		                      << "      2 for CFL quark star poly model" << std::endl
 		                      << "      3 for spherical model" << std::endl
 		                      << "-r * Radius of star (at the equator), in km." << std::endl
+		                      << "-R Resume the MCMC from the last checkpoint of its chain file." << std::endl
 		                      << "-s Spectral model of radiation: [0]" << std::endl
 		                      << "      0 for bolometric light curve." << std::endl
 		                      << "      1 for blackbody in monochromatic energy bands (must include T option)." << std::endl
@@ -344,12 +486,35 @@ int main ( int argc, char** argv ) try {  // argc, number of cmd line args;
 		                      << "-U Low energy band, upper limit, in keV. [3]" << std::endl
 		                      << "-v High energy band, lower limit, in keV. [5]" << std::endl
 		                      << "-V High energy band, upper limit, in keV. [6]" << std::endl
+		                      << "-w Number of threads used by the fit. [one per core]" << std::endl
+		                      << "-W Number of MCMC walkers. [2 x number of -F parameters]" << std::endl
 		                      << "-x Scattering radius, in kpc." << std::endl
 		                      << "-X Scattering intensity, units unspecified." << std::endl
-		                      << "-z Input file name for temperature mesh." << std::endl
+		                      << "-y Input file of a pixel mask for -H, of any shape; lines of: <pixel index> [weight]." << std::endl
+		                      << "-Y Input file of priors for -M and -L, or ranges for -G; lines of: <m|r|i|e|p|T|l> <uniform lo hi|gaussian mean sigma>." << std::endl
+		                      << "-z Input file of a temperature map over the pixels of the whole surface, of any nside, in place" << std::endl
+		                      << "      of -T and the spot(s); binary, see HealpixMap in Healpix.h. Sets -H to the map's nside." << std::endl
+		                      << "-Z Flag for computing the spectra and the rebinning in single precision (float), also in fits," << std::endl
+		                      << "      and printing how far the light curve is from the double one. [false]" << std::endl
 		                      << "-2 Flag for calculating two hot spots, on both magnetic poles. Using this sets it to true. [false]" << std::endl
-		                      << "-3 File name header, for use with Ferret and param_degen." << std::endl
-		                      << "-8 Sets a flag to indicate that param_degen gave a negative solution." << std::endl
+		                      << "--batch Input table of parameter sets, text or binary (see Batch.h), with a header of" << std::endl
+		                      << "      the letters m r i e p T l f; the light curve of each row, the other parameters as given" << std::endl
+		                      << "      here, goes into the -o file (binary), which a run that stopped carries on. A -o file" << std::endl
+		                      << "      from another table or other options is left alone, unless --overwrite. [none]" << std::endl
+		                      << "--binary Writes the light curve to the -o file in binary, 32- or 64-bit floats, with a text" << std::endl
+		                      << "      header saying what it is (see Output.h), instead of as text. [text]" << std::endl
+		                      << "--log Messages to write, <level>[:<category>,...]: levels 1 errors, 2 warnings, 3 info," << std::endl
+		                      << "      4 debug (built with make LOG_LEVEL=4); categories angles, curve, defl, mesh, fit. [2]" << std::endl
+		                      << "--overwrite Flag for --batch to replace a -o file from another table or other options. [false]" << std::endl
+		                      << "--profile Output file of the time taken by each stage of the light curves and the work" << std::endl
+		                      << "      counted in them, JSON (see Profile.h), written at the end of the run. [none]" << std::endl
+		                      << "--serve Unix domain socket to answer requests for light curves on, binary (see Server.h)," << std::endl
+		                      << "      or - for standard input and output; the other parameters as given here. [none]" << std::endl
+		                      << "--trace Output file of the timeline of each thread (tables, rings, rebinning, adding up," << std::endl
+		                      << "      output), a Chrome trace for chrome://tracing or ui.perfetto.dev. [none]" << std::endl
+		                      << "--tolerance Error of the flux allowed, as a fraction of the peak flux of each band: sets the" << std::endl
+		                      << "      integrals' resolutions, and -E if not given, from errors measured once into" << std::endl
+		                      << "      ~/.spot_accuracy (see Accuracy.h). [built-in resolutions]" << std::endl
 		                      << " Note: '*' next to description means required input parameter." << std::endl
 		                      << std::endl;
 	                return 0;
@@ -369,45 +534,16 @@ int main ( int argc, char** argv ) try {  // argc, number of cmd line args;
     }
     
    
-    /***************************************************************/
-    /* READING TEMPERATURE VALUES FROM AN INPUT FILE, IF SPECIFIED */
-    /***************************************************************/
-	
-    if ( T_mesh_in ) {
-    	std::ifstream inStream(T_mesh_file);
-    	std::cout << "** Tmeshfile name = " << T_mesh_file << std::endl;
-    	unsigned int n(0);
-
-    	if ( !inStream ) {
-        	throw( Exception( "Temperature mesh input file could not be opened. \nCheck that the actual input file name is the same as the -z flag parameter value. \nExiting.\n") );
-        	return -1;
-        }
-        std::string inLine;
-        while ( std::getline(inStream, inLine) )  // getting numtheta from the file
-        	n++;
-        if (n != numtheta) {
-        	throw( Exception( "Numtheta from mesh file does not match numtheta from command line input. \nExiting.\n") );
-        	return -1;
-        }
-        numtheta = numphi = n;
-        // go back to the beginning of the file
-        inStream.clear();
-        inStream.seekg (0, std::ios::beg);
-        for ( unsigned int k(0); k < numtheta; k++ ) {
-    		for ( unsigned int j(0); j < numphi; j++ ) {
-    			inStream >> T_mesh[k][j];
-    		}
-    	}
-    	inStream.close();
-    	
-    	// Printing the temperature mesh, for checking that it was read in correctly
-    	std::cout << "Temperature Mesh of Spot:" << std::endl;
-    	for ( unsigned int i(0); i < numtheta; i++ ) {
-    		for ( unsigned int j(0); j < numphi; j++ ) {
-    	    	std::cout << T_mesh[i][j] << "  ";
-    		}
-    		std::cout << std::endl;
-    	}
+    /**************************************************************/
+    /* READING THE TEMPERATURE MAP FROM AN INPUT FILE, IF SPECIFIED */
+    /**************************************************************/
+
+    std::unique_ptr< HealpixMap > pixel_map;
+    if ( map_file[0] != '\0' ) {
+        pixel_map.reset( new HealpixMap( map_file ) );
+        if ( nside > 0 && nside != pixel_map->nside )
+            throw( Exception(" The temperature map (-z) is for another nside than -H. Exiting.\n") );
+        nside = pixel_map->nside;
     }
     
     /******************************************/
@@ -422,6 +558,10 @@ int main ( int argc, char** argv ) try {  // argc, number of cmd line args;
         throw( Exception(" Cannot have a negative temperature, spot size, NS mass, NS radius, spin frequency. Exiting.\n") );
         return -1;
     }
+    if ( mesh_tolerance < 0.0 ) {
+        throw( Exception(" Illegal tolerance of the adaptive mesh. Must not be negative. Exiting.\n") );
+        return -1;
+    }
     if ( rho == 0.0 && numtheta != 1 ) {
         std::cout << "\nWarning: Setting theta bin to 1 for a trivially sized spot.\n" << std::endl;
         numtheta = 1;
@@ -438,17 +578,23 @@ int main ( int argc, char** argv ) try {  // argc, number of cmd line args;
     /* UNIT CONVERSIONS -- MAKE EVERYTHING DIMENSIONLESS */
     /*****************************************************/
 
+    fit_x[0] = mass;
+    fit_x[1] = req;
+    fit_x[2] = incl_1;
+    fit_x[3] = theta_1;
+    fit_x[4] = rho;
+    fit_x[5] = spot_temperature;
+    fit_x[6] = ts;
+
     mass_over_r = mass/(req) * Units::GMC2;
     incl_1 *= (Units::PI / 180.0);  // radians
     if ( only_second_spot ) incl_1 = Units::PI - incl_1; // for doing just the 2nd hot spot
     theta_1 *= (Units::PI / 180.0); // radians
-    theta_2 = theta_1; // radians
     //rho *= (Units::PI / 180.0);  // rho is input in radians
-    mu_1 = cos( theta_1 );
-    mu_2 = mu_1; 
     mass = Units::cgs_to_nounits( mass*Units::MSUN, Units::MASS );
     req = Units::cgs_to_nounits( req*1.0e5, Units::LENGTH );
    
+    double spin( omega ); // in Hz, for --batch
     omega = Units::cgs_to_nounits( 2.0*Units::PI*omega, Units::INVTIME );
     distance = Units::cgs_to_nounits( distance*100, Units::LENGTH );
 	
@@ -464,6 +610,7 @@ int main ( int argc, char** argv ) try {  // argc, number of cmd line args;
     curve.para.radius = req;
     curve.para.req = req;
     curve.para.theta = theta_1;
+    curve.para.rho = rho;
     curve.para.incl = incl_1;
     curve.para.aniso = aniso;
     curve.para.Gamma1 = Gamma1;
@@ -477,14 +624,26 @@ int main ( int argc, char** argv ) try {  // argc, number of cmd line args;
     curve.para.E_band_upper_2 = E_band_upper_2;
     curve.para.distance = distance;
     curve.numbins = numbins;
+    curve.numtheta = numtheta;
     //curve.para.rsc = r_sc;
     //curve.para.Isc = I_sc;
 
     //numphi = numtheta; // code currently only handles a square mesh over the hotspot
   
     curve.flags.ignore_time_delays = ignore_time_delays;
+    curve.flags.infile_is_set = datafile_is_set;
     curve.flags.spectral_model = spectral_model;
     curve.flags.beaming_model = beaming_model;
+    curve.flags.NS_model = NS_model;
+    curve.flags.two_spots = two_spots;
+    curve.flags.only_second_spot = only_second_spot;
+    curve.flags.normalize_flux = normalize_flux;
+    curve.flags.single_precision = single_precision;
+    curve.flags.mesh_tolerance = mesh_tolerance;
+    curve.flags.nside = nside;
+    curve.flags.pixel_mask = 0;
+    curve.flags.pixel_map = pixel_map.get();
+    curve.flags.spots = 0;
     curve.numbands = numbands;
 
    // Define the Spectral Model
@@ -502,6 +661,7 @@ int main ( int argc, char** argv ) try {  // argc, number of cmd line args;
 
     // initialize background
     for ( unsigned int p(0); p < numbands; p++ ) background[p] = 0.0;
+    for ( unsigned int p(0); p < NCURVES; p++ ) curve.background[p] = background[p];
 
     /*************************/
     /* OPENING THE DATA FILE */
@@ -510,623 +670,228 @@ int main ( int argc, char** argv ) try {  // argc, number of cmd line args;
     if ( datafile_is_set ) {	
       std::ifstream data; //(data_file);      // the data input stream
       data.open( data_file );  // opening the file with observational data
-      char line[265]; // line of the data file being read in
-      unsigned int numLines(0), i(0);
+      std::string line; // line of the data file being read in
+      unsigned int numLines(0);
       if ( data.fail() || data.bad() || !data ) {
 	throw( Exception("Couldn't open data file."));
 	return -1;
       }
       // need to do the following to use arrays of pointers (as defined in Struct)
-      for (unsigned int y(0); y < numbands; y++) {
-	obsdata.t = new double[numbins];
-	obsdata.f[y] = new double[numbins];
-	obsdata.err[y] = new double[numbins];
+      obsdata.t = new double[MAX_NUMBINS];
+      for (unsigned int y(0); y < curve.numbands; y++) {
+	obsdata.f[y] = new double[MAX_NUMBINS];
+	obsdata.err[y] = new double[MAX_NUMBINS];
       }
+      obsdata.numbands = curve.numbands;
  
       /****************************************/
       /* READING IN FLUXES FROM THE DATA FILE */
       /****************************************/
+      // Each line is: time, then flux and error bar for band 0, band 1, ...
+      // Bands missing from any line are left out of chi^2.
     	
-      while ( data.getline(line,265) ) {
-	i = numLines;
-	double get_f1;
-	double get_err1;
-	double get_f2;
-	double get_err2;
-			
-	sscanf( line, "%lf %lf %lf %lf %lf", &obsdata.t[i], &get_f1, &get_err1, &get_f2, &get_err2 );
-	obsdata.f[1][i] = get_f1;
-	obsdata.err[1][i] = get_err1;
-	obsdata.f[2][i] = get_f2;
-	obsdata.err[2][i] = get_err2;
-	// PG1808 data has 2 sigma error bars -- divide by 2!
-	//obsdata.err[1][i] *= 2.0; // to account for systematic errors
-	//obsdata.err[2][i] *= 2.0; // to account for systematic errors
+      while ( std::getline(data, line) && numLines < MAX_NUMBINS ) {
+	std::istringstream fields(line);
+	unsigned int p(0);
+	if ( !(fields >> obsdata.t[numLines]) ) continue; // skip blank lines
+	while ( p < curve.numbands && fields >> obsdata.f[p][numLines] >> obsdata.err[p][numLines] )
+	  p++;
+	if ( p < obsdata.numbands ) obsdata.numbands = p;
 	numLines++;
       } 
 
       if ( numLines != numbins ) {
-	//throw (Exception( "Numbins indicated in command-line not equal to numbins in data file."));
 	std::cout << "Warning! Numbins from command-line not equal to numbins in data file." << std::endl;
 	std::cout << "Command-line numbins = " << numbins <<", data file numbins = " << numLines << std::endl;
 	std::cout << "\t! Setting numbins = numbins from data file." << std::endl;
 	numbins = numLines;
 	curve.numbins = numLines;
-	//return -1;
       }
-       
-      // Read in data file to structure "obsdata" (observed data)
-      // f[1][i] flux in low energy band
-      // f[2][i] flux in high energy band
       obsdata.numbins = numbins;
 
       data.close();
-      //ts = obsdata.t[0]; // Don't do this if you want manually setting ts to do anything!!
-      //obsdata.shift = obsdata.t[0];
       obsdata.shift = ts;
-
-      //std::cout << "Finished reading data from " << data_file << ". " << std::endl;
     } // Finished reading in the data file
 		
-    /***************************/
-    /* START SETTING THINGS UP */
-    /***************************/ 
-
-    // Change to computation of rspot!!!!
-
-    // Calculate the Equatorial Radius of the star.
-    //req = calcreq( omega, mass, theta_1, rspot );  // implementation of MLCB11
-
-    //rspot = req;
-
-    /*********************************************************************************/
-    /* Set up model describing the shape of the NS; oblate, funky quark, & spherical */
-    /*********************************************************************************/
-	
-    OblModelBase* model;
-    if ( NS_model == 1 ) { // Oblate Neutron Hybrid Quark Star model
-        // Default model for oblate neutron star
-        model = new PolyOblModelNHQS( rspot, req,
-		   		    PolyOblModelBase::zetaparam(mass,req),
-				    PolyOblModelBase::epsparam(omega, mass, req) );
+    std::vector< double > pixel_mask;
+    if ( mask_file[0] != '\0' ) {
+        if ( nside == 0 )
+            throw( Exception(" A pixel mask (-y) needs the pixel mesh (-H). Exiting.\n") );
+        Healpix( nside ).ReadMask( mask_file, pixel_mask );
+        curve.flags.pixel_mask = &pixel_mask;
     }
-    else if ( NS_model == 2 ) { // Oblate Colour-Flavour Locked Quark Star model
-        // Alternative model for quark stars (not very different)
-        model = new PolyOblModelCFLQS( rspot, req,
-				     PolyOblModelBase::zetaparam(mass,rspot),
-				     PolyOblModelBase::epsparam(omega, mass, rspot) );
-    }
-    else if ( NS_model == 3 ) { // Standard spherical model
-        // Spherical neutron star
-      //req = rspot;
-      rspot = req;
-        model = new SphericalOblModel( rspot );
+
+    std::vector< struct SpotSpec > spots;
+    if ( spots_file[0] != '\0' ) {
+        ReadSpots( spots_file, spots );
+        curve.flags.spots = &spots;
     }
-    else {
-        throw(Exception("\nInvalid NS_model parameter. Exiting.\n"));
+
+    if ( fit_is_set && !datafile_is_set ) {
+        throw( Exception(" Fitting (-F) needs a data file (-I). Exiting.\n") );
         return -1;
     }
 
-    printf("R_Spot = %g; R_eq = %g \n", Units::nounits_to_cgs( rspot, Units::LENGTH ), Units::nounits_to_cgs( req, Units::LENGTH ));
-
-
-
-
-    // defltoa is a structure that "points" to routines in the file "OblDeflectionTOA.cpp"
-    // used to compute deflection angles and times of arrivals 
-    // defltoa is the deflection time of arrival
-    OblDeflectionTOA* defltoa = new OblDeflectionTOA(model, mass, mass_over_r, rspot); 
-    // defltoa is a pointer (of type OblDeclectionTOA) to a group of functions
-
-    // Values we need in some of the formulas.
-    cosgamma = model->cos_gamma(mu_1);   // model is pointing to the function cos_gamma
-    curve.para.cosgamma = cosgamma;
-
-
-    /**********************************************************/
-    /* Compute maximum deflection for purely outgoing photons */
-    /**********************************************************/
-	
-    double  b_mid;  // the value of b, the impact parameter, at 90% of b_max
-    curve.defl.b_max =  defltoa->bmax_outgoing(rspot); // telling us the largest value of b
+    /***************************/
+    /* START SETTING THINGS UP */
+    /***************************/ 
 
-    std::cout << "New M/R = " << mass_over_r << std::endl;
-    std::cout << "New b_max/R = " << 1.0 / sqrt( 1.0 - 2.0 * mass_over_r ) << std::endl;
-    std::cout << "z = " << 1.0 / sqrt( 1.0 - 2.0 * mass_over_r ) - 1.0 << std::endl;
-    std::cout << "b_max/R = " << curve.defl.b_max/rspot << std::endl;
+    if ( tolerance > 0.0 ) { // resolutions for the error asked for
+        struct Accuracy accuracy( TuneAccuracy( tolerance ) );
+        if ( mesh_tolerance == 0.0 && nside == 0 ) {
+            mesh_tolerance = accuracy.mesh_tolerance;
+            curve.flags.mesh_tolerance = mesh_tolerance;
+        }
+        std::cout << "Tolerance " << tolerance << ": quadrature x" << accuracy.quadrature << " (error "
+                  << accuracy.quadrature_error << "), band integrals x" << accuracy.spectra << " (error "
+                  << accuracy.spectra_error << ")" << std::endl;
+    }
 
-    curve.defl.psi_max = defltoa->psi_max_outgoing_u(curve.defl.b_max,rspot,&curve.problem); // telling us the largest value of psi
-    std::cout << "psi_max = " << curve.defl.psi_max << std::endl;
+    curve.para.temperature = spot_temperature;
 
-    /********************************************************************/
-    /* COMPUTE b VS psi LOOKUP TABLE, GOOD FOR THE SPECIFIED M/R AND mu */
-    /********************************************************************/
-	
-    b_mid = curve.defl.b_max * 0.9; 
-    // since we want to split up the table between coarse and fine spacing. 
-    // 0 - 90% is large spacing, 90% - 100% is small spacing. b_mid is this value at 90%.
-    curve.defl.b_psi[0] = 0.0; // definitions of the actual look-up table for b when psi = 0
-    curve.defl.psi_b[0] = 0.0; // definitions of the actual look-up table for psi when b = 0
-    
-    for ( unsigned int i(1); i < NN+1; i++ ) { /* compute table of b vs psi points */
-        curve.defl.b_psi[i] = b_mid * i / (NN * 1.0);
-        curve.defl.psi_b[i] = defltoa->psi_outgoing_u(curve.defl.b_psi[i], rspot, curve.defl.b_max, curve.defl.psi_max, &curve.problem); 
-	// calculates the integral
+    /**************************************************/
+    /* FIT THE PARAMETERS GIVEN WITH -F TO THE DATA   */
+    /**************************************************/
+
+    SessionCache().SetBudget( cache_mb );
+
+    if ( batch_file[0] != '\0' ) {
+        RunBatch( &curve, datafile_is_set ? &obsdata : 0, fit_x, spin, batch_file, out_file, numthreads,
+                  batch_overwrite );
+        std::cout << "Look-up tables: " << SessionCache().Hits() << " taken from the cache, "
+                  << SessionCache().Misses() << " built; " << SessionCache().Size() << " kept ("
+                  << SessionCache().Megabytes() << " MB)" << std::endl;
+        std::clog << LogSummary();
+        if ( profile_file[0] != '\0' ) ProfileReport( profile_file );
+        if ( trace_file[0] != '\0' ) ProfileTraceWrite( trace_file );
+        return 0;
     }
 
-    // For arcane reasons, the table is not evenly spaced.
-    for ( unsigned int i(NN+1); i < 3*NN; i++ ) { /* compute table of b vs psi points */
-        curve.defl.b_psi[i] = b_mid + (curve.defl.b_max - b_mid) / 2.0 * (i - NN) / (NN * 1.0); // spacing for the part where the points are closer together
-        curve.defl.psi_b[i] = defltoa->psi_outgoing_u(curve.defl.b_psi[i], rspot, curve.defl.b_max, curve.defl.psi_max, &curve.problem); // referenced same as above
+    if ( serve_path[0] != '\0' ) {
+        RunServer( &curve, datafile_is_set ? &obsdata : 0, serve_path, numthreads );
+        std::cout << "Look-up tables: " << SessionCache().Hits() << " taken from the cache, "
+                  << SessionCache().Misses() << " built; " << SessionCache().Size() << " kept ("
+                  << SessionCache().Megabytes() << " MB)" << std::endl;
+        std::clog << LogSummary();
+        if ( profile_file[0] != '\0' ) ProfileReport( profile_file );
+        if ( trace_file[0] != '\0' ) ProfileTraceWrite( trace_file );
+        return 0;
     }
-    
-    curve.defl.b_psi[3*NN] = curve.defl.b_max;   // maximums
-    curve.defl.psi_b[3*NN] = curve.defl.psi_max;
-    // Finished computing lookup table
-
-    // Print out bending angles
-    //std::cout << "Now print out the bending angles " << std::endl;
-    //Bend(&curve,defltoa);
 
-    /****************************/
-    /* Initialize time and flux */
-    /****************************/
-	
-    for ( unsigned int i(0); i < numbins; i++ ) {
-        curve.t[i] = i / (1.0 * numbins);// + ts;  // defining the time used in the lightcurves
-        for ( unsigned int p(0); p < numbands; p++ ) {
-            Flux[p][i] = 0.0;                   // initializing flux to 0
-            curve.f[p][i] = 0.0;
+    if ( fit_is_set ) {
+        fit_x[5] = spot_temperature;
+        if ( gradient_check ) {
+            // Automatic derivatives next to central differences, as a check
+            class ThreadPool pool( 1 );
+            class FitContext fit( &curve, &obsdata, &pool, fit_x, fit_vary );
+            const char* letters = "mriepTl";
+            double x[NDIM], grad[NDIM], chi;
+            for ( unsigned int k(0); k < fit.ndim; k++ ) x[k] = fit_x[fit.index[k]];
+            chi = fit.Gradient( x, grad, 0 );
+            std::cout << "chi^2 = " << chi << std::endl;
+            for ( unsigned int k(0); k < fit.ndim; k++ ) {
+                double h( 1.0e-6 * ( fabs(x[k]) > 1.0 ? fabs(x[k]) : 1.0 ) ), x0( x[k] ), up, down;
+                x[k] = x0 + h;
+                up = fit.Evaluate( x, 0 );
+                x[k] = x0 - h;
+                down = fit.Evaluate( x, 0 );
+                x[k] = x0;
+                std::cout << "d chi^2 / d" << letters[fit.index[k]] << " = " << grad[k]
+                          << " (central difference " << (up - down)/(2.0*h) << ")" << std::endl;
+            }
+            std::cout << "At: ";
+        }
+        else if ( nested_live > 0 ) {
+            PriorSet priors;
+            if ( prior_file[0] != '\0' ) priors.Read( prior_file );
+            std::string samples_file( out_file );
+            samples_file += ".nest";
+            double logz, logz_error;
+            logz = NestedSample( &curve, &obsdata, fit_x, fit_vary, &priors,
+                                 nested_live, numthreads, samples_file.c_str(), &logz_error );
+            std::cout << "Evidence: log Z = " << logz << " +/- " << logz_error << std::endl
+                      << "Highest likelihood: ";
+        }
+        else if ( ga_generations > 0 ) {
+            PriorSet priors;
+            if ( prior_file[0] != '\0' ) priors.Read( prior_file );
+            std::string log_file( out_file );
+            log_file += ".ga";
+            GeneticFit( &curve, &obsdata, fit_x, fit_vary, &priors, ga_population, ga_generations,
+                        numthreads, log_file.c_str() );
+            std::cout << "Best fit: ";
+        }
+        else if ( mcmc_steps > 0 ) {
+            PriorSet priors;
+            if ( prior_file[0] != '\0' ) priors.Read( prior_file );
+            std::string chain_file( out_file );
+            chain_file += ".chain";
+            EnsembleSample( &curve, &obsdata, fit_x, fit_step, fit_vary, &priors,
+                            mcmc_walkers, mcmc_steps, numthreads, chain_file.c_str(), mcmc_resume );
+            std::cout << "Highest posterior: ";
+        }
+        else {
+            std::string log_file( out_file );
+            log_file += ".fitlog";
+            bool converged( true );
+            FitCurve( &curve, &obsdata, fit_x, fit_step, fit_vary, ftol, numthreads, log_file.c_str(), &converged );
+            std::cout << ( converged ? "Best fit: " : "Best point, NOT CONVERGED: " );
         }
-    } 
-    
-   
-    /************************************/
-    /* LOCATION OF THE SPOT ON THE STAR */
-    /* FOR ONE OR FIRST HOT SPOT        */
-    /************************************/
-    bool negative_theta(false); // possibly used for a hotspot that is asymmetric over the geometric pole
-
-    /*********************************************/
-    /* SPOT IS TRIVIALLY SIZED ON GEOMETRIC POLE */
-    /*********************************************/
-		
-    if ( theta_1 == 0 && rho == 0 ) {
-      for ( unsigned int i(0); i < numbins; i++ ) {
-	for ( unsigned int p(0); p < numbands; p++ )
-	  curve.f[p][i] = 0.0;
-      }
-      
-      // Add curves, load into Flux array
-      for (unsigned int i(0); i < numbins; i++) {
-	for (unsigned int p(0); p < numbands; p++) {
-	  Flux[p][i] += curve.f[p][i];
-	}
-      } // ending Add curves
-    } // ending trivial spot on pole
-	
-    // This is the STANDARD CASE, and should be the one that is normally executed.
-    
-    //    std::cout << "Standard Case" << std::endl;
-		
-    if ( T_mesh_in ) {
-      std::cout << "WARNING: code can't handle a spot asymmetric over the pole with a temperature mesh." << std::endl;
-      spot_temperature = 2;
-    }
-    curve.para.temperature = spot_temperature;
 
-    int pieces;
-    //Does the spot go over the pole?
-    if ( rho > theta_1){ // yes
-      pieces=2;
+        std::cout << "M = " << fit_x[0] << " Msun, R_eq = " << fit_x[1] 
+                  << " km, i = " << fit_x[2] << ", e = " << fit_x[3] << ", rho = " << fit_x[4]
+                  << ", T = " << fit_x[5] << " keV, ts = " << fit_x[6] << std::endl;
+
+        std::cout << "Look-up tables: " << SessionCache().Hits() << " taken from the cache, "
+                  << SessionCache().Misses() << " built; " << SessionCache().Size() << " kept ("
+                  << SessionCache().Megabytes() << " MB)" << std::endl;
+
+        // Carry on with the best fit, as if it had been given on the command line
+        LoadFitParameters( &curve, fit_x );
+        mass = curve.para.mass;
+        req = curve.para.req;
+        mass_over_r = curve.para.mass_over_r;
+        incl_1 = curve.para.incl;
+        theta_1 = curve.para.theta;
+        rho = curve.para.rho;
+        spot_temperature = curve.para.temperature;
+        ts = curve.para.ts;
     }
-    else //no
-      pieces=1;
 
-    //std::cout << "pieces = " << pieces << std::endl;
+    /*********************************************************************************/
+    /* Set up model describing the shape of the NS and the bending angle look-up     */
+    /* table; oblate, funky quark, & spherical                                       */
+    /*********************************************************************************/
+	
+    std::shared_ptr< DeflTables > tables( SessionCache().Get( &curve ) ); // already built if the fit ended on this star
+    rspot = tables->rspot;
 
-    for (unsigned int p(0);p<pieces;p++){
+    printf("R_Spot = %g; R_eq = %g \n", Units::nounits_to_cgs( rspot, Units::LENGTH ), Units::nounits_to_cgs( req, Units::LENGTH ));
 
-      double deltatheta = 2.0*rho/numtheta;
+    std::cout << "New M/R = " << mass_over_r << std::endl;
+    std::cout << "New b_max/R = " << 1.0 / sqrt( 1.0 - 2.0 * mass_over_r ) << std::endl;
+    std::cout << "z = " << 1.0 / sqrt( 1.0 - 2.0 * mass_over_r ) - 1.0 << std::endl;
+    std::cout << "b_max/R = " << tables->defl.b_max/rspot << std::endl;
+    std::cout << "psi_max = " << tables->defl.psi_max << std::endl;
 
-      if (pieces==2){
-	if (p==0)
-	  deltatheta = (rho-theta_1)/numtheta;
-	else
-	  deltatheta = (2.0*theta_1)/numtheta;
-      }
-      
-      std::cout << "numtheta=" << numtheta
-		<< " theta = " << theta_1
-		<< " delta(theta) = " << deltatheta << std::endl;
-     
-      // Looping through the mesh of the spot
-      for (unsigned int k(0); k < numtheta; k++) { // Loop through the circles
-	//for (unsigned int k(0); k < 6; k++) { // Loop through the circles
-	std::cout << "k=" << k << std::endl;
-
-	double thetak = theta_1 - rho + (k+0.5)*deltatheta; 
-	double phi_edge, phij;
-
-	if (pieces==2){
-	  if (p==0){
-	    thetak = (k+0.5)*deltatheta;
-	    phi_edge = Units::PI;
-	  }
-	  else {
-	    thetak = rho - theta_1 + (k+0.5)*deltatheta;
-	  }
-	}
+    /****************************************/
+    /* COMPUTE THE FLUX FROM THE HOT SPOT(S) */
+    /****************************************/
 
-	std::cout << "k=" << k << " thetak = " << thetak << std::endl;
-	dphi = 2.0*Units::PI/(numbins*1.0);
-
-	if ( (pieces==2 && p==1) || (pieces==1)){
-	  double cos_phi_edge = (cos(rho) - cos(theta_1)*cos(thetak))/(sin(theta_1)*sin(thetak));
-	  /*std::cout << "cos(rho) = " << cos(rho)
-		    << " cos(th_1) = " << cos(theta_1)
-		    << " cos(th_k) = " << cos(thetak)
-		    << " Numerator = " << cos(rho) - cos(theta_1)*cos(thetak)
-		    << " sin(th_1) = " << sin(theta_1)
-		    << " sin(th_k) = " << sin(thetak)
-		    << " Denominator = " << sin(theta_1)*sin(thetak)
-		    << " cos(phi_e) = " << cos_phi_edge << std::endl;
-	  */
-	  if (  cos_phi_edge > 1.0 || cos_phi_edge < -1.0 ) 
-	    cos_phi_edge = 1.0;
-
-	  if ( fabs( sin(theta_1) * sin(thetak) ) > 0.0) { // checking for a divide by 0
-	    phi_edge = acos( cos_phi_edge );   // value of phi (a.k.a. azimuth projected onto equatorial plane) at the edge of the circular spot at some latitude theta_0_2
-	  // dphi = 2.0 * phi_edge / ( numphi * 1.0 );
-	    /*
-	    std::cout << "phi_edge = " << phi_edge 
-		      << "numphi = " << numphi
-		      << " delta(phi)= " << dphi << std::endl;
-	    */
-	  }
-	  else {  // trying to divide by zero
-	    throw( Exception(" Tried to divide by zero in calculation of phi_edge_2. Likely, theta_0_2 = 0. Exiting.") );
-	    return -1;
-	  }
-	}
-      
-	numphi = 2.0*phi_edge/dphi;
-	/*
-	std::cout << "2.0*phi_edge = " << 2.0*phi_edge << " numphi=" << numphi << "  numphi*dphi=" << numphi*dphi << std::endl;
-	std::cout << " Diff = " << 2.0*phi_edge - numphi*dphi << std::endl;
-	*/
-	phishift = 2.0*phi_edge - numphi*dphi;
-
-	curve.para.dS = pow(rspot,2) * sin(thetak) * deltatheta * dphi;
-	curve.para.theta = thetak;
-
-	if (numtheta==1){
-	  numphi=1;
-	  phi_edge=0.0;
-	  dphi=0.0;
-	  phishift = 0.0;
-	  curve.para.dS = 2.0*Units::PI * pow(rspot,2) * (1.0 - cos(rho));
-	}
-       
-
-      for ( unsigned int j(0); j < numphi; j++ ) {   // looping through the phi divisions
-	//  for ( unsigned int j(numphi-1); j < numphi; j++ ) {   // looping through the phi divisions
-		  
-	phij = -phi_edge + (j+0.5)*dphi;
-	curve.para.phi_0 = phij;
-	/*
-	std::cout << "k=" << k 
-		  << " theta-k = " << thetak
-		  << " j=" << j 
-		  << " phi-j = " << phij
-		  << " dS = " << curve.para.dS << std::endl;
-	*/
-	if ( NS_model == 1 || NS_model == 2 )
-	  curve.para.dS /= curve.para.cosgamma;
-
-
-	if ( j==0){ // Only do computation if its the first phi bin - otherwise just shift
-	  curve = ComputeAngles(&curve, defltoa); 
-	  curve = ComputeCurve(&curve);
-	}
-	
-	if ( curve.para.temperature == 0.0 ) { 
-	  for ( unsigned int i(0); i < numbins; i++ ) {
-	    for ( unsigned int p(0); p < numbands; p++ )
-	      curve.f[p][i] = 0.0;
-	  }
-	}
-	// Add curves, load into Flux array
-	for ( unsigned int i(0); i < numbins; i++ ) {
-	  int q(i+j);
-	  if (q>=numbins) q+=-numbins;
-	  for ( unsigned int p(0); p < numbands; p++ ) {
-	    Flux[p][i] += curve.f[p][q];
-	  }
-	} // ending Add curves
-      } // end for-j-loop
-      // Add in the missing bit.
-
-      
-      if (phishift != 0.0){ // Add light from last bin, which requires shifting
-      	for ( unsigned int i(0); i < numbins; i++ ) {
-	  int q(i+numphi-1);
-	  if (q>=numbins) q+=-numbins;
-	  for ( unsigned int p(0); p < numbands; p++ ) {
-	    Temp[p][i] = curve.f[p][q];
-	  }
-	}
-	for (unsigned int p(0); p < numbands; p++ )
-	  for ( unsigned int i(0); i < numbins; i++ ) 
-	    curve.f[p][i] = Temp[p][i];	  
-   	     
-	curve = ShiftCurve(&curve,phishift);
-       
-      for( unsigned int p(0); p < numbands; p++ )
-	for ( unsigned int i(0); i < numbins; i++ ) 
-	  Flux[p][i] += curve.f[p][i]*phishift/dphi      ;
-      }
-      
+    for ( unsigned int i(0); i < numbins; i++ )
+        for ( unsigned int p(0); p < numbands; p++ )
+            curve.f[p][i] = 0.0;
 
-      } // closing for loop through theta divisions
-    } // end loop through pieces		 
-	
-     // End Standard Case
-
-    /********************************************************************************/
-    /* SECOND HOT SPOT -- Can handle going over geometric pole, but not well-tested */
-    /********************************************************************************/
-
-    if ( two_spots ) {
-    	incl_2 = Units::PI - incl_1; // keeping theta the same, but changing inclination
-    	curve.para.incl = incl_2;
-    	curve.para.theta = theta_2;  // keeping theta the same, but changing inclination
-    	cosgamma = model->cos_gamma(mu_2);
-    	curve.para.cosgamma = cosgamma;
-    		
-    	if ( rho == 0.0 ) { // Default is an infinitesmal spot, defined to be 0 degrees in radius.
-     		phi_0_2 = Units::PI;
-     		theta_0_2 = theta_2;
-    		curve.para.dS = trueSurfArea = 0.0; // dS is the area of the particular bin of spot we're looking at right now
-    	}  
-    	else {   // for a nontrivially-sized spot
-    		dtheta = 2.0 * rho / (numtheta * 1.0);    // center of spot at theta, rho is angular radius of spot; starts at theta_2-rho to theta_2+rho
-    		theta_edge_2 = theta_2 - rho;
-    		trueSurfArea = 2 * Units::PI * pow(rspot,2) * (1 - cos(rho));
-    	}
-    		
-    	/****************************************************************/
-	/* SECOND HOT SPOT -- SPOT IS TRIVIALLY SIZED ON GEOMETRIC POLE */
-	/****************************************************************/
-		
-	if ( theta_2 == 0 && rho == 0 ) {
-	  for ( unsigned int i(0); i < numbins; i++ ) {
-	    for ( unsigned int p(0); p < numbands; p++ )
-	      curve.f[p][i] = 0.0;
-	  }
-	    
-	  // Add curves, load into Flux array
-	  for (unsigned int i(0); i < numbins; i++) {
-	    for (unsigned int p(0); p < numbands; p++) {
-	      Flux[p][i] += curve.f[p][i];
-	    }
-	  } // ending Add curves
-	      	
-	} // ending trivial spot on pole
-    
-    	/************************************************************/
-	/* SECOND HOT SPOT -- SPOT IS SYMMETRIC OVER GEOMETRIC POLE */
-	/************************************************************/
-		
-	else if ( theta_2 == 0 && rho != 0 ) {
-	  // Looping through the mesh of the spot
-	  for ( unsigned int k(0); k < numtheta; k++ ) {
-	    theta_0_2 = theta_2 - rho + k * dtheta + 0.5 * dtheta;   // note: theta_0_2 changes depending on how we've cut up the spot
-	    curve.para.theta = theta_0_2;
-	    // don't need a phi_edge the way i'm doing the phi_0_2 calculation
-	    dphi = Units::PI / numphi;
-	    for ( unsigned int j(0); j < numphi; j++ ) {
-	      phi_0_2 = -Units::PI/2 + dphi * j + 0.5 * dphi; // don't need to change phase because its second hot spot, because it's symmetric over the spin axis
-	      if ( !T_mesh_in ) {
-		T_mesh[k][j] = spot_temperature;
-	      }
-					
-	      curve.para.dS = pow(rspot,2) * sin(fabs(theta_0_2)) * dtheta * dphi;
-	      // Need to multiply by R^2 here because of my if numtheta=1 statement, 
-	      // which sets dS = true surface area
-					
-	      if ( numtheta == 1 ) 
-		curve.para.dS = trueSurfArea;
-	      if ( NS_model == 1 || NS_model == 2)
-		curve.para.dS /= curve.para.cosgamma;
-	      curve.para.temperature = T_mesh[k][j];
-	      curve.para.phi_0 = phi_0_2;
-	      curve = ComputeAngles(&curve, defltoa);  // Computing the parameters it needs to compute the light curve; defltoa has the routines for what we want to do
-	      curve = ComputeCurve(&curve);
-	      
-	      if (curve.para.temperature == 0.0) { 
-		for (unsigned int i(0); i < numbins; i++) {
-		  for (unsigned int p(0); p < numbands; p++)
-		    curve.f[p][i] = 0.0;  // if temperature is 0, then there is no flux!
-		}
-	      }
-	      // Add curves, load into Flux array
-	      for (unsigned int i(0); i < numbins; i++) {
-		for (unsigned int p(0); p < numbands; p++) {
-		  Flux[p][i] += curve.f[p][i];
-		}
-	      } // ending Add curves
-				
-	    }
-	  }
-	} // ending symmetric spot over pole
-    
-    	/****************************************************************/
-	/* SECOND HOT SPOT -- SPOT IS ASYMMETRIC OVER GEOMETRIC POLE */
-	/****************************************************************/
-		
-	//THIS NEEDS TO BE FIXED IN THE SAME WAY THAT THE OTHER ASYMMETRIC ONE WAS!
-		
-	else if ( (theta_2 - rho) <= 0 ) {
-	  // Looping through the mesh of the spot
-	  for (unsigned int k(0); k < numtheta; k++) { // looping through the theta divisions
-	    theta_0_2 = theta_2 - rho + 0.5 * dtheta + k * dtheta;   // note: theta_0_2 changes depending on how we've cut up the spot
-	    if (theta_0_2 == 0.0) 
-	      theta_0_2 = 0.0 + DBL_EPSILON;
-	    curve.para.theta = theta_0_2;   // passing this value into curve theta, so that we can use it in another routine; somewhat confusing names
-        
-	    double cos_phi_edge = (cos(rho) - cos(theta_2)*cos(theta_0_2))/(sin(theta_2)*sin(theta_0_2));
-	    if (  cos_phi_edge > 1.0 || cos_phi_edge < -1.0 ) 
-	      cos_phi_edge = 1.0;
-        
-	    if ( fabs( sin(theta_2) * sin(theta_0_2) ) > 0.0) { // checking for a divide by 0
-	      phi_edge_2 = acos( cos_phi_edge );   // value of phi (a.k.a. azimuth projected onto equatorial plane) at the edge of the circular spot at some latitude theta_0_2
-	      dphi = 2.0 * phi_edge_2 / ( numphi * 1.0 );
-	    }
-	    else {  // trying to divide by zero
-	      throw( Exception(" Tried to divide by zero in calculation of phi_edge_2. Likely, theta_0_2 = 0. Exiting.") );
-	      return -1;
-	    }
-
-	    for ( unsigned int j(0); j < numphi; j++ ) {   // looping through the phi divisions
-	      phi_0_2 = Units::PI -phi_edge_2 + 0.5 * dphi + j * dphi;   // phi_0_2 is at the center of the piece of the spot that we're looking at; defined as distance from the y-axis as projected onto the equator
-	      if ( !T_mesh_in ) {
-		T_mesh[k][j] = spot_temperature;
-	      }
-			 	
-	      curve.para.dS = pow(rspot,2) * sin(fabs(theta_0_2)) * dtheta * dphi;
-	      // Need to multiply by R^2 here because of my if numtheta=1 statement, 
-	      // which sets dS = true surface area
-            	
-	      if( numtheta == 1 ) 
-		curve.para.dS = trueSurfArea;
-	      if ( NS_model == 1 || NS_model == 2 )
-		curve.para.dS /= curve.para.cosgamma;
-	      curve.para.temperature = T_mesh[k][j];
-	      curve.para.phi_0 = phi_0_2;
-	      
-	      curve = ComputeAngles(&curve, defltoa);  // Computing the parameters it needs to compute the light curve; defltoa has the routines for what we want to do
-	      curve = ComputeCurve(&curve);
-	        	
-	      if ( curve.para.temperature == 0.0 ) { 
-		for ( unsigned int i(0); i < numbins; i++ ) {
-		  for ( unsigned int p(0); p < numbands; p++ )
-		    curve.f[p][i] = 0.0;
-		}
-	      }
-	      // Add curves, load into Flux array
-	      for ( unsigned int i(0); i < numbins; i++ ) {
-		for ( unsigned int p(0); p < numbands; p++ ) {
-		  Flux[p][i] += curve.f[p][i];
-		}
-	      } // ending Add curves
-       	
-	    } // closing for loop through phi divisions
-	  } // closing for loop through theta divisions
-	} // ending antisymmetric spot over pole
-
-	/***********************************************************/
-	/* SECOND HOT SPOT -- SPOT DOES NOT GO OVER GEOMETRIC POLE */
-	/***********************************************************/
-    
-	else {
-	  // Looping through the mesh of the second spot
-	  printf("Working on the 2nd spot!!!\n");
-
-	  for ( unsigned int k(0); k < numtheta; k++ ) { // looping through the theta divisions
-	    theta_0_2 = theta_2 - rho + 0.5 * dtheta + k * dtheta;   // note: theta_0_2 changes depending on how we've cut up the spot
-	    curve.para.theta = theta_0_2;   // passing this value into curve theta, so that we can use it in another routine; somewhat confusing names
-	    //std::cout //<< "\n " k = " << k << ", theta_0_2 = " << theta_0_2 * 180.0 / Units::PI << std::endl;
-       
-	    double cos_phi_edge = (cos(rho) - cos(theta_2)*cos(theta_0_2))/(sin(theta_2)*sin(theta_0_2));
-	    if ( cos_phi_edge > 1.0 || cos_phi_edge < -1.0 ) 
-	      cos_phi_edge = 1.0;
-       
-	    if ( fabs( sin(theta_2) * sin(theta_0_2) ) > 0.0 ) { // checking for a divide by 0
-	      phi_edge_2 = acos ( cos_phi_edge );   // value of phi (a.k.a. azimuth projected onto equatorial plane) at the edge of the circular spot at some latitude theta_0_2
-	      dphi = 2.0 * phi_edge_2 / ( numphi * 1.0 ); // want to keep the same dphi as before
-	    }
-	    else {  // trying to divide by zero
-	      throw( Exception(" Tried to divide by zero in calculation of phi_edge_2. \n Check values of sin(theta_2) and sin(theta_0_2). Exiting.") );
-	      return -1;
-	    }     
-        
-	    for ( unsigned int j(0); j < numphi; j++ ) {   // looping through the phi divisions
-	      phi_0_2 = Units::PI - phi_edge_2 + 0.5 * dphi + j * dphi;
-	      if ( !T_mesh_in ) {
-		T_mesh[k][j] = spot_temperature;
-	      }
-           
-	      curve.para.temperature = T_mesh[k][j];
-	      curve.para.phi_0 = phi_0_2;
-	      curve.para.dS = pow(rspot,2) * sin(fabs(theta_0_2)) * dtheta * dphi; // assigning partial dS here
-	      if( numtheta == 1 ) 
-		curve.para.dS = trueSurfArea;
-	      if ( NS_model == 1 || NS_model == 2 )
-		curve.para.dS /= curve.para.cosgamma;
-           			
-	      curve = ComputeAngles(&curve, defltoa);  // Computing the parameters it needs to compute the light curve; defltoa has the routines for what we want to do
-	      curve = ComputeCurve(&curve);            // Compute Light Curve, for each separate mesh bit
-        	
-	      if ( curve.para.temperature == 0.0 ) { 
-		for ( unsigned int i(0); i < numbins; i++ ) {
-		  for ( unsigned int p(0); p < numbands; p++ )
-		    curve.f[p][i] += 0.0;
-		}
-	      }
-	      // Add curves, load into Flux array
-	      for ( unsigned int i(0); i < numbins; i++ ) {
-		for ( unsigned int p(0); p < numbands; p++ ) {
-
-		  printf("i=%d Flux1=%g Flux2=%g ",i, Flux[p][i], curve.f[p][i]);
-		  Flux[p][i] += curve.f[p][i];
-		  printf(" Flux(1+2)=%g \n",Flux[p][i]);
-		}
-	      } // closing Add curves
-		      
-	    } // closing for loop through phi divisions
-	  } // closing for loop through theta divisions
-	} // closing spot doesn't go over geometric pole
-    		
-    } // closing if two spots
-	
+    ComputeFlux( &curve, tables.get() );
             
     // You need to be so super sure that ignore_time_delays is set equal to false.
     // It took almost a month to figure out that that was the reason it was messing up.
      
-    
     /*******************************/
     /* NORMALIZING THE FLUXES TO 1 */
     /*******************************/
-	    
-    // Normalizing the flux to 1 in low energy band. 
-    if ( normalize_flux ) {
-      normcurve = Normalize1( Flux, numbins );
-
-      // Add background to normalized flux
-      for ( unsigned int i(0); i < numbins; i++ ) {
-	for ( unsigned int p(0); p < numbands; p++ ) {
-	  Flux[p][i] = normcurve.f[p][i] + background[p];
-	}
-      } 
-      
-      // Renormalize to 1.0
-      normcurve = Normalize1( Flux, numbins );
-
-      // fun little way around declaring the Chi.cpp method Normalize as returning a matrix! so that we can still print out Flux
-      for ( unsigned int i(0); i < numbins; i++ ) {
-	for ( unsigned int p(0); p < numbands; p++ ) {
-	  curve.f[p][i] = normcurve.f[p][i];
-	}
-      }  
-    } // Finished Normalizing
-    else{ // Curves are not normalized
-      for ( unsigned int i(0); i < numbins; i++ ) {
-	for ( unsigned int p(0); p < numbands; p++ ) {
-	  curve.f[p][i] = Flux[p][i];
-	}
-      }  
-    }
+    
+    NormalizeFlux( &curve );
      
     /************************************************************/
     /* If data file is set, calculate chi^2 fit with simulation */
@@ -1143,6 +908,49 @@ int main ( int argc, char** argv ) try {  // argc, number of cmd line args;
 	      << ", e = " << theta_1 * 180.0 / Units::PI 
 	      << ", X^2 = " << chisquared 
 	      << std::endl;    
+    if ( nside > 0 )
+        std::cout << "Pixel mesh: nside = " << nside << ", " << curve.elements << " pixels on "
+                  << curve.rings << " rings" << std::endl;
+    if ( mesh_tolerance > 0.0 )
+        std::cout << "Adaptive mesh: " << curve.rings << " rings, " << curve.elements
+                  << " elements, estimated error " << curve.mesh_error << " of the peak flux (asked for "
+                  << mesh_tolerance << ")" << std::endl;
+
+    /****************************************************************/
+    /* ACCURACY OF SINGLE PRECISION, AGAINST THE DOUBLE COMPUTATION */
+    /****************************************************************/
+
+    if ( single_precision ) {
+        std::unique_ptr< LightCurve > check( new LightCurve( curve ) );
+        check->flags.single_precision = false;
+        ComputeFlux( check.get(), tables.get() );
+        NormalizeFlux( check.get() );
+
+        std::cout << "Single precision against double:" << std::endl;
+        for ( unsigned int p(0); p < numbands; p++ ) {
+            double peak(0.0), largest(0.0), squares(0.0);
+            unsigned int counted(0);
+            for ( unsigned int i(0); i < numbins; i++ ) {
+                if ( !std::isfinite( curve.f[p][i] ) || !std::isfinite( check->f[p][i] ) ) continue;
+                double diff( fabs( curve.f[p][i] - check->f[p][i] ) );
+                counted++;
+                if ( fabs( check->f[p][i] ) > peak ) peak = fabs( check->f[p][i] );
+                if ( diff > largest ) largest = diff;
+                squares += diff * diff;
+            }
+            if ( peak == 0.0 ) peak = 1.0;
+            if ( counted == 0 ) counted = 1;
+            std::cout << "  band " << p << ": largest difference = " << largest/peak
+                      << ", rms difference = " << sqrt( squares/counted )/peak 
+                      << " of the peak flux";
+            if ( counted < numbins )
+                std::cout << " (" << numbins - counted << " bins not finite left out)";
+            std::cout << std::endl;
+        }
+        if ( datafile_is_set )
+            std::cout << "  X^2 = " << chisquared << " (double: " << ChiSquare( &obsdata, check.get() )
+                      << ")" << std::endl;
+    }
 
 
     /*******************************/
@@ -1170,15 +978,10 @@ int main ( int argc, char** argv ) try {  // argc, number of cmd line args;
     /* WRITING THE SIMULATION TO AN OUTPUT FILE */
     /********************************************/ 
     	
-    out.open(out_file, std::ios_base::trunc);
-    if ( out.bad() || out.fail() ) {
-        std::cerr << "Couldn't open output file. Exiting." << std::endl;
-        return -1;
-    }
-
     if ( rho == 0.0 ) rho = Units::PI/180.0;
 
-    out << "# Photon Flux for hotspot on a NS. \n"
+    std::ostringstream header; // what the light curve is: the top of the text output, or in the binary header
+    header << "# Photon Flux for hotspot on a NS. \n"
         << "# R_sp = " << Units::nounits_to_cgs(rspot, Units::LENGTH )*1.0e-5 << " km; "
         << "# R_eq = " << Units::nounits_to_cgs(req, Units::LENGTH )*1.0e-5 << " km; "
         << "# M = " << Units::nounits_to_cgs(mass, Units::MASS)/Units::MSUN << " Msun; "
@@ -1204,24 +1007,53 @@ int main ( int argc, char** argv ) try {  // argc, number of cmd line args;
         << std::endl;
         
     if (datafile_is_set)
-    	out << "# Data file " << data_file << ", chisquared = " << chisquared << std::endl;
+    	header << "# Data file " << data_file << ", chisquared = " << chisquared << std::endl;
 
-    if ( T_mesh_in )
-    	out << "# Temperature mesh input: "<< T_mesh_file << std::endl;
+    if ( pixel_map )
+    	header << "# Temperature map input: " << map_file << std::endl;
     else
-    	out << "# Spot temperature, (star's frame) kT = " << spot_temperature << " keV " << std::endl;
-	if ( NS_model == 1)
-    	out << "# Oblate NS model " << std::endl;
+    	header << "# Spot temperature, (star's frame) kT = " << spot_temperature << " keV " << std::endl;
+    if ( !spots.empty() )
+    	header << "# " << spots.size() << " more hot spots from " << spots_file << std::endl;
+    if ( nside > 0 )
+    	header << "# Equal-area pixel mesh: nside = " << nside << ", " << curve.elements << " pixels on "
+    	    << curve.rings << " rings" << ( mask_file[0] != '\0' ? ", mask " : "" ) << mask_file << std::endl;
+    if ( mesh_tolerance > 0.0 )
+    	header << "# Adaptive spot mesh: " << curve.rings << " rings, " << curve.elements << " elements, estimated error "
+    	    << curve.mesh_error << " of the peak flux (tolerance " << mesh_tolerance << ") " << std::endl;
+    if ( single_precision )
+    	header << "# Spectra and rebinning in single precision " << std::endl;
+    if ( tolerance > 0.0 )
+    	header << "# Tolerance " << tolerance << " of the peak flux " << std::endl;
+    if ( NS_model == 1)
+    	header << "# Oblate NS model " << std::endl;
     else if (NS_model == 3)
-    	out << "# Spherical NS model " << std::endl;
+    	header << "# Spherical NS model " << std::endl;
     if ( beaming_model == 0 )
-        out << "# Isotropic Emission " << std::endl;
+        header << "# Isotropic Emission " << std::endl;
     else
-        out << "# Limb Darkening for Gray Atmosphere (Hopf Function) " << std::endl;
+        header << "# Limb Darkening for Gray Atmosphere (Hopf Function) " << std::endl;
     if ( normalize_flux )
-    	out << "# Flux normalized to 1 " << std::endl;
+    	header << "# Flux normalized to 1 " << std::endl;
     else
-    	out << "# Flux not normalized " << std::endl;
+    	header << "# Flux not normalized " << std::endl;
+
+    ProfileTimer output_timer( STAGE_OUTPUT );
+    if ( binary_bits > 0 ) {
+        WriteBinaryCurve( out_file, &curve, header.str(), binary_bits );
+        output_timer.Stop();
+        std::clog << LogSummary();
+        if ( profile_file[0] != '\0' ) ProfileReport( profile_file );
+        if ( trace_file[0] != '\0' ) ProfileTraceWrite( trace_file );
+        return 0;
+    }
+
+    out.open(out_file, std::ios_base::trunc);
+    if ( out.bad() || out.fail() ) {
+        std::cerr << "Couldn't open output file. Exiting." << std::endl;
+        return -1;
+    }
+    out << header.str();
     
     /***************************************************/
     /* WRITING COLUMN HEADINGS AND DATA TO OUTPUT FILE */
@@ -1240,7 +1072,7 @@ int main ( int argc, char** argv ) try {  // argc, number of cmd line args;
             out << curve.f[p][i] << "\t" ;
         }
 	out << i;
-        out << std::endl;
+        out << "\n";
       }
     }
 
@@ -1253,7 +1085,7 @@ int main ( int argc, char** argv ) try {  // argc, number of cmd line args;
 	for ( unsigned int i(0); i < numbins; i++ ) {
 	  out << curve.t[i]<< "\t" ;
 	  out << curve.para.E0 + p*curve.para.DeltaE << "\t";
-	  out << curve.f[p][i] << "\t" << std::endl;
+	  out << curve.f[p][i] << "\t\n";
 	  //out << i;
 	  //out << std::endl;
 	}
@@ -1271,9 +1103,11 @@ int main ( int argc, char** argv ) try {  // argc, number of cmd line args;
 
 
     out.close();
+    output_timer.Stop();
+    std::clog << LogSummary();
+    if ( profile_file[0] != '\0' ) ProfileReport( profile_file );
+    if ( trace_file[0] != '\0' ) ProfileTraceWrite( trace_file );
     
-    delete defltoa;
-    delete model;
     return 0;
 } 
 
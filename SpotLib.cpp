@@ -0,0 +1,229 @@
+/***************************************************************************************/
+/*                                      SpotLib.cpp
+
+    The C interface of libspot.so: engines that keep the settings, the threads and
+    their look-up tables between light curves. See SpotLib.h.
+*/
+/***************************************************************************************/
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <exception>
+#include <algorithm>
+#include <limits>
+#include <cmath>
+#include "SpotLib.h"
+#include "Engine.h"
+#include "ThreadPool.h"
+#include "Chi.h"
+#include "Units.h"
+#include "Exception.h"
+#include "Struct.h"
+
+struct spot_engine {
+    std::unique_ptr< LightCurve > curve;                    // the settings; the parameters are put in per call
+    std::unique_ptr< ThreadPool > pool;
+    std::vector< std::unique_ptr< LightCurve > > scratch;   // one light curve per thread
+    std::vector< std::shared_ptr< DeflTables > > tables;    // the look-up tables each thread is using
+    std::string error;
+};
+
+static thread_local std::string create_error; // why spot_create failed, for spot_last_error( 0 )
+
+void spot_default_options( spot_options* options ) {
+    options->version = SPOT_API_VERSION;
+    options->numbins = MAX_NUMBINS;
+    options->numtheta = 1;
+    options->ns_model = 1;
+    options->spectral_model = 0;
+    options->numbands = 1;
+    options->beaming_model = 0;
+    options->two_spots = 0;
+    options->normalize = 0;
+    options->threads = 0;
+    options->spin = 0.0;
+    options->distance = 3.0857e22;
+    options->mesh_tolerance = 0.0;
+    options->line_energy = 0.0;
+    options->line_width = 0.0;
+    options->line_low = 0.0;
+    options->line_high = 0.0;
+}
+
+spot_engine* spot_create( const spot_options* options ) try {
+
+    create_error.clear();
+    if ( !options || options->version != SPOT_API_VERSION )
+        throw( Exception("spot_create: options from spot_default_options of this version are needed") );
+    if ( options->numbins < 1 || options->numbins > MAX_NUMBINS )
+        throw( Exception("spot_create: numbins must be between 1 and MAX_NUMBINS") );
+    if ( options->numtheta < 1 )
+        throw( Exception("spot_create: numtheta must be at least 1") );
+    if ( options->ns_model < 1 || options->ns_model > 3 )
+        throw( Exception("spot_create: ns_model is 1, 2 or 3") );
+    if ( options->spectral_model > 1 || options->numbands < 1 || options->numbands > NCURVES
+         || ( options->spectral_model == 0 && options->numbands != 1 ) )
+        throw( Exception("spot_create: spectral_model 0 has 1 band, spectral_model 1 up to NCURVES") );
+    if ( options->mesh_tolerance < 0.0 )
+        throw( Exception("spot_create: mesh_tolerance must not be negative") );
+
+    std::unique_ptr< spot_engine > engine( new spot_engine );
+    engine->curve.reset( new LightCurve() );
+    class LightCurve& curve( *engine->curve );
+
+    curve.para.omega = Units::cgs_to_nounits( 2.0*Units::PI*options->spin, Units::INVTIME );
+    curve.para.distance = Units::cgs_to_nounits( options->distance*100, Units::LENGTH );
+    curve.para.aniso = 0.586;
+    curve.para.Gamma1 = curve.para.Gamma2 = curve.para.Gamma3 = 2.0;
+    curve.para.E_band_lower_1 = 2.0;
+    curve.para.E_band_upper_1 = 3.0;
+    curve.para.E_band_lower_2 = 5.0;
+    curve.para.E_band_upper_2 = 6.0;
+    curve.numbins = options->numbins;
+    curve.numtheta = options->numtheta;
+    curve.numbands = options->numbands;
+    curve.flags.spectral_model = options->spectral_model;
+    curve.flags.beaming_model = options->beaming_model;
+    curve.flags.NS_model = options->ns_model;
+    curve.flags.two_spots = options->two_spots != 0;
+    curve.flags.normalize_flux = options->normalize != 0;
+    curve.flags.mesh_tolerance = options->mesh_tolerance;
+    if ( options->spectral_model == 0 ) // monochromatic at 1 keV, as spot does
+        curve.para.E0 = 1.0;
+    else {
+        curve.para.E0 = options->line_energy;
+        curve.para.E1 = options->line_low;
+        curve.para.E2 = options->line_high;
+        curve.para.DeltaE = options->line_width;
+    }
+
+    engine->pool.reset( new ThreadPool( options->threads ) );
+    for ( unsigned int t(0); t < engine->pool->size(); t++ ) {
+        engine->scratch.push_back( std::unique_ptr< LightCurve >( new LightCurve() ) );
+        engine->tables.push_back( std::shared_ptr< DeflTables >() );
+    }
+    return engine.release();
+}
+catch ( std::exception& e ) {
+    create_error = e.what();
+    return 0;
+}
+
+void spot_destroy( spot_engine* engine ) {
+    delete engine;
+}
+
+unsigned int spot_numbins( const spot_engine* engine ) {
+    return engine->curve->numbins;
+}
+
+unsigned int spot_numbands( const spot_engine* engine ) {
+    return engine->curve->numbands;
+}
+
+const char* spot_last_error( const spot_engine* engine ) {
+    return engine ? engine->error.c_str() : create_error.c_str();
+}
+
+/**************************************************************************************/
+/* Evaluate:                                                                          */
+/*           the light curve at x on thread's workspace, as FitContext::Evaluate;     */
+/*           into flux if given, and chi^2 against obsdata into *chi if given;        */
+/*           unphysical parameters leave the flux 0                                   */
+/**************************************************************************************/
+static int Evaluate( spot_engine* engine, unsigned int thread, const double x[SPOT_NPARAMS],
+                     double* flux, class DataStruct* obsdata, double* chi ) {
+
+    class LightCurve* c( engine->scratch[thread].get() );
+    unsigned int numbins( engine->curve->numbins ), numbands( engine->curve->numbands );
+
+    *c = *engine->curve;
+    bool physical( LoadFitParameters( c, x ) );
+    if ( physical ) {
+        if ( !engine->tables[thread] || !engine->tables[thread]->Matches( c ) )
+            engine->tables[thread] = SessionCache().Get( c );
+        physical = !engine->tables[thread]->problem;
+    }
+    if ( !physical ) {
+        if ( flux )
+            for ( unsigned int k(0); k < numbands * numbins; k++ ) flux[k] = 0.0;
+        return SPOT_UNPHYSICAL;
+    }
+
+    ComputeFlux( c, engine->tables[thread].get() );
+    NormalizeFlux( c );
+    if ( flux )
+        for ( unsigned int p(0); p < numbands; p++ )
+            for ( unsigned int i(0); i < numbins; i++ )
+                flux[p*numbins + i] = c->f[p][i];
+    if ( chi )
+        *chi = ChiSquare( obsdata, c );
+    return SPOT_OK;
+}
+
+int spot_flux( spot_engine* engine, const double x[SPOT_NPARAMS], double* flux ) try {
+    engine->error.clear();
+    return Evaluate( engine, 0, x, flux, 0, 0 );
+}
+catch ( std::exception& e ) {
+    engine->error = e.what();
+    return SPOT_ERROR;
+}
+
+int spot_flux_batch( spot_engine* engine, size_t rows, const double* x, double* flux,
+                     int* status ) try {
+    engine->error.clear();
+    size_t size( static_cast< size_t >( engine->curve->numbands ) * engine->curve->numbins );
+    std::vector< std::string > errors( engine->pool->size() );
+    // ThreadPool::Run counts in unsigned int, so more rows than that go in pieces
+    const size_t piece( std::numeric_limits< unsigned int >::max() );
+    for ( size_t first(0); first < rows; first += piece )
+        engine->pool->Run( std::min( piece, rows - first ), [&]( unsigned int k, unsigned int thread ) {
+            const size_t r( first + k );
+            try {
+                status[r] = Evaluate( engine, thread, x + r * SPOT_NPARAMS, flux + r * size, 0, 0 );
+            }
+            catch ( std::exception& e ) {
+                status[r] = SPOT_ERROR;
+                errors[thread] = e.what();
+            }
+        } );
+    for ( unsigned int t(0); t < errors.size(); t++ )
+        if ( !errors[t].empty() ) {
+            engine->error = errors[t];
+            return SPOT_ERROR;
+        }
+    return SPOT_OK;
+}
+catch ( std::exception& e ) {
+    engine->error = e.what();
+    return SPOT_ERROR;
+}
+
+int spot_chi_square( spot_engine* engine, const double x[SPOT_NPARAMS], const double* data,
+                     const double* err, unsigned int numbands, double* chi ) try {
+    engine->error.clear();
+    unsigned int numbins( engine->curve->numbins );
+    if ( numbands < 1 || numbands > engine->curve->numbands )
+        throw( Exception("spot_chi_square: numbands must be between 1 and the engine's") );
+
+    class DataStruct obsdata; // points into the caller's arrays
+    obsdata.t = engine->curve->t;
+    for ( unsigned int p(0); p < numbands; p++ ) {
+        obsdata.f[p] = const_cast< double* >( data + p*numbins );
+        obsdata.err[p] = const_cast< double* >( err + p*numbins );
+    }
+    obsdata.numbins = numbins;
+    obsdata.numbands = numbands;
+    obsdata.shift = x[6];
+    obsdata.chisquare = 0.0;
+
+    int status( Evaluate( engine, 0, x, 0, &obsdata, chi ) );
+    if ( status == SPOT_UNPHYSICAL ) *chi = HUGE_VAL;
+    return status;
+}
+catch ( std::exception& e ) {
+    engine->error = e.what();
+    return SPOT_ERROR;
+}
@@ -0,0 +1,113 @@
+/***************************************************************************************/
+/*                                       SpotLib.h
+
+    The C interface of libspot.so (make libspot.so), for calling spot's light curves
+    from Python (ctypes, cffi), Julia, MATLAB or C without running spot, in place of
+    spotMex.cpp. Plain C, so it can be called from anything that calls C; the structs
+    only grow at the end, and version says which fields the caller knows.
+
+    An engine holds the settings of spot's command line that stay the same from one
+    light curve to the next (bins, mesh, shape and spectral models, spin, distance), a
+    pool of threads, and for each thread a light curve and the look-up tables it is
+    using; the tables of all the engines are shared (see DeflCache in Engine.h). A
+    light curve is asked for by the SPOT_NPARAMS parameters of a fit (spot -F):
+
+        M [Msun], R_eq [km], incl [deg], theta [deg], rho [rad], T [keV], ts [phase]
+
+    The arrays are the caller's, contiguous, band after band: flux[p*numbins + i] for
+    band p and phase bin i, and for a batch, row after row of that. Nothing is kept of
+    them after a call returns.
+
+    The functions return SPOT_OK, SPOT_UNPHYSICAL for parameters outside the physical
+    range (the flux is left 0), or SPOT_ERROR, with spot_last_error saying why. An
+    engine is to be used by one caller thread at a time; it runs batches on its own
+    threads.
+
+        spot_options options;
+        spot_default_options( &options );
+        options.numbins = 64;  options.spin = 300.0;
+        spot_engine* engine = spot_create( &options );
+        double x[SPOT_NPARAMS] = { 1.4, 12.0, 50.0, 65.0, 0.3, 0.35, 0.0 }, flux[64];
+        if ( spot_flux( engine, x, flux ) != SPOT_OK ) puts( spot_last_error( engine ) );
+        spot_destroy( engine );
+*/
+/***************************************************************************************/
+
+#ifndef SPOTLIB_H
+#define SPOTLIB_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#if defined(__GNUC__)
+#define SPOT_API __attribute__((visibility("default")))
+#else
+#define SPOT_API
+#endif
+
+#define SPOT_API_VERSION 1
+#define SPOT_NPARAMS 7
+
+#define SPOT_OK 0
+#define SPOT_UNPHYSICAL 1
+#define SPOT_ERROR (-1)
+
+typedef struct spot_engine spot_engine;
+
+typedef struct spot_options {
+    unsigned int version;          /* SPOT_API_VERSION */
+    unsigned int numbins;          /* phase bins, 1 to 512 (-n) */
+    unsigned int numtheta;         /* rings of the spot's mesh (-t) */
+    unsigned int ns_model;         /* 1 and 2 oblate (NHQS, CFLQS), 3 spherical (-q) */
+    unsigned int spectral_model;   /* 0 monochromatic at 1 keV, 1 the line (-s) */
+    unsigned int numbands;         /* bands of the line model (-S) */
+    unsigned int beaming_model;    /* 0 isotropic, 1 graybody (-g) */
+    unsigned int two_spots;        /* nonzero for the antipodal spot too (-2) */
+    unsigned int normalize;        /* nonzero to normalize the flux to 1 (-N) */
+    unsigned int threads;          /* for spot_flux_batch; 0 for one per core (-w) */
+    double spin;                   /* Hz (-f) */
+    double distance;               /* m (-D) */
+    double mesh_tolerance;         /* adaptive mesh, fraction of the peak; 0 for numtheta rings (-E) */
+    double line_energy;            /* line model: observed energy of the first band, keV (-x) */
+    double line_width;             /*   width of each band, keV (-X) */
+    double line_low, line_high;    /*   emitted energies of the line, star's frame, keV (-u, -U) */
+} spot_options;
+
+/* The defaults of spot's command line */
+SPOT_API void spot_default_options( spot_options* options );
+
+/* A new engine, or 0 (with spot_last_error( 0 ) saying why) */
+SPOT_API spot_engine* spot_create( const spot_options* options );
+SPOT_API void spot_destroy( spot_engine* engine );
+
+/* The shape of the flux arrays */
+SPOT_API unsigned int spot_numbins( const spot_engine* engine );
+SPOT_API unsigned int spot_numbands( const spot_engine* engine );
+
+/* The light curve at x into flux, numbands * numbins */
+SPOT_API int spot_flux( spot_engine* engine, const double x[SPOT_NPARAMS], double* flux );
+
+/* The light curves of rows sets of parameters, x[r*SPOT_NPARAMS ...], into flux, rows
+   * numbands * numbins, on the engine's threads; status[r] is the return of each row.
+   Returns SPOT_ERROR if any row had an error, else SPOT_OK. */
+SPOT_API int spot_flux_batch( spot_engine* engine, size_t rows, const double* x, double* flux,
+                              int* status );
+
+/* chi^2 of the light curve at x against data and its error bars err, each numbands *
+   numbins (bands missing from the data: numbands is the number of bands of data), as
+   the fits of spot work it out, into *chi */
+SPOT_API int spot_chi_square( spot_engine* engine, const double x[SPOT_NPARAMS],
+                              const double* data, const double* err, unsigned int numbands,
+                              double* chi );
+
+/* What went wrong in the last call to engine, or to spot_create for 0; "" if nothing */
+SPOT_API const char* spot_last_error( const spot_engine* engine );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SPOTLIB_H */
@@ -24,26 +24,34 @@
 #define NCURVES 100        // REMEMBER TO CHANGE THIS IN CHI.H AS WELL!! number of different light curves that it will calculate
 
 
-struct Parameters {      // local bit of spot information
-  double theta;          // Angle between the NS spin axis and the centre of the spot; in radians
-  double phi_0;          // Azimuthal angular location of the centre of the spot; in radians
-  double dS;             // Area of grid bit
-  double incl;           // Inclination angle (between NS spin axis and observer's line of sight); in radians
+// ParametersT and LightCurveT are templates on the type T of everything that can depend
+// on the fit parameters: double, or Dual<NDIM> (see Dual.h) to carry derivatives.
+// LightCurve is the double one. What never depends on the fit parameters (time grid,
+// spin, energy bands, distance, ...) is double in all of them.
+
+template <class T>
+struct ParametersT {     // local bit of spot information
+  T theta;               // Angle between the NS spin axis and the centre of the spot; in radians
+  T phi_0;               // Azimuthal angular location of the centre of the spot; in radians
+  T dS;                  // Area of grid bit
+  T rho;                 // Angular radius of the spot; in radians
+  T incl;                // Inclination angle (between NS spin axis and observer's line of sight); in radians
   double aniso;          // Anisotropy
   double Gamma;          // Angle between true normal to surface and radial vector
   double Gamma1;         // Not related to above gamma; spectral index
   double Gamma2;         // Not related to above gamma; spectral index
   double Gamma3;         // Not related to above gamma; spectral index
-  double temperature;    // Temperature of the spot, in the spot's frame; in keV
-  double mass;           // Mass of the star; unitless in here
-  double radius;         // Radius of the spot; unitless in here
-  double req;            // Radius at the equator
-  double rspot;          // Radius at the spot
-  double mass_over_r;    // Dimensionless mass divided by radius
+  T temperature;         // Temperature of the spot, in the spot's frame; in keV
+  T mass;                // Mass of the star; unitless in here
+  T radius;              // Radius of the spot; unitless in here
+  T req;                 // Radius at the equator
+  T rspot;               // Radius at the spot
+  T rpole;               // Radius at the pole (for the time delays; set by ComputeFlux)
+  T mass_over_r;         // Dimensionless mass divided by radius
   double omega;          // Spin frequency of the star; unitless in here
-  double cosgamma;       // Gamma is angle between true normal to surface and radial vector; probably in radians
+  T cosgamma;            // Gamma is angle between true normal to surface and radial vector; probably in radians
   double bbrat;          // Ratio of blackbody-to-comptonization of spectrum
-  double ts;             // Time shift between 0 and 1 (beginning of period, end of period)
+  T ts;                  // Time shift between 0 and 1 (beginning of period, end of period)
   double E_band_lower_1; // Lower bound of energy band for flux calculation; in keV
   double E_band_upper_1; // Upper bound of energy band for flux calculation; in keV
   double E_band_lower_2; // Lower bound of energy band for flux calculation; in keV
@@ -58,12 +66,29 @@ struct Parameters {      // local bit of spot information
   double DeltaE; // NICER 
 };
 
+struct SpotSpec {                 // a hot spot besides the one in para (see Flags)
+	double theta;                 // colatitude of its centre, in radians, 0 to PI
+	double phi;                   // longitude of its centre, in radians, from the spot in para
+	double rho;                   // angular radius, in radians
+	double temperature;           // in keV
+};
+
 struct Flags {
 	double shift_t;               // for shifting of time, to match light curve phases
 	bool infile_is_set;           // if an input file has been set
 	bool ignore_time_delays;      // if we should ignore time delays
 	unsigned int spectral_model;  // stating which model we're using -- definitions of models given elsewhere
 	unsigned int beaming_model;   // stating which model we're using -- definitions of models given elsewhere
+	unsigned int NS_model;        // shape of the star: 1 = NHQS, 2 = CFLQS, 3 = spherical
+	bool two_spots;               // if we are modelling two antipodal hot spots
+	bool only_second_spot;        // if we only want the flux from the second (antipodal) hot spot
+	bool normalize_flux;          // if the flux is normalized to 1 (after adding the background)
+	bool single_precision;        // if the spectra and the rebinning are done in float; the angles are always double
+	double mesh_tolerance;        // adaptive spot mesh: error of the flux allowed, as a fraction of the peak; 0 for numtheta rings
+	unsigned int nside;           // equal-area pixels of the whole surface, 12 nside^2 of them (see Healpix.h); 0 for the rings of the spot
+	const std::vector<double>* pixel_mask; // weight of each pixel; 0 for the spot(s) as caps of radius rho
+	const class HealpixMap* pixel_map;     // temperature (and beaming model) of each pixel; 0 for para.temperature
+	const std::vector<struct SpotSpec>* spots; // more hot spots, each with its own centre, radius and temperature; 0 for none
 };
 
 
@@ -76,35 +101,43 @@ class Defl {
 	//class OblDeflectionTOA defltoa;
 };
 
-class LightCurve {                     // Stores all the data about the light curve!
+template <class T>
+class LightCurveT {                    // Stores all the data about the light curve!
 	public:
 	double t[MAX_NUMBINS];                 // one-dimensional array that hold the value of time of emission; normalized between 0 and 1
-	double f[NCURVES][MAX_NUMBINS];        // two-dimensional array of fluxes (one one-dimensional array for each energy curve)
+	T f[NCURVES][MAX_NUMBINS];             // two-dimensional array of fluxes (one one-dimensional array for each energy curve)
 	bool visible[MAX_NUMBINS];             // is the spot visible at that point
-	double t_o[MAX_NUMBINS];               // the time in the observer's frame; takes into account the light travel time
-	double cosbeta[MAX_NUMBINS];           // as seen in MLCB17 (cos of zenith angle, between the norm vector and initial photon direction)
-	double eta[MAX_NUMBINS];               // doppler shift factor; MLCB33
-	double psi[MAX_NUMBINS];               // bending angle; MLCB15
-	double R_dpsi_db[MAX_NUMBINS];         // derivative with respect to b of MLCB20 times the radius
-	double b[MAX_NUMBINS];                 // impact parameter; defined in dimensionless units
-	double dcosalpha_dcospsi[MAX_NUMBINS]; // appears in MLCB30
-	double dOmega_s[MAX_NUMBINS];          // solid angle weight factor; MLCB30
-	struct Parameters para;                // parameters from above; para is like i, Parameters is like Integer
+	T t_o[MAX_NUMBINS];                    // the time in the observer's frame; takes into account the light travel time
+	T cosbeta[MAX_NUMBINS];                // as seen in MLCB17 (cos of zenith angle, between the norm vector and initial photon direction)
+	T eta[MAX_NUMBINS];                    // doppler shift factor; MLCB33
+	T psi[MAX_NUMBINS];                    // bending angle; MLCB15
+	T R_dpsi_db[MAX_NUMBINS];              // derivative with respect to b of MLCB20 times the radius
+	T b[MAX_NUMBINS];                      // impact parameter; defined in dimensionless units
+	T dcosalpha_dcospsi[MAX_NUMBINS];      // appears in MLCB30
+	T dOmega_s[MAX_NUMBINS];               // solid angle weight factor; MLCB30
+	struct ParametersT<T> para;            // parameters from above; para is like i, ParametersT is like Integer
 	struct Flags flags;                    // flags from above
 	class Defl defl;                       // deflection from above
 	unsigned int numbins;                  // Number of time or phase bins for one spin period; Also the number of flux data points
 	unsigned int numbands;
+	unsigned int numtheta;                 // Number of latitudinal (theta) bins across the spot
+	unsigned int rings;                    // Number of rings the spot(s) were cut into (set by ComputeFlux)
+	unsigned long elements;                // Number of mesh elements: phi divisions of the rings
+	double mesh_error;                     // Estimated error of the flux from the mesh, as a fraction of the peak; 0 if not adaptive
+	double background[NCURVES];            // Background added to each band before renormalizing
 	bool eclipse;                          // True if an eclipse occurs
 	bool ingoing;                          // True if one or more photons are ingoing
 	bool problem;                          // True if a problem occurs
-	double maxFlux[NCURVES];               // true (continuous) maximum flux values for each light curve
-	double minFlux[NCURVES];               // true (continuous) minimum flux values for each light curve
-	double pulseFraction[NCURVES];         // Pulse fraction of the light curve
-	double norm[NCURVES];                  // The average flux value of a light curve, used to normalize a light curve to 1
-	double asym[NCURVES];                  // Asymmetry between the rise and fall times for the light curve. =0 is rise=fall
+	T maxFlux[NCURVES];                    // true (continuous) maximum flux values for each light curve
+	T minFlux[NCURVES];                    // true (continuous) minimum flux values for each light curve
+	T pulseFraction[NCURVES];              // Pulse fraction of the light curve
+	T norm[NCURVES];                       // The average flux value of a light curve, used to normalize a light curve to 1
+	T asym[NCURVES];                       // Asymmetry between the rise and fall times for the light curve. =0 is rise=fall
 	unsigned int count;                    // for outputting command line args in Chisquare, chi.cpp
 };
 
+class LightCurve : public LightCurveT<double> { };
+
 // Need to have t, f, and err defined as pointers to arrays in this way:
 /*for (unsigned int y(0); y < NCURVES; y++) {
  	obsdata.t = new double[numbins];
@@ -120,6 +153,7 @@ class DataStruct {             // if reading in data, this would be the experime
 	double chisquare;                // chi squared
 	double shift;                    // if we need it; unused
 	unsigned int numbins;            // Number of time or phase bins for one spin period; Also the number of flux data points
+	unsigned int numbands;           // Number of energy bands in the data file; f[p] is compared to curve->f[p]
 };
 
 
@@ -0,0 +1,94 @@
+/***************************************************************************************/
+/*                                  ThreadPool.cpp
+
+    A fixed-size pool of worker threads. Tasks are handed out one index at a time,
+    so uneven tasks (light curves with and without ingoing photons, say) still keep
+    every thread busy.
+*/
+/***************************************************************************************/
+
+#include "ThreadPool.h"
+
+ThreadPool::ThreadPool( unsigned int numthreads )
+  : job(0), ntasks(0), next(0), finished(0), generation(0), stop(false) {
+
+    if ( numthreads == 0 ) numthreads = std::thread::hardware_concurrency();
+    if ( numthreads == 0 ) numthreads = 1;
+
+    for ( unsigned int i(1); i < numthreads; i++ )
+        workers.push_back( std::thread( &ThreadPool::Work, this, i ) );
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard< std::mutex > guard( lock );
+        stop = true;
+    }
+    wake.notify_all();
+    for ( unsigned int i(0); i < workers.size(); i++ )
+        workers[i].join();
+}
+
+unsigned int ThreadPool::size() const {
+    return workers.size() + 1;
+}
+
+void ThreadPool::Run( unsigned int n, const std::function<void(unsigned int, unsigned int)>& task ) {
+
+    if ( n == 0 ) return;
+    if ( workers.empty() ) { // nothing to hand out; run in the caller
+        for ( unsigned int i(0); i < n; i++ ) task( i, 0 );
+        return;
+    }
+    {
+        std::lock_guard< std::mutex > guard( lock );
+        job = &task;
+        ntasks = n;
+        next = 0;
+        finished = 0;
+        error = std::exception_ptr();
+        generation++;
+    }
+    wake.notify_all();
+
+    Drain( 0 );
+
+    std::unique_lock< std::mutex > guard( lock );
+    done.wait( guard, [this]{ return finished == ntasks; } );
+    job = 0;
+    if ( error ) std::rethrow_exception( error );
+}
+
+// Takes task indices until there are none left
+void ThreadPool::Drain( unsigned int thread ) {
+
+    std::unique_lock< std::mutex > guard( lock );
+    while ( next < ntasks ) {
+        unsigned int i = next++;
+        const std::function<void(unsigned int, unsigned int)>* task = job;
+        guard.unlock();
+        try {
+            (*task)( i, thread );
+        }
+        catch ( ... ) {
+            std::lock_guard< std::mutex > eguard( lock );
+            if ( !error ) error = std::current_exception();
+        }
+        guard.lock();
+        if ( ++finished == ntasks ) done.notify_all();
+    }
+}
+
+void ThreadPool::Work( unsigned int thread ) {
+
+    unsigned int seen(0);
+    while ( true ) {
+        {
+            std::unique_lock< std::mutex > guard( lock );
+            wake.wait( guard, [this, seen]{ return stop || generation != seen; } );
+            if ( stop ) return;
+            seen = generation;
+        }
+        Drain( thread );
+    }
+}
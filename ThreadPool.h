@@ -0,0 +1,49 @@
+/***************************************************************************************/
+/*                                   ThreadPool.h
+
+    This is the header file for ThreadPool.cpp, a small fixed-size pool of worker
+    threads used to compute several light curves at the same time (e.g. the trial
+    points of the simplex in FitCurve).
+
+    The calling thread takes part in the work as thread 0, so a pool of size 1 runs
+    everything in the caller and starts no threads at all.
+*/
+/***************************************************************************************/
+
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <functional>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+
+class ThreadPool {
+ 	public:
+  		// numthreads = 0 means one thread per hardware core
+  		ThreadPool( unsigned int numthreads );
+  		~ThreadPool();
+
+  		unsigned int size() const;
+
+  		// Runs task(i, thread) for i = 0 .. ntasks-1 and waits until all are done.
+  		// thread is in [0, size()) and can be used to index per-thread workspaces.
+  		// The first exception thrown by a task is rethrown here.
+  		void Run( unsigned int ntasks, const std::function<void(unsigned int, unsigned int)>& task );
+
+ 	private:
+  		void Work( unsigned int thread );
+  		void Drain( unsigned int thread );
+
+  		std::vector< std::thread > workers;
+  		std::mutex lock;
+  		std::condition_variable wake, done;
+  		const std::function<void(unsigned int, unsigned int)>* job;
+  		unsigned int ntasks, next, finished, generation;
+  		bool stop;
+  		std::exception_ptr error;
+};
+
+#endif // THREADPOOL_H
@@ -0,0 +1,246 @@
+/***************************************************************************************/
+/*                                      Validate.cpp
+
+    How far the fast modes of spot are from its accurate one (make validate): for each
+    star of a set of configurations, spot is run once in the reference mode (100 rings,
+    double precision) and once in each fast mode,
+
+      rings_30, rings_10    fewer rings (-t)
+      adaptive_1e-3         the adaptive mesh (-E) from 4 rings
+      float_rings_30        single precision (-Z) with 30 rings; its error less that of
+                            rings_30 is what the floats cost
+      pixels_nside32        the equal-area pixel mesh (-H)
+
+    and for each band of the light curve the largest and the RMS difference of the flux
+    from the reference, as fractions of the reference's peak flux in that band (the
+    measure -E uses), and the difference in the pulse fraction (max - min)/(max + min),
+    with the seconds each run took. The light curves go through --binary 64 files, so
+    nothing is lost to the text output. Bands at the edge of a line, with hardly any
+    flux, can be off by their whole peak.
+
+    The bending angles and times of arrival of OblDeflectionTOA for the spherical
+    1.4 Msun, 12 km star are also checked against the table in test.txt (b/R, psi and
+    toa c/R in columns 2, 3 and 5); the largest errors are those of grazing photons.
+
+    The results go to the -o file as JSON, the worst band of each to the screen.
+
+    usage: spotvalidate [-s spot] [-o results] [-d directory] [-b bending table]
+*/
+/***************************************************************************************/
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include "Engine.h"
+#include "OblDeflectionTOA.h"
+#include "Output.h"
+#include "Units.h"
+#include "Exception.h"
+#include "Struct.h"
+
+struct BandErrors {
+    std::vector< double > max, rms, pulse_fraction; // one of each per band
+};
+
+/**************************************************************************************/
+/* Run:                                                                               */
+/*           runs spot with the common flags and args, into curve; returns the        */
+/*           seconds it took                                                          */
+/**************************************************************************************/
+static double Run( const std::string& spot, const std::string& args, const std::string& file,
+                   class LightCurve* curve ) {
+    std::string command( spot + " -m 1.4 -r 12 -l 0 -n 128 -T 0.35 -D 6.1713552e18 -g 0 "
+                         + args + " --binary 64 -o " + file + " > /dev/null 2>&1" );
+    auto start( std::chrono::steady_clock::now() );
+    if ( std::system( command.c_str() ) != 0 )
+        throw( Exception( (" spotvalidate: this failed: " + command + "\n").c_str() ) );
+    double seconds( std::chrono::duration< double >( std::chrono::steady_clock::now() - start ).count() );
+    ReadBinaryCurve( file.c_str(), curve );
+    return seconds;
+}
+
+static double PulseFraction( const double* f, unsigned int numbins ) {
+    double max( *std::max_element( f, f + numbins ) ), min( *std::min_element( f, f + numbins ) );
+    return max + min > 0.0 ? ( max - min ) / ( max + min ) : 0.0;
+}
+
+/**************************************************************************************/
+/* Compare:                                                                           */
+/*           the errors of curve in each band, against reference                      */
+/**************************************************************************************/
+static BandErrors Compare( const class LightCurve* curve, const class LightCurve* reference ) {
+    if ( curve->numbins != reference->numbins || curve->numbands != reference->numbands )
+        throw( Exception(" spotvalidate: a fast mode gave another number of bins or bands.\n") );
+
+    BandErrors errors;
+    for ( unsigned int p(0); p < reference->numbands; p++ ) {
+        const double* f( reference->f[p] );
+        double peak( fabs( *std::max_element( f, f + reference->numbins ) ) ), max(0.0), squares(0.0);
+        for ( unsigned int i(0); i < reference->numbins; i++ ) {
+            double difference( fabs( curve->f[p][i] - f[i] ) );
+            max = std::max( max, difference );
+            squares += difference * difference;
+        }
+        double rms( sqrt( squares / reference->numbins ) );
+        errors.max.push_back( peak > 0.0 ? max / peak : 0.0 );
+        errors.rms.push_back( peak > 0.0 ? rms / peak : 0.0 );
+        errors.pulse_fraction.push_back( fabs( PulseFraction( curve->f[p], curve->numbins )
+                                               - PulseFraction( f, reference->numbins ) ) );
+    }
+    return errors;
+}
+
+static void WriteList( std::ostream& out, const std::vector< double >& values ) {
+    out << "[";
+    for ( unsigned int k(0); k < values.size(); k++ )
+        out << ( k > 0 ? ", " : "" ) << values[k];
+    out << "]";
+}
+
+/**************************************************************************************/
+/* Bending:                                                                           */
+/*           the largest errors of psi and of the time of arrival (c/R) of the        */
+/*           spherical 1.4 Msun, 12 km star against the table in file, written        */
+/*           to out as JSON                                                           */
+/**************************************************************************************/
+static void Bending( const char* file, std::ostream& out ) {
+
+    std::ifstream in( file );
+    if ( !in ) {
+        std::cout << "No bending table in " << file << "; not checked." << std::endl;
+        out << "null";
+        return;
+    }
+
+    std::unique_ptr< LightCurve > curve( new LightCurve );
+    curve->para.mass = Units::cgs_to_nounits( 1.4*Units::MSUN, Units::MASS );
+    curve->para.req = Units::cgs_to_nounits( 12.0*1.0e5, Units::LENGTH );
+    curve->para.mass_over_r = 1.4/12.0 * Units::GMC2;
+    curve->para.omega = 0.0;
+    curve->para.theta = 0.5*Units::PI;
+    curve->flags.NS_model = 3;
+    DeflTables tables( curve.get() );
+
+    double psi_error(0.0), toa_error(0.0);
+    unsigned int rows(0);
+    bool problem( false );
+    std::string line;
+    while ( std::getline( in, line ) ) {
+        double alpha, b_R, psi, dcos, toa;
+        if ( line.empty() || line[0] == '#'
+             || sscanf( line.c_str(), "%lf %lf %lf %lf %lf", &alpha, &b_R, &psi, &dcos, &toa ) != 5 )
+            continue;
+        double b( b_R * tables.rspot );
+        if ( b <= 0.0 || b >= tables.defl.b_max ) continue;
+        psi_error = std::max( psi_error, fabs( tables.defltoa->psi_outgoing_u( b, tables.rspot, tables.defl.b_max,
+                                                                               tables.defl.psi_max, &problem ) - psi ) );
+        toa_error = std::max( toa_error, fabs( tables.defltoa->toa_outgoing_u( b, tables.rspot, &problem )
+                                               / tables.rspot - toa ) );
+        rows++;
+    }
+    std::cout << "Bending table " << file << ", " << rows << " rows: largest error of psi " << psi_error
+              << " rad, of the time of arrival " << toa_error << " R/c" << std::endl;
+    out << "{ \"rows\": " << rows << ", \"psi_max_error\": " << psi_error
+        << ", \"toa_max_error\": " << toa_error << " }";
+}
+
+int main( int argc, char** argv ) try {
+
+    std::string spot( "./spot" ), directory( "/tmp" );
+    const char* out_file( "validate.json" );
+    const char* bending_file( "test.txt" );
+
+    for ( int i(1); i < argc; i++ ) {
+        if ( argv[i][0] != '-' || i+1 >= argc
+             || ( argv[i][1] != 's' && argv[i][1] != 'o' && argv[i][1] != 'd' && argv[i][1] != 'b' ) ) {
+            std::cout << "usage: spotvalidate [-s spot] [-o results] [-d directory] [-b bending table]" << std::endl;
+            return 2;
+        }
+        switch ( argv[i][1] ) {
+            case 's': spot = argv[++i]; break;
+            case 'o': out_file = argv[++i]; break;
+            case 'd': directory = argv[++i]; break;
+            case 'b': bending_file = argv[++i]; break;
+        }
+    }
+
+    const char* configurations[][2] = {
+        { "spherical_200hz",  "-q 3 -f 200 -i 90 -e 90 -p 1 -s 0 -S 1" },
+        { "spherical_400hz",  "-q 3 -f 400 -i 30 -e 60 -p 1 -s 0 -S 1" },
+        { "oblate_600hz",     "-q 1 -f 600 -i 90 -e 75 -p 1 -s 0 -S 1" },
+        { "line_100_bands",   "-q 3 -f 400 -i 60 -e 40 -p 0.5 -s 1 -S 100 -u 0.995 -U 1.005 -x 0.7 -X 1e-3" },
+        { "two_spots_200hz",  "-q 3 -f 200 -i 60 -e 40 -p 0.5 -s 0 -S 1 -2" }
+    };
+    const char* reference_mode( "-t 100" );
+    const char* modes[][2] = {
+        { "rings_30",        "-t 30" },
+        { "rings_10",        "-t 10" },
+        { "adaptive_1e-3",   "-t 4 -E 1e-3" },
+        { "float_rings_30",  "-t 30 -Z" },
+        { "pixels_nside32",  "-H 32" }
+    };
+    const unsigned int num_configurations( sizeof(configurations)/sizeof(configurations[0]) ),
+                       num_modes( sizeof(modes)/sizeof(modes[0]) );
+
+    std::ofstream out( out_file, std::ios_base::trunc );
+    if ( !out )
+        throw( Exception(" spotvalidate: couldn't open the results file.\n") );
+    out << std::setprecision( 6 ) << "{ \"reference_mode\": \"" << reference_mode << "\",\n  \"bending_table\": ";
+    Bending( bending_file, out );
+    out << ",\n  \"configurations\": {\n";
+
+    std::unique_ptr< LightCurve > reference( new LightCurve ), curve( new LightCurve );
+    std::string file( directory + "/spotvalidate.bin" );
+
+    std::cout << std::endl << std::setw(18) << std::left << "configuration" << std::setw(16) << "mode"
+              << std::setw(10) << "seconds" << std::setw(10) << "speedup" << std::setw(13) << "max error"
+              << std::setw(13) << "RMS error" << "pulse fraction error (worst band)" << std::endl;
+    for ( unsigned int c(0); c < num_configurations; c++ ) {
+        std::string args( configurations[c][1] );
+        double reference_seconds( Run( spot, args + " " + reference_mode, file, reference.get() ) );
+        std::cout << std::setw(18) << configurations[c][0] << std::setw(16) << "reference"
+                  << std::setw(10) << reference_seconds << std::endl;
+        out << "    \"" << configurations[c][0] << "\": { \"reference_seconds\": " << reference_seconds
+            << ", \"modes\": {\n";
+
+        for ( unsigned int m(0); m < num_modes; m++ ) {
+            double seconds( Run( spot, args + " " + modes[m][1], file, curve.get() ) );
+            BandErrors errors( Compare( curve.get(), reference.get() ) );
+            std::cout << std::setw(18) << "" << std::setw(16) << modes[m][0] << std::setw(10) << seconds
+                      << std::setw(10) << reference_seconds / seconds
+                      << std::setw(13) << *std::max_element( errors.max.begin(), errors.max.end() )
+                      << std::setw(13) << *std::max_element( errors.rms.begin(), errors.rms.end() )
+                      << *std::max_element( errors.pulse_fraction.begin(), errors.pulse_fraction.end() )
+                      << std::endl;
+            out << "      \"" << modes[m][0] << "\": { \"flags\": \"" << modes[m][1] << "\", \"seconds\": "
+                << seconds << ", \"speedup\": " << reference_seconds / seconds << ",\n        \"max_error\": ";
+            WriteList( out, errors.max );
+            out << ",\n        \"rms_error\": ";
+            WriteList( out, errors.rms );
+            out << ",\n        \"pulse_fraction_error\": ";
+            WriteList( out, errors.pulse_fraction );
+            out << " }" << ( m + 1 < num_modes ? ",\n" : "\n" );
+        }
+        out << "    } }" << ( c + 1 < num_configurations ? ",\n" : "\n" );
+    }
+    out << "  }\n}\n";
+    out.close();
+    std::remove( file.c_str() );
+    if ( !out )
+        throw( Exception(" spotvalidate: couldn't write the results file.\n") );
+    return 0;
+}
+
+catch ( std::exception& e ) {
+    std::cerr << "\nERROR: Exception thrown. " << std::endl << e.what() << std::endl;
+    return -1;
+}